@@ -13,6 +13,7 @@
 //  Created by Chris Marrin on 5/4/24.
 //
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdlib>
 #include <cctype>
@@ -20,10 +21,18 @@
 #include "BOSS9.h"
 #include "MC6809.h"
 
+#ifdef STATS
+#include "Stats.h"
+#endif
+
 using namespace mc6809;
 
 static Reg regsToPrint[ ] = { Reg::A, Reg::B, Reg::D, Reg::X, Reg::Y,
-                              Reg::U, Reg::S, Reg::PC, Reg::CC, Reg::DP };
+                              Reg::U, Reg::S, Reg::PC, Reg::CC, Reg::DP,
+#ifdef HD6309
+                              Reg::E, Reg::F, Reg::W, Reg::V, Reg::MD,
+#endif
+                            };
                                             
 void BOSS9Base::getCommand()
 {
@@ -158,6 +167,11 @@ void BOSS9Base::processCommand()
             _runState = RunState::Cmd;
             printF("Load complete, start addr = 0x%04x\n", _startAddr);
         }
+#ifdef SNAPSHOTS
+        if (_runState == RunState::Cmd) {
+            restartHistory();
+        }
+#endif
     }
     _cursor = 0;
 }
@@ -179,12 +193,22 @@ bool BOSS9Base::toNum(m8r::string& s, uint32_t& num)
     return true;
 }
 
-void BOSS9Base::showBreakpoint(uint8_t i) const
+void BOSS9Base::showBreakpoint(uint16_t i) const
 {
     BreakpointEntry entry;
-    if (emulator().breakpoint(i, entry)) {
-        printF("    Breakpoint[%d] -> $%04x (%sabled)\n", i, entry.addr, (entry.status == BPStatus::Enabled) ? "en" : "dis");
+    if (!emulator().breakpoint(i, entry)) {
+        return;
+    }
+    
+    const char* status = (entry.status == BPStatus::Enabled) ? "en" : "dis";
+    if (entry.kind == BPKind::Exec) {
+        printF("    Breakpoint[%d] -> $%04x (%sabled)\n", i, entry.addr, status);
+        return;
     }
+    
+    const char* kind = (entry.kind == BPKind::Read) ? "read" : ((entry.kind == BPKind::Write) ? "write" : "access");
+    printF("    Watchpoint[%d] -> $%04x-$%04x %s (%sabled)\n", i, entry.addr,
+           uint16_t(entry.addr + entry.size - 1), kind, status);
 }
 
 bool BOSS9Base::executeCommand(m8r::string cmdElements[3])
@@ -202,6 +226,9 @@ bool BOSS9Base::executeCommand(m8r::string cmdElements[3])
             printF("\tc a     - cont at addr a\n");
             printF("\tb       - show cur brkpts\n");
             printF("\tb a     - set brkpt at addr a\n");
+            printF("\tbr a n  - set read watchpoint on n bytes at addr a\n");
+            printF("\tbw a n  - set write watchpoint on n bytes at addr a\n");
+            printF("\tba a n  - set read/write watchpoint on n bytes at addr a\n");
             printF("\tbc      - clear all brkpts\n");
             printF("\tbc n    - clear brkpt <n>\n");
             printF("\tbe      - enable all brkpts\n");
@@ -220,6 +247,25 @@ bool BOSS9Base::executeCommand(m8r::string cmdElements[3])
             printF("\tregs    - show all regs\n");
             printF("\treg r   - show reg r\n");
             printF("\treg r v - set reg r to v\n");
+#ifdef COMPUTE_CYCLES
+            printF("\tclk     - show clock rate and cycles\n");
+            printF("\tclk hz  - set clock rate, 0 is unthrottled\n");
+#endif
+#ifdef STATS
+            printF("\tstats   - show op and address mode counts\n");
+            printF("\tstats c - clear them\n");
+#endif
+#ifdef SNAPSHOTS
+            printF("\tsb      - step back one inst\n");
+            printF("\tsb n    - step back n insts\n");
+            printF("\tsf      - go forward to the end of the history\n");
+            printF("\tsf n    - go forward n insts in the history\n");
+            printF("\trc      - reverse cont to the previous brkpt\n");
+            printF("\tlw a    - go back to the last write to addr a\n");
+            printF("\thist    - show history\n");
+            printF("\thist n  - checkpoint every n insts, 0 is off\n");
+            printF("\thist n m - and keep at most m checkpoints\n");
+#endif
 
             return true;
         }
@@ -258,6 +304,9 @@ bool BOSS9Base::executeCommand(m8r::string cmdElements[3])
         leaveMonitor();
         printF("Running at address $%04x\n", _startAddr);
         emulator().setReg(Reg::PC, _startAddr);
+#ifdef SNAPSHOTS
+        restartHistory();
+#endif
         return true;
     }
     
@@ -284,12 +333,9 @@ bool BOSS9Base::executeCommand(m8r::string cmdElements[3])
             // Show breakpoints
             bool haveBreakpoints = false;
         
-            for (auto i = 0; i < NumBreakpoints; ++i) {
-                BreakpointEntry entry;
-                if (emulator().breakpoint(i, entry)) {
-                    showBreakpoint(i);
-                    haveBreakpoints = true;
-                }
+            for (uint16_t i = 0; i < emulator().numBreakpoints(); ++i) {
+                showBreakpoint(i);
+                haveBreakpoints = true;
             }
             if (!haveBreakpoints) {
                 printF("    No breakpoints\n");
@@ -303,7 +349,7 @@ bool BOSS9Base::executeCommand(m8r::string cmdElements[3])
             return false;
         }
         
-        uint8_t breakpointNum;
+        uint16_t breakpointNum;
         if (!emulator().setBreakpoint(num, breakpointNum)) {
             printF("too many breakpoints\n");
             return false;
@@ -313,6 +359,34 @@ bool BOSS9Base::executeCommand(m8r::string cmdElements[3])
         return true;
     }
     
+    // Set watchpoint
+    if (cmdElements[0] == "br" || cmdElements[0] == "bw" || cmdElements[0] == "ba") {
+        uint32_t addr;
+        if (cmdElements[1].empty() || !toNum(cmdElements[1], addr)) {
+            return false;
+        }
+        
+        // n defaults to 1
+        uint32_t size = 1;
+        if (!cmdElements[2].empty() && !toNum(cmdElements[2], size)) {
+            return false;
+        }
+        if (size == 0 || size > 0xffff) {
+            printF("invalid watchpoint size\n");
+            return false;
+        }
+        
+        BPKind kind = (cmdElements[0] == "br") ? BPKind::Read : ((cmdElements[0] == "bw") ? BPKind::Write : BPKind::Access);
+        uint16_t breakpointNum;
+        if (!emulator().setWatchpoint(addr, size, kind, breakpointNum)) {
+            printF("too many breakpoints\n");
+            return false;
+        }
+        
+        showBreakpoint(breakpointNum);
+        return true;
+    }
+    
     // Clear all or one breakpoint
     if(cmdElements[0] == "bc") {
         if (!cmdElements[2].empty()) {
@@ -448,6 +522,9 @@ bool BOSS9Base::executeCommand(m8r::string cmdElements[3])
             return false;
         }
         emulator().setReg(Reg::PC, addr);
+#ifdef SNAPSHOTS
+        restartHistory();
+#endif
         emulator().printInstructions(emulator().getReg(Reg::PC), 1);
         return true;
     }
@@ -493,6 +570,9 @@ bool BOSS9Base::executeCommand(m8r::string cmdElements[3])
             if (testRegStr == regStrLower) {
                 if (setReg) {
                     emulator().setReg(reg, v);
+#ifdef SNAPSHOTS
+                    restartHistory();
+#endif
                 }
                 if (emulator().regSizeInBytes(reg) == 1) {
                     printF("    %s:%02x\n", regStr.c_str(), emulator().getReg(reg));
@@ -505,6 +585,162 @@ bool BOSS9Base::executeCommand(m8r::string cmdElements[3])
         return true;
     }
 
+#ifdef COMPUTE_CYCLES
+    // show or set clock rate
+    if(cmdElements[0] == "clk") {
+        if (!cmdElements[2].empty()) {
+            return false;
+        }
+        
+        if (!cmdElements[1].empty()) {
+            uint32_t hz;
+            if (!toNum(cmdElements[1], hz)) {
+                return false;
+            }
+            setClockRate(hz);
+        }
+        
+        if (_clockRate == 0) {
+            printF("    Clock unthrottled");
+        } else {
+            printF("    Clock %u Hz", (unsigned) _clockRate);
+        }
+        printF(", %llu cycles executed\n", (unsigned long long) emulator().cycles());
+        return true;
+    }
+#endif
+
+#ifdef STATS
+    // Show or clear the instruction counts
+    if (cmdElements[0] == "stats") {
+        if (!cmdElements[2].empty()) {
+            return false;
+        }
+        InstructionStats* stats = emulator().stats();
+        if (!stats) {
+            printF("    Not counting instructions\n");
+            return false;
+        }
+        
+        if (cmdElements[1] == "c") {
+            stats->reset();
+            return true;
+        }
+        if (!cmdElements[1].empty()) {
+            return false;
+        }
+        
+        stats->report([](void* context, const char* line) {
+            static_cast<BOSS9Base*>(context)->printF("    %s\n", line);
+        }, this);
+        return true;
+    }
+#endif
+
+#ifdef SNAPSHOTS
+    // step back or forward in the history
+    if (cmdElements[0] == "sb" || cmdElements[0] == "sf") {
+        if (!cmdElements[2].empty()) {
+            return false;
+        }
+        if (_history.numCheckpoints() == 0) {
+            printF("    No history, turn it on with hist\n");
+            return false;
+        }
+        
+        bool back = cmdElements[0] == "sb";
+        uint32_t num = 1;
+        if (!cmdElements[1].empty()) {
+            if (!toNum(cmdElements[1], num)) {
+                return false;
+            }
+        } else if (!back) {
+            num = UINT32_MAX;
+        }
+        
+        // Stop short of any interrupts taken after the instruction
+        uint64_t now = emulator().instructions();
+        HistoryPosition target;
+        if (back) {
+            uint64_t start = _history.start().instructions;
+            target.instructions = (now - start > num) ? now - num : start;
+        } else {
+            uint64_t end = _history.end().instructions;
+            target.instructions = (end - now > num) ? now + num : end;
+        }
+        if (target.instructions == _history.end().instructions) {
+            target = _history.end();
+        } else if (target.instructions == _history.start().instructions) {
+            target = _history.start();
+        }
+        
+        replayTo(target);
+        printF("    At instruction %llu, history is %llu to %llu\n", (unsigned long long) emulator().instructions(),
+               (unsigned long long) _history.start().instructions, (unsigned long long) _history.end().instructions);
+        return true;
+    }
+    
+    // reverse continue
+    if (cmdElements[0] == "rc") {
+        if (!cmdElements[1].empty() || !cmdElements[2].empty()) {
+            return false;
+        }
+        
+        if (!reverseContinue()) {
+            printF("    No earlier brkpt hit in the history\n");
+            return true;
+        }
+        printF("\n*** reverse cont, stopped at addr $%04x, instruction %llu\n\n", emulator().getReg(Reg::PC),
+               (unsigned long long) emulator().instructions());
+        return true;
+    }
+    
+    // go back to the last write to <addr>
+    if (cmdElements[0] == "lw") {
+        if (cmdElements[1].empty() || !cmdElements[2].empty()) {
+            return false;
+        }
+        
+        uint32_t addr;
+        if (!toNum(cmdElements[1], addr) || addr > 65535) {
+            return false;
+        }
+        
+        if (!reverseContinue(int32_t(addr))) {
+            printF("    No write to $%04x in the history\n", addr);
+            return true;
+        }
+        
+        // Go back one more to show the instruction which did it
+        HistoryPosition hit = position();
+        replayTo({ hit.instructions - 1, hit.interrupts });
+        uint16_t pc = emulator().getReg(Reg::PC);
+        replayTo(hit);
+        
+        printF("\n*** last write to $%04x was instruction %llu:\n", addr, (unsigned long long) hit.instructions);
+        emulator().printInstructions(pc, 1);
+        printF("\n");
+        return true;
+    }
+    
+    // show or set history
+    if (cmdElements[0] == "hist") {
+        if (!cmdElements[1].empty()) {
+            uint32_t interval;
+            uint32_t maxCheckpoints = DefaultMaxCheckpoints;
+            if (!toNum(cmdElements[1], interval)) {
+                return false;
+            }
+            if (!cmdElements[2].empty() && !toNum(cmdElements[2], maxCheckpoints)) {
+                return false;
+            }
+            setCheckpointInterval(interval, maxCheckpoints);
+        }
+        showHistory();
+        return true;
+    }
+#endif
+
     if (_runState != RunState::Cmd) {
         return cmdElements[1].empty() && cmdElements[2].empty();
     }
@@ -516,20 +752,82 @@ bool BOSS9Base::executeCommand(m8r::string cmdElements[3])
 bool BOSS9Base::call(Func func)
 {
     switch (func) {
-        case Func::putc:
-            putc(emulator().getReg(Reg::A));
+        case Func::putc: {
+            char c = char(emulator().getReg(Reg::A));
+            output(&c, 1);
             return true;
+        }
         case Func::puts: {
-            const char* s = reinterpret_cast<const char*>(emulator().getAddr(emulator().getReg(Reg::X)));
-            puts(s);
+            uint16_t addr = emulator().getReg(Reg::X);
+            outputMemory(addr, stringLength(addr));
             return true;
         }
+        case Func::putsn:
+            outputMemory(emulator().getReg(Reg::X), emulator().getReg(Reg::Y));
+            return true;
         case Func::getc: {
-            emulator().setReg(Reg::A, getc());
+            // Anything read ahead comes first
+            int c;
+            if (_inputSize) {
+                c = uint8_t(_input[0]);
+                consumeInput(1);
+            } else {
+                c = readConsole();
+            }
+            emulator().setReg(Reg::A, c);
             break;
         }
+        
+        // The rest keep running if they have something for the
+        // program. Otherwise, like getc, they give the host a turn
+        case Func::peekc:
+            fillInput();
+            emulator().setReg(Reg::A, _inputSize != 0);
+            return _inputSize != 0;
+        case Func::peeks: {
+            fillInput();
+            int32_t length = inputLineLength();
+            emulator().setReg(Reg::A, length >= 0);
+            if (length >= 0) {
+                emulator().setReg(Reg::Y, uint16_t(length));
+            }
+            return length >= 0;
+        }
+        case Func::gets: {
+            // X has the buffer and Y its size. The line is null terminated
+            // and truncated to fit. Returns the chars stored in Y and
+            // whether there was a line in A
+            fillInput();
+            int32_t length = inputLineLength();
+            if (length < 0) {
+                emulator().setReg(Reg::A, 0);
+                emulator().setReg(Reg::Y, 0);
+                break;
+            }
+            
+            uint16_t addr = emulator().getReg(Reg::X);
+            uint16_t bufSize = emulator().getReg(Reg::Y);
+            uint16_t n = std::min(uint16_t(length), uint16_t(bufSize ? bufSize - 1 : 0));
+            if (bufSize) {
+                uint8_t terminator = 0;
+                emulator().writeMemory(addr, reinterpret_cast<const uint8_t*>(_input), n);
+                emulator().writeMemory(addr + n, &terminator, 1);
+            }
+            
+            // Take the terminator too. A CR LF pair is one terminator
+            uint16_t consumed = uint16_t(length);
+            if (consumed < _inputSize) {
+                consumed += (_input[consumed] == '\r' && consumed + 1 < _inputSize && _input[consumed + 1] == '\n') ? 2 : 1;
+            }
+            consumeInput(consumed);
+            emulator().setReg(Reg::A, 1);
+            emulator().setReg(Reg::Y, n);
+            return true;
+        }
         case Func::exit:
-            printF("Program exited with code %d\n", int32_t(emulator().getReg(Reg::A)));
+            _exited = true;
+            _exitCode = int32_t(emulator().getReg(Reg::A));
+            printF("Program exited with code %d\n", _exitCode);
             enterMonitor();
             emulator().setReg(Reg::PC, _startAddr);
             break;
@@ -542,9 +840,16 @@ bool BOSS9Base::call(Func func)
         case Func::ldLine: {
             // X has pointer to data.
             // Return bool success in A, bool finished in B
-            const char* s = reinterpret_cast<const char*>(emulator().getAddr(emulator().getReg(Reg::X)));
+            // The line is read through the bus, since it could be in
+            // banked memory or past the end of RAM. 514 characters is
+            // the longest s-record
+            uint16_t addr = emulator().getReg(Reg::X);
+            char line[516];
+            uint16_t length = std::min(stringLength(addr), uint16_t(sizeof(line) - 1));
+            emulator().readMemory(addr, reinterpret_cast<uint8_t*>(line), length);
+            line[length] = '\0';
             bool finished;
-            bool result = emulator().loadLine(s, finished);
+            bool result = emulator().loadLine(line, finished);
             emulator().setReg(Reg::A, result);
             emulator().setReg(Reg::B, finished);
             break;
@@ -552,6 +857,38 @@ bool BOSS9Base::call(Func func)
         case Func::ldEnd:
             emulator().loadEnd();
             break;
+        case Func::dkRead:
+        case Func::dkWrite: {
+            // Sectors are copied straight between guest RAM and the
+            // disk, or its cache
+            bool write = func == Func::dkWrite;
+            uint16_t addr = emulator().getReg(Reg::X);
+#ifdef SNAPSHOTS
+            // The disk isn't part of the history, so replaying mustn't
+            // write it again. Reads see the disk as it is now
+            if (write && _replaying) {
+                emulator().setReg(Reg::A, 1);
+                return true;
+            }
+#endif
+            uint8_t* sector = _disk.sector(emulator().getReg(Reg::Y), write);
+            if (sector) {
+                if (write) {
+                    emulator().readMemory(addr, sector, SectorSize);
+                } else {
+                    emulator().writeMemory(addr, sector, SectorSize);
+                }
+            }
+            emulator().setReg(Reg::A, sector != nullptr);
+            return true;
+        }
+        case Func::dkFlush:
+            emulator().setReg(Reg::A, _disk.flush());
+            return true;
+        case Func::dkInfo:
+            emulator().setReg(Reg::D, SectorSize);
+            emulator().setReg(Reg::Y, uint16_t(std::min(_disk.sectorCount(), uint32_t(0xffff))));
+            return true;
         default: break;
     }
     return false;
@@ -566,21 +903,147 @@ bool BOSS9Base::startExecution(uint16_t addr, bool startInMonitor)
     }
     emulator().setReg(Reg::PC, addr);
     _startAddr = addr;
+    _exited = false;
+    _inputSize = 0;
+    
+#ifdef SNAPSHOTS
+    restartHistory();
+#endif
     
     promptIfNeeded();
     return true;
 }
 
+int BOSS9Base::readConsole(bool logEmpty)
+{
+#ifdef SNAPSHOTS
+    if (_replaying) {
+        return _history.replayInput();
+    }
+    
+    int c = getc();
+    if (_history.recording() && (c > 0 || logEmpty)) {
+        _history.input(c);
+    }
+    return c;
+#else
+    (void) logEmpty;
+    return getc();
+#endif
+}
+
+void BOSS9Base::fillInput(bool logEmpty)
+{
+    while (_inputSize < InputQueueSize) {
+        int c = readConsole(logEmpty);
+        if (c <= 0) {
+            break;
+        }
+        _input[_inputSize++] = char(c);
+    }
+}
+
+int32_t BOSS9Base::inputLineLength() const
+{
+    for (uint16_t i = 0; i < _inputSize; ++i) {
+        if (_input[i] == '\r' || _input[i] == '\n') {
+            return i;
+        }
+    }
+    return (_inputSize == InputQueueSize) ? _inputSize : -1;
+}
+
+bool BOSS9Base::takeEscape()
+{
+    const char* esc = static_cast<const char*>(memchr(_input, 0x1b, _inputSize));
+    if (!esc) {
+        // A program which has stopped reading leaves _input full. An
+        // ESC typed after that still has to get through, so the console
+        // is read up to it. What comes before it has nowhere to go and
+        // the program never sees it, so it isn't logged for replay
+        if (_inputSize == InputQueueSize) {
+            while (true) {
+                int c = getc();
+                if (c <= 0) {
+                    break;
+                }
+                if (c == 0x1b) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    
+    uint16_t i = uint16_t(esc - _input);
+    memmove(_input + i, _input + i + 1, _inputSize - i - 1);
+    _inputSize -= 1;
+    return true;
+}
+
+void BOSS9Base::consumeInput(uint16_t n)
+{
+    n = std::min(n, _inputSize);
+    memmove(_input, _input + n, _inputSize - n);
+    _inputSize -= n;
+}
+
+void BOSS9Base::outputMemory(uint16_t addr, uint16_t size)
+{
+    // Straight from guest RAM when it's plain memory, otherwise
+    // a piece at a time through the bus
+    const uint8_t* span = emulator().memorySpan(addr, size);
+    if (span) {
+        output(reinterpret_cast<const char*>(span), size);
+        return;
+    }
+    
+    uint8_t buf[256];
+    while (size) {
+        uint16_t n = std::min(size, uint16_t(sizeof(buf)));
+        emulator().readMemory(addr, buf, n);
+        output(reinterpret_cast<const char*>(buf), n);
+        addr += n;
+        size -= n;
+    }
+}
+
+uint16_t BOSS9Base::stringLength(uint16_t addr)
+{
+    // Look a page at a time, so most strings are one memchr
+    uint16_t length = 0;
+    while (length < 0xffff) {
+        uint16_t n = std::min(uint16_t(0x100 - ((addr + length) & 0xff)), uint16_t(0xffff - length));
+        uint8_t buf[256];
+        const uint8_t* p = emulator().memorySpan(addr + length, n);
+        if (!p) {
+            emulator().readMemory(addr + length, buf, n);
+            p = buf;
+        }
+        const void* end = memchr(p, 0, n);
+        if (end) {
+            return length + uint16_t(static_cast<const uint8_t*>(end) - p);
+        }
+        length += n;
+    }
+    return length;
+}
+
 bool BOSS9Base::continueExecution()
 {
     if (_runState == RunState::Cmd || _runState == RunState::Loading) {
+#ifdef COMPUTE_CYCLES
+        _throttleReset = true;
+#endif
         getCommand();
         return true;
     }
     
-    // See if we got an ESC
-    int c = getc();
-    if (checkEscape(c)) {
+    // See if we got an ESC. Everything else typed stays queued for the
+    // program. The reads which get something are logged as if the
+    // program had made them, so a replay still sees the same input
+    fillInput(false);
+    if (takeEscape() && checkEscape(0x1b)) {
         printF("*** Stopped at $%04x\n", emulator().getReg(Reg::PC));
         return true;
     }
@@ -594,9 +1057,387 @@ bool BOSS9Base::continueExecution()
     // to change the state to Running after execute() so we run normally
     // the next time through. The other states are for stepping through
     // the code which execute() will deal with.
+#ifdef SNAPSHOTS
+    // Running from a point in the past replaces the history after it
+    if (_inPast) {
+        _history.truncate(emulator().instructions());
+        _inPast = false;
+    }
+#endif
+    
+    uint32_t startTime = _quantumTarget ? microseconds() : 0;
+    uint64_t startInstructions = emulator().instructions();
+#ifdef COMPUTE_CYCLES
+    uint64_t startCycles = emulator().cycles();
+#endif
+    
     bool retval = emulator().execute(_runState);
     if (_runState == RunState::Continuing) {
         _runState = RunState::Running;
     }
+    
+    if (_quantumTarget) {
+        uint32_t us = microseconds() - startTime;
+#ifdef COMPUTE_CYCLES
+        // Throttled, the quantum is followed by a sleep until the
+        // emulated time it took
+        if (_clockRate) {
+            us = std::max(us, uint32_t((emulator().cycles() - startCycles) * 1000000 / _clockRate));
+        }
+#endif
+        adaptQuantum(us, emulator().instructions() - startInstructions);
+    }
+    
+#ifdef SNAPSHOTS
+    recordHistory();
+#endif
+    
+    // Let the host sleep rather than spinning on SYNC, CWAI or an idle
+    // loop. We come back after MaxInterruptWaitUS at most to check for ESC
+    if (emulator().waitingForInterrupt()) {
+        waitForInterrupt(MaxInterruptWaitUS);
+#ifdef COMPUTE_CYCLES
+        _throttleReset = true;
+#endif
+    }
+    
+#ifdef IDLE_LOOPS
+    // A program polling in an idle loop won't get anywhere until there's
+    // input or a device changes, so let the host sleep until there's input
+    if (emulator().idle() == Emulator::Idle::Polling) {
+        waitForInput(MaxIdlePollUS);
+#ifdef COMPUTE_CYCLES
+        _throttleReset = true;
+#endif
+    }
+#endif
+    
+#ifdef COMPUTE_CYCLES
+    throttle();
+#endif
     return retval;
 }
+
+#ifdef SNAPSHOTS
+void BOSS9Base::takeSnapshot(Snapshot& snapshot)
+{
+    emulator().takeSnapshot(snapshot);
+    snapshot.runState = uint8_t(_runState);
+    snapshot.startAddr = _startAddr;
+    snapshot.exited = _exited;
+    snapshot.exitCode = _exitCode;
+    snapshot.input.assign(_input, _input + _inputSize);
+}
+
+void BOSS9Base::restoreSnapshot(const Snapshot& snapshot)
+{
+    emulator().restoreSnapshot(snapshot);
+    _runState = RunState(snapshot.runState);
+    _startAddr = snapshot.startAddr;
+    _exited = snapshot.exited;
+    _exitCode = snapshot.exitCode;
+    restoreInput(snapshot);
+    _needPrompt = _runState == RunState::Cmd;
+    
+#ifdef COMPUTE_CYCLES
+    _throttleReset = true;
+#endif
+    
+    restartHistory();
+}
+
+void BOSS9Base::setCheckpointInterval(uint64_t interval, uint32_t maxCheckpoints)
+{
+    _history.setInterval(interval, maxCheckpoints);
+    restartHistory();
+}
+
+void BOSS9Base::restartHistory()
+{
+    _history.clear();
+    _inPast = false;
+    emulator().setHistory(_history.recording() ? &_history : nullptr);
+    recordHistory();
+}
+
+void BOSS9Base::recordHistory()
+{
+    if (!_history.recording()) {
+        return;
+    }
+    
+    uint64_t instructions = emulator().instructions();
+    if (_history.checkpointDue(instructions)) {
+        Snapshot snapshot;
+        takeSnapshot(snapshot);
+        _history.addCheckpoint(snapshot);
+    }
+    _history.setEnd(instructions);
+}
+
+HistoryPosition BOSS9Base::position() const
+{
+    // Replay leaves the interrupt count where it stopped
+    return { emulator().instructions(), _inPast ? _history.interruptsReplayed() : _history.end().interrupts };
+}
+
+void BOSS9Base::showHistory() const
+{
+    if (!_history.recording()) {
+        printF("    History off\n");
+        return;
+    }
+    
+    printF("    Checkpoint every %llu insts, %u of %u checkpoints using %u KB\n",
+           (unsigned long long) _history.interval(), unsigned(_history.numCheckpoints()),
+           unsigned(_history.maxCheckpoints()), unsigned(_history.pages() * sizeof(Snapshot::Page) / 1024));
+    printF("    Instructions %llu to %llu, at %llu\n", (unsigned long long) _history.start().instructions,
+           (unsigned long long) _history.end().instructions, (unsigned long long) emulator().instructions());
+}
+
+static std::vector<Snapshot::Breakpoint> currentBreakpoints(const Emulator& emulator)
+{
+    std::vector<Snapshot::Breakpoint> breakpoints;
+    for (uint16_t i = 0; i < emulator.numBreakpoints(); ++i) {
+        BreakpointEntry entry;
+        emulator.breakpoint(i, entry);
+        breakpoints.push_back({ entry.addr, entry.size, uint8_t(entry.kind), uint8_t(entry.status) });
+    }
+    return breakpoints;
+}
+
+void BOSS9Base::restoreCheckpoint(size_t i, const std::vector<Snapshot::Breakpoint>* breakpoints)
+{
+    // The checkpoint's breakpoints are whatever they were at the
+    // time, so use the ones we have now instead
+    Snapshot snapshot = _history.checkpoint(i).snapshot;
+    snapshot.breakpoints = breakpoints ? *breakpoints : currentBreakpoints(emulator());
+    
+    emulator().restoreSnapshot(snapshot);
+    _exited = snapshot.exited;
+    _exitCode = snapshot.exitCode;
+    restoreInput(snapshot);
+    _history.startReplay(i);
+}
+
+void BOSS9Base::replayTo(const HistoryPosition& to)
+{
+    size_t i;
+    if (!_history.findCheckpoint(to, i)) {
+        return;
+    }
+    
+    beginReplay();
+    
+    // Going forward is just a matter of running, unless there's a
+    // checkpoint on the way
+    HistoryPosition now = position();
+    if (!_inPast || to < now || now < _history.checkpoint(i).position) {
+        restoreCheckpoint(i);
+    }
+    _inPast = true;
+    replay(to);
+    
+    endReplay();
+    _inPast = position() != _history.end();
+}
+
+bool BOSS9Base::reverseContinue(int32_t watchAddr)
+{
+    HistoryPosition now = position();
+    size_t i;
+    if (!_history.findCheckpoint(now, i)) {
+        return false;
+    }
+    
+    std::vector<Snapshot::Breakpoint> breakpoints = currentBreakpoints(emulator());
+    std::vector<Snapshot::Breakpoint> searchBreakpoints;
+    if (watchAddr < 0) {
+        searchBreakpoints = breakpoints;
+    } else {
+        searchBreakpoints.push_back({ uint16_t(watchAddr), 1, uint8_t(BPKind::Write), uint8_t(BPStatus::Enabled) });
+    }
+    
+    beginReplay();
+    _inPast = true;
+    
+    // Look for the last hit between each checkpoint and the next,
+    // going back until there is one
+    HistoryPosition to = now;
+    HistoryPosition hit;
+    bool found = false;
+    
+    while (true) {
+        restoreCheckpoint(i, &searchBreakpoints);
+        found = replay(to, &hit);
+        if (found || i == 0) {
+            break;
+        }
+        to = _history.checkpoint(i).position;
+        i -= 1;
+    }
+    
+    // Go to the hit, or back to where we were
+    if (!found) {
+        hit = now;
+        _history.findCheckpoint(now, i);
+    }
+    restoreCheckpoint(i, &breakpoints);
+    replay(hit);
+    
+    endReplay();
+    _inPast = position() != _history.end();
+    return found;
+}
+
+bool BOSS9Base::replay(const HistoryPosition& to, HistoryPosition* lastHit)
+{
+    bool hit = false;
+    RunState runState = RunState::Running;
+    
+    while (true) {
+        // Take the interrupts logged before the next instruction
+        uint64_t at;
+        Interrupt line;
+        while (_history.nextInterrupt(at, line) && at == emulator().instructions() &&
+               HistoryPosition { at, _history.interruptsReplayed() } < to) {
+            emulator().serviceInterrupt(line);
+            _history.skipInterrupt();
+        }
+        
+        uint64_t now = emulator().instructions();
+        if (now >= to.instructions) {
+            break;
+        }
+        
+        uint64_t limit = to.instructions;
+        if (_history.nextInterrupt(at, line) && at < limit) {
+            limit = at;
+        }
+        emulator().setInstructionLimit(limit);
+        emulator().execute(runState);
+        runState = RunState::Running;
+        
+        if (emulator().stoppedAtBreakpoint()) {
+            hit = true;
+            if (lastHit) {
+                *lastHit = { emulator().instructions(), _history.interruptsReplayed() };
+            }
+            
+            // Carry on past it, like continuing from the monitor
+            runState = RunState::Continuing;
+        } else if (emulator().instructions() == now) {
+            // Waiting for an interrupt that isn't in the log
+            break;
+        }
+    }
+    
+    emulator().setInstructionLimit(UINT64_MAX);
+    return hit;
+}
+
+static constexpr Interrupt InterruptLines[] = { Interrupt::NMI, Interrupt::FIRQ, Interrupt::IRQ };
+
+void BOSS9Base::beginReplay()
+{
+    _replaying = true;
+    emulator().setHistory(nullptr);
+    
+    // Interrupts come from the log rather than the lines
+    _replayPendingInterrupts = emulator().pendingInterrupts();
+    for (Interrupt line : InterruptLines) {
+        emulator().releaseInterrupt(line);
+    }
+    
+    // Don't trace or profile anything twice
+#ifdef TRACE
+    _replayTrace = emulator().trace();
+    emulator().setTrace(nullptr);
+#endif
+#ifdef PROFILER
+    _replayProfiler = emulator().profiler();
+    emulator().setProfiler(nullptr);
+#endif
+#ifdef STATS
+    _replayStats = emulator().stats();
+    emulator().setStats(nullptr);
+#endif
+}
+
+void BOSS9Base::endReplay()
+{
+#ifdef TRACE
+    emulator().setTrace(_replayTrace);
+#endif
+#ifdef PROFILER
+    emulator().setProfiler(_replayProfiler);
+#endif
+#ifdef STATS
+    emulator().setStats(_replayStats);
+#endif
+    
+    for (Interrupt line : InterruptLines) {
+        if (_replayPendingInterrupts & uint8_t(line)) {
+            emulator().assertInterrupt(line);
+        }
+    }
+    
+    emulator().setHistory(&_history);
+    _replaying = false;
+    
+    // Replay leaves the monitor where it was
+    _runState = RunState::Cmd;
+}
+#endif
+
+void BOSS9Base::adaptQuantum(uint32_t us, uint64_t instructions)
+{
+    // Only a whole quantum says how long one takes
+    uint32_t quantum = _emu.quantum();
+    if (instructions < quantum) {
+        return;
+    }
+    
+    if (us > _quantumTarget * 2 && quantum > MinQuantum) {
+        _emu.setQuantum(quantum / 2);
+    } else if (us < _quantumTarget / 2 && quantum < MaxQuantum) {
+        _emu.setQuantum(quantum * 2);
+    }
+}
+
+#ifdef COMPUTE_CYCLES
+void BOSS9Base::throttle()
+{
+    if (_clockRate == 0) {
+        return;
+    }
+    
+    uint32_t now = microseconds();
+    uint64_t cycles = emulator().cycles();
+    
+    if (_throttleReset) {
+        _throttleCycles = cycles;
+        _throttleTime = now;
+        _throttleReset = false;
+        return;
+    }
+    
+    // Wait until the time the cycles executed so far should have taken
+    uint64_t deadline = (cycles - _throttleCycles) * 1000000 / _clockRate;
+    uint32_t elapsed = now - _throttleTime;
+    
+    if (deadline > elapsed) {
+        sleepMicroseconds(uint32_t(deadline - elapsed));
+    } else if (elapsed - deadline > MaxThrottleLagUS) {
+        _throttleReset = true;
+        return;
+    }
+    
+    // Move the base point along a second at a time so the
+    // time differences stay small and microseconds() can wrap
+    if (deadline >= 1000000) {
+        _throttleCycles += _clockRate;
+        _throttleTime += 1000000;
+    }
+}
+#endif
@@ -15,15 +15,45 @@
 
 #pragma once
 
+#include <algorithm>
+
 #include "string.h"
+#include "BlockDevice.h"
 #include "MC6809.h"
 
+#ifdef SNAPSHOTS
+#include "History.h"
+#endif
+
 namespace mc6809 {
 
 static constexpr const char* MainPromptString = "BOSS9> ";
 static constexpr const char* LoadingPromptString = "Loading> ";
 static constexpr uint16_t CmdBufSize = 80;
 
+#ifdef COMPUTE_CYCLES
+// If execution falls further behind the clock than this, the throttle
+// starts again from the current time rather than running flat out to
+// catch up
+static constexpr uint32_t MaxThrottleLagUS = 100000;
+#endif
+
+// Longest the host blocks in SYNC or CWAI before checking for ESC
+static constexpr uint32_t MaxInterruptWaitUS = 10000;
+
+#ifdef IDLE_LOOPS
+// Longest the host blocks while the program polls in an idle loop. It's
+// shorter since a device it's polling can change at any time
+static constexpr uint32_t MaxIdlePollUS = 1000;
+#endif
+
+// Console input the program hasn't taken yet. The longest line gets can return
+static constexpr uint16_t InputQueueSize = 256;
+
+// Range of the quantum when it adapts to a target time
+static constexpr uint32_t MinQuantum = 64;
+static constexpr uint32_t MaxQuantum = 1024 * 1024;
+
 class Emulator;
 
 // These must match BOSS9.inc
@@ -42,12 +72,19 @@ enum class Func : uint16_t {
     ldStart = 0xFC12, // Start loading s-records
     ldLine = 0xFC14,  // Load an s-record line
     ldEnd = 0xFC16,   // End loading s-records
+    dkRead = 0xFC18,  // Read sector Y into the 256 byte buffer pointed to by X.
+                                            // Return in A a 1 on success and 0 otherwise
+    dkWrite = 0xFC1A, // Write the 256 byte buffer pointed to by X to sector Y.
+                                            // Return in A a 1 on success and 0 otherwise
+    dkFlush = 0xFC1C, // Make all sector writes permanent. Return in A a 1 on success
+    dkInfo = 0xFC1E,  // Return the sector size in D and the number of sectors in Y
+                                            // (0 if there is no disk)
 };
 
 class BOSS9Base
 {
   public:
-    BOSS9Base(uint8_t* ram) : _emu(ram, this) { }
+    BOSS9Base(uint8_t* ram, uint32_t ramSize) : _emu(ram, ramSize, this) { }
     
     virtual ~BOSS9Base() { }
         
@@ -62,15 +99,62 @@ class BOSS9Base
         _needPrompt = true;
     }
     
+    RunState runState() const { return _runState; }
+    
+    // True if the program has called exit since it was started
+    bool exited() const { return _exited; }
+    int32_t exitCode() const { return _exitCode; }
+    
     Emulator& emulator() { return _emu; }
     const Emulator& emulator() const { return _emu; }
     
-    void puts(const char* s) const
+#ifdef SNAPSHOTS
+    // Snapshots of the emulator plus the monitor state. Restoring
+    // one is a fast way to reset to a loaded or booted program
+    void takeSnapshot(Snapshot&);
+    void restoreSnapshot(const Snapshot&);
+    
+    // Record history for reverse execution, checkpointing every interval
+    // instructions and keeping at most maxCheckpoints. 0 turns it off.
+    // It's off unless this is called
+    void setCheckpointInterval(uint64_t interval, uint32_t maxCheckpoints = DefaultMaxCheckpoints);
+    const History& history() const { return _history; }
+#endif
+    
+    // Called by Emulator::assertInterrupt, possibly from another
+    // thread, to wake up waitForInterrupt
+    virtual void interruptAsserted() = 0;
+    
+#ifdef COMPUTE_CYCLES
+    // Pace execution to a clock rate in Hz. 0 runs as fast as possible
+    void setClockRate(uint32_t hz)
     {
-        while (*s) {
-            putc(*s++);
+        _clockRate = hz;
+        _throttleReset = true;
+    }
+    
+    uint32_t clockRate() const { return _clockRate; }
+#endif
+    
+    // Adapt the instructions each continueExecution() runs so it takes
+    // about us microseconds, of emulated time with a clock rate and of
+    // host time without. That's how long an ESC can take to be seen, so
+    // a few ms is plenty. 0, the default, always runs
+    // InstructionsToExecutePerContinue.
+    void setQuantumTarget(uint32_t us)
+    {
+        _quantumTarget = us;
+        if (us == 0) {
+            _emu.setQuantum(InstructionsToExecutePerContinue);
         }
     }
+    
+    // The disk for the dk functions, nullptr for none. It must be
+    // removed before it's destroyed
+    void setBlockDevice(BlockDevice* device) { _disk.setDevice(device); }
+    bool flushDisk() { return _disk.flush(); }
+    
+    void puts(const char* s) const { output(s, strlen(s)); }
 
     void printF(const char* fmt, ...) const
     {
@@ -88,11 +172,54 @@ class BOSS9Base
     // Methods to override
     virtual void putc(char c) const = 0;
     virtual int getc() = 0;
+    
+    // Output n chars at once. Override it if the host can do
+    // better than a putc() for each one
+    virtual void write(const char* s, size_t n) const
+    {
+        while (n--) {
+            putc(*s++);
+        }
+    }
     virtual bool handleRunLoop() = 0;
+    
+    // Used by the throttle. microseconds() is a free running
+    // counter which is allowed to wrap
+    virtual uint32_t microseconds() const = 0;
+    virtual void sleepMicroseconds(uint32_t us) = 0;
+    
+    // Called while the CPU is in SYNC or CWAI. Block until
+    // emulator().waitingForInterrupt() is false or us have passed
+    virtual void waitForInterrupt(uint32_t us) = 0;
+    
+#ifdef IDLE_LOOPS
+    // Called while the program is polling in an idle loop. Block until
+    // there's input, an interrupt is asserted or us have passed. Override
+    // it if the host can do better than sleeping
+    virtual void waitForInput(uint32_t us) { sleepMicroseconds(us); }
+#endif
 
     bool _echoBS = false; // If true when backspace received, sends <space><backspace> to erase char
     
   private:
+    void output(const char* s, size_t n) const
+    {
+#ifdef SNAPSHOTS
+        // Replaying history mustn't repeat any output
+        if (_replaying) {
+            return;
+        }
+#endif
+        write(s, n);
+    }
+    
+    // Output size bytes of guest memory at addr
+    void outputMemory(uint16_t addr, uint16_t size);
+    
+    // Length of the null terminated string at addr, not
+    // counting the null. 0xffff at most
+    uint16_t stringLength(uint16_t addr);
+    
     void promptIfNeeded()
     {
         if (_needPrompt) {
@@ -113,11 +240,75 @@ class BOSS9Base
     void processCommand();
     bool executeCommand(m8r::string _cmdElements[3]);
 
-    void showBreakpoint(uint8_t i) const;
+    void showBreakpoint(uint16_t i) const;
     
     bool checkEscape(int c);
     
     bool toNum(m8r::string& s, uint32_t& num);
+    
+    // Console input for the program. A read which gets nothing is only
+    // logged for replay if logEmpty is true
+    int readConsole(bool logEmpty = true);
+    
+    // Move all the console input that's waiting into _input, until it's full
+    void fillInput(bool logEmpty = true);
+    
+    // Take an ESC out of _input, leaving the rest for the program. If
+    // _input is full the console is searched for one too, since it
+    // can't be queued. Returns true if there was one
+    bool takeEscape();
+    
+    // Length of the first line in _input, not counting its terminator,
+    // or -1 if there isn't a whole line. A full _input counts as a line
+    int32_t inputLineLength() const;
+    
+    void consumeInput(uint16_t n);
+    
+#ifdef SNAPSHOTS
+    void restoreInput(const Snapshot& snapshot)
+    {
+        _inputSize = uint16_t(std::min(snapshot.input.size(), size_t(InputQueueSize)));
+        memcpy(_input, snapshot.input.data(), _inputSize);
+    }
+#endif
+    
+#ifdef SNAPSHOTS
+    // Start the history over from the current state. Called whenever
+    // the monitor changes the machine in a way replay wouldn't repeat
+    void restartHistory();
+    
+    // Take a checkpoint if it's time and move the end of the history along
+    void recordHistory();
+    
+    // Go to a point in the history. Breakpoint hits are ignored
+    void replayTo(const HistoryPosition&);
+    
+    // Find the last breakpoint or watchpoint hit before now and go to
+    // it. With watchAddr only a write to it counts. Returns false, and
+    // stays where it is, if there isn't one
+    bool reverseContinue(int32_t watchAddr = -1);
+    
+    // Restore checkpoint i with the current breakpoints, or with
+    // breakpoints if it's given, and start replaying from it
+    void restoreCheckpoint(size_t i, const std::vector<Snapshot::Breakpoint>* breakpoints = nullptr);
+    
+    // Run from the current point to position. If lastHit is given it's
+    // set to the last breakpoint or watchpoint hit, if there was one
+    bool replay(const HistoryPosition&, HistoryPosition* lastHit = nullptr);
+    
+    void beginReplay();
+    void endReplay();
+    
+    // Where the machine is in the history
+    HistoryPosition position() const;
+    void showHistory() const;
+#endif
+    
+    void adaptQuantum(uint32_t us, uint64_t instructions);
+    
+#ifdef COMPUTE_CYCLES
+    void throttle();
+#endif
 
     bool _needPrompt = false;
     
@@ -126,20 +317,63 @@ class BOSS9Base
     
     uint16_t _startAddr = 0;
     
+    bool _exited = false;
+    int32_t _exitCode = 0;
+    
     RunState _runState = RunState::Cmd;
     
+    uint32_t _quantumTarget = 0;
+    
+    // Console input read ahead of the program by peekc, peeks and gets
+    char _input[InputQueueSize];
+    uint16_t _inputSize = 0;
+    
+    SectorCache _disk;
+    
+#ifdef SNAPSHOTS
+    History _history;
+    
+    // True if the monitor has gone back from the end of the history.
+    // Running from there discards the history after it
+    bool _inPast = false;
+    
+    bool _replaying = false;
+    uint8_t _replayPendingInterrupts = 0;
+#ifdef TRACE
+    TraceRecorder* _replayTrace = nullptr;
+#endif
+#ifdef PROFILER
+    Profiler* _replayProfiler = nullptr;
+#endif
+#ifdef STATS
+    InstructionStats* _replayStats = nullptr;
+#endif
+#endif
+    
+#ifdef COMPUTE_CYCLES
+    // The throttle paces execution against a base point. The deadline for
+    // the cycles executed since then is _throttleTime plus the time those
+    // cycles take at _clockRate
+    uint32_t _clockRate = 0;
+    uint64_t _throttleCycles = 0;
+    uint32_t _throttleTime = 0;
+    bool _throttleReset = true;
+#endif
+    
     Emulator _emu;
 };
 
 template<uint32_t size> class BOSS9 : public BOSS9Base
 {
   public:
-    BOSS9() : BOSS9Base(_ram) { }
+    BOSS9() : BOSS9Base(_ram, size) { }
     
     ~BOSS9() { }
     
   private:
-    uint8_t _ram[size];
+    // Zeroed, so programs which read memory they never wrote behave
+    // the same in every instance
+    uint8_t _ram[size] = { };
 };
 
 }
@@ -0,0 +1,296 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  BlockDevice.cpp
+//  Disk storage for BOSS9
+//
+
+#include "BlockDevice.h"
+
+#include <cstring>
+
+#ifndef ARDUINO
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace mc6809;
+
+void SectorCache::setDevice(BlockDevice* device)
+{
+    flush();
+    for (auto& it : _entries) {
+        it.valid = false;
+        it.dirty = false;
+    }
+    _nextSequential = UINT32_MAX;
+    _device = device;
+}
+
+uint8_t* SectorCache::sector(uint32_t sector, bool forWrite)
+{
+    if (!_device || sector >= _device->sectorCount()) {
+        return nullptr;
+    }
+
+    // Mapped devices are their own cache
+    uint8_t* mapped = _device->map(sector);
+    if (mapped) {
+        return mapped;
+    }
+
+    int32_t i = find(sector);
+    if (i < 0) {
+        i = evict();
+        if (i < 0 || (!forWrite && !_device->read(sector, 1, _data[i]))) {
+            return nullptr;
+        }
+        _entries[i] = { sector, ++_useCount, true, false };
+
+        // Reading in order, so get the next few while we're at it
+        if (!forWrite) {
+            uint32_t count = 1;
+            if (sector == _nextSequential) {
+                for ( ; count < SectorReadAhead && sector + count < _device->sectorCount(); ++count) {
+                    if (find(sector + count) >= 0) {
+                        continue;
+                    }
+                    int32_t j = evict();
+                    if (j < 0 || !_device->read(sector + count, 1, _data[j])) {
+                        break;
+                    }
+                    _entries[j] = { sector + count, ++_useCount, true, false };
+                }
+            }
+            _nextSequential = sector + count;
+        }
+    }
+
+    Entry& entry = _entries[i];
+    entry.lastUsed = ++_useCount;
+    entry.dirty = entry.dirty || forWrite;
+    return _data[i];
+}
+
+bool SectorCache::flush()
+{
+    if (!_device) {
+        return true;
+    }
+
+    // In sector order, so sectors which share an erase block go together
+    bool ok = true;
+    while (true) {
+        int32_t next = -1;
+        for (uint16_t i = 0; i < SectorCacheSize; ++i) {
+            if (_entries[i].dirty && (next < 0 || _entries[i].sector < _entries[next].sector)) {
+                next = i;
+            }
+        }
+        if (next < 0) {
+            break;
+        }
+        if (!writeBack(_entries[next], _data[next])) {
+            // It's lost. Don't try it again forever
+            _entries[next].valid = false;
+            _entries[next].dirty = false;
+            ok = false;
+        }
+    }
+    return _device->flush() && ok;
+}
+
+int32_t SectorCache::find(uint32_t sector) const
+{
+    for (uint16_t i = 0; i < SectorCacheSize; ++i) {
+        if (_entries[i].valid && _entries[i].sector == sector) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int32_t SectorCache::evict()
+{
+    int32_t lru = 0;
+    for (uint16_t i = 0; i < SectorCacheSize; ++i) {
+        if (!_entries[i].valid) {
+            lru = i;
+            break;
+        }
+        if (_entries[i].lastUsed < _entries[lru].lastUsed) {
+            lru = i;
+        }
+    }
+
+    Entry& entry = _entries[lru];
+    if (entry.valid && entry.dirty && !writeBack(entry, _data[lru])) {
+        return -1;
+    }
+    entry.valid = false;
+    return lru;
+}
+
+bool SectorCache::writeBack(Entry& entry, uint8_t* data)
+{
+    if (!_device->write(entry.sector, 1, data)) {
+        return false;
+    }
+    entry.dirty = false;
+    return true;
+}
+
+#ifndef ARDUINO
+bool MappedBlockDevice::open(const char* filename)
+{
+    close();
+
+    int fd = ::open(filename, O_RDWR);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < SectorSize) {
+        ::close(fd);
+        return false;
+    }
+
+    // The mapping keeps the file open
+    uint64_t sectors = uint64_t(st.st_size) / SectorSize;
+    if (sectors > UINT32_MAX) {
+        sectors = UINT32_MAX;
+    }
+    void* data = mmap(nullptr, size_t(sectors) * SectorSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    _data = static_cast<uint8_t*>(data);
+    _sectorCount = uint32_t(sectors);
+    return true;
+}
+
+void MappedBlockDevice::close()
+{
+    if (_data) {
+        flush();
+        munmap(_data, size_t(_sectorCount) * SectorSize);
+        _data = nullptr;
+        _sectorCount = 0;
+    }
+}
+
+bool MappedBlockDevice::read(uint32_t sector, uint32_t count, uint8_t* buf)
+{
+    if (!inRange(sector, count)) {
+        return false;
+    }
+    memcpy(buf, _data + size_t(sector) * SectorSize, size_t(count) * SectorSize);
+    return true;
+}
+
+bool MappedBlockDevice::write(uint32_t sector, uint32_t count, const uint8_t* buf)
+{
+    if (!inRange(sector, count)) {
+        return false;
+    }
+    memcpy(_data + size_t(sector) * SectorSize, buf, size_t(count) * SectorSize);
+    return true;
+}
+
+bool MappedBlockDevice::flush()
+{
+    return !_data || msync(_data, size_t(_sectorCount) * SectorSize, MS_SYNC) == 0;
+}
+
+uint8_t* MappedBlockDevice::map(uint32_t sector)
+{
+    return inRange(sector, 1) ? _data + size_t(sector) * SectorSize : nullptr;
+}
+#endif
+
+#if defined(ARDUINO) && defined(ESP32)
+static constexpr uint32_t FlashEraseSize = 4096;
+
+bool FlashBlockDevice::open(const char* label)
+{
+    _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!_partition) {
+        return false;
+    }
+    if (!_eraseBuf) {
+        _eraseBuf = new uint8_t[FlashEraseSize];
+    }
+
+    // Whole erase blocks only, so rewriting one never touches what's after the partition
+    _sectorCount = (_partition->size / FlashEraseSize) * (FlashEraseSize / SectorSize);
+    _eraseBlock = UINT32_MAX;
+    _eraseBufDirty = false;
+    return true;
+}
+
+bool FlashBlockDevice::read(uint32_t sector, uint32_t count, uint8_t* buf)
+{
+    if (!inRange(sector, count)) {
+        return false;
+    }
+
+    for ( ; count; --count, ++sector, buf += SectorSize) {
+        uint32_t offset = sector * SectorSize;
+        if (offset / FlashEraseSize == _eraseBlock) {
+            // Written but not committed yet
+            memcpy(buf, _eraseBuf + offset % FlashEraseSize, SectorSize);
+        } else if (esp_partition_read(_partition, offset, buf, SectorSize) != ESP_OK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FlashBlockDevice::write(uint32_t sector, uint32_t count, const uint8_t* buf)
+{
+    if (!inRange(sector, count)) {
+        return false;
+    }
+
+    for ( ; count; --count, ++sector, buf += SectorSize) {
+        uint32_t offset = sector * SectorSize;
+        uint32_t block = offset / FlashEraseSize;
+        if (block != _eraseBlock) {
+            if (!commit()) {
+                return false;
+            }
+            if (esp_partition_read(_partition, block * FlashEraseSize, _eraseBuf, FlashEraseSize) != ESP_OK) {
+                _eraseBlock = UINT32_MAX;
+                return false;
+            }
+            _eraseBlock = block;
+        }
+        memcpy(_eraseBuf + offset % FlashEraseSize, buf, SectorSize);
+        _eraseBufDirty = true;
+    }
+    return true;
+}
+
+bool FlashBlockDevice::commit()
+{
+    if (!_eraseBufDirty) {
+        return true;
+    }
+    _eraseBufDirty = false;
+
+    uint32_t offset = _eraseBlock * FlashEraseSize;
+    return esp_partition_erase_range(_partition, offset, FlashEraseSize) == ESP_OK &&
+           esp_partition_write(_partition, offset, _eraseBuf, FlashEraseSize) == ESP_OK;
+}
+#endif
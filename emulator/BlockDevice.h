@@ -0,0 +1,177 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  BlockDevice.h
+//  Disk storage for BOSS9
+//
+//  A BlockDevice is an array of 256 byte sectors, the same size as a
+//  page of the 6809 address space. BOSS9 reads and writes them with the
+//  dkRead and dkWrite system calls, through a SectorCache.
+//
+//  On the host a MappedBlockDevice memory maps a disk image file, so a
+//  sector is just a pointer into the mapping and the OS page cache does
+//  the caching and read-ahead. On ESP32 a FlashBlockDevice uses a data
+//  partition of the flash. Flash is slow to read, and has to be erased
+//  4KB at a time before it's written, so the SectorCache keeps recently
+//  used sectors, writes dirty ones back only when they're evicted or
+//  flushed, and reads ahead when the program reads sectors in order.
+//  FlashBlockDevice itself holds one erase block, so sectors written
+//  back together cost one erase.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(ARDUINO) && defined(ESP32)
+#include <esp_partition.h>
+#endif
+
+namespace mc6809 {
+
+static constexpr uint16_t SectorSize = 256;
+
+// Sectors the SectorCache holds, and how many it reads at once when
+// it sees sequential reads
+#ifdef ARDUINO
+static constexpr uint16_t SectorCacheSize = 8;
+#else
+static constexpr uint16_t SectorCacheSize = 32;
+#endif
+static constexpr uint16_t SectorReadAhead = 4;
+
+class BlockDevice
+{
+  public:
+    virtual ~BlockDevice() { }
+
+    virtual uint32_t sectorCount() const = 0;
+
+    // Copy count sectors starting at sector. Return false if any of
+    // them are out of range or the device fails
+    virtual bool read(uint32_t sector, uint32_t count, uint8_t* buf) = 0;
+    virtual bool write(uint32_t sector, uint32_t count, const uint8_t* buf) = 0;
+
+    // Make everything written so far permanent
+    virtual bool flush() = 0;
+
+    // Host memory for sector if the device is memory mapped. Writes to
+    // it are writes to the device. nullptr otherwise
+    virtual uint8_t* map(uint32_t sector) { return nullptr; }
+};
+
+class SectorCache
+{
+  public:
+    // Flushes the old device, if any. nullptr means no disk. The
+    // device must be removed this way before it's destroyed
+    void setDevice(BlockDevice*);
+    BlockDevice* device() const { return _device; }
+
+    uint32_t sectorCount() const { return _device ? _device->sectorCount() : 0; }
+
+    // Host memory for sector, valid until the next call. nullptr if
+    // there's no such sector or it can't be read. With forWrite the
+    // caller must fill the whole sector, so it isn't read first, and
+    // it's marked dirty to be written back
+    uint8_t* sector(uint32_t sector, bool forWrite);
+
+    bool flush();
+
+  private:
+    struct Entry
+    {
+        uint32_t sector = 0;
+        uint32_t lastUsed = 0;
+        bool valid = false;
+        bool dirty = false;
+    };
+
+    int32_t find(uint32_t sector) const;
+
+    // The least recently used entry, written back if it's dirty.
+    // -1 if it's dirty and can't be written
+    int32_t evict();
+
+    bool writeBack(Entry&, uint8_t* data);
+
+    BlockDevice* _device = nullptr;
+    Entry _entries[SectorCacheSize];
+    uint8_t _data[SectorCacheSize][SectorSize];
+    uint32_t _useCount = 0;
+
+    // The sector after the last ones read from the device. A
+    // miss on it means the program is reading in order
+    uint32_t _nextSequential = UINT32_MAX;
+};
+
+#ifndef ARDUINO
+// A disk image file, which must already exist. Its size is rounded
+// down to whole sectors
+class MappedBlockDevice : public BlockDevice
+{
+  public:
+    MappedBlockDevice() { }
+    virtual ~MappedBlockDevice() { close(); }
+
+    MappedBlockDevice(const MappedBlockDevice&) = delete;
+    MappedBlockDevice& operator=(const MappedBlockDevice&) = delete;
+
+    bool open(const char* filename);
+    void close();
+
+    virtual uint32_t sectorCount() const override { return _sectorCount; }
+    virtual bool read(uint32_t sector, uint32_t count, uint8_t* buf) override;
+    virtual bool write(uint32_t sector, uint32_t count, const uint8_t* buf) override;
+    virtual bool flush() override;
+    virtual uint8_t* map(uint32_t sector) override;
+
+  private:
+    bool inRange(uint32_t sector, uint32_t count) const { return sector < _sectorCount && count <= _sectorCount - sector; }
+
+    uint8_t* _data = nullptr;
+    uint32_t _sectorCount = 0;
+};
+#endif
+
+#if defined(ARDUINO) && defined(ESP32)
+// A data partition in flash, found by its label
+class FlashBlockDevice : public BlockDevice
+{
+  public:
+    FlashBlockDevice() { }
+    virtual ~FlashBlockDevice() { commit(); delete [ ] _eraseBuf; }
+
+    bool open(const char* label);
+
+    virtual uint32_t sectorCount() const override { return _sectorCount; }
+    virtual bool read(uint32_t sector, uint32_t count, uint8_t* buf) override;
+    virtual bool write(uint32_t sector, uint32_t count, const uint8_t* buf) override;
+
+    virtual bool flush() override { return commit(); }
+
+  private:
+    bool inRange(uint32_t sector, uint32_t count) const { return sector < _sectorCount && count <= _sectorCount - sector; }
+
+    // Erase and rewrite the block in _eraseBuf if it's been written
+    bool commit();
+
+    const esp_partition_t* _partition = nullptr;
+    uint32_t _sectorCount = 0;
+
+    // Writes go into a copy of their erase block, which is only erased
+    // and rewritten when a write goes to another block or on flush
+    uint8_t* _eraseBuf = nullptr;
+    uint32_t _eraseBlock = UINT32_MAX;
+    bool _eraseBufDirty = false;
+};
+#endif
+
+}
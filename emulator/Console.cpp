@@ -0,0 +1,124 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Console.cpp
+//  Host console on its own thread
+//
+
+#include "Console.h"
+
+#ifndef ARDUINO
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <poll.h>
+#include <sys/uio.h>
+
+using namespace mc6809;
+
+void Console::start()
+{
+    if (_running.exchange(true)) {
+        return;
+    }
+    _thread = std::thread([this] { run(); });
+}
+
+void Console::stop()
+{
+    if (!_running.exchange(false)) {
+        return;
+    }
+    _thread.join();
+}
+
+void Console::run()
+{
+    while (_running.load(std::memory_order_acquire)) {
+        // Only wait for input there's room for
+        pollfd fd = { _inFd, POLLIN, 0 };
+        bool wantInput = _inputOpen && _input.space() != 0;
+        int ready = poll(&fd, wantInput ? 1 : 0, FlushIntervalMS);
+
+        if (ready > 0 && (fd.revents & (POLLIN | POLLHUP))) {
+            readInput();
+        }
+        writeOutput();
+    }
+
+    writeOutput();
+}
+
+void Console::readInput()
+{
+    char buf[256];
+    size_t size = std::min(sizeof(buf), _input.space());
+    ssize_t n = read(_inFd, buf, size);
+
+    if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) {
+        // End of input. Stop polling for it, or poll would never wait
+        _inputOpen = false;
+        return;
+    }
+
+    for (ssize_t i = 0; i < n; ++i) {
+        _input.push(buf[i]);
+    }
+    wake();
+}
+
+void Console::waitForInput(uint32_t us)
+{
+    std::unique_lock<std::mutex> lock(_waitMutex);
+    _waitCondition.wait_for(lock, std::chrono::microseconds(us), [this] { return _woken || !_input.empty(); });
+    _woken = false;
+}
+
+void Console::wake()
+{
+    // Taking the lock makes sure we don't notify between the
+    // waiter checking and going to sleep
+    std::lock_guard<std::mutex> lock(_waitMutex);
+    _woken = true;
+    _waitCondition.notify_one();
+}
+
+void Console::writeOutput()
+{
+    while (true) {
+        iovec iov[2];
+        const char* first;
+        const char* second;
+        size_t firstSize;
+        size_t secondSize;
+        if (_output.peek(first, firstSize, second, secondSize) == 0) {
+            return;
+        }
+
+        iov[0] = { const_cast<char*>(first), firstSize };
+        iov[1] = { const_cast<char*>(second), secondSize };
+        ssize_t n = writev(_outFd, iov, secondSize ? 2 : 1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                return;
+            }
+
+            // Nowhere to write it, so throw it away rather than block putc
+            _output.consume(firstSize + secondSize);
+            return;
+        }
+        _output.consume(size_t(n));
+    }
+}
+
+#endif
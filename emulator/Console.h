@@ -0,0 +1,116 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Console.h
+//  Host console on its own thread
+//
+//  A Console does the terminal I/O for a BOSS9 on a thread of its own,
+//  so the thread running the emulator never makes a system call for it.
+//  Input and output go through SPSCRings. getc() and putc() are just a
+//  ring pop and push, and write() copies a whole string into the ring.
+//
+//  The console thread waits in poll() for input, or for FlushIntervalMS.
+//  Each time it wakes it writes out everything in the output ring with
+//  one writev(), so a burst of output costs one system call rather than
+//  one per character.
+//
+
+#pragma once
+
+#ifndef ARDUINO
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+#include "SPSCRing.h"
+
+namespace mc6809 {
+
+static constexpr size_t ConsoleInputSize = 4 * 1024;
+static constexpr size_t ConsoleOutputSize = 64 * 1024;
+
+// Longest output waits before it's written
+static constexpr int FlushIntervalMS = 2;
+
+class Console
+{
+  public:
+    Console(int inFd = STDIN_FILENO, int outFd = STDOUT_FILENO) : _inFd(inFd), _outFd(outFd) { }
+    ~Console() { stop(); }
+
+    Console(const Console&) = delete;
+    Console& operator=(const Console&) = delete;
+
+    void start();
+
+    // Writes out any output left and waits for the thread to finish
+    void stop();
+
+    // Called from the emulator thread. getc returns 0 if there's no input
+    int getc()
+    {
+        char c;
+        return _input.pop(c) ? uint8_t(c) : 0;
+    }
+
+    // Called from the emulator thread. Blocks until there's input,
+    // wake() is called or us have passed
+    void waitForInput(uint32_t us);
+
+    // Ends a waitForInput() early, or the next one if none is waiting.
+    // It can be called from any thread
+    void wake();
+
+    void putc(char c)
+    {
+        // Only full if the terminal can't keep up, so let it catch up
+        while (!_output.push(c)) {
+            std::this_thread::yield();
+        }
+    }
+    
+    // All n chars go into the ring as one or two copies
+    void write(const char* s, size_t n)
+    {
+        while (n) {
+            size_t pushed = _output.push(s, n);
+            if (pushed == 0) {
+                std::this_thread::yield();
+            }
+            s += pushed;
+            n -= pushed;
+        }
+    }
+
+  private:
+    void run();
+    void readInput();
+    void writeOutput();
+
+    int _inFd;
+    int _outFd;
+    bool _inputOpen = true;
+
+    SPSCRing<char, ConsoleInputSize> _input;
+    SPSCRing<char, ConsoleOutputSize> _output;
+
+    std::thread _thread;
+    std::atomic<bool> _running { false };
+
+    std::mutex _waitMutex;
+    std::condition_variable _waitCondition;
+    bool _woken = false;
+};
+
+}
+
+#endif
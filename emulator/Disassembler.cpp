@@ -0,0 +1,299 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Disassembler.cpp
+//  6809 disassembler
+//
+
+#include "Disassembler.h"
+
+using namespace mc6809;
+
+// Text is appended by these, which return the new end. Lines are
+// bounded by MaxLineSize, so nothing checks for the end of the buffer
+
+static inline char* put(char* p, const char* s)
+{
+    while (*s) {
+        *p++ = *s++;
+    }
+    return p;
+}
+
+static inline char* hex2(char* p, uint8_t v)
+{
+    static const char digits[] = "0123456789abcdef";
+    p[0] = digits[v >> 4];
+    p[1] = digits[v & 0x0f];
+    return p + 2;
+}
+
+static inline char* hex4(char* p, uint16_t v)
+{
+    return hex2(hex2(p, uint8_t(v >> 8)), uint8_t(v));
+}
+
+static char* dec(char* p, int16_t v)
+{
+    int32_t n = v;
+    if (n < 0) {
+        *p++ = '-';
+        n = -n;
+    }
+
+    char digits[6];
+    uint8_t count = 0;
+    do {
+        digits[count++] = char('0' + n % 10);
+        n /= 10;
+    } while (n);
+
+    while (count) {
+        *p++ = digits[--count];
+    }
+    return p;
+}
+
+// A label if there's one at addr, otherwise $addr
+char* Disassembler::address(uint16_t addr, char* p) const
+{
+    const char* label = _symbols ? _symbols->name(addr) : nullptr;
+    if (!label) {
+        *p++ = '$';
+        return hex4(p, addr);
+    }
+
+    for (uint8_t i = 0; i < MaxLabelSize && label[i]; ++i) {
+        *p++ = label[i];
+    }
+    return p;
+}
+
+char* Disassembler::indexed(const DecodedInst& inst, char* p) const
+{
+    static const char* indexRegs[4] = { "X", "Y", "U", "S" };
+
+    uint8_t postbyte = inst.postbyte;
+    const char* reg = indexRegs[(postbyte >> 5) & 0x03];
+
+    if ((postbyte & 0x80) == 0) {
+        // Constant offset direct (5 bit signed), which can't be indirect
+        p = dec(p, int16_t(inst.operand));
+        *p++ = ',';
+        return put(p, reg);
+    }
+
+    bool indirect;
+
+#ifdef HD6309
+    if (wIndexed(postbyte)) {
+        indirect = (postbyte & IdxWMask) == IdxWInd;
+        if (indirect) {
+            *p++ = '[';
+        }
+        switch (RR(postbyte & 0b01100000)) {
+            case RR::X: p = put(p, ",W"); break;
+            case RR::Y: p = put(dec(p, int16_t(inst.operand)), ",W"); break;
+            case RR::U: p = put(p, ",W++"); break;
+            case RR::S: p = put(p, ",--W"); break;
+        }
+        if (indirect) {
+            *p++ = ']';
+        }
+        return p;
+    }
+#endif
+
+    indirect = (postbyte & IndexedIndMask) != 0;
+    if (indirect) {
+        *p++ = '[';
+    }
+
+    switch (IdxMode(postbyte & IdxModeMask)) {
+        case IdxMode::ConstRegNoOff : p = put(put(p, ","), reg); break;
+        case IdxMode::ConstReg8Off  :
+        case IdxMode::ConstReg16Off : p = put(put(dec(p, int16_t(inst.operand)), ","), reg); break;
+        case IdxMode::AccAOffReg    : p = put(put(p, "A,"), reg); break;
+        case IdxMode::AccBOffReg    : p = put(put(p, "B,"), reg); break;
+        case IdxMode::AccDOffReg    : p = put(put(p, "D,"), reg); break;
+        case IdxMode::Inc1Reg       : p = put(put(put(p, ","), reg), "+"); break;
+        case IdxMode::Inc2Reg       : p = put(put(put(p, ","), reg), "++"); break;
+        case IdxMode::Dec1Reg       : p = put(put(p, ",-"), reg); break;
+        case IdxMode::Dec2Reg       : p = put(put(p, ",--"), reg); break;
+        case IdxMode::ConstPC8Off   :
+        case IdxMode::ConstPC16Off  : p = put(address(inst.operand, p), ",PCR"); break;
+        case IdxMode::Extended      : p = address(inst.operand, p); break;
+#ifdef HD6309
+        case IdxMode::AccEOffReg    : p = put(put(p, "E,"), reg); break;
+        case IdxMode::AccFOffReg    : p = put(put(p, "F,"), reg); break;
+        case IdxMode::AccWOffReg    : p = put(put(p, "W,"), reg); break;
+#else
+        default                     : p = put(p, "???"); break;
+#endif
+    }
+
+    if (indirect) {
+        *p++ = ']';
+    }
+    return p;
+}
+
+char* Disassembler::format(const DecodedInst& inst, uint16_t addr, char* p) const
+{
+    Op op = inst.op;
+    Adr adr = inst.adr;
+
+    if (adr == Adr::RelL) {
+        *p++ = 'L';
+    }
+    p = put(p, opToString(op));
+    p = put(p, Emulator::regToString(inst.reg));
+
+    if (adr == Adr::None || adr == Adr::Inherent) {
+        return p;
+    }
+
+#ifdef HD6309
+    if (op == Op::PSHW || op == Op::PULW) {
+        return put(p, "W");
+    }
+#endif
+
+    p = put(p, "  ");
+
+#ifdef HD6309
+    // The immediate byte or bit op postbyte comes before the address
+    if (op >= Op::OIM && op <= Op::TIM) {
+        p = hex2(put(p, "#$"), uint8_t(inst.extra));
+        *p++ = ',';
+    } else if (op >= Op::BAND && op <= Op::STBT) {
+        static const char* bitRegs[4] = { "CC", "A", "B", "?" };
+        p = put(p, bitRegs[(inst.extra >> 6) & 0x03]);
+        *p++ = ',';
+        *p++ = char('0' + ((inst.extra >> 3) & 0x07));
+        *p++ = ',';
+        *p++ = char('0' + (inst.extra & 0x07));
+        *p++ = ',';
+    }
+#endif
+
+    switch (adr) {
+        case Adr::None:
+        case Adr::Inherent:
+        case Adr::RelP:
+            break;
+        case Adr::Direct:
+            p = hex2(put(p, "<$"), uint8_t(inst.operand));
+            break;
+        case Adr::Extended:
+            *p++ = '>';
+            p = address(inst.operand, p);
+            break;
+        case Adr::Immed16:
+            p = hex4(put(p, "#$"), inst.operand);
+            break;
+#ifdef HD6309
+        case Adr::Immed32:
+            p = hex4(hex4(put(p, "#$"), inst.operand), inst.extra);
+            break;
+#endif
+        case Adr::Rel:
+        case Adr::RelL:
+            p = address(uint16_t(addr + inst.size + int16_t(inst.operand)), p);
+            break;
+        case Adr::Indexed:
+            p = indexed(inst, p);
+            break;
+        case Adr::Immed8: {
+            uint8_t value = uint8_t(inst.operand);
+            bool regPair = op == Op::TFR || op == Op::EXG;
+#ifdef HD6309
+            regPair = regPair || (op >= Op::ADDR && op <= Op::CMPR);
+            if (op == Op::TFM) {
+                static const char* srcInc[4] = { "+", "-", "+", "" };
+                static const char* dstInc[4] = { "+", "-", "", "+" };
+                p = put(p, Emulator::regToString(Reg(value >> 4)));
+                p = put(p, srcInc[inst.extra & 0x03]);
+                *p++ = ',';
+                p = put(p, Emulator::regToString(Reg(value & 0x0f)));
+                p = put(p, dstInc[inst.extra & 0x03]);
+                break;
+            }
+#endif
+            if (regPair) {
+                p = put(p, Emulator::regToString(Reg(value >> 4)));
+                *p++ = ',';
+                p = put(p, Emulator::regToString(Reg(value & 0x0f)));
+            } else if (op == Op::PSH || op == Op::PUL) {
+                // PSHU and PULU have U where PSHS and PULS have S
+                static const char* pushRegs[8] = { "CC", "A", "B", "DP", "X", "Y", "S", "PC" };
+                bool first = true;
+                for (uint8_t i = 0; i < 8; ++i) {
+                    if ((value & (1 << i)) == 0) {
+                        continue;
+                    }
+                    if (!first) {
+                        *p++ = ',';
+                    }
+                    p = put(p, (i == 6 && inst.reg == Reg::S) ? "U" : pushRegs[i]);
+                    first = false;
+                }
+            } else {
+                p = hex2(put(p, "#$"), value);
+            }
+            break;
+        }
+    }
+    return p;
+}
+
+uint8_t Disassembler::instruction(const uint8_t* code, size_t size, uint16_t addr, char* buf) const
+{
+    DecodedInst inst;
+    decodeInstruction(code, size, addr, inst);
+    if (inst.size > size) {
+        buf[0] = '\0';
+        return 0;
+    }
+
+    *format(inst, addr, buf) = '\0';
+    return inst.size;
+}
+
+size_t Disassembler::range(const uint8_t* code, size_t size, uint16_t addr, uint32_t& n, char* buf, size_t bufSize) const
+{
+    if (bufSize == 0) {
+        return 0;
+    }
+
+    char* p = buf;
+    char* end = buf + bufSize;
+    size_t used = 0;
+
+    // A line and the terminator have to fit
+    while (n && size_t(end - p) > MaxLineSize) {
+        uint16_t pc = uint16_t(addr + used);
+        DecodedInst inst;
+        decodeInstruction(code + used, size - used, pc, inst);
+        if (inst.size > size - used) {
+            break;
+        }
+
+        p = hex4(put(p, "[$"), pc);
+        p = put(p, "]    ");
+        p = format(inst, pc, p);
+        *p++ = '\n';
+
+        used += inst.size;
+        n -= 1;
+    }
+
+    *p = '\0';
+    return used;
+}
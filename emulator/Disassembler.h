@@ -0,0 +1,74 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Disassembler.h
+//  6809 disassembler
+//
+//  A Disassembler turns instruction bytes into text, written straight
+//  into a buffer the caller owns. It decodes with decodeInstruction(),
+//  so it knows every instruction the emulator does, and works on any
+//  bytes, not just those in an Emulator's memory. That makes it usable
+//  for the monitor, trace dumps and listings alike, and it doesn't
+//  allocate or call printf, so it can do tens of millions of
+//  instructions a second.
+//
+//  Branch targets, PC relative addresses and extended addresses are
+//  shown as labels when there are Symbols with exactly that address.
+//  Direct addresses depend on DP and immediates may not be addresses
+//  at all, so those are always numbers.
+//
+
+#pragma once
+
+#include "MC6809.h"
+#include "Symbols.h"
+
+namespace mc6809 {
+
+class Disassembler
+{
+  public:
+    // Enough for any instruction, even one with a run of prefixes
+    static constexpr uint8_t MaxInstructionSize = 8;
+
+    // Labels longer than this are cut short
+    static constexpr uint8_t MaxLabelSize = 32;
+
+    // The longest line range() writes, with its newline. instruction()
+    // writes less
+    static constexpr size_t MaxLineSize = 80;
+
+    Disassembler(const Symbols* symbols = nullptr) : _symbols(symbols) { }
+
+    // Symbols to name addresses with, or nullptr for just addresses
+    void setSymbols(const Symbols* symbols) { _symbols = symbols; }
+
+    // Disassemble the instruction at the start of code, which is at
+    // addr in the guest, into buf as "LDA  #$01". buf must hold
+    // MaxLineSize chars. Returns the size of the instruction, or 0 with
+    // buf empty if it's longer than size
+    uint8_t instruction(const uint8_t* code, size_t size, uint16_t addr, char* buf) const;
+
+    // Disassemble the instructions in code, which starts at addr in the
+    // guest, into buf a line each as "[$0400]    LDA  #$01\n". Stops
+    // after n instructions, before one which is longer than what's left
+    // of code or when buf can't hold another line. n is decreased by
+    // the number done and buf is always terminated. Returns the number
+    // of bytes of code used
+    size_t range(const uint8_t* code, size_t size, uint16_t addr, uint32_t& n, char* buf, size_t bufSize) const;
+
+  private:
+    char* format(const DecodedInst&, uint16_t addr, char* p) const;
+    char* address(uint16_t addr, char* p) const;
+    char* indexed(const DecodedInst&, char* p) const;
+
+    const Symbols* _symbols;
+};
+
+}
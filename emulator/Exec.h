@@ -0,0 +1,669 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Exec.h
+//  The body of every instruction
+//
+//  Emulator::exec is here rather than in MC6809.cpp so code generated
+//  by the recompile tool can inline it too. Every caller passes the op,
+//  register, address mode and load and store kinds as constants, and
+//  recompiled code passes the decoded instruction as one as well, so
+//  each call compiles down to just the code for that instruction.
+//
+
+#pragma once
+
+#include "MC6809.h"
+#include "BOSS9.h"
+
+namespace mc6809 {
+
+static inline uint16_t concat(uint8_t a, uint8_t b)
+{
+    return (uint16_t(a) << 8) | uint16_t(b);
+}
+
+ALWAYS_INLINE StepResult Emulator::exec(Op op, Reg reg, Adr adr, Left left, Right right,
+                                        const DecodedInst& inst, uint16_t& ea)
+{
+#ifdef CHECK_LAZY_FLAGS
+    uint16_t pc = _pc;
+#endif
+    
+    _pc += inst.size;
+    
+#ifdef COMPUTE_CYCLES
+    _cycles += inst.cycles;
+#endif
+
+    // Handle address modes
+    // If this is an addressing mode that produces a 16 bit effective address
+    // it will be placed in ea. If it's immediate or branch relative then the
+    // 8 or 16 bit value is placed in _right
+    ea = 0;
+    
+    // This is an if chain rather than a switch. Each mode is a well
+    // predicted branch, where a switch would be an indirect jump on top
+    // of the one for the op
+    if (adr == Adr::Direct) {
+        ea = concat(_dp, uint8_t(inst.operand));
+    } else if (adr == Adr::Extended) {
+        ea = inst.operand;
+    } else if (adr == Adr::Immed8 || adr == Adr::Immed16) {
+        _right = inst.operand;
+    } else if (adr == Adr::Rel || adr == Adr::RelL || adr == Adr::RelP) {
+        // All the relative addressing modes need to be sign extended to 32 bits
+        _right = int16_t(inst.operand);
+#ifdef HD6309
+    } else if (adr == Adr::Indexed && wIndexed(inst.postbyte)) {
+        switch (RR(inst.postbyte & 0b01100000)) {
+            case RR::X: ea = _w; break;
+            case RR::Y: ea = _w + inst.operand; break;
+            case RR::U: ea = _w; _w += 2; break;
+            case RR::S: _w -= 2; ea = _w; break;
+        }
+        
+        if ((inst.postbyte & IdxWMask) == IdxWInd) {
+            ea = load16(ea);
+        }
+#endif
+    } else if (adr == Adr::Indexed) {
+        uint8_t postbyte = inst.postbyte;
+        uint16_t* idxReg = nullptr;
+        
+        // Load value of RR reg in ea
+        switch (RR(postbyte & 0b01100000)) {
+            case RR::X: idxReg = &_x; break;
+            case RR::Y: idxReg = &_y; break;
+            case RR::U: idxReg = &_u; break;
+            case RR::S: idxReg = &_s; break;
+        }
+        
+        if ((postbyte & 0x80) == 0) {
+            // Constant offset direct (5 bit signed)
+            ea = *idxReg + int16_t(inst.operand);
+        } else {
+            switch(IdxMode(postbyte & IdxModeMask)) {
+                case IdxMode::ConstRegNoOff   : ea = *idxReg; break;
+                case IdxMode::ConstReg8Off    :
+                case IdxMode::ConstReg16Off   : ea = *idxReg + int16_t(inst.operand); break;
+                case IdxMode::AccAOffReg      : ea = *idxReg + int8_t(_a); break;
+                case IdxMode::AccBOffReg      : ea = *idxReg + int8_t(_b); break;
+                case IdxMode::AccDOffReg      : ea = *idxReg + int16_t(_d); break;
+                case IdxMode::Inc1Reg         : ea = *idxReg; (*idxReg) += 1; break;
+                case IdxMode::Inc2Reg         : ea = *idxReg; (*idxReg) += 2; break;
+                case IdxMode::Dec1Reg         : (*idxReg) -= 1; ea = *idxReg; break;
+                case IdxMode::Dec2Reg         : (*idxReg) -= 2; ea = *idxReg; break;
+                case IdxMode::ConstPC8Off     :
+                case IdxMode::ConstPC16Off    :
+                case IdxMode::Extended        : ea = inst.operand; break;
+#ifdef HD6309
+                case IdxMode::AccEOffReg      : ea = *idxReg + int8_t(_e); break;
+                case IdxMode::AccFOffReg      : ea = *idxReg + int8_t(_f); break;
+                case IdxMode::AccWOffReg      : ea = *idxReg + int16_t(_w); break;
+#endif
+            }
+            
+            if (postbyte & IndexedIndMask) {
+                // indirect from ea
+                ea = load16(ea);
+            }
+        }
+    }
+    
+    // Get left operand
+    if (left == Left::Ld || left == Left::LdSt) {
+        if (reg == Reg::M8) {
+            _left = load8(ea);
+        } else if (reg == Reg::M16) {
+            _left = load16(ea);
+        } else {
+            _left = getReg(reg);
+        }
+    }
+    
+    // Get right operand
+    if (right == Right::Ld8) {
+        _right = load8(ea);
+    } else if (right == Right::Ld16) {
+        _right = load16(ea);
+    }
+            
+    // Perform operation
+    switch(op) {
+        case Op::ILL:
+        case Op::Page2:
+        case Op::Page3:
+            // Page2 and Page3 are folded into the decoded instruction,
+            // so we only see them here if decode gave up on a long run
+            // of prefixes. The 6309 would trap, but stopping in the
+            // monitor is more use
+#ifdef HD6309
+            _md |= MDIllegal;
+#endif
+            _error = Error::Illegal;
+            return StepResult::Error;
+
+        case Op::BHS:
+        case Op::BCC: if (!flag(FlagC)) takeBranch(adr); break;
+        case Op::BLO:
+        case Op::BCS: if (flag(FlagC)) takeBranch(adr); break;
+        case Op::BEQ: if (flag(FlagZ)) takeBranch(adr); break;
+        case Op::BGE: if (!NxorV()) takeBranch(adr); break;
+        case Op::BGT: if (!(NxorV() || flag(FlagZ))) takeBranch(adr); break;
+        case Op::BHI: if (flags(FlagC | FlagZ) == 0) takeBranch(adr); break;
+        case Op::BLE: if (NxorV() || flag(FlagZ)) takeBranch(adr); break;
+        case Op::BLS: if (flags(FlagC | FlagZ) != 0) takeBranch(adr); break;
+        case Op::BLT: if (NxorV()) takeBranch(adr); break;
+        case Op::BMI: if (flag(FlagN)) takeBranch(adr); break;
+        case Op::BNE: if (!flag(FlagZ)) takeBranch(adr); break;
+        case Op::BPL: if (!flag(FlagN)) takeBranch(adr); break;
+        case Op::BRA: _pc += _right; break;
+        case Op::BRN: break;
+        case Op::BVC: if (!flag(FlagV)) takeBranch(adr); break;
+        case Op::BVS: if (flag(FlagV)) takeBranch(adr); break;
+        case Op::BSR:
+            push16(_s, _pc);
+            _pc += _right;
+            _subroutineDepth += 1;
+            break;
+
+        case Op::ABX:
+            _x = _x + uint16_t(_b);
+            break;
+        case Op::ADC:
+            _result = _left + _right + (flag(FlagC) ? 1 : 0);
+            HNZVC8();
+            break;
+        case Op::ADD8:
+            _result = _left + _right;
+            HNZVC8();
+            break;
+        case Op::ADD16:
+            _result = _left + _right;
+            xNZVC16();
+            break;
+        case Op::AND:
+            _result = _left & _right;
+            xNZ0x8();
+            break;
+        case Op::ANDCC:
+            setCCByte(ccByte() & _right);
+            break;
+        case Op::ASL:
+            _result = _left << 1;
+            setFlag(FlagV, (((_left & 0x40) >> 6) ^ ((_left & 0x80) >> 7)) != 0);
+            xNZxC8();
+            break;
+        case Op::ASR:
+            _result = (_left >> 1) | (_left & 0x80);
+            setFlag(FlagC, (_left & 0x01) != 0);
+            xNZxx8();
+            break;
+        case Op::BIT:
+            _result = _left & _right;
+            xNZ0x8();
+            break;
+#ifdef HD6309
+        case Op::CLR16:
+#endif
+        case Op::CLR:
+            _result = 0;
+            setFlag(FlagN, false);
+            setFlag(FlagZ, true);
+            setFlag(FlagV, false);
+            setFlag(FlagC, false);
+            break;
+        case Op::CMP8:
+        case Op::SUB8:
+            _result = _left - _right;
+            xNZVC8();
+            break;
+        case Op::CMP16:
+        case Op::SUB16:
+            _result = _left - _right;
+            xNZVC16();
+            
+            // We need to do setReg here because the opcode table only has
+            // Left::Ld for SUB16. Prefixed SUB16 ops are decoded as CMP16.
+            if (op == Op::SUB16) {
+                setReg(reg, _result);
+            }
+            break;
+        case Op::COM:
+            _result = ~_left;
+            xNZ018();
+            break;
+        case Op::CWAI:
+            // Stack the entire state now. The interrupt that ends
+            // the wait doesn't stack it again.
+            setCCByte(ccByte() & _right);
+            setFlag(FlagE, true);
+            pushEntireState();
+            _waitState = WaitState::Cwai;
+            break;
+        case Op::DAA: {
+            _result = _a;
+            uint8_t LSN = _result & 0x0f;
+            uint8_t MSN = (_result & 0xf0) >> 4;
+            
+            // LSN
+            if (flag(FlagH) || LSN > 9) {
+                _result += 6;
+            }
+            
+            // MSN. A carry which was already there stays
+            bool carry = flag(FlagC);
+            if (carry || (MSN > 9) || (MSN > 8 && LSN > 9)) {
+                _result += 0x60;
+            }
+            xNZ0C8();
+            if (carry) {
+                setFlag(FlagC, true);
+            }
+            _a = _result;
+            break;
+        }
+        case Op::DEC:
+            _result = _left - 1;
+            setFlag(FlagV, _left == 0x80);
+            xNZxx8();
+            break;
+        case Op::EOR:
+            _result = _left ^ _right;
+            xNZ0x8();
+            break;
+        case Op::EXG: {
+            uint16_t r1 = getReg(Reg(_right & 0xf));
+            uint16_t r2 = getReg(Reg(_right >> 4));
+            setReg(Reg(_right & 0xf), r2);
+            setReg(Reg(_right >> 4), r1);
+            break;
+        }
+        case Op::INC:
+            _result = _left + 1;
+            setFlag(FlagV, _left == 0x7f);
+            xNZxx8();
+            break;
+        case Op::JMP:
+        case Op::JSR:
+            if (ea >= SystemAddrStart) {
+                // This is possibly a system call
+                if (!_boss9->call(Func(ea))) {
+                    return StepResult::Stop;
+                }
+            } else {
+                if (op == Op::JSR) {
+                    push16(_s, _pc);
+                }
+                _pc = ea;
+                if (op == Op::JSR) {
+                    _subroutineDepth += 1;
+                }
+            }
+            break;
+        case Op::LD8:
+            _result = _right;
+            xNZ0x8();
+            break;
+        case Op::LD16:
+            _result = _right;
+            xNZ0x16();
+            break;
+        case Op::LEA:
+            _result = ea;
+            if (reg == Reg::X || reg == Reg::Y) {
+                setFlag(FlagZ, _result == 0);
+            }
+            break;
+        case Op::LSR:
+            _result = _left >> 1;
+            setFlag(FlagN, false);
+            setFlag(FlagC, (_left & 0x01) != 0);
+            setFlags<false>(FlagZ);
+            break;
+        case Op::MUL:
+            _d = _a * _b;
+            setFlag(FlagZ, _d == 0);
+            setFlag(FlagC, _b & 0x80);
+            break;
+        case Op::NEG:
+            _result = -_left;
+            setFlag(FlagV, _left == 0x80);
+            xNZxC8();
+            break;
+        case Op::NOP:
+            break;
+        case Op::OR:
+            _result = _left | _right;
+            xNZ0x8();
+            break;
+        case Op::ORCC:
+            setCCByte(ccByte() | _right);
+            break;
+        case Op::PSH:
+        case Op::PUL: {
+            // bit pattern to push or pull are in _right
+            uint16_t& stack = (reg == Reg::U) ? _u : _s;
+            if (op == Op::PSH) {
+                if (_right & 0x80) push16(stack, _pc);
+                if (_right & 0x40) push16(stack, (reg == Reg::U) ? _s : _u);
+                if (_right & 0x20) push16(stack, _y);
+                if (_right & 0x10) push16(stack, _x);
+                if (_right & 0x08) push8(stack, _dp);
+                if (_right & 0x04) push8(stack, _b);
+                if (_right & 0x02) push8(stack, _a);
+                if (_right & 0x01) push8(stack, ccByte());
+            } else {
+                if (_right & 0x01) setCCByte(pop8(stack));
+                if (_right & 0x02) _a = pop8(stack);
+                if (_right & 0x04) _b = pop8(stack);
+                if (_right & 0x08) _dp = pop8(stack);
+                if (_right & 0x10) _x = pop16(stack);
+                if (_right & 0x20) _y = pop16(stack);
+                if (_right & 0x40) {
+                    if (reg == Reg::U) {
+                        _s = pop16(stack);
+                    } else {
+                        _u = pop16(stack);
+                    }
+                }
+                if (_right & 0x80) _pc = pop16(stack);
+            }
+            break;
+        }
+        case Op::ROL:
+            _result = _left << 1;
+            if (flag(FlagC)) {
+                _result |= 0x01;
+            }
+            setFlag(FlagV, (((_left & 0x40) >> 6) ^ ((_left & 0x80) >> 7)) != 0);
+            xNZxC8();
+            break;
+        case Op::ROR:
+            _result = (_left >> 1) | (flag(FlagC) ? 0x80 : 0);
+            setFlag(FlagC, (_left & 0x01) != 0);
+            xNZxx8();
+            break;
+        case Op::RTI:
+            // The stacked E says whether this was an FIRQ
+            setCCByte(pop8(_s));
+            if (flag(FlagE)) {
+#ifdef COMPUTE_CYCLES
+                // Pulling the entire state takes 9 more cycles
+                _cycles += 9;
+#endif
+                _a = pop8(_s);
+                _b = pop8(_s);
+#ifdef HD6309
+                if (nativeMode()) {
+#ifdef COMPUTE_CYCLES
+                    _cycles += 2;
+#endif
+                    _e = pop8(_s);
+                    _f = pop8(_s);
+                }
+#endif
+                _dp = pop8(_s);
+                _x = pop16(_s);
+                _y = pop16(_s);
+                _u = pop16(_s);
+            }
+            _pc = pop16(_s);
+            break;
+        case Op::RTS:
+            _pc = pop16(_s);
+            _subroutineDepth -= 1;
+            if (_lastRunState != RunState::Running && _subroutineDepth == 0) {
+                _boss9->printF("\n*** step %s, stopped at addr $%04x\n\n",
+                        (_lastRunState == RunState::StepOver) ? "over" : "out", _pc);
+                // enter the monitor
+                _boss9->call(Func::mon);
+                return StepResult::Stop;
+            }
+            break;
+        case Op::SBC:
+            _result = _left - _right - (flag(FlagC) ? 1 : 0);
+            xNZVC8();
+            break;
+        case Op::SEX:
+            // N and Z come from all of D and V is left alone
+            _a = (_b & 0x80) ? 0xff : 0;
+            _result = _d;
+            setFlags<true>(FlagN | FlagZ);
+            break;
+        case Op::ST8: // The store is done in post processing
+            _result = _left;
+            xNZ0x8();
+            break;
+        case Op::ST16:
+            _result = _left;
+            xNZ0x16();
+            break;
+        case Op::SWI:
+            setFlag(FlagE, true);
+            pushEntireState();
+            setFlag(FlagI, true);
+            setFlag(FlagF, true);
+            if (inst.prefix == Op::Page3) {
+                _pc = load16(0xfff2);
+            } else if (inst.prefix == Op::Page2) {
+                _pc = load16(0xfff4);
+            } else {
+                _pc = load16(0xfffa);
+            }
+            break;
+        case Op::SYNC:
+            _waitState = WaitState::Sync;
+            break;
+        case Op::TFR:
+            setReg(Reg(_right & 0xf), getReg(Reg(_right >> 4)));
+            break;
+        case Op::TST:
+            _result = _left - 0;
+            xNZ0x8();
+            break;
+        case Op::FIRQ:
+        case Op::IRQ:
+        case Op::NMI:
+        case Op::RESTART:
+            // Not opcodes. Interrupts are taken by checkInterrupts
+            break;
+            
+#ifdef HD6309
+        case Op::OIM:
+            _result = _left | inst.extra;
+            xNZ0x8();
+            break;
+        case Op::AIM:
+        case Op::TIM:
+            _result = _left & inst.extra;
+            xNZ0x8();
+            break;
+        case Op::EIM:
+            _result = _left ^ inst.extra;
+            xNZ0x8();
+            break;
+        case Op::SEXW:
+            _d = (_w & 0x8000) ? 0xffff : 0;
+            setFlag(FlagN, _d != 0);
+            setFlag(FlagZ, _w == 0);
+            break;
+        case Op::LDQ: {
+            uint32_t q = (adr == Adr::Immed32) ? ((uint32_t(inst.operand) << 16) | inst.extra) :
+                                                 ((uint32_t(load16(ea)) << 16) | load16(ea + 2));
+            _d = q >> 16;
+            _w = q;
+            xNZ0x32(q);
+            break;
+        }
+        case Op::STQ:
+            store16(ea, _d);
+            store16(ea + 2, _w);
+            xNZ0x32((uint32_t(_d) << 16) | _w);
+            break;
+        case Op::ADDR:
+        case Op::ADCR:
+        case Op::SUBR:
+        case Op::SBCR:
+        case Op::ANDR:
+        case Op::ORR:
+        case Op::EORR:
+        case Op::CMPR:
+            registerOp(op);
+            break;
+        case Op::PSHW:
+            push16((reg == Reg::U) ? _u : _s, _w);
+            break;
+        case Op::PULW:
+            _w = pop16((reg == Reg::U) ? _u : _s);
+            break;
+        case Op::BAND:
+        case Op::BIAND:
+        case Op::BOR:
+        case Op::BIOR:
+        case Op::BEOR:
+        case Op::BIEOR:
+        case Op::LDBT:
+        case Op::STBT:
+            if (!bitOp(op, uint8_t(inst.extra), ea)) {
+                _md |= MDIllegal;
+                _error = Error::Illegal;
+                return StepResult::Error;
+            }
+            break;
+        case Op::TFM:
+            if (!transfer(uint8_t(_right), uint8_t(inst.extra))) {
+                _md |= MDIllegal;
+                _error = Error::Illegal;
+                return StepResult::Error;
+            }
+            break;
+        case Op::BITMD: {
+            // The trap bits are cleared once they've been tested
+            uint8_t bits = uint8_t(_right) & (MDIllegal | MDDivZero);
+            setFlag(FlagZ, (_md & bits) == 0);
+            _md &= ~bits;
+            break;
+        }
+        case Op::LDMD:
+            _md = (_md & (MDIllegal | MDDivZero)) | (uint8_t(_right) & (MDNative | MDFirqEntire));
+            break;
+        case Op::DIVD:
+        case Op::DIVQ:
+            divide(op);
+            break;
+        case Op::MULD: {
+            uint32_t q = uint32_t(int32_t(int16_t(_d)) * int32_t(int16_t(_right)));
+            _d = q >> 16;
+            _w = q;
+            xNZ0x32(q);
+            setFlag(FlagC, false);
+            break;
+        }
+        case Op::NEG16:
+            _result = -_left;
+            setFlag(FlagV, _left == 0x8000);
+            xNZxC16();
+            break;
+        case Op::COM16:
+            _result = ~_left;
+            xNZ0116();
+            break;
+        case Op::LSR16:
+            _result = _left >> 1;
+            setFlag(FlagN, false);
+            setFlag(FlagC, (_left & 0x01) != 0);
+            setFlags<true>(FlagZ);
+            break;
+        case Op::ROR16:
+            _result = (_left >> 1) | (flag(FlagC) ? 0x8000 : 0);
+            setFlag(FlagC, (_left & 0x01) != 0);
+            xNZxx16();
+            break;
+        case Op::ASR16:
+            _result = (_left >> 1) | (_left & 0x8000);
+            setFlag(FlagC, (_left & 0x01) != 0);
+            xNZxx16();
+            break;
+        case Op::ASL16:
+            _result = _left << 1;
+            setFlag(FlagV, (((_left >> 15) ^ (_left >> 14)) & 0x01) != 0);
+            xNZxC16();
+            break;
+        case Op::ROL16:
+            _result = (_left << 1) | (flag(FlagC) ? 1 : 0);
+            setFlag(FlagV, (((_left >> 15) ^ (_left >> 14)) & 0x01) != 0);
+            xNZxC16();
+            break;
+        case Op::DEC16:
+            _result = _left - 1;
+            setFlag(FlagV, _left == 0x8000);
+            xNZxx16();
+            break;
+        case Op::INC16:
+            _result = _left + 1;
+            setFlag(FlagV, _left == 0x7fff);
+            xNZxx16();
+            break;
+        case Op::TST16:
+            _result = _left;
+            xNZ0x16();
+            break;
+        case Op::ADC16:
+            _result = _left + _right + (flag(FlagC) ? 1 : 0);
+            xNZVC16();
+            break;
+        case Op::SBC16:
+            _result = _left - _right - (flag(FlagC) ? 1 : 0);
+            xNZVC16();
+            break;
+        case Op::AND16:
+        case Op::BIT16:
+            _result = _left & _right;
+            xNZ0x16();
+            break;
+        case Op::EOR16:
+            _result = _left ^ _right;
+            xNZ0x16();
+            break;
+        case Op::OR16:
+            _result = _left | _right;
+            xNZ0x16();
+            break;
+#endif
+    }
+    
+    // Store _result
+    if (right == Right::St8) {
+        store8(ea, _left);
+    } else if (right == Right::St16) {
+        store16(ea, _left);
+    } else if (left == Left::St || left == Left::LdSt) {
+        if (right == Right::St8 || reg == Reg::M8) {
+            store8(ea, _result);
+        } else if (right == Right::St16 || reg == Reg::M16) {
+            store16(ea, _result);
+        } else {
+            setReg(reg, _result);
+        }
+    }
+    
+    _prevOp = op;
+    
+#ifdef CHECK_LAZY_FLAGS
+    if (!checkLazyFlags(pc)) {
+        _error = Error::FlagsMismatch;
+        return StepResult::Error;
+    }
+#endif
+    return StepResult::Continue;
+}
+
+}
@@ -0,0 +1,156 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  History.cpp
+//  Checkpoints and input logs for reverse execution
+//
+
+#include "History.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+using namespace mc6809;
+
+void History::setInterval(uint64_t interval, uint32_t maxCheckpoints)
+{
+    _interval = interval;
+    _maxCheckpoints = std::max(maxCheckpoints, uint32_t(1));
+    clear();
+}
+
+void History::clear()
+{
+    _checkpoints.clear();
+    _end = HistoryPosition();
+    _interrupts.clear();
+    _interruptsDropped = 0;
+    _interruptsLogged = 0;
+    _inputs.clear();
+    _inputReads = 0;
+    _replayInterrupt = 0;
+    _replayRead = 0;
+    _replayInput = 0;
+}
+
+void History::addCheckpoint(const Snapshot& snapshot)
+{
+    _checkpoints.push_back({ snapshot, { snapshot.instructions, _interruptsLogged }, _inputReads });
+    _end = _checkpoints.back().position;
+
+    if (_checkpoints.size() > _maxCheckpoints) {
+        dropOldest();
+    }
+}
+
+void History::dropOldest()
+{
+    _checkpoints.pop_front();
+
+    // Nothing can be replayed from before the oldest checkpoint
+    const Checkpoint& oldest = _checkpoints.front();
+    while (_interruptsDropped < oldest.position.interrupts) {
+        _interrupts.pop_front();
+        _interruptsDropped += 1;
+    }
+    while (!_inputs.empty() && _inputs.front().read < oldest.inputReads) {
+        _inputs.pop_front();
+    }
+}
+
+void History::interrupt(uint64_t instructions, Interrupt line)
+{
+    _interrupts.push_back({ instructions, line });
+    _interruptsLogged += 1;
+}
+
+void History::input(int c)
+{
+    if (c != 0) {
+        _inputs.push_back({ _inputReads, c });
+    }
+    _inputReads += 1;
+}
+
+bool History::findCheckpoint(const HistoryPosition& position, size_t& i) const
+{
+    auto it = std::upper_bound(_checkpoints.begin(), _checkpoints.end(), position,
+                               [](const HistoryPosition& pos, const Checkpoint& cp) { return pos < cp.position; });
+    if (it == _checkpoints.begin()) {
+        return false;
+    }
+    i = size_t(it - _checkpoints.begin()) - 1;
+    return true;
+}
+
+size_t History::pages() const
+{
+    std::unordered_set<const Snapshot::Page*> pages;
+    for (const auto& it : _checkpoints) {
+        for (const auto& page : it.snapshot.pages) {
+            if (page) {
+                pages.insert(page.get());
+            }
+        }
+    }
+    return pages.size();
+}
+
+void History::startReplay(size_t i)
+{
+    const Checkpoint& checkpoint = _checkpoints[i];
+    _replayInterrupt = checkpoint.position.interrupts;
+    _replayRead = checkpoint.inputReads;
+
+    auto it = std::lower_bound(_inputs.begin(), _inputs.end(), _replayRead,
+                               [](const InputEntry& entry, uint64_t read) { return entry.read < read; });
+    _replayInput = size_t(it - _inputs.begin());
+}
+
+bool History::nextInterrupt(uint64_t& instructions, Interrupt& line) const
+{
+    uint64_t i = _replayInterrupt - _interruptsDropped;
+    if (i >= _interrupts.size()) {
+        return false;
+    }
+    instructions = _interrupts[i].instructions;
+    line = _interrupts[i].line;
+    return true;
+}
+
+int History::replayInput()
+{
+    int c = 0;
+    if (_replayInput < _inputs.size() && _inputs[_replayInput].read == _replayRead) {
+        c = _inputs[_replayInput++].c;
+    }
+    _replayRead += 1;
+    return c;
+}
+
+void History::truncate(uint64_t instructions)
+{
+    // Checkpoints past here saw a different future
+    while (!_checkpoints.empty()) {
+        const Checkpoint& newest = _checkpoints.back();
+        if (newest.position.instructions <= instructions && newest.position.interrupts <= _replayInterrupt &&
+                newest.inputReads <= _replayRead) {
+            break;
+        }
+        _checkpoints.pop_back();
+    }
+
+    _interrupts.resize(size_t(_replayInterrupt - _interruptsDropped));
+    _interruptsLogged = _replayInterrupt;
+
+    _inputs.resize(_replayInput);
+    _inputReads = _replayRead;
+
+    _end = { instructions, _interruptsLogged };
+}
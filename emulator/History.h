@@ -0,0 +1,166 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  History.h
+//  Checkpoints and input logs for reverse execution
+//
+//  A History lets the monitor go back to any point since it started
+//  recording. Every interval instructions it keeps a checkpoint, which
+//  is a Snapshot of the machine. Snapshots share the pages they don't
+//  change, so a checkpoint costs little more than the pages written
+//  since the one before it.
+//
+//  Going to a point between checkpoints means restoring the one before
+//  it and running forward again. That gives the same result as the
+//  first time, except for what came from outside: the console input
+//  the program read and the interrupts the CPU took. Those are logged
+//  as they happen and played back from the log.
+//
+//  Once there are more than the maximum number of checkpoints the
+//  oldest is dropped, along with the log entries before the next one.
+//  So memory stays bounded and the history covers the last interval
+//  times maximum instructions.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+
+#include "MC6809.h"
+#include "Snapshot.h"
+
+namespace mc6809 {
+
+static constexpr uint64_t DefaultCheckpointInterval = 100000;
+static constexpr uint32_t DefaultMaxCheckpoints = 1000;
+
+// A point in the history, after instructions were executed and
+// interrupts (counted from the start of recording) were taken. More
+// than one interrupt can be taken between two instructions
+struct HistoryPosition
+{
+    uint64_t instructions = 0;
+    uint64_t interrupts = 0;
+
+    bool operator<(const HistoryPosition& other) const
+    {
+        return instructions < other.instructions ||
+               (instructions == other.instructions && interrupts < other.interrupts);
+    }
+    bool operator==(const HistoryPosition& other) const
+    {
+        return instructions == other.instructions && interrupts == other.interrupts;
+    }
+    bool operator!=(const HistoryPosition& other) const { return !(*this == other); }
+    bool operator<=(const HistoryPosition& other) const { return !(other < *this); }
+};
+
+class History
+{
+  public:
+    struct Checkpoint
+    {
+        Snapshot snapshot;
+        HistoryPosition position;
+        uint64_t inputReads;
+    };
+
+    // Checkpoint every interval instructions and keep at most maxCheckpoints.
+    // An interval of 0 stops recording. Either one discards the history
+    void setInterval(uint64_t interval, uint32_t maxCheckpoints = DefaultMaxCheckpoints);
+    uint64_t interval() const { return _interval; }
+    uint32_t maxCheckpoints() const { return _maxCheckpoints; }
+    bool recording() const { return _interval != 0; }
+
+    void clear();
+
+    // Recording
+    //
+    // The owner adds a checkpoint when one is due and moves the end
+    // along as it runs. The Emulator logs interrupts and the owner logs
+    // every console read
+    bool checkpointDue(uint64_t instructions) const
+    {
+        return _interval && (_checkpoints.empty() || instructions - _checkpoints.back().position.instructions >= _interval);
+    }
+
+    void addCheckpoint(const Snapshot&);
+    void setEnd(uint64_t instructions) { _end = { instructions, _interruptsLogged }; }
+    void interrupt(uint64_t instructions, Interrupt line);
+    void input(int c);
+
+    // The oldest and newest points in the history
+    HistoryPosition start() const { return _checkpoints.empty() ? _end : _checkpoints.front().position; }
+    HistoryPosition end() const { return _end; }
+
+    size_t numCheckpoints() const { return _checkpoints.size(); }
+    const Checkpoint& checkpoint(size_t i) const { return _checkpoints[i]; }
+
+    // The newest checkpoint at or before position. Returns false if there isn't one
+    bool findCheckpoint(const HistoryPosition& position, size_t& i) const;
+
+    // Distinct memory pages held by the checkpoints
+    size_t pages() const;
+
+    // Replaying
+    //
+    // startReplay sets the logs back to checkpoint i. The owner restores
+    // its snapshot, then takes each interrupt when it gets to its
+    // instruction count and reads the console with replayInput()
+    void startReplay(size_t i);
+    uint64_t interruptsReplayed() const { return _replayInterrupt; }
+
+    // The next interrupt in the log. Returns false if there are no more
+    bool nextInterrupt(uint64_t& instructions, Interrupt& line) const;
+    void skipInterrupt() { _replayInterrupt += 1; }
+
+    int replayInput();
+
+    // Discard everything past the replay position, which is at
+    // instructions, so recording carries on from there
+    void truncate(uint64_t instructions);
+
+  private:
+    struct InterruptEntry
+    {
+        uint64_t instructions;
+        Interrupt line;
+    };
+
+    // Reads which returned nothing (0) aren't logged, so each entry
+    // has the number of the read it was returned by
+    struct InputEntry
+    {
+        uint64_t read;
+        int c;
+    };
+
+    void dropOldest();
+
+    uint64_t _interval = 0;
+    uint32_t _maxCheckpoints = DefaultMaxCheckpoints;
+
+    std::deque<Checkpoint> _checkpoints;
+    HistoryPosition _end;
+
+    // _interrupts[0] is interrupt number _interruptsDropped
+    std::deque<InterruptEntry> _interrupts;
+    uint64_t _interruptsDropped = 0;
+    uint64_t _interruptsLogged = 0;
+
+    std::deque<InputEntry> _inputs;
+    uint64_t _inputReads = 0;
+
+    uint64_t _replayInterrupt = 0;
+    uint64_t _replayRead = 0;
+    size_t _replayInput = 0;
+};
+
+}
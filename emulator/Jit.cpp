@@ -0,0 +1,1533 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Jit.cpp
+//  Translator from decoded 6809 blocks to x86-64 code
+//
+
+#include "Jit.h"
+
+#ifdef JIT
+
+#include <sys/mman.h>
+#include <vector>
+
+using namespace mc6809;
+
+// Host registers, numbered as they're encoded. AH and BH are the high
+// byte registers, which can only be encoded without a REX prefix. The
+// low bytes of RSP, RBP, RSI and RDI need one.
+static constexpr uint8_t RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7;
+static constexpr uint8_t R8 = 8, R12 = 12, R13 = 13, R14 = 14, R15 = 15;
+static constexpr uint8_t AH = 0x14, BH = 0x17;
+static constexpr uint8_t NoIndex = 0xff;
+
+// Where the guest registers live in translated code. A is BH and B is BL
+static constexpr uint8_t HostD = RBX;
+static constexpr uint8_t HostX = R12;
+static constexpr uint8_t HostY = R13;
+static constexpr uint8_t HostU = R14;
+static constexpr uint8_t HostS = R15;
+
+// The stack frame. FrameEA holds the effective address, so it can be put
+// back in ESI after a call. FrameBudget is the number of instructions left
+// in the quantum and FrameTemp holds a value across a call
+static constexpr int32_t FrameEA = 0;
+static constexpr int32_t FrameBudget = 8;
+static constexpr int32_t FrameTemp = 16;
+static constexpr int32_t FrameSize = 24;
+
+// Don't start a translation with less than this left in the buffer,
+// which is more than the largest block can need
+static constexpr uint32_t MaxBlockCode = 64 * 1024;
+
+enum class Size : uint8_t { Byte, Word, Dword, Qword };
+enum class Alu : uint8_t { Add = 0, Or = 1, Adc = 2, Sbb = 3, And = 4, Sub = 5, Xor = 6, Cmp = 7 };
+enum class Shift : uint8_t { Rol = 0, Ror = 1, Rcl = 2, Rcr = 3, Shl = 4, Shr = 5, Sar = 7 };
+enum class Cond : uint8_t { O = 0x0, NO = 0x1, B = 0x2, AE = 0x3, E = 0x4, NE = 0x5, BE = 0x6, A = 0x7 };
+
+// [base + index * scale + disp]
+struct Mem
+{
+    uint8_t base;
+    int32_t disp;
+    uint8_t index = NoIndex;
+    uint8_t scale = 1;
+};
+
+static bool byteNeedsRex(uint8_t reg) { return reg >= RSP && reg <= RDI; }
+static bool fitsInt8(int32_t v) { return v >= -128 && v <= 127; }
+
+// Just enough of an x86-64 assembler for the translator. Positions are
+// offsets from the start of the code buffer, so rip relative operands
+// can be resolved as they're emitted. Writes past the end of the buffer
+// are dropped and show up in overflowed().
+class Assembler
+{
+  public:
+    Assembler(uint8_t* buffer, uint32_t start, uint32_t capacity)
+        : _buffer(buffer)
+        , _size(start)
+        , _capacity(capacity)
+    { }
+
+    uint32_t pos() const { return _size; }
+    bool overflowed() const { return _size > _capacity; }
+
+    void byte(uint8_t b)
+    {
+        if (_size < _capacity) {
+            _buffer[_size] = b;
+        }
+        _size += 1;
+    }
+
+    void word(uint16_t v) { byte(v); byte(v >> 8); }
+    void dword(uint32_t v) { word(v); word(v >> 16); }
+    void qword(uint64_t v) { dword(uint32_t(v)); dword(uint32_t(v >> 32)); }
+
+    void alu(Alu op, Size size, uint8_t dst, uint8_t src) { rr(size, uint8_t(op) * 8, src, dst); }
+    void alu(Alu op, Size size, uint8_t dst, const Mem& src) { rm(size, uint8_t(op) * 8 + 2, dst, src); }
+    void alu(Alu op, Size size, const Mem& dst, uint8_t src) { rm(size, uint8_t(op) * 8, src, dst); }
+
+    void aluImm(Alu op, Size size, uint8_t dst, int32_t imm)
+    {
+        prefix(size, 0, 0, dst, size == Size::Byte && byteNeedsRex(dst));
+        opImm(size, imm);
+        byte(0xc0 | (uint8_t(op) << 3) | (dst & 7));
+        imm8or32(size, imm);
+    }
+
+    void aluImm(Alu op, Size size, const Mem& dst, int32_t imm)
+    {
+        prefix(size, 0, dst.index, dst.base, false);
+        opImm(size, imm);
+        modrm(uint8_t(op), dst);
+        imm8or32(size, imm);
+    }
+
+    void mov(Size size, uint8_t dst, uint8_t src) { rr(size, 0x88, src, dst); }
+    void mov(Size size, uint8_t dst, const Mem& src) { rm(size, 0x8a, dst, src); }
+    void mov(Size size, const Mem& dst, uint8_t src) { rm(size, 0x88, src, dst); }
+
+    void movImm(Size size, const Mem& dst, int32_t imm)
+    {
+        prefix(size, 0, dst.index, dst.base, false);
+        byte((size == Size::Byte) ? 0xc6 : 0xc7);
+        modrm(0, dst);
+        if (size == Size::Byte) {
+            byte(imm);
+        } else if (size == Size::Word) {
+            word(imm);
+        } else {
+            dword(imm);
+        }
+    }
+
+    // 32 bit immediate, zero extended to 64
+    void movImm(uint8_t dst, uint32_t imm)
+    {
+        prefix(Size::Dword, 0, 0, dst, false);
+        byte(0xb8 + (dst & 7));
+        dword(imm);
+    }
+
+    void mov64(uint8_t dst, uint64_t imm)
+    {
+        prefix(Size::Qword, 0, 0, dst, false);
+        byte(0xb8 + (dst & 7));
+        qword(imm);
+    }
+
+    // Zero and sign extend a byte or word into a 32 bit register
+    void movzx(uint8_t dst, Size size, uint8_t src) { extend(0xb6, dst, size, src); }
+    void movsx(uint8_t dst, Size size, uint8_t src) { extend(0xbe, dst, size, src); }
+
+    void movzx(uint8_t dst, Size size, const Mem& src)
+    {
+        prefix(Size::Dword, dst, src.index, src.base, false);
+        byte(0x0f);
+        byte((size == Size::Byte) ? 0xb6 : 0xb7);
+        modrm(dst, src);
+    }
+
+    void lea(Size size, uint8_t dst, const Mem& src)
+    {
+        prefix(size, dst, src.index, src.base, false);
+        byte(0x8d);
+        modrm(dst, src);
+    }
+
+    // lea dst, [rip + target]
+    void leaRip(uint8_t dst, uint32_t target)
+    {
+        prefix(Size::Qword, dst, 0, 0, false);
+        byte(0x8d);
+        byte(0x05 | ((dst & 7) << 3));
+        dword(target - (_size + 4));
+    }
+
+    void test(Size size, uint8_t a, uint8_t b) { rr(size, 0x84, b, a); }
+
+    void testImm(Size size, uint8_t reg, int32_t imm)
+    {
+        prefix(size, 0, 0, reg, size == Size::Byte && byteNeedsRex(reg));
+        byte((size == Size::Byte) ? 0xf6 : 0xf7);
+        byte(0xc0 | (reg & 7));
+        immediate(size, imm);
+    }
+
+    void shift(Shift op, Size size, uint8_t reg, uint8_t count)
+    {
+        prefix(size, 0, 0, reg, size == Size::Byte && byteNeedsRex(reg));
+
+        // The 1 bit forms are the ones with OF defined
+        if (count == 1) {
+            byte((size == Size::Byte) ? 0xd0 : 0xd1);
+            byte(0xc0 | (uint8_t(op) << 3) | (reg & 7));
+        } else {
+            byte((size == Size::Byte) ? 0xc0 : 0xc1);
+            byte(0xc0 | (uint8_t(op) << 3) | (reg & 7));
+            byte(count);
+        }
+    }
+
+    void neg(Size size, uint8_t reg) { unary(3, size, reg); }
+    void bitNot(Size size, uint8_t reg) { unary(2, size, reg); }
+
+    void imul(uint8_t dst, uint8_t src)
+    {
+        prefix(Size::Dword, dst, 0, src, false);
+        byte(0x0f);
+        byte(0xaf);
+        byte(0xc0 | ((dst & 7) << 3) | (src & 7));
+    }
+
+    void setcc(Cond cond, uint8_t reg)
+    {
+        prefix(Size::Byte, 0, 0, reg, byteNeedsRex(reg));
+        byte(0x0f);
+        byte(0x90 + uint8_t(cond));
+        byte(0xc0 | (reg & 7));
+    }
+
+    void lahf() { byte(0x9f); }
+    void ret() { byte(0xc3); }
+
+    void push(uint8_t reg)
+    {
+        if (reg & 8) {
+            byte(0x41);
+        }
+        byte(0x50 + (reg & 7));
+    }
+
+    void pop(uint8_t reg)
+    {
+        if (reg & 8) {
+            byte(0x41);
+        }
+        byte(0x58 + (reg & 7));
+    }
+
+    void call(uint8_t reg)
+    {
+        prefix(Size::Dword, 0, 0, reg, false);
+        byte(0xff);
+        byte(0xd0 | (reg & 7));
+    }
+
+    // Forward jumps return the position of their displacement, for bind()
+    uint32_t jcc(Cond cond)
+    {
+        byte(0x0f);
+        byte(0x80 + uint8_t(cond));
+        dword(0);
+        return _size - 4;
+    }
+
+    uint32_t jmp()
+    {
+        byte(0xe9);
+        dword(0);
+        return _size - 4;
+    }
+
+    void jcc(Cond cond, uint32_t target)
+    {
+        byte(0x0f);
+        byte(0x80 + uint8_t(cond));
+        dword(target - (_size + 4));
+    }
+
+    void jmp(uint32_t target)
+    {
+        byte(0xe9);
+        dword(target - (_size + 4));
+    }
+
+    // Point the forward jump at fixup here
+    void bind(uint32_t fixup)
+    {
+        uint32_t rel = _size - (fixup + 4);
+        if (fixup + 4 <= _capacity) {
+            memcpy(_buffer + fixup, &rel, 4);
+        }
+    }
+
+  private:
+    void prefix(Size size, uint8_t reg, uint8_t index, uint8_t base, bool forceRex)
+    {
+        if (size == Size::Word) {
+            byte(0x66);
+        }
+
+        uint8_t rex = 0x40 | ((size == Size::Qword) ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) |
+                      ((index != NoIndex && (index & 8)) ? 0x02 : 0) | ((base & 8) ? 0x01 : 0);
+        if (rex != 0x40 || forceRex) {
+            byte(rex);
+        }
+    }
+
+    void modrm(uint8_t reg, const Mem& m)
+    {
+        // RBP and R13 bases always have a displacement, since there's no
+        // mod 0 form for them. RSP and R12 bases need a SIB byte
+        bool sib = m.index != NoIndex || (m.base & 7) == RSP;
+        uint8_t mod = fitsInt8(m.disp) ? 0x40 : 0x80;
+        byte(mod | ((reg & 7) << 3) | (sib ? 4 : (m.base & 7)));
+        if (sib) {
+            uint8_t ss = (m.scale == 8) ? 3 : ((m.scale == 4) ? 2 : ((m.scale == 2) ? 1 : 0));
+            uint8_t index = (m.index == NoIndex) ? RSP : (m.index & 7);
+            byte((ss << 6) | (index << 3) | (m.base & 7));
+        }
+        if (mod == 0x40) {
+            byte(m.disp);
+        } else {
+            dword(m.disp);
+        }
+    }
+
+    // Register to register, reg is the ModRM reg field
+    void rr(Size size, uint8_t opcode, uint8_t reg, uint8_t rm)
+    {
+        bool lowBytes = size == Size::Byte && (byteNeedsRex(reg) || byteNeedsRex(rm));
+        prefix(size, reg, 0, rm, lowBytes);
+        byte((size == Size::Byte) ? opcode : opcode + 1);
+        byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    void rm(Size size, uint8_t opcode, uint8_t reg, const Mem& m)
+    {
+        prefix(size, reg, m.index, m.base, size == Size::Byte && byteNeedsRex(reg));
+        byte((size == Size::Byte) ? opcode : opcode + 1);
+        modrm(reg, m);
+    }
+
+    void extend(uint8_t opcode, uint8_t dst, Size size, uint8_t src)
+    {
+        prefix(Size::Dword, dst, 0, src, size == Size::Byte && byteNeedsRex(src));
+        byte(0x0f);
+        byte((size == Size::Byte) ? opcode : opcode + 1);
+        byte(0xc0 | ((dst & 7) << 3) | (src & 7));
+    }
+
+    void unary(uint8_t ext, Size size, uint8_t reg)
+    {
+        prefix(size, 0, 0, reg, size == Size::Byte && byteNeedsRex(reg));
+        byte((size == Size::Byte) ? 0xf6 : 0xf7);
+        byte(0xc0 | (ext << 3) | (reg & 7));
+    }
+
+    void opImm(Size size, int32_t imm)
+    {
+        byte((size == Size::Byte) ? 0x80 : (fitsInt8(imm) ? 0x83 : 0x81));
+    }
+
+    void imm8or32(Size size, int32_t imm)
+    {
+        if (size == Size::Byte || fitsInt8(imm)) {
+            byte(imm);
+        } else {
+            immediate(size, imm);
+        }
+    }
+
+    void immediate(Size size, int32_t v)
+    {
+        if (size == Size::Byte) {
+            byte(v);
+        } else if (size == Size::Word) {
+            word(v);
+        } else {
+            dword(v);
+        }
+    }
+
+    uint8_t* _buffer;
+    uint32_t _size;
+    uint32_t _capacity;
+};
+
+// Offsets from the Emulator pointer of the members translated code uses
+struct Fields
+{
+    int32_t d, x, y, u, s, pc, dp, cc;
+    int32_t left, right, result, prevOp;
+    int32_t cycles, instructions, quantumEnd;
+    int32_t readPage, writePage, codePages;
+    int32_t blockInvalidated, pendingInterrupts;
+    int32_t subroutineDepth, lastRunState;
+};
+
+// Where translated code goes when it leaves the block. Unless pcStored
+// it sets _pc to pc. Then it counts count instructions and their cycles
+// and sets _prevOp to op if count is nonzero.
+struct Exit
+{
+    uint32_t fixup;
+    uint16_t pc;
+    bool pcStored;
+    uint8_t count;
+    uint32_t cycles;
+    Op op;
+};
+
+static bool isBranch(Op op)
+{
+    switch (op) {
+        default:
+            return false;
+        case Op::BCC: case Op::BCS: case Op::BEQ: case Op::BGE: case Op::BGT:
+        case Op::BHI: case Op::BHS: case Op::BLE: case Op::BLO: case Op::BLS:
+        case Op::BLT: case Op::BMI: case Op::BNE: case Op::BPL: case Op::BVC:
+        case Op::BVS:
+            return true;
+    }
+}
+
+// Registers TFR and EXG can name which the translator handles
+static bool simpleReg(uint8_t r)
+{
+    switch (Reg(r)) {
+        default:
+            return false;
+        case Reg::D: case Reg::X: case Reg::Y: case Reg::U: case Reg::S:
+        case Reg::A: case Reg::B: case Reg::CC: case Reg::DP:
+            return true;
+    }
+}
+
+static bool knownIndexedMode(uint8_t postbyte)
+{
+#ifdef HD6309
+    if (wIndexed(postbyte)) {
+        return false;
+    }
+#endif
+    if ((postbyte & 0x80) == 0) {
+        return true;
+    }
+    switch (IdxMode(postbyte & IdxModeMask)) {
+        default:
+            return false;
+        case IdxMode::ConstRegNoOff: case IdxMode::ConstReg8Off: case IdxMode::ConstReg16Off:
+        case IdxMode::AccAOffReg: case IdxMode::AccBOffReg: case IdxMode::AccDOffReg:
+        case IdxMode::Inc1Reg: case IdxMode::Inc2Reg: case IdxMode::Dec1Reg: case IdxMode::Dec2Reg:
+        case IdxMode::ConstPC8Off: case IdxMode::ConstPC16Off: case IdxMode::Extended:
+            return true;
+    }
+}
+
+// JMP and JSR to the system area are system calls, which only the
+// interpreter can make. So a computed address is checked before the
+// jump, and it needs to be computed without side effects so the
+// interpreter can do the instruction over
+static bool pureIndexedMode(uint8_t postbyte)
+{
+    if ((postbyte & 0x80) == 0) {
+        return true;
+    }
+    if (postbyte & IndexedIndMask) {
+        return false;
+    }
+    switch (IdxMode(postbyte & IdxModeMask)) {
+        default:
+            return true;
+        case IdxMode::Inc1Reg: case IdxMode::Inc2Reg: case IdxMode::Dec1Reg: case IdxMode::Dec2Reg:
+            return false;
+    }
+}
+
+static bool translatable(const DecodedInst& inst)
+{
+    switch (inst.reg) {
+        default:
+            return false;
+        case Reg::D: case Reg::X: case Reg::Y: case Reg::U: case Reg::S:
+        case Reg::A: case Reg::B: case Reg::M8: case Reg::M16: case Reg::None:
+            break;
+    }
+
+    if (inst.adr == Adr::Indexed && !knownIndexedMode(inst.postbyte)) {
+        return false;
+    }
+
+    if (isBranch(inst.op)) {
+        return true;
+    }
+
+    switch (inst.op) {
+        default:
+            return false;
+        case Op::JMP:
+        case Op::JSR:
+            if (inst.adr == Adr::Extended) {
+                return inst.operand < SystemAddrStart;
+            }
+            return inst.adr == Adr::Direct || (inst.adr == Adr::Indexed && pureIndexedMode(inst.postbyte));
+        case Op::TFR:
+        case Op::EXG:
+            return simpleReg(inst.operand & 0x0f) && simpleReg(inst.operand >> 4);
+        case Op::NOP: case Op::BRN: case Op::BRA: case Op::BSR: case Op::RTS:
+        case Op::ABX: case Op::ADC: case Op::ADD8: case Op::ADD16: case Op::AND:
+        case Op::ANDCC: case Op::ASL: case Op::ASR: case Op::BIT: case Op::CLR:
+        case Op::CMP8: case Op::CMP16: case Op::COM: case Op::DEC: case Op::EOR:
+        case Op::INC: case Op::LD8: case Op::LD16: case Op::LEA: case Op::LSR:
+        case Op::MUL: case Op::NEG: case Op::OR: case Op::ORCC: case Op::PSH:
+        case Op::PUL: case Op::ROL: case Op::ROR: case Op::SBC: case Op::SEX:
+        case Op::ST8: case Op::ST16: case Op::SUB8: case Op::SUB16: case Op::TST:
+            return true;
+    }
+}
+
+// True if the instruction can write memory
+static bool stores(const DecodedInst& inst)
+{
+    switch (inst.op) {
+        default:
+            return inst.right == Right::St8 || inst.right == Right::St16 ||
+                   ((inst.left == Left::St || inst.left == Left::LdSt) &&
+                    (inst.reg == Reg::M8 || inst.reg == Reg::M16));
+        case Op::PSH:
+        case Op::BSR:
+        case Op::JSR:
+            return true;
+    }
+}
+
+// Translates one block. Instruction i of the block is emitted as
+// exec() would run it, with the effective address in ESI, _left in
+// EDI, _right in ECX and _result in R8D. EAX, ECX and EDX are scratch.
+class Translator
+{
+  public:
+    Translator(Assembler& a, const Fields& f, const DecodedBlock& block, uint32_t flagTable,
+               uint64_t load8, uint64_t load16, uint64_t store8, uint64_t store16)
+        : _a(a)
+        , _f(f)
+        , _block(block)
+        , _flagTable(flagTable)
+        , _load8(load8)
+        , _load16(load16)
+        , _store8(store8)
+        , _store16(store16)
+    { }
+
+    // Returns how many instructions were translated
+    uint8_t translate()
+    {
+        uint8_t count = 0;
+        while (count < _block.count && translatable(_block.insts[count])) {
+            count += 1;
+        }
+        if (count == 0) {
+            return 0;
+        }
+
+        _a.push(RBX);
+        _a.push(RBP);
+        _a.push(R12);
+        _a.push(R13);
+        _a.push(R14);
+        _a.push(R15);
+        _a.aluImm(Alu::Sub, Size::Qword, RSP, FrameSize);
+        _a.mov(Size::Qword, RBP, RDI);
+
+        _a.movzx(HostD, Size::Word, field(_f.d));
+        _a.movzx(HostX, Size::Word, field(_f.x));
+        _a.movzx(HostY, Size::Word, field(_f.y));
+        _a.movzx(HostU, Size::Word, field(_f.u));
+        _a.movzx(HostS, Size::Word, field(_f.s));
+
+        _a.mov(Size::Qword, RAX, field(_f.quantumEnd));
+        _a.alu(Alu::Sub, Size::Qword, RAX, field(_f.instructions));
+        _a.mov(Size::Qword, Mem { RSP, FrameBudget }, RAX);
+
+        // Each pass needs room in the quantum for the whole block. That
+        // way the count can only run out at the end of a pass
+        _top = _a.pos();
+        _a.aluImm(Alu::Cmp, Size::Qword, Mem { RSP, FrameBudget }, count);
+        _exits.push_back(Exit { _a.jcc(Cond::B), _block.pc, false, 0, 0, Op::NOP });
+
+        uint16_t pc = _block.pc;
+        uint32_t cycles = 0;
+        for (uint8_t i = 0; i < count; ++i) {
+            const DecodedInst& inst = _block.insts[i];
+            _pc = pc;
+            _nextPC = pc + inst.size;
+            _cyclesBefore = cycles;
+#ifdef COMPUTE_CYCLES
+            cycles += inst.cycles;
+#endif
+            _cycles = cycles;
+            _index = i;
+
+            if (!instruction(inst)) {
+                // It never falls through
+                count = i + 1;
+                break;
+            }
+            pc = _nextPC;
+
+            if (i == count - 1) {
+                exit(pc, i + 1, cycles, inst.op);
+            }
+        }
+
+        // The exits and the epilogue
+        for (const Exit& e : _exits) {
+            _a.bind(e.fixup);
+            if (!e.pcStored) {
+                _a.movImm(Size::Word, field(_f.pc), e.pc);
+            }
+            if (e.count) {
+                _a.aluImm(Alu::Add, Size::Qword, field(_f.instructions), e.count);
+#ifdef COMPUTE_CYCLES
+                _a.aluImm(Alu::Add, Size::Qword, field(_f.cycles), int32_t(e.cycles));
+#endif
+                _a.movImm(Size::Byte, field(_f.prevOp), int32_t(e.op));
+            }
+            _epilogueJumps.push_back(_a.jmp());
+        }
+
+        for (uint32_t fixup : _epilogueJumps) {
+            _a.bind(fixup);
+        }
+        _a.mov(Size::Word, field(_f.d), HostD);
+        _a.mov(Size::Word, field(_f.x), HostX);
+        _a.mov(Size::Word, field(_f.y), HostY);
+        _a.mov(Size::Word, field(_f.u), HostU);
+        _a.mov(Size::Word, field(_f.s), HostS);
+        _a.aluImm(Alu::Add, Size::Qword, RSP, FrameSize);
+        _a.pop(R15);
+        _a.pop(R14);
+        _a.pop(R13);
+        _a.pop(R12);
+        _a.pop(RBP);
+        _a.pop(RBX);
+        _a.ret();
+        return count;
+    }
+
+  private:
+    Mem field(int32_t offset) const { return Mem { RBP, offset }; }
+
+    // Leave the block after count instructions, with pc in _pc
+    void exit(uint16_t pc, uint8_t count, uint32_t cycles, Op op)
+    {
+        _exits.push_back(Exit { _a.jmp(), pc, false, count, cycles, op });
+    }
+
+    void exitIf(Cond cond, uint16_t pc, uint8_t count, uint32_t cycles, Op op)
+    {
+        _exits.push_back(Exit { _a.jcc(cond), pc, false, count, cycles, op });
+    }
+
+    // Leave the block before the current instruction, so the
+    // interpreter does it
+    void exitBeforeIf(Cond cond)
+    {
+        _exits.push_back(Exit { _a.jcc(cond), _pc, false, _index, _cyclesBefore,
+                                (_index == 0) ? Op::NOP : _block.insts[_index - 1].op });
+    }
+
+    // Go to target after the current instruction. A jump to the start
+    // of the block loops without leaving translated code
+    void jumpTo(uint16_t target, const DecodedInst& inst, uint32_t cycles)
+    {
+        uint8_t count = _index + 1;
+        if (target != _block.pc) {
+            exit(target, count, cycles, inst.op);
+            return;
+        }
+
+        if (stores(inst)) {
+            _a.aluImm(Alu::Cmp, Size::Byte, field(_f.blockInvalidated), 0);
+            exitIf(Cond::NE, target, count, cycles, inst.op);
+        }
+
+        _a.aluImm(Alu::Add, Size::Qword, field(_f.instructions), count);
+#ifdef COMPUTE_CYCLES
+        _a.aluImm(Alu::Add, Size::Qword, field(_f.cycles), int32_t(cycles));
+#endif
+        _a.movImm(Size::Byte, field(_f.prevOp), int32_t(inst.op));
+        _a.aluImm(Alu::Sub, Size::Qword, Mem { RSP, FrameBudget }, count);
+
+        // The interpreter takes interrupts at the start of a block
+        _a.aluImm(Alu::Cmp, Size::Byte, field(_f.pendingInterrupts), 0);
+        exitIf(Cond::NE, target, 0, 0, inst.op);
+        _a.jmp(_top);
+    }
+
+    void saveEA() { _a.mov(Size::Dword, Mem { RSP, FrameEA }, RSI); }
+
+    // Call a helper with the Emulator and ESI, and EDX for a store
+    void callHelper(uint64_t helper)
+    {
+        _a.mov(Size::Qword, RDI, RBP);
+        _a.mov64(RAX, helper);
+        _a.call(RAX);
+        _a.mov(Size::Dword, RSI, Mem { RSP, FrameEA });
+    }
+
+    // Load from ESI into EAX. Clobbers ECX and EDX, and everything
+    // a call does if it's not plain memory
+    void load(bool word)
+    {
+        _a.mov(Size::Dword, RAX, RSI);
+        _a.shift(Shift::Shr, Size::Dword, RAX, 8);
+        _a.mov(Size::Qword, RAX, Mem { RBP, _f.readPage, RAX, 8 });
+        _a.test(Size::Qword, RAX, RAX);
+        uint32_t slow = _a.jcc(Cond::E);
+        uint32_t slowWord = 0;
+        if (word) {
+            _a.aluImm(Alu::Cmp, Size::Byte, RSI, 0xff);
+            slowWord = _a.jcc(Cond::E);
+        }
+        _a.movzx(RDX, Size::Byte, RSI);
+        _a.movzx(RAX, word ? Size::Word : Size::Byte, Mem { RAX, 0, RDX, 1 });
+        if (word) {
+            _a.shift(Shift::Rol, Size::Word, RAX, 8);
+        }
+        uint32_t done = _a.jmp();
+
+        _a.bind(slow);
+        if (word) {
+            _a.bind(slowWord);
+        }
+        callHelper(word ? _load16 : _load8);
+        _a.bind(done);
+    }
+
+    // Store EAX at ESI, the same way
+    void store(bool word)
+    {
+        _a.mov(Size::Dword, RCX, RSI);
+        _a.shift(Shift::Shr, Size::Dword, RCX, 8);
+        _a.aluImm(Alu::Cmp, Size::Byte, Mem { RBP, _f.codePages, RCX, 1 }, 0);
+        uint32_t slowCode = _a.jcc(Cond::NE);
+        _a.mov(Size::Qword, RCX, Mem { RBP, _f.writePage, RCX, 8 });
+        _a.test(Size::Qword, RCX, RCX);
+        uint32_t slow = _a.jcc(Cond::E);
+        uint32_t slowWord = 0;
+        if (word) {
+            _a.aluImm(Alu::Cmp, Size::Byte, RSI, 0xff);
+            slowWord = _a.jcc(Cond::E);
+        }
+        _a.movzx(RDX, Size::Byte, RSI);
+        if (word) {
+            _a.alu(Alu::Add, Size::Qword, RCX, RDX);
+            _a.mov(Size::Dword, RDX, RAX);
+            _a.shift(Shift::Rol, Size::Word, RDX, 8);
+            _a.mov(Size::Word, Mem { RCX, 0 }, RDX);
+        } else {
+            _a.mov(Size::Byte, Mem { RCX, 0, RDX, 1 }, RAX);
+        }
+        uint32_t done = _a.jmp();
+
+        _a.bind(slowCode);
+        _a.bind(slow);
+        if (word) {
+            _a.bind(slowWord);
+        }
+        _a.mov(Size::Dword, RDX, RAX);
+        callHelper(word ? _store16 : _store8);
+        _a.bind(done);
+    }
+
+    static uint8_t hostReg(Reg reg)
+    {
+        switch (reg) {
+            default:        return HostD;
+            case Reg::X:    return HostX;
+            case Reg::Y:    return HostY;
+            case Reg::U:    return HostU;
+            case Reg::S:    return HostS;
+        }
+    }
+
+    // getReg() into EAX
+    void getReg(Reg reg)
+    {
+        switch (reg) {
+            default:        _a.alu(Alu::Xor, Size::Dword, RAX, RAX); break;
+            case Reg::A:    _a.movzx(RAX, Size::Byte, BH); break;
+            case Reg::B:    _a.movzx(RAX, Size::Byte, RBX); break;
+            case Reg::CC:   _a.movzx(RAX, Size::Byte, field(_f.cc)); break;
+            case Reg::DP:   _a.movzx(RAX, Size::Byte, field(_f.dp)); break;
+            case Reg::D:
+            case Reg::X:
+            case Reg::Y:
+            case Reg::U:
+            case Reg::S:    _a.movzx(RAX, Size::Word, hostReg(reg)); break;
+        }
+    }
+
+    // setReg() from EAX
+    void setReg(Reg reg)
+    {
+        switch (reg) {
+            default:        break;
+            case Reg::A:    _a.mov(Size::Byte, BH, RAX); break;
+            case Reg::B:    _a.mov(Size::Byte, RBX, RAX); break;
+            case Reg::CC:   _a.mov(Size::Byte, field(_f.cc), RAX); break;
+            case Reg::DP:   _a.mov(Size::Byte, field(_f.dp), RAX); break;
+            case Reg::D:
+            case Reg::X:
+            case Reg::Y:
+            case Reg::U:
+            case Reg::S:    _a.movzx(hostReg(reg), Size::Word, RAX); break;
+        }
+    }
+
+    // Stack accesses through the 16 bit stack pointer in reg
+    void push8(uint8_t stack)
+    {
+        _a.aluImm(Alu::Sub, Size::Word, stack, 1);
+        _a.movzx(RSI, Size::Word, stack);
+        saveEA();
+        store(false);
+    }
+
+    void pop8(uint8_t stack)
+    {
+        _a.movzx(RSI, Size::Word, stack);
+        _a.aluImm(Alu::Add, Size::Word, stack, 1);
+        saveEA();
+        load(false);
+    }
+
+    // Push the 16 bit value getReg(reg) gives, or value if reg is PC
+    void push16(uint8_t stack, Reg reg, uint16_t value = 0)
+    {
+        for (uint8_t shift = 0; shift <= 8; shift += 8) {
+            if (reg == Reg::PC) {
+                _a.movImm(RAX, uint32_t(value >> shift));
+            } else {
+                getReg(reg);
+                if (shift) {
+                    _a.shift(Shift::Shr, Size::Dword, RAX, shift);
+                }
+            }
+            push8(stack);
+        }
+    }
+
+    // Pop 16 bits into EAX
+    void pop16(uint8_t stack)
+    {
+        pop8(stack);
+        _a.mov(Size::Dword, Mem { RSP, FrameTemp }, RAX);
+        pop8(stack);
+        _a.mov(Size::Dword, RCX, Mem { RSP, FrameTemp });
+        _a.shift(Shift::Shl, Size::Dword, RCX, 8);
+        _a.alu(Alu::Or, Size::Dword, RAX, RCX);
+    }
+
+    // Put the 6809 flags in mask, from the host flags, in ECX. The host
+    // flags must come from an op of the same size as the 6809 one. Clobbers
+    // EAX and EDX
+    void hostFlags(uint8_t mask)
+    {
+        _a.lahf();
+        if (mask & FlagV) {
+            _a.setcc(Cond::O, RAX);
+        }
+        _a.movzx(RCX, Size::Byte, AH);
+        _a.leaRip(RDX, _flagTable);
+        _a.movzx(RCX, Size::Byte, Mem { RDX, 0, RCX, 1 });
+        if (mask & FlagV) {
+            _a.movzx(RAX, Size::Byte, RAX);
+            _a.alu(Alu::Add, Size::Dword, RAX, RAX);
+            _a.alu(Alu::Or, Size::Dword, RCX, RAX);
+        }
+        _a.aluImm(Alu::And, Size::Dword, RCX, mask);
+    }
+
+    // _ccByte = (_ccByte & ~(mask | zeros | ones)) | ECX | ones, where
+    // ECX has only bits in mask, or bits the op sets but never clears
+    void mergeFlags(uint8_t mask, uint8_t zeros = 0, uint8_t ones = 0, bool haveBits = true)
+    {
+        _a.movzx(RAX, Size::Byte, field(_f.cc));
+        _a.aluImm(Alu::And, Size::Dword, RAX, uint8_t(~(mask | zeros | ones)));
+        if (haveBits) {
+            _a.alu(Alu::Or, Size::Dword, RAX, RCX);
+        }
+        if (ones) {
+            _a.aluImm(Alu::Or, Size::Dword, RAX, ones);
+        }
+        _a.mov(Size::Byte, field(_f.cc), RAX);
+    }
+
+    void setFlags(uint8_t mask, uint8_t zeros = 0, uint8_t ones = 0)
+    {
+        hostFlags(mask);
+        mergeFlags(mask, zeros, ones);
+    }
+
+    void storeResult() { _a.mov(Size::Dword, field(_f.result), R8); }
+
+    // Effective address into ESI, the same as exec()
+    void indexed(const DecodedInst& inst)
+    {
+        uint8_t postbyte = inst.postbyte;
+        uint8_t reg = HostX;
+        switch (RR(postbyte & 0b01100000)) {
+            case RR::X: reg = HostX; break;
+            case RR::Y: reg = HostY; break;
+            case RR::U: reg = HostU; break;
+            case RR::S: reg = HostS; break;
+        }
+
+        int32_t offset = int16_t(inst.operand);
+        if ((postbyte & 0x80) == 0) {
+            _a.lea(Size::Dword, RSI, Mem { reg, offset });
+            _a.movzx(RSI, Size::Word, RSI);
+            return;
+        }
+
+        switch (IdxMode(postbyte & IdxModeMask)) {
+            default:
+                break;
+            case IdxMode::ConstRegNoOff:
+                _a.movzx(RSI, Size::Word, reg);
+                break;
+            case IdxMode::ConstReg8Off:
+            case IdxMode::ConstReg16Off:
+                _a.lea(Size::Dword, RSI, Mem { reg, offset });
+                _a.movzx(RSI, Size::Word, RSI);
+                break;
+            case IdxMode::AccAOffReg:
+            case IdxMode::AccBOffReg:
+            case IdxMode::AccDOffReg:
+                if (IdxMode(postbyte & IdxModeMask) == IdxMode::AccAOffReg) {
+                    _a.movsx(RAX, Size::Byte, BH);
+                } else if (IdxMode(postbyte & IdxModeMask) == IdxMode::AccBOffReg) {
+                    _a.movsx(RAX, Size::Byte, RBX);
+                } else {
+                    _a.movsx(RAX, Size::Word, RBX);
+                }
+                _a.lea(Size::Dword, RSI, Mem { reg, 0, RAX, 1 });
+                _a.movzx(RSI, Size::Word, RSI);
+                break;
+            case IdxMode::Inc1Reg:
+            case IdxMode::Inc2Reg:
+                _a.movzx(RSI, Size::Word, reg);
+                _a.aluImm(Alu::Add, Size::Word, reg, (IdxMode(postbyte & IdxModeMask) == IdxMode::Inc1Reg) ? 1 : 2);
+                break;
+            case IdxMode::Dec1Reg:
+            case IdxMode::Dec2Reg:
+                _a.aluImm(Alu::Sub, Size::Word, reg, (IdxMode(postbyte & IdxModeMask) == IdxMode::Dec1Reg) ? 1 : 2);
+                _a.movzx(RSI, Size::Word, reg);
+                break;
+            case IdxMode::ConstPC8Off:
+            case IdxMode::ConstPC16Off:
+            case IdxMode::Extended:
+                _a.movImm(RSI, uint32_t(inst.operand));
+                break;
+        }
+
+        if (postbyte & IndexedIndMask) {
+            saveEA();
+            load(true);
+            _a.mov(Size::Dword, RSI, RAX);
+        }
+    }
+
+    // Branch to the exit or loop if the 6809 condition for op is true
+    void branch(const DecodedInst& inst)
+    {
+        uint16_t target = _nextPC + int16_t(inst.operand);
+#ifdef COMPUTE_CYCLES
+        uint32_t takenCycles = _cycles + ((inst.adr == Adr::RelL) ? 1 : 0);
+#else
+        uint32_t takenCycles = _cycles;
+#endif
+
+        // Test the flags so NE means the branch is taken
+        _a.movzx(RAX, Size::Byte, field(_f.cc));
+        bool invert = false;
+        switch (inst.op) {
+            default:
+                break;
+            case Op::BCC: case Op::BHS: invert = true; // Fall through
+            case Op::BCS: case Op::BLO: _a.testImm(Size::Byte, RAX, FlagC); break;
+            case Op::BNE: invert = true;                // Fall through
+            case Op::BEQ: _a.testImm(Size::Byte, RAX, FlagZ); break;
+            case Op::BPL: invert = true;                // Fall through
+            case Op::BMI: _a.testImm(Size::Byte, RAX, FlagN); break;
+            case Op::BVC: invert = true;                // Fall through
+            case Op::BVS: _a.testImm(Size::Byte, RAX, FlagV); break;
+            case Op::BHI: invert = true;                // Fall through
+            case Op::BLS: _a.testImm(Size::Byte, RAX, FlagC | FlagZ); break;
+            case Op::BGE: invert = true;                // Fall through
+            case Op::BLT:
+                // N is 2 bits above V
+                _a.mov(Size::Dword, RCX, RAX);
+                _a.shift(Shift::Shr, Size::Dword, RCX, 2);
+                _a.alu(Alu::Xor, Size::Dword, RCX, RAX);
+                _a.testImm(Size::Byte, RCX, FlagV);
+                break;
+            case Op::BGT: invert = true;                // Fall through
+            case Op::BLE:
+                _a.mov(Size::Dword, RCX, RAX);
+                _a.shift(Shift::Shr, Size::Dword, RCX, 2);
+                _a.alu(Alu::Xor, Size::Dword, RCX, RAX);
+                _a.aluImm(Alu::And, Size::Dword, RCX, FlagV);
+                _a.aluImm(Alu::And, Size::Dword, RAX, FlagZ);
+                _a.alu(Alu::Or, Size::Dword, RCX, RAX);
+                break;
+        }
+
+        uint32_t notTaken = _a.jcc(invert ? Cond::NE : Cond::E);
+        jumpTo(target, inst, takenCycles);
+        _a.bind(notTaken);
+    }
+
+    // Emit one instruction. Returns false if it never falls through
+    bool instruction(const DecodedInst& inst)
+    {
+        Op op = inst.op;
+        Reg reg = inst.reg;
+        Adr adr = inst.adr;
+        Left left = inst.left;
+        Right right = inst.right;
+
+        bool haveEA = true;
+        if (adr == Adr::Direct) {
+            _a.movzx(RSI, Size::Byte, field(_f.dp));
+            _a.shift(Shift::Shl, Size::Dword, RSI, 8);
+            _a.aluImm(Alu::Or, Size::Dword, RSI, inst.operand & 0xff);
+        } else if (adr == Adr::Extended) {
+            _a.movImm(RSI, uint32_t(inst.operand));
+        } else if (adr == Adr::Indexed) {
+            indexed(inst);
+        } else {
+            haveEA = false;
+        }
+        if (haveEA) {
+            saveEA();
+        }
+
+        // _right. Only one of the operands can come from memory, so
+        // doing the load first keeps it from clobbering the other
+        uint32_t rightValue = 0;
+        bool rightConst = false;
+        if (adr == Adr::Immed8 || adr == Adr::Immed16) {
+            rightValue = inst.operand;
+            rightConst = true;
+        } else if (adr == Adr::Rel || adr == Adr::RelL || adr == Adr::RelP) {
+            rightValue = uint32_t(int32_t(int16_t(inst.operand)));
+            rightConst = true;
+        }
+        if (rightConst) {
+            _a.movImm(Size::Dword, field(_f.right), int32_t(rightValue));
+        }
+        if (right == Right::Ld8 || right == Right::Ld16) {
+            load(right == Right::Ld16);
+            _a.mov(Size::Dword, field(_f.right), RAX);
+            _a.mov(Size::Dword, RCX, RAX);
+        }
+
+        if (left == Left::Ld || left == Left::LdSt) {
+            if (reg == Reg::M8 || reg == Reg::M16) {
+                load(reg == Reg::M16);
+            } else {
+                getReg(reg);
+            }
+            _a.mov(Size::Dword, field(_f.left), RAX);
+            _a.mov(Size::Dword, RDI, RAX);
+        }
+
+        if (rightConst) {
+            _a.movImm(RCX, rightValue);
+        }
+
+        if (isBranch(op)) {
+            branch(inst);
+            return true;
+        }
+
+        Size size = (op == Op::ADD16 || op == Op::SUB16 || op == Op::CMP16 ||
+                     op == Op::LD16 || op == Op::ST16) ? Size::Word : Size::Byte;
+
+        switch (op) {
+            default:
+                break;
+            case Op::NOP:
+            case Op::BRN:
+                break;
+            case Op::BRA:
+                jumpTo(_nextPC + int16_t(inst.operand), inst, _cycles);
+                return false;
+            case Op::BSR:
+                push16(HostS, Reg::PC, _nextPC);
+                _a.aluImm(Alu::Add, Size::Dword, field(_f.subroutineDepth), 1);
+                jumpTo(_nextPC + int16_t(inst.operand), inst, _cycles);
+                return false;
+            case Op::JMP:
+            case Op::JSR:
+                if (adr != Adr::Extended) {
+                    _a.aluImm(Alu::Cmp, Size::Dword, RSI, SystemAddrStart);
+                    exitBeforeIf(Cond::AE);
+                    _a.mov(Size::Dword, Mem { RSP, FrameTemp }, RSI);
+                }
+                if (op == Op::JSR) {
+                    push16(HostS, Reg::PC, _nextPC);
+                    _a.aluImm(Alu::Add, Size::Dword, field(_f.subroutineDepth), 1);
+                }
+                if (adr == Adr::Extended) {
+                    jumpTo(inst.operand, inst, _cycles);
+                } else {
+                    _a.mov(Size::Dword, RAX, Mem { RSP, FrameTemp });
+                    _a.mov(Size::Word, field(_f.pc), RAX);
+                    _exits.push_back(Exit { _a.jmp(), 0, true, uint8_t(_index + 1), _cycles, op });
+                }
+                return false;
+            case Op::RTS:
+                // Stepping over or out of a subroutine stops at its return,
+                // which the interpreter does
+                _a.aluImm(Alu::Cmp, Size::Dword, field(_f.lastRunState), int32_t(RunState::Running));
+                {
+                    uint32_t running = _a.jcc(Cond::E);
+                    _a.aluImm(Alu::Cmp, Size::Dword, field(_f.subroutineDepth), 1);
+                    exitBeforeIf(Cond::E);
+                    _a.bind(running);
+                }
+                pop16(HostS);
+                _a.mov(Size::Word, field(_f.pc), RAX);
+                _a.aluImm(Alu::Sub, Size::Dword, field(_f.subroutineDepth), 1);
+                _exits.push_back(Exit { _a.jmp(), 0, true, uint8_t(_index + 1), _cycles, op });
+                return false;
+            case Op::ABX:
+                _a.movzx(RAX, Size::Byte, RBX);
+                _a.alu(Alu::Add, Size::Word, HostX, RAX);
+                break;
+            case Op::ADD8:
+            case Op::ADD16:
+            case Op::SUB8:
+            case Op::SUB16:
+            case Op::CMP8:
+            case Op::CMP16:
+            case Op::AND:
+            case Op::OR:
+            case Op::EOR:
+            case Op::BIT: {
+                Alu alu = (op == Op::ADD8 || op == Op::ADD16) ? Alu::Add :
+                          ((op == Op::AND || op == Op::BIT) ? Alu::And :
+                           ((op == Op::OR) ? Alu::Or :
+                            ((op == Op::EOR) ? Alu::Xor : Alu::Sub)));
+                _a.mov(Size::Dword, R8, RDI);
+                _a.alu(alu, Size::Dword, R8, RCX);
+                storeResult();
+                _a.mov(Size::Dword, RDX, RDI);
+                _a.alu(alu, size, RDX, RCX);
+                if (alu == Alu::And || alu == Alu::Or || alu == Alu::Xor) {
+                    setFlags(FlagN | FlagZ | FlagV);
+                } else if (op == Op::ADD8) {
+                    setFlags(FlagH | FlagN | FlagZ | FlagV | FlagC);
+                } else {
+                    setFlags(FlagN | FlagZ | FlagV | FlagC);
+                }
+                if (op == Op::SUB16) {
+                    _a.mov(Size::Dword, RAX, R8);
+                    setReg(reg);
+                }
+                break;
+            }
+            case Op::ADC:
+            case Op::SBC: {
+                Alu alu = (op == Op::ADC) ? Alu::Add : Alu::Sub;
+                _a.movzx(RAX, Size::Byte, field(_f.cc));
+                _a.aluImm(Alu::And, Size::Dword, RAX, FlagC);
+                _a.mov(Size::Dword, R8, RDI);
+                _a.alu(alu, Size::Dword, R8, RCX);
+                _a.alu(alu, Size::Dword, R8, RAX);
+                storeResult();
+                _a.mov(Size::Dword, RDX, RDI);
+                _a.shift(Shift::Shr, Size::Dword, RAX, 1);
+                _a.alu((op == Op::ADC) ? Alu::Adc : Alu::Sbb, Size::Byte, RDX, RCX);
+                setFlags((op == Op::ADC) ? (FlagH | FlagN | FlagZ | FlagV | FlagC) : (FlagN | FlagZ | FlagV | FlagC));
+                break;
+            }
+            case Op::ANDCC:
+            case Op::ORCC:
+                _a.movzx(RAX, Size::Byte, field(_f.cc));
+                _a.alu((op == Op::ANDCC) ? Alu::And : Alu::Or, Size::Dword, RAX, RCX);
+                _a.mov(Size::Byte, field(_f.cc), RAX);
+                break;
+            case Op::ASL:
+                _a.mov(Size::Dword, R8, RDI);
+                _a.alu(Alu::Add, Size::Dword, R8, R8);
+                storeResult();
+                _a.mov(Size::Dword, RDX, RDI);
+                _a.shift(Shift::Shl, Size::Byte, RDX, 1);
+                setFlags(FlagN | FlagZ | FlagV | FlagC);
+                break;
+            case Op::ASR:
+            case Op::LSR:
+                // The host shift leaves bit 0 of _left in C
+                _a.mov(Size::Dword, R8, RDI);
+                _a.shift(Shift::Shr, Size::Dword, R8, 1);
+                if (op == Op::ASR) {
+                    _a.mov(Size::Dword, RAX, RDI);
+                    _a.aluImm(Alu::And, Size::Dword, RAX, 0x80);
+                    _a.alu(Alu::Or, Size::Dword, R8, RAX);
+                }
+                storeResult();
+                _a.mov(Size::Dword, RDX, RDI);
+                _a.shift((op == Op::ASR) ? Shift::Sar : Shift::Shr, Size::Byte, RDX, 1);
+                setFlags(FlagN | FlagZ | FlagC);
+                break;
+            case Op::ROL:
+                _a.movzx(RAX, Size::Byte, field(_f.cc));
+                _a.aluImm(Alu::And, Size::Dword, RAX, FlagC);
+                _a.mov(Size::Dword, R8, RDI);
+                _a.alu(Alu::Add, Size::Dword, R8, R8);
+                _a.alu(Alu::Or, Size::Dword, R8, RAX);
+                storeResult();
+
+                // C is bit 7 and V is bit 7 ^ bit 6 of _left
+                _a.mov(Size::Dword, RDX, R8);
+                _a.test(Size::Byte, RDX, RDX);
+                hostFlags(FlagN | FlagZ);
+                _a.mov(Size::Dword, RAX, RDI);
+                _a.shift(Shift::Shr, Size::Dword, RAX, 7);
+                _a.aluImm(Alu::And, Size::Dword, RAX, FlagC);
+                _a.alu(Alu::Or, Size::Dword, RCX, RAX);
+                _a.mov(Size::Dword, RAX, RDI);
+                _a.mov(Size::Dword, RDX, RDI);
+                _a.shift(Shift::Shr, Size::Dword, RAX, 6);
+                _a.shift(Shift::Shr, Size::Dword, RDX, 7);
+                _a.alu(Alu::Xor, Size::Dword, RAX, RDX);
+                _a.aluImm(Alu::And, Size::Dword, RAX, 1);
+                _a.alu(Alu::Add, Size::Dword, RAX, RAX);
+                _a.alu(Alu::Or, Size::Dword, RCX, RAX);
+                mergeFlags(FlagN | FlagZ | FlagV | FlagC);
+                break;
+            case Op::ROR:
+                // C is bit 0 of _left
+                _a.movzx(RAX, Size::Byte, field(_f.cc));
+                _a.aluImm(Alu::And, Size::Dword, RAX, FlagC);
+                _a.shift(Shift::Shl, Size::Dword, RAX, 7);
+                _a.mov(Size::Dword, R8, RDI);
+                _a.shift(Shift::Shr, Size::Dword, R8, 1);
+                _a.alu(Alu::Or, Size::Dword, R8, RAX);
+                storeResult();
+                _a.mov(Size::Dword, RDX, R8);
+                _a.test(Size::Byte, RDX, RDX);
+                hostFlags(FlagN | FlagZ);
+                _a.mov(Size::Dword, RAX, RDI);
+                _a.aluImm(Alu::And, Size::Dword, RAX, FlagC);
+                _a.alu(Alu::Or, Size::Dword, RCX, RAX);
+                mergeFlags(FlagN | FlagZ | FlagC);
+                break;
+            case Op::CLR:
+                _a.alu(Alu::Xor, Size::Dword, R8, R8);
+                storeResult();
+                mergeFlags(0, FlagN | FlagV | FlagC, FlagZ, false);
+                break;
+            case Op::COM:
+                _a.mov(Size::Dword, R8, RDI);
+                _a.bitNot(Size::Dword, R8);
+                storeResult();
+                _a.mov(Size::Dword, RDX, R8);
+                _a.test(Size::Byte, RDX, RDX);
+                setFlags(FlagN | FlagZ, FlagV, FlagC);
+                break;
+            case Op::DEC:
+            case Op::INC:
+            case Op::NEG:
+            case Op::TST: {
+                _a.mov(Size::Dword, R8, RDI);
+                _a.mov(Size::Dword, RDX, RDI);
+                if (op == Op::NEG) {
+                    _a.neg(Size::Dword, R8);
+                    storeResult();
+                    _a.neg(Size::Byte, RDX);
+                    setFlags(FlagN | FlagZ | FlagV | FlagC);
+                    break;
+                }
+                if (op == Op::TST) {
+                    storeResult();
+                    _a.test(Size::Byte, RDX, RDX);
+                } else {
+                    Alu alu = (op == Op::INC) ? Alu::Add : Alu::Sub;
+                    _a.aluImm(alu, Size::Dword, R8, 1);
+                    storeResult();
+                    _a.aluImm(alu, Size::Byte, RDX, 1);
+                }
+                setFlags(FlagN | FlagZ | FlagV);
+                break;
+            }
+            case Op::LD8:
+            case Op::LD16:
+                _a.mov(Size::Dword, R8, RCX);
+                storeResult();
+                _a.test(size, RCX, RCX);
+                setFlags(FlagN | FlagZ | FlagV);
+                break;
+            case Op::ST8:
+            case Op::ST16:
+                _a.mov(Size::Dword, R8, RDI);
+                storeResult();
+                _a.test(size, RDI, RDI);
+                setFlags(FlagN | FlagZ | FlagV);
+                break;
+            case Op::SEX:
+                // N and Z come from all of D and V is left alone
+                _a.movsx(RAX, Size::Byte, RBX);
+                _a.mov(Size::Byte, BH, AH);
+                _a.movzx(R8, Size::Word, RBX);
+                storeResult();
+                _a.test(Size::Word, RBX, RBX);
+                setFlags(FlagN | FlagZ);
+                break;
+            case Op::LEA:
+                _a.mov(Size::Dword, R8, RSI);
+                storeResult();
+                if (reg == Reg::X || reg == Reg::Y) {
+                    _a.test(Size::Word, RSI, RSI);
+                    setFlags(FlagZ);
+                }
+                break;
+            case Op::MUL:
+                _a.movzx(RAX, Size::Byte, BH);
+                _a.movzx(RCX, Size::Byte, RBX);
+                _a.imul(RAX, RCX);
+                _a.movzx(HostD, Size::Word, RAX);
+                _a.test(Size::Word, RAX, RAX);
+                _a.setcc(Cond::E, RDX);
+                _a.movzx(RCX, Size::Byte, RDX);
+                _a.shift(Shift::Shl, Size::Dword, RCX, 2);
+                _a.shift(Shift::Shr, Size::Byte, RAX, 7);
+                _a.alu(Alu::Or, Size::Byte, RCX, RAX);
+                mergeFlags(FlagZ | FlagC);
+                break;
+            case Op::TFR:
+                getReg(Reg(inst.operand >> 4));
+                setReg(Reg(inst.operand & 0x0f));
+                break;
+            case Op::EXG:
+                getReg(Reg(inst.operand & 0x0f));
+                _a.mov(Size::Dword, Mem { RSP, FrameTemp }, RAX);
+                getReg(Reg(inst.operand >> 4));
+                setReg(Reg(inst.operand & 0x0f));
+                _a.mov(Size::Dword, RAX, Mem { RSP, FrameTemp });
+                setReg(Reg(inst.operand >> 4));
+                break;
+            case Op::PSH: {
+                uint8_t stack = hostReg(reg);
+                uint8_t bits = inst.operand;
+                if (bits & 0x80) push16(stack, Reg::PC, _nextPC);
+                if (bits & 0x40) push16(stack, (reg == Reg::U) ? Reg::S : Reg::U);
+                if (bits & 0x20) push16(stack, Reg::Y);
+                if (bits & 0x10) push16(stack, Reg::X);
+                if (bits & 0x08) { getReg(Reg::DP); push8(stack); }
+                if (bits & 0x04) { getReg(Reg::B); push8(stack); }
+                if (bits & 0x02) { getReg(Reg::A); push8(stack); }
+                if (bits & 0x01) { getReg(Reg::CC); push8(stack); }
+                break;
+            }
+            case Op::PUL: {
+                uint8_t stack = hostReg(reg);
+                uint8_t bits = inst.operand;
+                if (bits & 0x01) { pop8(stack); setReg(Reg::CC); }
+                if (bits & 0x02) { pop8(stack); setReg(Reg::A); }
+                if (bits & 0x04) { pop8(stack); setReg(Reg::B); }
+                if (bits & 0x08) { pop8(stack); setReg(Reg::DP); }
+                if (bits & 0x10) { pop16(stack); setReg(Reg::X); }
+                if (bits & 0x20) { pop16(stack); setReg(Reg::Y); }
+                if (bits & 0x40) { pop16(stack); setReg((reg == Reg::U) ? Reg::S : Reg::U); }
+                if (bits & 0x80) {
+                    pop16(stack);
+                    _a.mov(Size::Word, field(_f.pc), RAX);
+                    _exits.push_back(Exit { _a.jmp(), 0, true, uint8_t(_index + 1), _cycles, op });
+                    return false;
+                }
+                break;
+            }
+        }
+
+        // Store _result
+        if (right == Right::St8 || right == Right::St16) {
+            _a.mov(Size::Dword, RAX, RDI);
+            store(right == Right::St16);
+        } else if (left == Left::St || left == Left::LdSt) {
+            _a.mov(Size::Dword, RAX, R8);
+            if (reg == Reg::M8 || reg == Reg::M16) {
+                store(reg == Reg::M16);
+            } else {
+                setReg(reg);
+            }
+        }
+
+        // The interpreter ends the block if a store hit decoded code
+        if (stores(inst)) {
+            _a.aluImm(Alu::Cmp, Size::Byte, field(_f.blockInvalidated), 0);
+            exitIf(Cond::NE, _nextPC, _index + 1, _cycles, op);
+        }
+        return true;
+    }
+
+    Assembler& _a;
+    const Fields& _f;
+    const DecodedBlock& _block;
+    uint32_t _flagTable;
+    uint64_t _load8, _load16, _store8, _store16;
+
+    std::vector<Exit> _exits;
+    std::vector<uint32_t> _epilogueJumps;
+    uint32_t _top = 0;
+
+    // The instruction being translated
+    uint8_t _index = 0;
+    uint16_t _pc = 0;
+    uint16_t _nextPC = 0;
+    uint32_t _cyclesBefore = 0;
+    uint32_t _cycles = 0;
+};
+
+Jit::Jit()
+{
+    void* code = mmap(nullptr, JitCodeSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        return;
+    }
+    _code = static_cast<uint8_t*>(code);
+
+    // The table of 6809 flags for each value of the host flags LAHF puts
+    // in AH, where SF is bit 7, ZF bit 6, AF bit 4 and CF bit 0
+    for (uint32_t ah = 0; ah < 256; ++ah) {
+        _code[ah] = ((ah & 0x80) ? FlagN : 0) | ((ah & 0x40) ? FlagZ : 0) |
+                    ((ah & 0x10) ? FlagH : 0) | ((ah & 0x01) ? FlagC : 0);
+    }
+    _tableSize = 256;
+    reset();
+}
+
+Jit::~Jit()
+{
+    if (_code) {
+        munmap(_code, JitCodeSize);
+    }
+}
+
+void Jit::reset()
+{
+    _used = _tableSize;
+    _full = false;
+}
+
+JitCode Jit::translate(Emulator& emulator, const DecodedBlock& block)
+{
+    if (!_code) {
+        return nullptr;
+    }
+    if (JitCodeSize - _used < MaxBlockCode) {
+        _full = true;
+        return nullptr;
+    }
+
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(&emulator);
+    auto offset = [base](const void* member) {
+        return int32_t(static_cast<const uint8_t*>(member) - base);
+    };
+
+    Fields f;
+    f.d = offset(&emulator._d);
+    f.x = offset(&emulator._x);
+    f.y = offset(&emulator._y);
+    f.u = offset(&emulator._u);
+    f.s = offset(&emulator._s);
+    f.pc = offset(&emulator._pc);
+    f.dp = offset(&emulator._dp);
+    f.cc = offset(&emulator._ccByte);
+    f.left = offset(&emulator._left);
+    f.right = offset(&emulator._right);
+    f.result = offset(&emulator._result);
+    f.prevOp = offset(&emulator._prevOp);
+#ifdef COMPUTE_CYCLES
+    f.cycles = offset(&emulator._cycles);
+#else
+    f.cycles = 0;
+#endif
+    f.instructions = offset(&emulator._instructions);
+    f.quantumEnd = offset(&emulator._quantumEnd);
+    f.readPage = offset(&emulator._readPage[0]);
+    f.writePage = offset(&emulator._writePage[0]);
+    f.codePages = offset(&emulator._codePages[0]);
+    f.blockInvalidated = offset(&emulator._blockInvalidated);
+    f.pendingInterrupts = offset(&emulator._pendingInterrupts);
+    f.subroutineDepth = offset(&emulator._subroutineDepth);
+    f.lastRunState = offset(&emulator._lastRunState);
+
+    static_assert(sizeof(RunState) == 4, "translated code compares _lastRunState as 32 bits");
+    static_assert(sizeof(std::atomic<uint8_t>) == 1, "translated code reads _pendingInterrupts as a byte");
+
+    Assembler a(_code, _used, JitCodeSize);
+    Translator translator(a, f, block, 0,
+                          reinterpret_cast<uint64_t>(&Jit::load8), reinterpret_cast<uint64_t>(&Jit::load16),
+                          reinterpret_cast<uint64_t>(&Jit::store8), reinterpret_cast<uint64_t>(&Jit::store16));
+    uint8_t count = translator.translate();
+    if (count == 0 || a.overflowed()) {
+        return nullptr;
+    }
+
+    JitCode code = reinterpret_cast<JitCode>(_code + _used);
+
+    // Keep entry points 16 byte aligned
+    _used = (a.pos() + 15) & ~15;
+    _blocksTranslated += 1;
+    _instructionsTranslated += count;
+    return code;
+}
+
+uint32_t Jit::load8(Emulator* emulator, uint32_t ea)
+{
+    return emulator->load8(uint16_t(ea));
+}
+
+uint32_t Jit::load16(Emulator* emulator, uint32_t ea)
+{
+    return emulator->load16(uint16_t(ea));
+}
+
+void Jit::store8(Emulator* emulator, uint32_t ea, uint32_t v)
+{
+    emulator->store8(uint16_t(ea), uint8_t(v));
+}
+
+void Jit::store16(Emulator* emulator, uint32_t ea, uint32_t v)
+{
+    emulator->store16(uint16_t(ea), uint16_t(v));
+}
+
+#endif
@@ -0,0 +1,86 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Jit.h
+//  Translator from decoded 6809 blocks to x86-64 code
+//
+//  A block which has been entered JitThreshold times is translated into
+//  host code which keeps D, X, Y, U and S in host registers and does
+//  everything exec() would do for each instruction, including the side
+//  effects on _left, _right and _result, so the interpreter can take over
+//  at any instruction boundary. Ops it doesn't know end the translation
+//  and the interpreter runs the rest of the block. A block which branches
+//  back to its own start loops in host code until the quantum is used up,
+//  an interrupt is pending or a store hits decoded code.
+//
+//  Memory accesses to plain RAM are done inline. Everything else, devices,
+//  watched pages, clean snapshot pages and pages with decoded code, goes
+//  through load8, load16, store8 and store16 on the Emulator, so nothing
+//  is missed by the block cache invalidation.
+//
+
+#pragma once
+
+#include "MC6809.h"
+
+#ifdef JIT
+
+namespace mc6809 {
+
+// Translated code is bump allocated from one executable buffer. When it
+// fills up the emulator's block cache is flushed, which empties it.
+static constexpr uint32_t JitCodeSize = 8 * 1024 * 1024;
+
+class Jit
+{
+  public:
+    Jit();
+    ~Jit();
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // False if the code buffer couldn't be allocated. Nothing is
+    // translated in that case
+    bool valid() const { return _code != nullptr; }
+
+    // Translate as many of the block's instructions as possible, from
+    // its start. Returns nullptr if the first one can't be translated or
+    // the buffer is full, which full() tells apart.
+    JitCode translate(Emulator&, const DecodedBlock&);
+
+    bool full() const { return _full; }
+
+    // Throw away every translation. The emulator calls this whenever it
+    // flushes its block cache, since the translations point into it
+    void reset();
+
+    uint32_t blocksTranslated() const { return _blocksTranslated; }
+    uint32_t instructionsTranslated() const { return _instructionsTranslated; }
+    uint32_t bytesUsed() const { return _used; }
+
+  private:
+    // Called by translated code for accesses which aren't to plain RAM
+    static uint32_t load8(Emulator*, uint32_t ea);
+    static uint32_t load16(Emulator*, uint32_t ea);
+    static void store8(Emulator*, uint32_t ea, uint32_t v);
+    static void store16(Emulator*, uint32_t ea, uint32_t v);
+
+    uint8_t* _code = nullptr;
+    uint32_t _used = 0;
+    uint32_t _tableSize = 0;
+    bool _full = false;
+
+    uint32_t _blocksTranslated = 0;
+    uint32_t _instructionsTranslated = 0;
+};
+
+}
+
+#endif
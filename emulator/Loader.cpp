@@ -0,0 +1,289 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Loader.cpp
+//  Load a whole program image into RAM
+//
+
+#include "Loader.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#ifndef ARDUINO
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace mc6809;
+
+// Value of each hex digit, or BadDigit. Two digits are decoded by
+// or'ing their entries together, so one test catches either being bad
+static constexpr uint8_t BadDigit = 0x10;
+
+struct HexTable
+{
+    constexpr HexTable()
+    {
+        for (int i = 0; i < 256; ++i) {
+            digits[i] = BadDigit;
+        }
+        for (int i = 0; i < 10; ++i) {
+            digits['0' + i] = uint8_t(i);
+        }
+        for (int i = 0; i < 6; ++i) {
+            digits['A' + i] = uint8_t(10 + i);
+            digits['a' + i] = uint8_t(10 + i);
+        }
+    }
+
+    uint8_t digits[256] = { };
+};
+
+static constexpr HexTable Hex;
+
+// Returns the digits or'ed together, which has BadDigit set if either was bad
+static inline uint8_t hexByte(const uint8_t* s, uint8_t& b)
+{
+    uint8_t hi = Hex.digits[s[0]];
+    uint8_t lo = Hex.digits[s[1]];
+    b = uint8_t(hi << 4 | lo);
+    return hi | lo;
+}
+
+bool Loader::load(const uint8_t* data, size_t size, ImageFormat format, uint16_t rawAddr)
+{
+    _startAddr = 0;
+    _startAddrSet = false;
+    _haveData = false;
+    _error[0] = '\0';
+
+    if (format == ImageFormat::Auto) {
+        format = detect(data, size);
+    }
+
+    switch (format) {
+        case ImageFormat::S19: return loadS19(data, size);
+        case ImageFormat::DECB: return loadDECB(data, size);
+        default:
+            setStartAddr(rawAddr);
+            return store(rawAddr, data, size);
+    }
+}
+
+ImageFormat Loader::detect(const uint8_t* data, size_t size)
+{
+    if (size >= 2 && data[0] == 'S' && data[1] >= '0' && data[1] <= '9') {
+        return ImageFormat::S19;
+    }
+
+    // Each DECB block is a type byte, a 16 bit length and a 16 bit
+    // address, followed by the data for a preamble (0x00) block
+    size_t i = 0;
+    while (i + 5 <= size) {
+        if (data[i] == 0xff) {
+            return (data[i + 1] == 0 && data[i + 2] == 0) ? ImageFormat::DECB : ImageFormat::Raw;
+        }
+        if (data[i] != 0x00) {
+            break;
+        }
+        i += 5 + (uint16_t(data[i + 1]) << 8 | data[i + 2]);
+    }
+    return ImageFormat::Raw;
+}
+
+bool Loader::loadS19(const uint8_t* data, size_t size)
+{
+    const uint8_t* s = data;
+    const uint8_t* end = data + size;
+    unsigned line = 1;
+
+    while (true) {
+        // Skip line endings, blank lines and a trailing NUL
+        while (s < end && *s <= ' ') {
+            if (*s++ == '\n') {
+                line++;
+            }
+        }
+        if (s == end) {
+            break;
+        }
+
+        if (end - s < 4 || s[0] != 'S') {
+            return fail("line %u: doesn't start with an 'S'", line);
+        }
+
+        // Address size for each record type. S4 isn't used
+        static constexpr uint8_t addrSizes[10] = { 2, 2, 3, 4, 0, 2, 3, 4, 3, 2 };
+        uint8_t type = s[1] - '0';
+        if (type > 9 || addrSizes[type] == 0) {
+            return fail("line %u: unrecognized S-Record: S%c", line, s[1]);
+        }
+        uint8_t addrSize = addrSizes[type];
+
+        uint8_t count;
+        if (hexByte(s + 2, count) & BadDigit) {
+            return fail("line %u: bad count", line);
+        }
+        s += 4;
+        if (count <= addrSize || size_t(end - s) < size_t(count) * 2) {
+            return fail("line %u: record is too short", line);
+        }
+
+        uint8_t sum = count;
+        uint8_t bad = 0;
+        uint32_t addr = 0;
+        for (uint8_t i = 0; i < addrSize; ++i, s += 2) {
+            uint8_t b;
+            bad |= hexByte(s, b);
+            sum += b;
+            addr = addr << 8 | b;
+        }
+
+        uint8_t dataSize = count - addrSize - 1;
+        bool isData = type >= 1 && type <= 3;
+        if (isData && !inRange(addr, dataSize)) {
+            return fail("line %u: $%04x-$%04x is outside of RAM", line, addr, addr + dataSize - 1);
+        }
+
+        // Nothing goes into RAM until the whole record checks out
+        uint8_t buf[255];
+        for (uint8_t i = 0; i < dataSize; ++i, s += 2) {
+            bad |= hexByte(s, buf[i]);
+            sum += buf[i];
+        }
+
+        uint8_t checksum;
+        bad |= hexByte(s, checksum);
+        s += 2;
+        if (bad & BadDigit) {
+            return fail("line %u: bad hex digit", line);
+        }
+        if (checksum != uint8_t(~sum)) {
+            return fail("line %u: found checksum 0x%02x, expecting 0x%02x", line, checksum, uint8_t(~sum));
+        }
+
+        if (isData) {
+            memcpy(_ram + addr, buf, dataSize);
+            if (!_haveData) {
+                setStartAddr(addr);
+            }
+            _haveData = true;
+        } else if (type >= 7) {
+            _startAddr = uint16_t(addr);
+            _startAddrSet = true;
+        }
+
+        // Anything after the checksum is ignored, like SRecordParser does
+        while (s < end && *s != '\n') {
+            s++;
+        }
+    }
+    return true;
+}
+
+bool Loader::loadDECB(const uint8_t* data, size_t size)
+{
+    size_t i = 0;
+    while (i + 5 <= size) {
+        uint8_t type = data[i];
+        uint16_t length = uint16_t(data[i + 1]) << 8 | data[i + 2];
+        uint16_t addr = uint16_t(data[i + 3]) << 8 | data[i + 4];
+        i += 5;
+
+        if (type == 0xff) {
+            // Postamble. The address is where to start
+            _startAddr = addr;
+            _startAddrSet = true;
+            return true;
+        }
+        if (type != 0x00) {
+            return fail("offset %zu: bad DECB block type $%02x", i - 5, type);
+        }
+        if (length > size - i) {
+            return fail("offset %zu: DECB block is truncated", i - 5);
+        }
+
+        if (!_haveData) {
+            setStartAddr(addr);
+        }
+        _haveData = true;
+        if (!store(addr, data + i, length)) {
+            return false;
+        }
+        i += length;
+    }
+    return fail("DECB image has no postamble");
+}
+
+bool Loader::store(uint32_t addr, const uint8_t* data, size_t size)
+{
+    if (!inRange(addr, size)) {
+        return fail("$%04x-$%04x is outside of RAM", addr, unsigned(addr + size - 1));
+    }
+    memcpy(_ram + addr, data, size);
+    return true;
+}
+
+void Loader::setStartAddr(uint32_t addr)
+{
+    if (!_startAddrSet) {
+        _startAddr = uint16_t(addr);
+    }
+}
+
+bool Loader::fail(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(_error, sizeof(_error), fmt, args);
+    va_end(args);
+    return false;
+}
+
+#ifndef ARDUINO
+bool MappedFile::open(const char* filename)
+{
+    close();
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    // The mapping keeps the file open
+    void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    _data = static_cast<uint8_t*>(data);
+    _size = size_t(st.st_size);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (_data) {
+        munmap(_data, _size);
+        _data = nullptr;
+        _size = 0;
+    }
+}
+#endif
@@ -0,0 +1,95 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Loader.h
+//  Load a whole program image into RAM
+//
+//  Unlike SRecordInfo, which is given the s19 file a line at a time as
+//  it's typed or pasted into the monitor, Loader is given the whole
+//  image at once. s19 text is decoded with a table straight into RAM,
+//  with every record checked against the RAM size first. It also takes
+//  the binaries lwasm makes with --raw and --decb.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mc6809 {
+
+enum class ImageFormat { Auto, S19, Raw, DECB };
+
+class Loader
+{
+  public:
+    // ram is mapped from address 0 for ramSize bytes
+    Loader(uint8_t* ram, uint32_t ramSize) : _ram(ram), _ramSize(ramSize) { }
+
+    // Returns false and sets error() if the image is malformed or
+    // doesn't fit in RAM. A raw image has no addresses, so it's
+    // loaded at rawAddr, which is also its start address
+    bool load(const uint8_t* data, size_t size, ImageFormat format, uint16_t rawAddr = 0);
+
+    // The address in the S9 or DECB postamble record, otherwise the
+    // address of the first data
+    uint16_t startAddr() const { return _startAddr; }
+
+    const char* error() const { return _error; }
+
+    // s19 images start with an S record. Anything that parses as a
+    // series of DECB blocks ending in a postamble is DECB, and anything
+    // else is raw
+    static ImageFormat detect(const uint8_t* data, size_t size);
+
+  private:
+    bool loadS19(const uint8_t* data, size_t size);
+    bool loadDECB(const uint8_t* data, size_t size);
+
+    bool store(uint32_t addr, const uint8_t* data, size_t size);
+    bool inRange(uint32_t addr, size_t size) const { return addr <= _ramSize && size <= _ramSize - addr; }
+
+    void setStartAddr(uint32_t addr);
+    bool fail(const char* fmt, ...);
+
+    uint8_t* _ram = nullptr;
+    uint32_t _ramSize = 0;
+    uint16_t _startAddr = 0;
+    bool _startAddrSet = false;
+    bool _haveData = false;
+
+    char _error[80] = "";
+};
+
+#ifndef ARDUINO
+// A read only mapping of a whole file, so it can be handed to Loader
+// without being copied
+class MappedFile
+{
+  public:
+    MappedFile() { }
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns false if the file can't be opened or is empty
+    bool open(const char* filename);
+    void close();
+
+    const uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+
+  private:
+    uint8_t* _data = nullptr;
+    size_t _size = 0;
+};
+#endif
+
+}
@@ -13,14 +13,34 @@
 //  Created by Chris Marrin on 4/22/24.
 //
 
+#include <algorithm>
+
 #include "MC6809.h"
 #include "BOSS9.h"
+#include "Disassembler.h"
+#include "Exec.h"
+
+#ifdef SNAPSHOTS
+#include "History.h"
+#endif
+
+#ifdef JIT
+#include "Jit.h"
+#endif
+
+#ifdef RECOMPILED
+#include "Recompiled.h"
+#endif
+
+#ifdef STATS
+#include "Stats.h"
+#endif
 
 using namespace mc6809;
 
 static_assert (sizeof(Opcode) == 3, "Opcode is wrong size");
 
-static inline const char* opToString(Op op)
+const char* mc6809::opToString(Op op)
 {
     switch (op) {
         default: return "???";
@@ -95,6 +115,56 @@ static inline const char* opToString(Op op)
         case Op::IRQ    : return "IRQ"; 
         case Op::NMI    : return "NMI"; 
         case Op::RESTART: return "RESTART";
+#ifdef HD6309
+        case Op::OIM    : return "OIM";
+        case Op::AIM    : return "AIM";
+        case Op::EIM    : return "EIM";
+        case Op::TIM    : return "TIM";
+        case Op::SEXW   : return "SEXW";
+        case Op::LDQ    : return "LDQ";
+        case Op::STQ    : return "STQ";
+        case Op::ADDR   : return "ADDR";
+        case Op::ADCR   : return "ADCR";
+        case Op::SUBR   : return "SUBR";
+        case Op::SBCR   : return "SBCR";
+        case Op::ANDR   : return "ANDR";
+        case Op::ORR    : return "ORR";
+        case Op::EORR   : return "EORR";
+        case Op::CMPR   : return "CMPR";
+        case Op::PSHW   : return "PSH";
+        case Op::PULW   : return "PUL";
+        case Op::BAND   : return "BAND";
+        case Op::BIAND  : return "BIAND";
+        case Op::BOR    : return "BOR";
+        case Op::BIOR   : return "BIOR";
+        case Op::BEOR   : return "BEOR";
+        case Op::BIEOR  : return "BIEOR";
+        case Op::LDBT   : return "LDBT";
+        case Op::STBT   : return "STBT";
+        case Op::TFM    : return "TFM";
+        case Op::BITMD  : return "BITMD";
+        case Op::LDMD   : return "LDMD";
+        case Op::DIVD   : return "DIVD";
+        case Op::DIVQ   : return "DIVQ";
+        case Op::MULD   : return "MULD";
+        case Op::NEG16  : return "NEG";
+        case Op::COM16  : return "COM";
+        case Op::LSR16  : return "LSR";
+        case Op::ROR16  : return "ROR";
+        case Op::ASR16  : return "ASR";
+        case Op::ASL16  : return "ASL";
+        case Op::ROL16  : return "ROL";
+        case Op::DEC16  : return "DEC";
+        case Op::INC16  : return "INC";
+        case Op::TST16  : return "TST";
+        case Op::CLR16  : return "CLR";
+        case Op::ADC16  : return "ADC";
+        case Op::SBC16  : return "SBC";
+        case Op::AND16  : return "AND";
+        case Op::BIT16  : return "BIT";
+        case Op::EOR16  : return "EOR";
+        case Op::OR16   : return "OR";
+#endif
     }
 }
 
@@ -148,9 +218,9 @@ static constexpr Opcode opcodeTable[ ] = {
     /*2E*/  	{ Op::BGT	  , Reg::None , Left::None, Right::None , Adr::RelP	    },
     /*2F*/  	{ Op::BLE	  , Reg::None , Left::None, Right::None , Adr::RelP	    },
     /*30*/  	{ Op::LEA	  , Reg::X    , Left::St  , Right::None , Adr::Indexed	},
-    /*31*/  	{ Op::LEA	  , Reg::Y    , Left::None, Right::None , Adr::Indexed	},
-    /*32*/  	{ Op::LEA	  , Reg::S    , Left::None, Right::None , Adr::Indexed	},
-    /*33*/  	{ Op::LEA	  , Reg::U    , Left::None, Right::None , Adr::Indexed	},
+    /*31*/  	{ Op::LEA	  , Reg::Y    , Left::St  , Right::None , Adr::Indexed	},
+    /*32*/  	{ Op::LEA	  , Reg::S    , Left::St  , Right::None , Adr::Indexed	},
+    /*33*/  	{ Op::LEA	  , Reg::U    , Left::St  , Right::None , Adr::Indexed	},
     /*34*/  	{ Op::PSH	  , Reg::S    , Left::None, Right::None , Adr::Immed8	},
     /*35*/  	{ Op::PUL	  , Reg::S    , Left::None, Right::None , Adr::Immed8	},
     /*36*/  	{ Op::PSH	  , Reg::U    , Left::None, Right::None , Adr::Immed8	},
@@ -159,7 +229,7 @@ static constexpr Opcode opcodeTable[ ] = {
     /*39*/  	{ Op::RTS	  , Reg::None , Left::None, Right::None , Adr::Inherent	},
     /*3A*/  	{ Op::ABX	  , Reg::None , Left::None, Right::None , Adr::Inherent	},
     /*3B*/  	{ Op::RTI	  , Reg::None , Left::None, Right::None , Adr::Inherent	},          // 6 if FIRQ, 15 if IRQ
-    /*3C*/  	{ Op::CWAI	  , Reg::None , Left::None, Right::None , Adr::Inherent	},
+    /*3C*/  	{ Op::CWAI	  , Reg::None , Left::None, Right::None , Adr::Immed8	},
     /*3D*/  	{ Op::MUL	  , Reg::None , Left::None, Right::None , Adr::Inherent	},
     /*3E*/  	{ Op::ILL	  , Reg::None , Left::None, Right::None , Adr::None	    },
     /*3F*/  	{ Op::SWI	  , Reg::None , Left::None, Right::None , Adr::Inherent	},
@@ -255,7 +325,7 @@ static constexpr Opcode opcodeTable[ ] = {
     /*99*/  	{ Op::ADC	  , Reg::A    , Left::LdSt, Right::Ld8  , Adr::Direct	},
     /*9A*/  	{ Op::OR	  , Reg::A    , Left::LdSt, Right::Ld8  , Adr::Direct	},
     /*9B*/  	{ Op::ADD8	  , Reg::A    , Left::LdSt, Right::Ld8  , Adr::Direct	},
-    /*9C*/  	{ Op::CMP16	  , Reg::X    , Left::Ld  , Right::Ld8  , Adr::Direct	},
+    /*9C*/  	{ Op::CMP16	  , Reg::XYS  , Left::Ld  , Right::Ld16 , Adr::Direct	},
     /*9D*/  	{ Op::JSR	  , Reg::None , Left::None, Right::None , Adr::Direct	},
     /*9E*/  	{ Op::LD16	  , Reg::XY   , Left::St  , Right::Ld16 , Adr::Direct	},
     /*9F*/  	{ Op::ST16	  , Reg::XY   , Left::Ld  , Right::St16 , Adr::Direct	},
@@ -358,6 +428,10 @@ static constexpr Opcode opcodeTable[ ] = {
 };
 
 #ifdef COMPUTE_CYCLES
+// Base cycles for the first page. Page2 and Page3 ops take one more than
+// the op they're based on, except the long branches and SWI2/SWI3. Indexed
+// modes, PSH/PUL and RTI add cycles depending on their operands (see
+// instructionCycles()).
 static constexpr uint8_t cyclesTable[ ] = {
     /*00*/  	6 , 0 , 0 , 6 , 6 , 0 , 6 , 6 , 6 , 6 , 6 , 0 , 6 , 6 , 3 , 6 ,
     /*10*/  	0 , 0 , 2 , 4 , 0 , 0 , 5 , 9 , 0 , 2 , 3 , 0 , 3 , 2 , 8 , 6 ,
@@ -415,10 +489,271 @@ static constexpr uint8_t cyclesTable[ ] = {
 // FF STU  -> 10FF STS   ->
 
 static_assert (sizeof(opcodeTable) == 256 * sizeof(Opcode), "Opcode table is wrong size");
+#ifdef COMPUTE_CYCLES
+static_assert (sizeof(cyclesTable) == 256, "Cycles table is wrong size");
+#endif
+
+#ifdef HD6309
+// 6309 ops
+//
+// The 6309 fills in most of the holes in the 6809 opcode map, mostly on
+// Page2 and Page3. Each entry here replaces the one which would otherwise
+// come from opcodeTable. page is 0 for no prefix, 1 for Page2 and 2 for
+// Page3. cycles are the emulation mode counts for the whole instruction,
+// including the prefix. Native mode runs most ops in fewer cycles, but
+// counting those needs a second set of tables for both pages, so native
+// mode uses these too.
+//
+// Any other prefixed opcode is the unprefixed one, as in the 6809 build,
+// rather than an illegal instruction trap.
+struct ExtendedOpcode
+{
+    uint8_t page;
+    uint8_t index;
+    Opcode opcode;
+    uint8_t cycles;
+};
+
+static constexpr ExtendedOpcode extendedOpcodeTable[ ] = {
+    { 0, 0x01, { Op::OIM   , Reg::M8  , Left::LdSt, Right::None, Adr::Direct    },  6 },
+    { 0, 0x02, { Op::AIM   , Reg::M8  , Left::LdSt, Right::None, Adr::Direct    },  6 },
+    { 0, 0x05, { Op::EIM   , Reg::M8  , Left::LdSt, Right::None, Adr::Direct    },  6 },
+    { 0, 0x0B, { Op::TIM   , Reg::M8  , Left::Ld  , Right::None, Adr::Direct    },  6 },
+    { 0, 0x14, { Op::SEXW  , Reg::None, Left::None, Right::None, Adr::Inherent  },  4 },
+    { 0, 0x61, { Op::OIM   , Reg::M8  , Left::LdSt, Right::None, Adr::Indexed   },  7 },
+    { 0, 0x62, { Op::AIM   , Reg::M8  , Left::LdSt, Right::None, Adr::Indexed   },  7 },
+    { 0, 0x65, { Op::EIM   , Reg::M8  , Left::LdSt, Right::None, Adr::Indexed   },  7 },
+    { 0, 0x6B, { Op::TIM   , Reg::M8  , Left::Ld  , Right::None, Adr::Indexed   },  7 },
+    { 0, 0x71, { Op::OIM   , Reg::M8  , Left::LdSt, Right::None, Adr::Extended  },  7 },
+    { 0, 0x72, { Op::AIM   , Reg::M8  , Left::LdSt, Right::None, Adr::Extended  },  7 },
+    { 0, 0x75, { Op::EIM   , Reg::M8  , Left::LdSt, Right::None, Adr::Extended  },  7 },
+    { 0, 0x7B, { Op::TIM   , Reg::M8  , Left::Ld  , Right::None, Adr::Extended  },  7 },
+    { 0, 0xCD, { Op::LDQ   , Reg::None, Left::None, Right::None, Adr::Immed32   },  5 },
+    { 1, 0x30, { Op::ADDR  , Reg::None, Left::None, Right::None, Adr::Immed8    },  4 },
+    { 1, 0x31, { Op::ADCR  , Reg::None, Left::None, Right::None, Adr::Immed8    },  4 },
+    { 1, 0x32, { Op::SUBR  , Reg::None, Left::None, Right::None, Adr::Immed8    },  4 },
+    { 1, 0x33, { Op::SBCR  , Reg::None, Left::None, Right::None, Adr::Immed8    },  4 },
+    { 1, 0x34, { Op::ANDR  , Reg::None, Left::None, Right::None, Adr::Immed8    },  4 },
+    { 1, 0x35, { Op::ORR   , Reg::None, Left::None, Right::None, Adr::Immed8    },  4 },
+    { 1, 0x36, { Op::EORR  , Reg::None, Left::None, Right::None, Adr::Immed8    },  4 },
+    { 1, 0x37, { Op::CMPR  , Reg::None, Left::None, Right::None, Adr::Immed8    },  4 },
+    { 1, 0x38, { Op::PSHW  , Reg::S   , Left::None, Right::None, Adr::Inherent  },  6 },
+    { 1, 0x39, { Op::PULW  , Reg::S   , Left::None, Right::None, Adr::Inherent  },  6 },
+    { 1, 0x3A, { Op::PSHW  , Reg::U   , Left::None, Right::None, Adr::Inherent  },  6 },
+    { 1, 0x3B, { Op::PULW  , Reg::U   , Left::None, Right::None, Adr::Inherent  },  6 },
+    { 1, 0x40, { Op::NEG16 , Reg::D   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x43, { Op::COM16 , Reg::D   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x44, { Op::LSR16 , Reg::D   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x46, { Op::ROR16 , Reg::D   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x47, { Op::ASR16 , Reg::D   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x48, { Op::ASL16 , Reg::D   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x49, { Op::ROL16 , Reg::D   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x4A, { Op::DEC16 , Reg::D   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x4C, { Op::INC16 , Reg::D   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x4D, { Op::TST16 , Reg::D   , Left::Ld  , Right::None, Adr::Inherent  },  3 },
+    { 1, 0x4F, { Op::CLR16 , Reg::D   , Left::St  , Right::None, Adr::Inherent  },  3 },
+    { 1, 0x53, { Op::COM16 , Reg::W   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x54, { Op::LSR16 , Reg::W   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x56, { Op::ROR16 , Reg::W   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x59, { Op::ROL16 , Reg::W   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x5A, { Op::DEC16 , Reg::W   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x5C, { Op::INC16 , Reg::W   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 1, 0x5D, { Op::TST16 , Reg::W   , Left::Ld  , Right::None, Adr::Inherent  },  3 },
+    { 1, 0x5F, { Op::CLR16 , Reg::W   , Left::St  , Right::None, Adr::Inherent  },  3 },
+    { 1, 0x80, { Op::SUB16 , Reg::W   , Left::Ld  , Right::None, Adr::Immed16   },  5 },
+    { 1, 0x81, { Op::CMP16 , Reg::W   , Left::Ld  , Right::None, Adr::Immed16   },  5 },
+    { 1, 0x82, { Op::SBC16 , Reg::D   , Left::LdSt, Right::None, Adr::Immed16   },  5 },
+    { 1, 0x84, { Op::AND16 , Reg::D   , Left::LdSt, Right::None, Adr::Immed16   },  5 },
+    { 1, 0x85, { Op::BIT16 , Reg::D   , Left::Ld  , Right::None, Adr::Immed16   },  5 },
+    { 1, 0x86, { Op::LD16  , Reg::W   , Left::St  , Right::None, Adr::Immed16   },  4 },
+    { 1, 0x88, { Op::EOR16 , Reg::D   , Left::LdSt, Right::None, Adr::Immed16   },  5 },
+    { 1, 0x89, { Op::ADC16 , Reg::D   , Left::LdSt, Right::None, Adr::Immed16   },  5 },
+    { 1, 0x8A, { Op::OR16  , Reg::D   , Left::LdSt, Right::None, Adr::Immed16   },  5 },
+    { 1, 0x8B, { Op::ADD16 , Reg::W   , Left::LdSt, Right::None, Adr::Immed16   },  5 },
+    { 1, 0x90, { Op::SUB16 , Reg::W   , Left::Ld  , Right::Ld16, Adr::Direct    },  7 },
+    { 1, 0x91, { Op::CMP16 , Reg::W   , Left::Ld  , Right::Ld16, Adr::Direct    },  7 },
+    { 1, 0x92, { Op::SBC16 , Reg::D   , Left::LdSt, Right::Ld16, Adr::Direct    },  7 },
+    { 1, 0x94, { Op::AND16 , Reg::D   , Left::LdSt, Right::Ld16, Adr::Direct    },  7 },
+    { 1, 0x95, { Op::BIT16 , Reg::D   , Left::Ld  , Right::Ld16, Adr::Direct    },  7 },
+    { 1, 0x96, { Op::LD16  , Reg::W   , Left::St  , Right::Ld16, Adr::Direct    },  6 },
+    { 1, 0x97, { Op::ST16  , Reg::W   , Left::Ld  , Right::St16, Adr::Direct    },  6 },
+    { 1, 0x98, { Op::EOR16 , Reg::D   , Left::LdSt, Right::Ld16, Adr::Direct    },  7 },
+    { 1, 0x99, { Op::ADC16 , Reg::D   , Left::LdSt, Right::Ld16, Adr::Direct    },  7 },
+    { 1, 0x9A, { Op::OR16  , Reg::D   , Left::LdSt, Right::Ld16, Adr::Direct    },  7 },
+    { 1, 0x9B, { Op::ADD16 , Reg::W   , Left::LdSt, Right::Ld16, Adr::Direct    },  7 },
+    { 1, 0xA0, { Op::SUB16 , Reg::W   , Left::Ld  , Right::Ld16, Adr::Indexed   },  7 },
+    { 1, 0xA1, { Op::CMP16 , Reg::W   , Left::Ld  , Right::Ld16, Adr::Indexed   },  7 },
+    { 1, 0xA2, { Op::SBC16 , Reg::D   , Left::LdSt, Right::Ld16, Adr::Indexed   },  7 },
+    { 1, 0xA4, { Op::AND16 , Reg::D   , Left::LdSt, Right::Ld16, Adr::Indexed   },  7 },
+    { 1, 0xA5, { Op::BIT16 , Reg::D   , Left::Ld  , Right::Ld16, Adr::Indexed   },  7 },
+    { 1, 0xA6, { Op::LD16  , Reg::W   , Left::St  , Right::Ld16, Adr::Indexed   },  6 },
+    { 1, 0xA7, { Op::ST16  , Reg::W   , Left::Ld  , Right::St16, Adr::Indexed   },  6 },
+    { 1, 0xA8, { Op::EOR16 , Reg::D   , Left::LdSt, Right::Ld16, Adr::Indexed   },  7 },
+    { 1, 0xA9, { Op::ADC16 , Reg::D   , Left::LdSt, Right::Ld16, Adr::Indexed   },  7 },
+    { 1, 0xAA, { Op::OR16  , Reg::D   , Left::LdSt, Right::Ld16, Adr::Indexed   },  7 },
+    { 1, 0xAB, { Op::ADD16 , Reg::W   , Left::LdSt, Right::Ld16, Adr::Indexed   },  7 },
+    { 1, 0xB0, { Op::SUB16 , Reg::W   , Left::Ld  , Right::Ld16, Adr::Extended  },  8 },
+    { 1, 0xB1, { Op::CMP16 , Reg::W   , Left::Ld  , Right::Ld16, Adr::Extended  },  8 },
+    { 1, 0xB2, { Op::SBC16 , Reg::D   , Left::LdSt, Right::Ld16, Adr::Extended  },  8 },
+    { 1, 0xB4, { Op::AND16 , Reg::D   , Left::LdSt, Right::Ld16, Adr::Extended  },  8 },
+    { 1, 0xB5, { Op::BIT16 , Reg::D   , Left::Ld  , Right::Ld16, Adr::Extended  },  8 },
+    { 1, 0xB6, { Op::LD16  , Reg::W   , Left::St  , Right::Ld16, Adr::Extended  },  7 },
+    { 1, 0xB7, { Op::ST16  , Reg::W   , Left::Ld  , Right::St16, Adr::Extended  },  7 },
+    { 1, 0xB8, { Op::EOR16 , Reg::D   , Left::LdSt, Right::Ld16, Adr::Extended  },  8 },
+    { 1, 0xB9, { Op::ADC16 , Reg::D   , Left::LdSt, Right::Ld16, Adr::Extended  },  8 },
+    { 1, 0xBA, { Op::OR16  , Reg::D   , Left::LdSt, Right::Ld16, Adr::Extended  },  8 },
+    { 1, 0xBB, { Op::ADD16 , Reg::W   , Left::LdSt, Right::Ld16, Adr::Extended  },  8 },
+    { 1, 0xDC, { Op::LDQ   , Reg::None, Left::None, Right::None, Adr::Direct    },  8 },
+    { 1, 0xDD, { Op::STQ   , Reg::None, Left::None, Right::None, Adr::Direct    },  8 },
+    { 1, 0xEC, { Op::LDQ   , Reg::None, Left::None, Right::None, Adr::Indexed   },  8 },
+    { 1, 0xED, { Op::STQ   , Reg::None, Left::None, Right::None, Adr::Indexed   },  8 },
+    { 1, 0xFC, { Op::LDQ   , Reg::None, Left::None, Right::None, Adr::Extended  },  9 },
+    { 1, 0xFD, { Op::STQ   , Reg::None, Left::None, Right::None, Adr::Extended  },  9 },
+    { 2, 0x30, { Op::BAND  , Reg::None, Left::None, Right::None, Adr::Direct    },  7 },
+    { 2, 0x31, { Op::BIAND , Reg::None, Left::None, Right::None, Adr::Direct    },  7 },
+    { 2, 0x32, { Op::BOR   , Reg::None, Left::None, Right::None, Adr::Direct    },  7 },
+    { 2, 0x33, { Op::BIOR  , Reg::None, Left::None, Right::None, Adr::Direct    },  7 },
+    { 2, 0x34, { Op::BEOR  , Reg::None, Left::None, Right::None, Adr::Direct    },  7 },
+    { 2, 0x35, { Op::BIEOR , Reg::None, Left::None, Right::None, Adr::Direct    },  7 },
+    { 2, 0x36, { Op::LDBT  , Reg::None, Left::None, Right::None, Adr::Direct    },  7 },
+    { 2, 0x37, { Op::STBT  , Reg::None, Left::None, Right::None, Adr::Direct    },  8 },
+    { 2, 0x38, { Op::TFM   , Reg::None, Left::None, Right::None, Adr::Immed8    },  6 },
+    { 2, 0x39, { Op::TFM   , Reg::None, Left::None, Right::None, Adr::Immed8    },  6 },
+    { 2, 0x3A, { Op::TFM   , Reg::None, Left::None, Right::None, Adr::Immed8    },  6 },
+    { 2, 0x3B, { Op::TFM   , Reg::None, Left::None, Right::None, Adr::Immed8    },  6 },
+    { 2, 0x3C, { Op::BITMD , Reg::None, Left::None, Right::None, Adr::Immed8    },  4 },
+    { 2, 0x3D, { Op::LDMD  , Reg::None, Left::None, Right::None, Adr::Immed8    },  5 },
+    { 2, 0x43, { Op::COM   , Reg::E   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 2, 0x4A, { Op::DEC   , Reg::E   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 2, 0x4C, { Op::INC   , Reg::E   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 2, 0x4D, { Op::TST   , Reg::E   , Left::Ld  , Right::None, Adr::Inherent  },  3 },
+    { 2, 0x4F, { Op::CLR   , Reg::E   , Left::St  , Right::None, Adr::Inherent  },  3 },
+    { 2, 0x53, { Op::COM   , Reg::F   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 2, 0x5A, { Op::DEC   , Reg::F   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 2, 0x5C, { Op::INC   , Reg::F   , Left::LdSt, Right::None, Adr::Inherent  },  3 },
+    { 2, 0x5D, { Op::TST   , Reg::F   , Left::Ld  , Right::None, Adr::Inherent  },  3 },
+    { 2, 0x5F, { Op::CLR   , Reg::F   , Left::St  , Right::None, Adr::Inherent  },  3 },
+    { 2, 0x80, { Op::SUB8  , Reg::E   , Left::LdSt, Right::None, Adr::Immed8    },  3 },
+    { 2, 0x81, { Op::CMP8  , Reg::E   , Left::Ld  , Right::None, Adr::Immed8    },  3 },
+    { 2, 0x86, { Op::LD8   , Reg::E   , Left::St  , Right::None, Adr::Immed8    },  3 },
+    { 2, 0x8B, { Op::ADD8  , Reg::E   , Left::LdSt, Right::None, Adr::Immed8    },  3 },
+    { 2, 0x8D, { Op::DIVD  , Reg::None, Left::None, Right::None, Adr::Immed8    }, 25 },
+    { 2, 0x8E, { Op::DIVQ  , Reg::None, Left::None, Right::None, Adr::Immed16   }, 34 },
+    { 2, 0x8F, { Op::MULD  , Reg::None, Left::None, Right::None, Adr::Immed16   }, 28 },
+    { 2, 0x90, { Op::SUB8  , Reg::E   , Left::LdSt, Right::Ld8 , Adr::Direct    },  5 },
+    { 2, 0x91, { Op::CMP8  , Reg::E   , Left::Ld  , Right::Ld8 , Adr::Direct    },  5 },
+    { 2, 0x96, { Op::LD8   , Reg::E   , Left::St  , Right::Ld8 , Adr::Direct    },  5 },
+    { 2, 0x97, { Op::ST8   , Reg::E   , Left::Ld  , Right::St8 , Adr::Direct    },  5 },
+    { 2, 0x9B, { Op::ADD8  , Reg::E   , Left::LdSt, Right::Ld8 , Adr::Direct    },  5 },
+    { 2, 0x9D, { Op::DIVD  , Reg::None, Left::None, Right::Ld8 , Adr::Direct    }, 27 },
+    { 2, 0x9E, { Op::DIVQ  , Reg::None, Left::None, Right::Ld16, Adr::Direct    }, 36 },
+    { 2, 0x9F, { Op::MULD  , Reg::None, Left::None, Right::Ld16, Adr::Direct    }, 30 },
+    { 2, 0xA0, { Op::SUB8  , Reg::E   , Left::LdSt, Right::Ld8 , Adr::Indexed   },  5 },
+    { 2, 0xA1, { Op::CMP8  , Reg::E   , Left::Ld  , Right::Ld8 , Adr::Indexed   },  5 },
+    { 2, 0xA6, { Op::LD8   , Reg::E   , Left::St  , Right::Ld8 , Adr::Indexed   },  5 },
+    { 2, 0xA7, { Op::ST8   , Reg::E   , Left::Ld  , Right::St8 , Adr::Indexed   },  5 },
+    { 2, 0xAB, { Op::ADD8  , Reg::E   , Left::LdSt, Right::Ld8 , Adr::Indexed   },  5 },
+    { 2, 0xAD, { Op::DIVD  , Reg::None, Left::None, Right::Ld8 , Adr::Indexed   }, 27 },
+    { 2, 0xAE, { Op::DIVQ  , Reg::None, Left::None, Right::Ld16, Adr::Indexed   }, 36 },
+    { 2, 0xAF, { Op::MULD  , Reg::None, Left::None, Right::Ld16, Adr::Indexed   }, 30 },
+    { 2, 0xB0, { Op::SUB8  , Reg::E   , Left::LdSt, Right::Ld8 , Adr::Extended  },  6 },
+    { 2, 0xB1, { Op::CMP8  , Reg::E   , Left::Ld  , Right::Ld8 , Adr::Extended  },  6 },
+    { 2, 0xB6, { Op::LD8   , Reg::E   , Left::St  , Right::Ld8 , Adr::Extended  },  6 },
+    { 2, 0xB7, { Op::ST8   , Reg::E   , Left::Ld  , Right::St8 , Adr::Extended  },  6 },
+    { 2, 0xBB, { Op::ADD8  , Reg::E   , Left::LdSt, Right::Ld8 , Adr::Extended  },  6 },
+    { 2, 0xBD, { Op::DIVD  , Reg::None, Left::None, Right::Ld8 , Adr::Extended  }, 28 },
+    { 2, 0xBE, { Op::DIVQ  , Reg::None, Left::None, Right::Ld16, Adr::Extended  }, 37 },
+    { 2, 0xBF, { Op::MULD  , Reg::None, Left::None, Right::Ld16, Adr::Extended  }, 31 },
+    { 2, 0xC0, { Op::SUB8  , Reg::F   , Left::LdSt, Right::None, Adr::Immed8    },  3 },
+    { 2, 0xC1, { Op::CMP8  , Reg::F   , Left::Ld  , Right::None, Adr::Immed8    },  3 },
+    { 2, 0xC6, { Op::LD8   , Reg::F   , Left::St  , Right::None, Adr::Immed8    },  3 },
+    { 2, 0xCB, { Op::ADD8  , Reg::F   , Left::LdSt, Right::None, Adr::Immed8    },  3 },
+    { 2, 0xD0, { Op::SUB8  , Reg::F   , Left::LdSt, Right::Ld8 , Adr::Direct    },  5 },
+    { 2, 0xD1, { Op::CMP8  , Reg::F   , Left::Ld  , Right::Ld8 , Adr::Direct    },  5 },
+    { 2, 0xD6, { Op::LD8   , Reg::F   , Left::St  , Right::Ld8 , Adr::Direct    },  5 },
+    { 2, 0xD7, { Op::ST8   , Reg::F   , Left::Ld  , Right::St8 , Adr::Direct    },  5 },
+    { 2, 0xDB, { Op::ADD8  , Reg::F   , Left::LdSt, Right::Ld8 , Adr::Direct    },  5 },
+    { 2, 0xE0, { Op::SUB8  , Reg::F   , Left::LdSt, Right::Ld8 , Adr::Indexed   },  5 },
+    { 2, 0xE1, { Op::CMP8  , Reg::F   , Left::Ld  , Right::Ld8 , Adr::Indexed   },  5 },
+    { 2, 0xE6, { Op::LD8   , Reg::F   , Left::St  , Right::Ld8 , Adr::Indexed   },  5 },
+    { 2, 0xE7, { Op::ST8   , Reg::F   , Left::Ld  , Right::St8 , Adr::Indexed   },  5 },
+    { 2, 0xEB, { Op::ADD8  , Reg::F   , Left::LdSt, Right::Ld8 , Adr::Indexed   },  5 },
+    { 2, 0xF0, { Op::SUB8  , Reg::F   , Left::LdSt, Right::Ld8 , Adr::Extended  },  6 },
+    { 2, 0xF1, { Op::CMP8  , Reg::F   , Left::Ld  , Right::Ld8 , Adr::Extended  },  6 },
+    { 2, 0xF6, { Op::LD8   , Reg::F   , Left::St  , Right::Ld8 , Adr::Extended  },  6 },
+    { 2, 0xF7, { Op::ST8   , Reg::F   , Left::Ld  , Right::St8 , Adr::Extended  },  6 },
+    { 2, 0xFB, { Op::ADD8  , Reg::F   , Left::LdSt, Right::Ld8 , Adr::Extended  },  6 },
+};
+
+static constexpr uint8_t NumExtendedOpcodes = sizeof(extendedOpcodeTable) / sizeof(ExtendedOpcode);
+
+// Index + 1 of the extendedOpcodeTable entry for index on page, 0 if it has none
+static constexpr uint8_t findExtendedOpcode(uint8_t page, uint8_t index, uint8_t i = 0)
+{
+    return (i == NumExtendedOpcodes) ? 0 :
+           ((extendedOpcodeTable[i].page == page && extendedOpcodeTable[i].index == index) ? i + 1 :
+            findExtendedOpcode(page, index, i + 1));
+}
+
+template<size_t... I>
+static constexpr std::array<uint8_t, sizeof...(I)> makeExtendedOpcodeIndex(std::index_sequence<I...>)
+{
+    return { { findExtendedOpcode(I / 256, I % 256)... } };
+}
+
+static constexpr std::array<uint8_t, 3 * 256> extendedOpcodeIndex = makeExtendedOpcodeIndex(std::make_index_sequence<3 * 256>());
+#endif
+
+// Resolve the parts of an opcode table entry which depend on the prefix.
+// These are constexpr so the specialized handlers can resolve them at
+// compile time
+static constexpr Reg resolveReg(Reg reg, Op prefix)
+{
+    return (reg == Reg::DDU) ? ((prefix == Op::Page3) ? Reg::U : Reg::D) :
+           (reg == Reg::XYS) ? ((prefix == Op::Page2) ? Reg::Y : ((prefix == Op::Page3) ? Reg::S : Reg::X)) :
+           (reg == Reg::XY)  ? ((prefix == Op::Page2) ? Reg::Y : ((prefix == Op::Page3) ? Reg::None : Reg::X)) :
+           (reg == Reg::US)  ? ((prefix == Op::Page2) ? Reg::S : ((prefix == Op::Page3) ? Reg::None : Reg::U)) :
+           reg;
+}
+
+// Prefixed SUB16 ops are CMPD, CMPY, CMPU and CMPS
+static constexpr Op resolveOp(Op op, Op prefix)
+{
+    return (prefix != Op::NOP && op == Op::SUB16) ? Op::CMP16 : op;
+}
+
+// Page2 turns a short branch into a long one
+static constexpr Adr resolveAdr(Adr adr, Op prefix)
+{
+    return (adr != Adr::RelP) ? adr : ((prefix == Op::Page2) ? Adr::RelL : Adr::Rel);
+}
+
+static constexpr Op pagePrefix(uint8_t page)
+{
+    return (page == 1) ? Op::Page2 : ((page == 2) ? Op::Page3 : Op::NOP);
+}
 
-static inline uint16_t concat(uint8_t a, uint8_t b)
+static constexpr Opcode resolveOpcode(const Opcode& opcode, Op prefix)
 {
-    return (uint16_t(a) << 8) | uint16_t(b);
+    // Assigned a field at a time, since a brace list would narrow into the bitfields
+    Opcode resolved = opcode;
+    resolved.op = resolveOp(opcode.op, prefix);
+    resolved.reg = resolveReg(opcode.reg, prefix);
+    resolved.adr = resolveAdr(opcode.adr, prefix);
+    return resolved;
+}
+
+// The opcode for index on page (0 for no prefix, 1 for Page2 and 2 for
+// Page3) with the prefix resolved
+static constexpr Opcode pageOpcode(uint8_t page, uint8_t index)
+{
+#ifdef HD6309
+    return extendedOpcodeIndex[page * 256 + index] ?
+                extendedOpcodeTable[extendedOpcodeIndex[page * 256 + index] - 1].opcode :
+                resolveOpcode(opcodeTable[index], pagePrefix(page));
+#else
+    return resolveOpcode(opcodeTable[index], pagePrefix(page));
+#endif
 }
 
 void SRecordInfo::ParseError(unsigned linenum, const char *fmt, va_list args)
@@ -432,6 +767,13 @@ void SRecordInfo::ParseError(unsigned linenum, const char *fmt, va_list args)
     _boss9->printF("\n");
 }
 
+void SRecordInfo::rangeError(const SRecordData *sRecData)
+{
+    _outOfRange = true;
+    _boss9->printF("Error: line %d: $%04x-$%04x is outside of RAM\n", sRecData->m_lineNum,
+                   sRecData->m_addr, sRecData->m_addr + sRecData->m_dataLen - 1);
+}
+
 const char*
 Emulator::regToString(Reg op, Op prevOp)
 {
@@ -447,6 +789,13 @@ Emulator::regToString(Reg op, Op prevOp)
         case Reg::CC:   return "CC";
         case Reg::PC:   return "PC";
         case Reg::DP:   return "DP";
+#ifdef HD6309
+        case Reg::W:    return "W";
+        case Reg::V:    return "V";
+        case Reg::E:    return "E";
+        case Reg::F:    return "F";
+        case Reg::MD:   return "MD";
+#endif
         case Reg::DDU:  return (prevOp == Op::Page2) ? "D" : ((prevOp == Op::Page3) ? "U" : "D");
         case Reg::XYS:  return (prevOp == Op::Page2) ? "Y" : ((prevOp == Op::Page3) ? "S" : "X");
         case Reg::XY:   return (prevOp == Op::Page2) ? "Y" : ((prevOp == Op::Page3) ?  "" : "X");
@@ -457,192 +806,32 @@ Emulator::regToString(Reg op, Op prevOp)
 void
 Emulator::printInstructions(uint16_t addr, uint16_t n)
 {
-    while (n-- > 0) {
-        uint16_t instAddr = addr;
-        const Opcode* opcode = &(opcodeTable[load8(addr++)]);
-        Op prevOp = Op::NOP;
-        Op op = opcode->op;
-        
-        if (op == Op::Page2 || op == Op::Page3) {
-            prevOp = op;
-            opcode = &(opcodeTable[load8(addr++)]);
-        }
-        
-        // Do the addr mode
-        uint16_t ea = 0;
-        int16_t relAddr = 0;
-        uint16_t value = 0;
-        int16_t offset = 0;
-        const char* longBranch = "";
-        const char* indexReg = nullptr;
-        const char* offsetReg = nullptr;
-        bool indirect = false;
-        int8_t autoInc = 0;
-        Adr addrMode = opcode->adr;
-        
-        switch(addrMode) {
-            case Adr::None:
-            case Adr::Inherent:
-                break;
-            case Adr::Direct:
-                ea = load8(addr++);
-                break;
-            case Adr::Extended:
-                ea = load16(addr);
-                addr += 2;
-                break;
-            case Adr::Immed8:
-                value = load8(addr++);
-                break;
-            case Adr::Immed16:
-                value = load16(addr);
-                addr += 2;
-                break;
-                
-            case Adr::RelL:
-                relAddr = int16_t(load16(addr));
-                addr += 2;
-                longBranch = "l";
-                break;
-            case Adr::Rel:
-                relAddr = int8_t(load8(addr++));
-                break;
-          case Adr::RelP:
-                if (prevOp == Op::Page2) {
-                    relAddr = int16_t(load16(addr));
-                    addr += 2;
-                    longBranch = "l";
-                    addrMode = Adr::RelL;
-                } else {
-                    relAddr = int8_t(load8(addr++));
-                    addrMode = Adr::Rel;
-                }
-                break;
-            case Adr::Indexed: {
-                uint8_t postbyte = load8(addr++);
-                
-                // Load value of RR reg in ea
-                switch (RR(postbyte & 0b01100000)) {
-                    case RR::X: indexReg = "X"; break;
-                    case RR::Y: indexReg = "Y"; break;
-                    case RR::U: indexReg = "U"; break;
-                    case RR::S: indexReg = "S"; break;
-                }
-                
-                if ((postbyte & 0x80) == 0) {
-                    // Constant offset direct (5 bit signed)
-                    offset = postbyte & 0x1f;
-                    if (offset & 0x10) {
-                        offset |= 0xe0;
-                    }
-                } else {
-                    switch(IdxMode(postbyte & IdxModeMask)) {
-                        case IdxMode::ConstRegNoOff   : offset = 0; break;
-                        case IdxMode::ConstReg8Off    : offset = int8_t(load8(addr)); addr += 1; break;
-                        case IdxMode::ConstReg16Off   : offset = int16_t(load16(addr)); addr += 2; break;
-                        case IdxMode::AccAOffReg      : offsetReg = "A"; break;
-                        case IdxMode::AccBOffReg      : offsetReg = "B"; break;
-                        case IdxMode::AccDOffReg      : offsetReg = "D"; break;
-                        case IdxMode::Inc1Reg         : autoInc = 1; break;
-                        case IdxMode::Inc2Reg         : autoInc = 2; break;
-                        case IdxMode::Dec1Reg         : autoInc = -1; break;
-                        case IdxMode::Dec2Reg         : autoInc = -2; break;
-                        case IdxMode::ConstPC8Off     : offset = int8_t(load8(addr)); addr += 1; indexReg = "PC"; break;
-                        case IdxMode::ConstPC16Off    : offset = _pc + int16_t(load16(addr)); addr += 2; indexReg = "PC"; break;
-                        case IdxMode::Extended:
-                            offset = load16(addr);
-                            addr += 2;
-                            indexReg = nullptr;
-                            break;
-                    }
-                    
-                    if (postbyte & IndexedIndMask) {
-                        // indirect
-                        indirect = true;
-                    }
-                }
-                    
-                break;
-            }
+    Disassembler disassembler(_symbols);
+    uint8_t code[256];
+    char buf[2048];
+    uint32_t count = n;
+    
+    while (count) {
+        // Fetched, like instructions, so watchpoints don't see it
+        uint16_t size = uint16_t(std::min(uint32_t(sizeof(code)), count * Disassembler::MaxInstructionSize));
+        for (uint16_t i = 0; i < size; ++i) {
+            code[i] = fetch8(uint16_t(addr + i));
         }
         
-        _boss9->printF("[$%04x]    %s%s%s", instAddr, longBranch, opToString(op), regToString(opcode->reg, prevOp));
-
-        switch(addrMode) {
-            case Adr::None:
-            case Adr::Inherent: break;
-            case Adr::Direct:   _boss9->printF("  <$%02x", ea); break;
-            case Adr::Extended: _boss9->printF("  >$%04x", ea); break;
-            case Adr::Immed16:  _boss9->printF("  #$%04x", value); break;
-            case Adr::Rel:      _boss9->printF("  %d", relAddr); break;
-            case Adr::RelL:     _boss9->printF("  %d", relAddr); break;
-            case Adr::RelP:     break;
-            case Adr::Immed8:
-                if (op == Op::TFR || op == Op::EXG) {
-                    _boss9->printF("  %s,%s", regToString(Reg(uint8_t(value) >> 4), prevOp),
-                                              regToString(Reg(uint8_t(value) & 0xf), prevOp));
-                } else if (op == Op::PSH || op == Op::PUL) {
-                    _boss9->printF("  ");
-                    
-                    const char* pushRegs[8] = { "CC", "A", "B", "DP", "X", "Y", "S", "PC" };
-                    bool first = true;
-                    
-                    for (int i = 0; i < 8; ++i) {
-                        if ((value & (0x01 << i)) != 0) {
-                            const char* r = pushRegs[i];
-                            if (r[0] == 'S' && opcode->reg == Reg::S) {
-                                r = "U";
-                            }
-                            if (!first) {
-                                _boss9->printF(",");
-                            }
-                            _boss9->printF("%s", r);
-                            first = false;
-                        }
-                    }
-                } else {
-                    _boss9->printF("  #$%02x", value);
-                }
-                break;
-            case Adr::Indexed:
-                if (indexReg) {
-                    if (offsetReg) {
-                        if (indirect) {
-                            _boss9->printF("  %s,%s", offsetReg, indexReg); break;
-                        } else {
-                            _boss9->printF("  [%s,%s]", offsetReg, indexReg); break;
-                        }
-                    } else if (autoInc != 0) {
-                        if (indirect) {
-                            if (autoInc > 0) {
-                                _boss9->printF("  [,%s%s]", (autoInc == 1) ? "+" : "++", indexReg); break;
-                            } else {
-                                _boss9->printF("  [,%s%s]", indexReg, (autoInc == -1) ? "-" : "--"); break;
-                            }
-                        } else {
-                            if (autoInc > 0) {
-                                _boss9->printF("  ,%s%s", (autoInc == 1) ? "+" : "++", indexReg); break;
-                            } else {
-                                _boss9->printF("  ,%s%s", indexReg, (autoInc == -1) ? "-" : "--"); break;
-                            }
-                        }
-                    } else {
-                        if (indirect) {
-                            _boss9->printF("  [%d,%s]", offset, indexReg); break;
-                        } else {
-                            _boss9->printF("  %d,%s", offset, indexReg); break;
-                        }
-                    }
-                } else {
-                    // Must be extended indirect
-                    _boss9->printF("  [$%04x]", offset); break;
-                }
-                break;
+        size_t used = disassembler.range(code, size, addr, count, buf, sizeof(buf));
+        _boss9->puts(buf);
+        addr += uint16_t(used);
+    }
+}
 
-        }
-        
-        _boss9->printF("\n");
+uint8_t
+Emulator::disassemble(uint16_t addr, char* buf)
+{
+    uint8_t code[Disassembler::MaxInstructionSize];
+    for (uint8_t i = 0; i < sizeof(code); ++i) {
+        code[i] = fetch8(uint16_t(addr + i));
     }
+    return Disassembler(_symbols).instruction(code, sizeof(code), addr, buf);
 }
     
 void Emulator::loadStart()
@@ -654,7 +843,23 @@ void Emulator::loadStart()
 bool Emulator::loadLine(const char* data, bool& finished)
 {
     _lineNum++;
-    if (!sRecInfo.ParseLine(_lineNum, data)) {
+    bool result = sRecInfo.ParseLine(_lineNum, data);
+    
+#ifdef BLOCK_CACHE
+    // The s-record data is copied straight into RAM
+    flushBlockCache();
+#endif
+
+#ifdef IDLE_LOOPS
+    resetIdleWatch();
+#endif
+
+#ifdef SNAPSHOTS
+    // So it's not tracked as written either
+    setAllPagesClean(false);
+#endif
+
+    if (!result || sRecInfo.outOfRange()) {
         return false;
     }
     finished = sRecInfo.finished();
@@ -667,616 +872,1977 @@ uint16_t Emulator::loadEnd()
     return sRecInfo.startAddr();
 }
 
-bool Emulator::execute(RunState runState)
+bool Emulator::loadImage(const uint8_t* data, size_t size, uint16_t& startAddr, ImageFormat format, uint16_t rawAddr)
 {
-    uint32_t instructionsToExecute = InstructionsToExecutePerContinue;
-    bool firstTime = true;
+    Loader loader(_ram, _ramSize);
+    bool result = loader.load(data, size, format, rawAddr);
     
-    while(true) {
-        // if runState is not Running we need to ignore a breakpoint at the
-        // PC upon entry. Continuing and all the stepping states need to
-        // execute the first instruction they encounter
-        if (!firstTime || runState == RunState::Running) {
-            if (atBreakpoint(_pc)) {
-                _boss9->printF("\n*** hit breakpoint at addr $%04x\n\n", _pc);
-                _boss9->call(Func::mon);
-                return true;
-            }
-        }
-        
-        firstTime = false;
-        
-#ifdef TRACE
-        _traceBuffer[_traceBufferIndex++] = _pc;
-        if (_traceBufferIndex >= TraceBufferSize) {
-            _traceBufferIndex = 0;
-        }
+#ifdef BLOCK_CACHE
+    // Even a failed load can have written some of RAM
+    flushBlockCache();
 #endif
-        
-        uint16_t ea = 0;
-        uint8_t opIndex = next8();
-        
-        const Opcode* opcode = &(opcodeTable[opIndex]);
-                
-        // Handle address modes
-        // If this is an addressing mode that produces a 16 bit effective address
-        // it will be placed in ea. If it's immediate or branch relative then the
-        // 8 or 16 bit value is placed in _right
-        //
-        // NOTE: gcc seems to have a problem with emum class and bitfields. It
-        // tries to cast the value to an int, which can't be done implicitly with
-        // enum class. Moving the value into a bare variable solves the problem.
-        //
-        Adr adr = opcode->adr;
-        
-        switch(adr) {
-            case Adr::None:
-            case Adr::Inherent:
-                break;
-            case Adr::Direct:
-                ea = concat(_dp, next8());
-                break;
-            case Adr::Extended:
-                ea = next16();
-                break;
-            case Adr::Immed8:
-                _right = next8();
-                break;
-            case Adr::Immed16:
-                _right = next16();
-                break;
-                
-            // All the relative addressing modes need to be sign extended to 32 bits
-            case Adr::RelL:
-                _right = int16_t(next16());
-                break;
-            case Adr::Rel:
-                _right = int8_t(next8());
-                break;
-          case Adr::RelP:
-                if (_prevOp == Op::Page2) {
-                    _right = int16_t(next16());
-                } else {
-                    _right = int8_t(next8());
-                }
-                break;
-            case Adr::Indexed: {
-                uint8_t postbyte = next8();
-                uint16_t* reg = nullptr;
-                
-                // Load value of RR reg in ea
-                switch (RR(postbyte & 0b01100000)) {
-                    case RR::X: reg = &_x; break;
-                    case RR::Y: reg = &_y; break;
-                    case RR::U: reg = &_u; break;
-                    case RR::S: reg = &_s; break;
-                }
-                
-                if ((postbyte & 0x80) == 0) {
-                    // Constant offset direct (5 bit signed)
-                    int8_t offset = postbyte & 0x1f;
-                    if (offset & 0x10) {
-                        offset |= 0xe0;
-                    }
-                    
-                    ea = *reg + offset;
-                } else {
-                    switch(IdxMode(postbyte & IdxModeMask)) {
-                        case IdxMode::ConstRegNoOff   : ea = *reg; break;
-                        case IdxMode::ConstReg8Off    : ea = *reg + int8_t(load8(_pc)); _pc += 1; break;
-                        case IdxMode::ConstReg16Off   : ea = *reg + int16_t(load16(_pc)); _pc += 2; break;
-                        case IdxMode::AccAOffReg      : ea = *reg + int8_t(_a); break;
-                        case IdxMode::AccBOffReg      : ea = *reg + int8_t(_b); break;
-                        case IdxMode::AccDOffReg      : ea = *reg + int16_t(_d); break;
-                        case IdxMode::Inc1Reg         : ea = *reg; (*reg) += 1; break;
-                        case IdxMode::Inc2Reg         : ea = *reg; (*reg) += 2; break;
-                        case IdxMode::Dec1Reg         : (*reg) -= 1; ea = *reg; break;
-                        case IdxMode::Dec2Reg         : (*reg) -= 2; ea = *reg; break;
-                        case IdxMode::ConstPC8Off     : ea = _pc + int8_t(load8(_pc)); _pc += 1; break;
-                        case IdxMode::ConstPC16Off    : ea = _pc + int16_t(load16(_pc)); _pc += 2; break;
-                        case IdxMode::Extended        : ea = next16();
-                    }
-                    
-                    if (postbyte & IndexedIndMask) {
-                        // indirect from ea
-                        ea = load16(ea);
-                    }
-                }
-                    
-                break;
-            }
-        }
-        
-        // Get left operand
-        if (opcode->left == Left::Ld || opcode->left == Left::LdSt) {
-            if (opcode->reg == Reg::M8) {
-                _left = load8(ea);
-            } else if (opcode->reg == Reg::M16) {
-                _left = load16(ea);
-            } else {
-                _left = getReg(opcode->reg);
-            }
-        }
-        
-        // Get right operand
-        if (opcode->right == Right::Ld8) {
-            _right = load8(ea);
-        } else if (opcode->right == Right::Ld16) {
-            _right = load16(ea);
-        }
-                
-        // Perform operation
-        Op op = opcode->op;
-        
-        switch(op) {
-            case Op::ILL:
-                _error = Error::Illegal;
-                return false;
-            case Op::Page2:
-            case Op::Page3:
-                // We never want to leave execution after a Page2 or Page3.
-                // They are basically just part of the next instruction.
-                // Since we do the check for whether or not to leave the
-                // loop at the end we can ensure that simply by doing
-                // a continue to skip that test
-                _prevOp = op;
-                continue;
-
-            case Op::BHS:
-            case Op::BCC: if (!_cc.C) _pc += _right; break;
-            case Op::BLO:
-            case Op::BCS: if (_cc.C) _pc += _right; break;
-            case Op::BEQ: if (_cc.Z) _pc += _right; break;
-            case Op::BGE: if (!NxorV()) _pc += _right; break;
-            case Op::BGT: if (!(NxorV() || _cc.Z)) _pc += _right; break;
-            case Op::BHI: if (!_cc.C && !_cc.Z) _pc += _right; break;
-            case Op::BLE: if (NxorV() || _cc.Z) _pc += _right; break;
-            case Op::BLS: if (_cc.C || _cc.Z) _pc += _right; break;
-            case Op::BLT: if (NxorV()) _pc += _right; break;
-            case Op::BMI: if (_cc.N) _pc += _right; break;
-            case Op::BNE: if (!_cc.Z) _pc += _right; break;
-            case Op::BPL: if (!_cc.N) _pc += _right; break;
-            case Op::BRA: _pc += _right; break;
-            case Op::BRN: break;
-            case Op::BVC: if (!_cc.V) _pc += _right; break;
-            case Op::BVS: if (_cc.V) _pc += _right; break;
-            case Op::BSR:
-                push16(_s, _pc);
-                _pc += _right;
-                _subroutineDepth += 1;
-                break;
-
-            case Op::ABX:
-                _x = _x + uint16_t(_b);
-                break;
-            case Op::ADC:
-                _result = _left + _right + (_cc.C ? 1 : 0);
-                HNZVC8();
-                break;
-            case Op::ADD8:
-                _result = _left + _right;
-                HNZVC8();
-                break;
-            case Op::ADD16:
-                _result = _left + _right;
-                xNZVC16();
-                break;
-            case Op::AND:
-                _result = _left & _right;
-                xNZ0x8();
-                break;
-            case Op::ANDCC:
-                _ccByte &= _right;
-                break;
-            case Op::ASL:
-                _result = _left << 1;
-                xNZxC8();
-                _cc.V = (((_left & 0x40) >> 6) ^ ((_left & 0x80) >> 7)) != 0;
-                break;
-            case Op::ASR:
-                _result = int16_t(_left) >> 1;
-                if (_left & 0x80) {
-                    _result |= 0x80;
-                }
-                xNZxC8();
-                break;
-            case Op::BIT:
-                _result = _left ^ _right;
-                xNZ0x8();
-                break;
-            case Op::CLR:
-                _result = 0;
-                _cc.N = false;
-                _cc.Z = true;
-                _cc.V = false;
-                _cc.C = false;
-                break;
-            case Op::CMP8:
-            case Op::SUB8:
-                _result = _left - _right;
-                xNZVC8();
-                break;
-            case Op::CMP16:
-            case Op::SUB16:
-                _result = _left - _right;
-                xNZVC16();
-                
-                // We need to do setReg here because if we're on an altPage these
-                // are actually CMP16 and not SUB16
-                if (_prevOp != Op::Page2 && _prevOp != Op::Page3 && opcode->op == Op::SUB16) {
-                    setReg(opcode->reg, _result);
-                }
-                break;
-            case Op::COM:
-                _result = ~_right;
-                xNZ018();
-                break;
-            case Op::CWAI:
-                _ccByte ^= _right;
-                _cc.E = true;
-                push16(_s, _pc);
-                push16(_s, _u);
-                push16(_s, _y);
-                push16(_s, _x);
-                push8(_s, _dp);
-                push8(_s, _b);
-                push8(_s, _a);
-                
-                // Now what?
-                break;
-            case Op::DAA: {
-                _result = _a;
-                uint8_t LSN = _result & 0x0f;
-                uint8_t MSN = (_result & 0xf0) >> 4;
-                
-                // LSN
-                if (_cc.H || LSN > 9) {
-                    _result += 6;
-                }
-                
-                // MSN
-                if (_cc.C || (MSN > 9) || (MSN > 8 && LSN > 9)) {
-                    _result += 0x60;
-                }
-                xNZ0C8();
-                _a = _result;
-                break;
-            }
-            case Op::DEC:
-                _result = _left - 1;
-                xNZxx8();
-                _cc.V = _left == 0x80;
-                break;
-            case Op::EOR:
-                _result = _left ^ _right;
-                xNZ0x8();
-                break;
-            case Op::EXG: {
-                uint16_t r1 = getReg(Reg(_right & 0xf));
-                uint16_t r2 = getReg(Reg(_right >> 4));
-                setReg(Reg(_right & 0xf), r2);
-                setReg(Reg(_right >> 4), r1);
-                break;
-            }
-            case Op::INC:
-                _result = _left + 1;
-                xNZxx8();
-                _cc.V = _left == 0x7f;
-                break;
-            case Op::JMP:
-            case Op::JSR:
-                if (ea >= SystemAddrStart) {
-                    // This is possibly a system call
-                    if (!_boss9->call(Func(ea))) {
-                        return true;
-                    }
-                } else {
-                    if (op == Op::JSR) {
-                        push16(_s, _pc);
-                    }
-                    _pc = ea;
-                    if (op == Op::JSR) {
-                        _subroutineDepth += 1;
-                    }
-                }
-                break;
-            case Op::LD8:
-                _result = _right;
-                xNZ0x8();
-                break;
-            case Op::LD16:
-                _result = _right;
-                xNZ0x16();
-                break;
-            case Op::LEA:
-                _result = ea;
-                if (opcode->reg == Reg::X || opcode->reg == Reg::Y) {
-                    _cc.Z = _result == 0;
-                }
-                break;
-            case Op::LSR:
-                _result = _left >> 1;
-                x0ZxC8();
-                break;
-            case Op::MUL:
-                _d = _a * _b;
-                _cc.Z = _d == 0;
-                _cc.C = _b & 0x80;
-                break;
-            case Op::NEG:
-                _result = -_left;
-                xNZxC8();
-                _cc.V = _left == 0x80;
-                break;
-            case Op::NOP:
-                break;
-            case Op::OR:
-                _result = _left | _right;
-                xNZ0x8();
-                break;
-            case Op::ORCC:
-                _ccByte |= _right;
-                break;
-            case Op::PSH:
-            case Op::PUL: {
-                // bit pattern to push or pull are in _right
-                uint16_t& stack = (opcode->reg == Reg::U) ? _u : _s;
-                if (opcode->op == Op::PSH) {
-                    if (_right & 0x80) push16(stack, _pc);
-                    if (_right & 0x40) push16(stack, (opcode->reg == Reg::U) ? _s : _u);
-                    if (_right & 0x20) push16(stack, _y);
-                    if (_right & 0x10) push16(stack, _x);
-                    if (_right & 0x08) push8(stack, _dp);
-                    if (_right & 0x04) push8(stack, _b);
-                    if (_right & 0x02) push8(stack, _a);
-                    if (_right & 0x01) push8(stack, _ccByte);
-                } else {
-                    if (_right & 0x01) _ccByte = pop8(stack);
-                    if (_right & 0x02) _a = pop8(stack);
-                    if (_right & 0x04) _b = pop8(stack);
-                    if (_right & 0x08) _dp = pop8(stack);
-                    if (_right & 0x10) _x = pop16(stack);
-                    if (_right & 0x20) _y = pop16(stack);
-                    if (_right & 0x40) {
-                        if (opcode->reg == Reg::U) {
-                            _s = pop16(stack);
-                        } else {
-                            _u = pop16(stack);
-                        }
-                    }
-                    if (_right & 0x80) _pc = pop16(stack);
-                }
-                break;
-            }
-            case Op::ROL:
-                _result = _left << 1;
-                if (_cc.C) {
-                    _result |= 0x01;
-                }
-                xNZxC8();
-                _cc.V = (((_left & 0x40) >> 6) ^ ((_left & 0x80) >> 7)) != 0;
-                break;
-            case Op::ROR:
-                _result = _left >> 1;
-                xNZxx8();
-                if (_cc.C) {
-                    _result |= 0x80;
-                }
-                if (_left & 0x01) {
-                    _cc.C = true;
-                }
-                break;
-            case Op::RTI:
-                if (_cc.E) {
-                    _a = pop8(_s);
-                    _b = pop8(_s);
-                    _dp = pop8(_s);
-                    _x = pop16(_s);
-                    _y = pop16(_s);
-                    _u = pop16(_s);
-                }
-                _pc = pop16(_s);
-                break;
-            case Op::RTS:
-                _pc = pop16(_s);
-                _subroutineDepth -= 1;
-                if (_lastRunState != RunState::Running && _subroutineDepth == 0) {
-                    _boss9->printF("\n*** step %s, stopped at addr $%04x\n\n",
-                            (_lastRunState == RunState::StepOver) ? "over" : "out", _pc);
-                    // enter the monitor
-                    _boss9->call(Func::mon);
-                    return true;
-                }
-                break;
-            case Op::SBC:
-                _result = _left - _right - (_cc.C ? 1 : 0);
-                xNZVC8();
-                break;
-            case Op::SEX:
-                _a = (_b & 0x80) ? 0xff : 0;
-                xNZ0x8();
-                break;
-            case Op::ST8:
-                xNZ0x8();
-                break;
-            case Op::ST16: // All done in pre and post processing
-                xNZ0x16();
-                break;
-            case Op::SWI:
-                _cc.E = true;
-                push16(_s, _pc);
-                push16(_s, _u);
-                push16(_s, _y);
-                push16(_s, _x);
-                push8(_s, _dp);
-                push8(_s, _b);
-                push8(_s, _a);
-                _cc.I = true;
-                _cc.F = true;
-                if (_prevOp == Op::Page3) {
-                    _pc = load16(0xfff2);
-                } else if (_prevOp == Op::Page2) {
-                    _pc = load16(0xfff4);
-                } else {
-                    _pc = load16(0xfffa);
-                }
-                break;
-            case Op::SYNC:
-                // Now what?
-                break;
-            case Op::TFR:
-                setReg(Reg(_right & 0xf), getReg(Reg(_right >> 4)));
-                break;
-            case Op::TST:
-                _result = _left - 0;
-                xNZ0x8();
-                break;
-            case Op::FIRQ:
-            case Op::IRQ:
-            case Op::NMI:
-            case Op::RESTART:
-                // Now what?
-                break;
-        }
-        
-        // Store _result
-        if (opcode->right == Right::St8) {
-            store8(ea, _left);
-        } else if (opcode->right == Right::St16) {
-            store16(ea, _left);
-        } else if (opcode->left == Left::St || opcode->left == Left::LdSt) {
-            if (opcode->right == Right::St8 || opcode->reg == Reg::M8) {
-                store8(ea, _result);
-            } else if (opcode->right == Right::St16 || opcode->reg == Reg::M16) {
-                store16(ea, _result);
-            } else {
-                setReg(opcode->reg, _result);
-            }
-        }
-        
-        _prevOp = opcode->op;
-        
-        // Step handling
-        //
-        //  Step In     - Go back to monitor after each instruction executed
-        //  Step Over   - Behave like Step In unless current instruction is
-        //                BSR or JSR in which case we run until that subroutine
-        //                returns.
-        //  Step Out    - Run until we return from current subroutine. If none
-        //                then we never enter monitor until program exits of ESC.
-        //
-        // When doing Step Over or Step Out we need to stop when we hit RTS. but
-        // there might be nested subroutines so we have to keep track of the
-        // depth using _subroutineDepth. When we execute BSR or JSR we increment
-        // and when we hit RTS we decrement. When it hits 0 we stop. For Step Over
-        // we start with _subroutineDepth = 0. Entering the current BSR or JSR
-        // increments to 0 and the matching RTS decrements back to 0 and we
-        // enter the monitor. If there are nested subroutines _subroutineDepth
-        // keeps track of them so we return on the correct RTS. For Step Out
-        // we set _subroutineDepth = 1 so the next RTS we see will stop.
-        //
-        if (runState != RunState::Running) {
-            _lastRunState = runState;
-        }
-        
-        bool handleStepOverLikeStepIn = false;
-        
-        if (runState == RunState::StepOver) {
-            if ((_prevOp != Op::BSR && _prevOp != Op::JSR) ||
-                    (_prevOp == Op::JSR && ea >= SystemAddrStart)) {
-                handleStepOverLikeStepIn = true;
-            } else {
-                _subroutineDepth = 1;
-            }
-        }
-        
-        if (runState == RunState::StepIn || handleStepOverLikeStepIn) {
-            _boss9->printF("\n*** step %s, stopped at addr $%04x\n\n",
-                    (_lastRunState == RunState::StepIn) ? "in" : "over", _pc);
-            _boss9->call(Func::mon);
-            return true;
-        }
-        
-        if (runState == RunState::StepOut) {
-            _subroutineDepth = 1;
-        }
-
-        runState = RunState::Running;
-        
-        if (--instructionsToExecute == 0) {
-            return true;
-        }
-    }
-}
 
-void Emulator::readOnlyAddr(uint16_t addr)
-{
-    _boss9->printF("Address $%04x is read-only\n", addr);
-}
+#ifdef IDLE_LOOPS
+    resetIdleWatch();
+#endif
 
-void Emulator::checkActiveBreakpoints()
-{
-    _haveBreakpoints = false;
-    for (auto it : _breakpoints) {
-        if (it.status == BPStatus::Enabled) {
-            _haveBreakpoints = true;
-            return;
-        }
-    }
-}
+#ifdef SNAPSHOTS
+    setAllPagesClean(false);
+#endif
 
-bool Emulator::breakpoint(uint8_t i, BreakpointEntry& entry) const
-{
-    if (i >= NumBreakpoints || _breakpoints[i].status == BPStatus::Empty) {
+    if (!result) {
+        _boss9->printF("Error: %s\n", loader.error());
         return false;
     }
-    entry = _breakpoints[i];
+    startAddr = loader.startAddr();
     return true;
 }
 
-bool Emulator::setBreakpoint(uint16_t addr, uint8_t& i)
+#ifdef COMPUTE_CYCLES
+// Extra cycles taken by the indexed addressing modes
+static uint8_t indexedCycles(uint8_t postbyte)
 {
-    i = 0;
-    for (auto &it : _breakpoints) {
-        if (it.status == BPStatus::Empty) {
-            it.status = BPStatus::Enabled;
-            it.addr = addr;
-            _haveBreakpoints = true;
-            return true;
-        }
-        i += 1;
+    if ((postbyte & 0x80) == 0) {
+        return 1;
     }
-    return false;
+    
+#ifdef HD6309
+    if (wIndexed(postbyte)) {
+        // ,W  n16,W  ,W++  ,--W. Indirection takes 3 more
+        static constexpr uint8_t wCycles[4] = { 0, 2, 1, 1 };
+        uint8_t cycles = wCycles[(postbyte >> 5) & 0x03];
+        return ((postbyte & IdxWMask) == IdxWInd) ? cycles + 3 : cycles;
+    }
+#endif
+    
+    uint8_t cycles = 0;
+    switch(IdxMode(postbyte & IdxModeMask)) {
+        case IdxMode::ConstRegNoOff   : cycles = 0; break;
+        case IdxMode::ConstReg8Off    : cycles = 1; break;
+        case IdxMode::ConstReg16Off   : cycles = 4; break;
+        case IdxMode::AccAOffReg      :
+        case IdxMode::AccBOffReg      : cycles = 1; break;
+        case IdxMode::AccDOffReg      : cycles = 4; break;
+        case IdxMode::Inc1Reg         :
+        case IdxMode::Dec1Reg         : cycles = 2; break;
+        case IdxMode::Inc2Reg         :
+        case IdxMode::Dec2Reg         : cycles = 3; break;
+        case IdxMode::ConstPC8Off     : cycles = 1; break;
+        case IdxMode::ConstPC16Off    : cycles = 5; break;
+        case IdxMode::Extended        : return 5;
+#ifdef HD6309
+        case IdxMode::AccEOffReg      :
+        case IdxMode::AccFOffReg      : cycles = 1; break;
+        case IdxMode::AccWOffReg      : cycles = 4; break;
+#endif
+    }
+    
+    // Indirection takes 3 more
+    return (postbyte & IndexedIndMask) ? cycles + 3 : cycles;
 }
 
-bool Emulator::clearBreakpoint(uint8_t i)
+// Cycles for a decoded instruction. Everything but a taken
+// long conditional branch and RTI with E set is known here. page
+// only matters for the 6309 ops
+static uint8_t instructionCycles([[maybe_unused]] uint8_t page, uint8_t opIndex, const DecodedInst& inst)
 {
-    // Clear the passed breakpoint and move all the others past it up one
-    if (i >= NumBreakpoints || _breakpoints[i].status == BPStatus::Empty) {
-        return false;
+    uint8_t cycles = cyclesTable[opIndex];
+    
+    if (inst.prefix != Op::NOP) {
+        if (inst.adr == Adr::RelL) {
+            // Long conditional branches take 6 if the branch is taken
+            cycles = 5;
+        } else if (inst.op == Op::SWI) {
+            cycles = 20;
+        } else {
+            cycles += 1;
+        }
     }
     
-    for ( ; i < NumBreakpoints - 1; ++i) {
-        _breakpoints[i] = _breakpoints[i + 1];
+#ifdef HD6309
+    // The 6309 ops have their own counts, TFM adds 3 for each byte
+    if (extendedOpcodeIndex[page * 256 + opIndex]) {
+        cycles = extendedOpcodeTable[extendedOpcodeIndex[page * 256 + opIndex] - 1].cycles;
     }
-    _breakpoints[i].status = BPStatus::Empty;
+#endif
     
-    checkActiveBreakpoints();
-    return true;
+    if (inst.adr == Adr::Indexed) {
+        cycles += indexedCycles(inst.postbyte);
+    }
+    
+    if (inst.op == Op::PSH || inst.op == Op::PUL) {
+        // One cycle per byte pushed or pulled
+        uint8_t regs = inst.operand;
+        cycles += ((regs & 0x80) ? 2 : 0) + ((regs & 0x40) ? 2 : 0) + ((regs & 0x20) ? 2 : 0) + ((regs & 0x10) ? 2 : 0) +
+                  ((regs & 0x08) ? 1 : 0) + ((regs & 0x04) ? 1 : 0) + ((regs & 0x02) ? 1 : 0) + ((regs & 0x01) ? 1 : 0);
+    }
+    return cycles;
 }
+#endif
 
-bool Emulator::clearAllBreakpoints()
+#ifdef TRACE
+// The TraceReg bit for a register, or 0 if the trace doesn't have it
+static uint8_t traceReg(Reg reg)
 {
-    for (auto &it : _breakpoints) {
-        it.status = BPStatus::Empty;
+    switch (reg) {
+        case Reg::A:
+        case Reg::B:
+        case Reg::D:    return TraceRegD;
+        case Reg::X:    return TraceRegX;
+        case Reg::Y:    return TraceRegY;
+        case Reg::U:    return TraceRegU;
+        case Reg::S:    return TraceRegS;
+        case Reg::DP:   return TraceRegDP;
+        default:        return 0;
     }
-    checkActiveBreakpoints();
-    return true;
 }
 
-bool Emulator::disableBreakpoint(uint8_t i)
+// Set the trace fields of a decoded instruction. traceRegs has the
+// registers it can change, so only they need to be looked at after it
+// runs. An instruction which can change ones its operands don't name,
+// like a system call or a pull, gets all of them. An index register
+// incremented or decremented is left to traceIndex unless it's also
+// written or the mode is indirect, when ea doesn't say what it became
+static void setTraceInfo(DecodedInst& inst)
 {
-    if (i >= NumBreakpoints || _breakpoints[i].status == BPStatus::Empty) {
+    inst.traceFlags = std::min(inst.size, uint8_t(5));
+    if (inst.adr == Adr::Direct || inst.adr == Adr::Extended || inst.adr == Adr::Indexed) {
+        inst.traceFlags |= TraceEA;
+    }
+    inst.traceIndex = 0;
+    
+    // SUB16 is Left::Ld in the opcode table but it stores its result
+    uint8_t regs = 0;
+    if (inst.left == Left::St || inst.left == Left::LdSt || inst.op == Op::SUB16) {
+        regs = traceReg(inst.reg);
+    }
+    
+    uint8_t postbyte = inst.postbyte;
+    bool autoIndex = inst.adr == Adr::Indexed && (postbyte & 0x80) && (postbyte & IdxModeMask) <= uint8_t(IdxMode::Dec2Reg);
+#ifdef HD6309
+    autoIndex = autoIndex && !wIndexed(postbyte);
+#endif
+    
+    switch (inst.op) {
+        default:
+            break;
+        case Op::ABX:
+            regs |= TraceRegX;
+            break;
+        case Op::DAA:
+        case Op::SEX:
+        case Op::MUL:
+            regs |= TraceRegD;
+            break;
+        case Op::BSR:
+        case Op::RTS:
+            regs |= TraceRegS;
+            break;
+        case Op::PSH:
+            regs |= traceReg(inst.reg);
+            break;
+        case Op::JMP:
+        case Op::JSR:
+            // Only an extended address is known to not be a system call
+            if (inst.adr != Adr::Extended || inst.operand >= SystemAddrStart) {
+                regs = TraceRegAll;
+                break;
+            }
+            regs |= (inst.op == Op::JSR) ? TraceRegS : 0;
+            break;
+        case Op::ILL:
+        case Op::Page2:
+        case Op::Page3:
+        case Op::EXG:
+        case Op::TFR:
+        case Op::PUL:
+        case Op::RTI:
+        case Op::SWI:
+        case Op::CWAI:
+        case Op::SYNC:
+        case Op::FIRQ:
+        case Op::IRQ:
+        case Op::NMI:
+        case Op::RESTART:
+            regs = TraceRegAll;
+            break;
+#ifdef HD6309
+        case Op::SEXW:
+        case Op::LDQ:
+            regs |= TraceRegD;
+            break;
+        case Op::PSHW:
+        case Op::PULW:
+            regs |= traceReg(inst.reg);
+            break;
+        case Op::ADDR:
+        case Op::ADCR:
+        case Op::SUBR:
+        case Op::SBCR:
+        case Op::ANDR:
+        case Op::ORR:
+        case Op::EORR:
+        case Op::CMPR:
+        case Op::BAND:
+        case Op::BIAND:
+        case Op::BOR:
+        case Op::BIOR:
+        case Op::BEOR:
+        case Op::BIEOR:
+        case Op::LDBT:
+        case Op::STBT:
+        case Op::TFM:
+        case Op::DIVD:
+        case Op::DIVQ:
+        case Op::MULD:
+            regs = TraceRegAll;
+            break;
+#endif
+    }
+    
+    if (autoIndex) {
+        static const uint8_t indexRegs[4] = { TraceRegX, TraceRegY, TraceRegU, TraceRegS };
+        uint8_t index = indexRegs[(postbyte >> 5) & 0x03];
+        if ((postbyte & IndexedIndMask) || (regs & index)) {
+            regs |= index;
+        } else {
+            // Increments leave it past ea, decrements at it
+            IdxMode mode = IdxMode(postbyte & IdxModeMask);
+            uint8_t past = (mode == IdxMode::Inc1Reg) ? 1 : ((mode == IdxMode::Inc2Reg) ? 2 : 0);
+            inst.traceIndex = index | uint8_t(past << TraceIndexShift);
+        }
+    }
+    inst.traceRegs = regs;
+}
+#endif
+
+// Decode the instruction at pc, reading its bytes with fetch8. Sets
+// everything but the handler, and returns the page and index of the
+// opcode to look it up
+template<typename Fetch8>
+static inline void decodeInst(uint16_t pc, DecodedInst& inst, Fetch8 fetch8, uint8_t& page, uint8_t& opIndex)
+{
+    auto fetch16 = [&fetch8](uint16_t ea) { return uint16_t((uint16_t(fetch8(ea)) << 8) | uint16_t(fetch8(uint16_t(ea + 1)))); };
+
+    uint16_t addr = pc;
+    opIndex = fetch8(addr++);
+    Op prefix = Op::NOP;
+    
+    // Only the last of a run of prefixes counts. Give up on a long
+    // run (which leaves op as Page2 or Page3 and is treated as illegal)
+    while ((opcodeTable[opIndex].op == Op::Page2 || opcodeTable[opIndex].op == Op::Page3) && uint16_t(addr - pc) < 4) {
+        prefix = opcodeTable[opIndex].op;
+        opIndex = fetch8(addr++);
+    }
+    
+    page = (prefix == Op::Page2) ? 1 : ((prefix == Op::Page3) ? 2 : 0);
+    const Opcode opcode = pageOpcode(page, opIndex);
+    
+    // NOTE: gcc seems to have a problem with emum class and bitfields. It
+    // tries to cast the value to an int, which can't be done implicitly with
+    // enum class. Moving the value into a bare variable solves the problem.
+    Op op = opcode.op;
+    Adr adr = opcode.adr;
+    
+    inst.op = op;
+    inst.reg = opcode.reg;
+    inst.left = opcode.left;
+    inst.right = opcode.right;
+    inst.prefix = prefix;
+    inst.postbyte = 0;
+    inst.operand = 0;
+    
+#ifdef HD6309
+    inst.extra = 0;
+    if ((op >= Op::OIM && op <= Op::TIM) || (op >= Op::BAND && op <= Op::STBT)) {
+        // The immediate byte or bit op postbyte comes before the address
+        inst.extra = fetch8(addr++);
+    } else if (op == Op::TFM) {
+        inst.extra = opIndex & 0x03;
+    }
+#endif
+    
+    switch(adr) {
+        case Adr::None:
+        case Adr::Inherent:
+            break;
+        case Adr::Direct:
+        case Adr::Immed8:
+            inst.operand = fetch8(addr++);
+            break;
+        case Adr::Extended:
+        case Adr::Immed16:
+            inst.operand = fetch16(addr);
+            addr += 2;
+            break;
+#ifdef HD6309
+        case Adr::Immed32:
+            inst.operand = fetch16(addr);
+            inst.extra = fetch16(addr + 2);
+            addr += 4;
+            break;
+#endif
+        case Adr::RelL:
+            inst.operand = fetch16(addr);
+            addr += 2;
+            break;
+        case Adr::Rel:
+        case Adr::RelP:
+            inst.operand = int8_t(fetch8(addr++));
+            break;
+        case Adr::Indexed: {
+            uint8_t postbyte = fetch8(addr++);
+            inst.postbyte = postbyte;
+            
+            if ((postbyte & 0x80) == 0) {
+                // Constant offset direct (5 bit signed)
+                int8_t offset = postbyte & 0x1f;
+                if (offset & 0x10) {
+                    offset |= 0xe0;
+                }
+                inst.operand = offset;
+#ifdef HD6309
+            } else if (wIndexed(postbyte)) {
+                // Only n16,W has an offset
+                if (RR(postbyte & 0b01100000) == RR::Y) {
+                    inst.operand = fetch16(addr);
+                    addr += 2;
+                }
+#endif
+            } else {
+                // PC relative modes are relative to the address of
+                // the offset, so the final address is known here
+                switch(IdxMode(postbyte & IdxModeMask)) {
+                    default: break;
+                    case IdxMode::ConstReg8Off    : inst.operand = int8_t(fetch8(addr)); addr += 1; break;
+                    case IdxMode::ConstReg16Off   : inst.operand = fetch16(addr); addr += 2; break;
+                    case IdxMode::ConstPC8Off     : inst.operand = addr + 1 + int8_t(fetch8(addr)); addr += 1; break;
+                    case IdxMode::ConstPC16Off    : inst.operand = addr + 2 + int16_t(fetch16(addr)); addr += 2; break;
+                    case IdxMode::Extended        : inst.operand = fetch16(addr); addr += 2; break;
+                }
+            }
+            break;
+        }
+    }
+    
+    inst.adr = adr;
+    inst.size = uint8_t(addr - pc);
+    
+#ifdef COMPUTE_CYCLES
+    inst.cycles = instructionCycles(page, opIndex, inst);
+#endif
+#ifdef TRACE
+    setTraceInfo(inst);
+#endif
+}
+
+void Emulator::decode(uint16_t pc, DecodedInst& inst)
+{
+    uint8_t page;
+    uint8_t opIndex;
+    decodeInst(pc, inst, [this](uint16_t ea) { return fetch8(ea); }, page, opIndex);
+    
+#ifdef OPCODE_HANDLERS
+    inst.handler = _handlers[page * 256 + opIndex];
+#else
+    (void) page;
+    (void) opIndex;
+#endif
+}
+
+void mc6809::decodeInstruction(const uint8_t* code, size_t size, uint16_t pc, DecodedInst& inst)
+{
+    uint8_t page;
+    uint8_t opIndex;
+    decodeInst(pc, inst, [code, size, pc](uint16_t ea) { return (uint16_t(ea - pc) < size) ? code[uint16_t(ea - pc)] : uint8_t(0); },
+               page, opIndex);
+    
+#ifdef OPCODE_HANDLERS
+    inst.handler = nullptr;
+#endif
+}
+
+#ifdef BLOCK_CACHE
+static inline bool uncachedPage(const uint8_t* pageInvalidations, uint16_t addr)
+{
+    return pageInvalidations[addr >> 8] >= MaxPageInvalidations;
+}
+
+DecodedBlock& Emulator::decodeBlock(uint16_t pc)
+{
+    if (uncachedPage(_pageInvalidations, pc)) {
+        _scratchBlock.pc = pc;
+        _scratchBlock.count = 1;
+        decode(pc, _scratchBlock.insts[0]);
+        _scratchBlock.bytes = _scratchBlock.insts[0].size;
+#ifdef IDLE_LOOPS
+        _scratchBlock.idleHead = false;
+#endif
+        return _scratchBlock;
+    }
+    
+    if (_nextBlock >= BlockCacheSize) {
+        flushBlockCache();
+    }
+    
+    uint16_t slot = _nextBlock++;
+    DecodedBlock& block = _blocks[slot];
+    block.pc = pc;
+    block.count = 0;
+#ifdef JIT
+    block.entries = 0;
+    block.code = nullptr;
+#endif
+    
+    // Stop at the end of the block, at the system area, where addr wraps,
+    // where we would run into a self modifying page or before a breakpoint
+    uint16_t addr = pc;
+    while (block.count < MaxBlockInsts) {
+        DecodedInst& inst = block.insts[block.count++];
+        decode(addr, inst);
+        
+        uint16_t next = addr + inst.size;
+        if (endsBlock(inst) || next >= SystemAddrStart || next < addr ||
+                uncachedPage(_pageInvalidations, next) || atBreakpoint(next)) {
+            addr = next;
+            break;
+        }
+        addr = next;
+    }
+    
+    block.bytes = addr - pc;
+    
+    for (uint16_t i = 0; i < block.bytes; ++i) {
+        uint16_t a = pc + i;
+        _codePages[a >> 8] = 1;
+        _codeBytes[a >> 3] |= uint8_t(1 << (a & 0x07));
+    }
+    
+#ifdef RECOMPILED
+    block.native = _recompiled ? findRecompiled(block) : nullptr;
+#endif
+    
+#ifdef IDLE_LOOPS
+    bool polls;
+    block.idleHead = idleLoop(pc, polls) != 0;
+#endif
+    
+    _blockIndex[pc] = slot + 1;
+    return block;
+}
+
+void Emulator::flushBlockCache()
+{
+    _blockInvalidated = true;
+#ifdef IDLE_LOOPS
+    resetIdleWatch();
+#endif
+    
+    // Nothing can have been decoded or invalidated since the last flush
+    if (_nextBlock == 0) {
+        return;
+    }
+    
+    memset(_blockIndex, 0, 65536 * sizeof(uint16_t));
+    memset(_codePages, 0, sizeof(_codePages));
+    memset(_pageInvalidations, 0, sizeof(_pageInvalidations));
+    memset(_codeBytes, 0, sizeof(_codeBytes));
+    _nextBlock = 0;
+    
+#ifdef JIT
+    // Translations are only reachable through the blocks
+    if (_jit) {
+        _jit->reset();
+    }
+#endif
+}
+
+void Emulator::invalidateCode(uint16_t ea)
+{
+    if ((_codeBytes[ea >> 3] & (1 << (ea & 0x07))) == 0) {
+        return;
+    }
+    
+    // Remove every block that covers ea. Blocks are at most
+    // MaxBlockInsts * 8 bytes long, so that's as far back as
+    // we need to look. After that no block covers ea so its
+    // code bit can be cleared.
+    for (uint16_t i = 0; i < MaxBlockInsts * 8; ++i) {
+        uint16_t pc = ea - i;
+        uint16_t slot = _blockIndex[pc];
+        if (slot && _blocks[slot - 1].bytes > i) {
+            _blockIndex[pc] = 0;
+            _blockInvalidated = true;
+        }
+    }
+    
+    _codeBytes[ea >> 3] &= ~uint8_t(1 << (ea & 0x07));
+    
+    uint8_t& count = _pageInvalidations[ea >> 8];
+    if (count < MaxPageInvalidations) {
+        count += 1;
+    }
+}
+#endif
+
+#ifdef CHECK_LAZY_FLAGS
+bool Emulator::checkLazyFlags(uint16_t pc)
+{
+    // Compute the pending flags without resolving them, so the
+    // lazy state carries on exactly as it would without the check
+    uint8_t lazy = mergeFlags(_ccByte, _lazyFlags, computeFlags(_flagSign, _flagLeft, _flagRight, _flagResult));
+    
+    if (lazy == _checkCCByte) {
+        return true;
+    }
+    
+    _boss9->printF("\n*** lazy flags $%02x don't match $%02x after instruction at addr $%04x\n\n",
+            lazy, _checkCCByte, pc);
+    return false;
+}
+#endif
+
+#ifdef OPCODE_HANDLERS
+template<uint8_t Page, uint8_t Opcode>
+StepResult Emulator::handler(Emulator& emulator, const DecodedInst& inst, uint16_t& ea)
+{
+    static constexpr mc6809::Opcode opcode = pageOpcode(Page, Opcode);
+    
+    return emulator.exec(opcode.op, opcode.reg, opcode.adr, opcode.left, opcode.right, inst, ea);
+}
+
+const std::array<InstHandler, 3 * 256> Emulator::_handlers = Emulator::makeHandlers(std::make_index_sequence<3 * 256>());
+#endif
+
+#ifdef TRACE
+uint64_t Emulator::fetchTraceBytes(uint16_t pc, const DecodedInst& inst)
+{
+    uint64_t bytes = 0;
+    for (uint8_t i = 0; i < inst.size && i < 5; ++i) {
+        bytes |= uint64_t(fetch8(pc + i)) << (i * 8);
+    }
+    return bytes;
+}
+
+void Emulator::traceAll(uint16_t pc, uint64_t bytes, const DecodedInst& inst, uint16_t ea,
+                        uint64_t cycles, uint8_t instCycles)
+{
+    _trace->instruction(pc, bytes, inst.traceFlags, ea, traceRegisters(), cycles, instCycles);
+}
+
+TraceRegisters Emulator::traceRegisters()
+{
+    TraceRegisters regs;
+    regs.d = _d;
+    regs.x = _x;
+    regs.y = _y;
+    regs.u = _u;
+    regs.s = _s;
+    regs.dp = _dp;
+    regs.cc = ccByte();
+    return regs;
+}
+
+void Emulator::traceSkipped(uint16_t pc, uint64_t instructions, uint64_t cycles)
+{
+    if (_trace && _instructions != instructions) {
+        _trace->skip(pc, uint32_t(_instructions - instructions), traceRegisters(), cycles);
+    }
+}
+#endif
+
+#ifdef PROFILER
+StepResult Emulator::profileStep(const DecodedInst& inst, uint16_t& ea)
+{
+    uint16_t pc = _pc;
+#ifdef COMPUTE_CYCLES
+    uint64_t cycles = _cycles;
+#endif
+    
+    StepResult result = dispatch(inst, ea);
+    
+#ifdef COMPUTE_CYCLES
+    _profiler->instruction(pc, uint32_t(_cycles - cycles));
+#else
+    _profiler->instruction(pc, 1);
+#endif
+    
+    if (result != StepResult::Continue) {
+        return result;
+    }
+    
+    // The instruction is charged to the caller. A JSR into
+    // the system area is a system call, which pushes nothing
+    switch (inst.op) {
+        default:
+            break;
+        case Op::JSR:
+            if (ea >= SystemAddrStart) {
+                break;
+            }
+            [[fallthrough]];
+        case Op::BSR:
+        case Op::SWI:
+            _profiler->call(_pc, _s);
+            break;
+        case Op::RTS:
+        case Op::RTI:
+            _profiler->ret(_s);
+            break;
+        case Op::PUL:
+            if (inst.reg == Reg::S && (inst.operand & 0x80)) {
+                _profiler->ret(_s);
+            }
+            break;
+    }
+    return result;
+}
+#endif
+
+#ifdef STATS
+void Emulator::countInstruction(const DecodedInst& inst)
+{
+    _stats->instruction(inst);
+}
+#endif
+
+bool Emulator::execute(RunState runState)
+{
+    uint16_t ea;
+    
+    _stoppedAtBreakpoint = false;
+#ifdef IDLE_LOOPS
+    _idle = Idle::None;
+#endif
+    if (_instructions >= _instructionLimit) {
+        return true;
+    }
+    _quantumEnd = std::min(_instructions + _quantum, _instructionLimit);
+    
+#ifdef TRACE
+    // The monitor, a snapshot or a replay could have changed any register
+    if (_trace) {
+        _trace->resync();
+    }
+#endif
+    
+    if (interruptCheckNeeded() && !checkInterrupts()) {
+        return true;
+    }
+    
+    // If runState is not Running we need to ignore a breakpoint at the
+    // PC upon entry. Continuing and all the stepping states need to
+    // execute the first instruction they encounter. After that they
+    // all behave like Running.
+    if (runState != RunState::Running) {
+        DecodedInst inst;
+        decode(_pc, inst);
+        
+        StepResult result = step(inst, ea);
+        _instructions += 1;
+        if (result != StepResult::Continue) {
+            return result == StepResult::Stop;
+        }
+        if (_watchHit) {
+            return hitWatchpoint();
+        }
+        if (stepDone(runState, ea) || _instructions == _quantumEnd) {
+            return true;
+        }
+    }
+    
+    while(true) {
+#ifdef BLOCK_CACHE
+        if (interruptCheckNeeded() && !checkInterrupts()) {
+            return true;
+        }
+        if (_watchHit) {
+            return hitWatchpoint();
+        }
+        
+        // Blocks end before a breakpoint, so one can only be at the start
+        if (atBreakpoint(_pc)) {
+            return hitBreakpoint();
+        }
+        
+        // Run the block at the current pc until the quantum is used up,
+        // an instruction changes flow, a store hits decoded code or an
+        // access hits a watchpoint
+        DecodedBlock& block = findBlock(_pc);
+        _blockInvalidated = false;
+        
+#ifdef IDLE_LOOPS
+        if (block.idleHead && idlePass(runState)) {
+            return true;
+        }
+#endif
+        
+#ifdef RECOMPILED
+        if (block.native && !mustInterpret(block, runState)) {
+#ifdef TRACE
+            uint16_t pc = _pc;
+            uint64_t instructions = _instructions;
+#ifdef COMPUTE_CYCLES
+            uint64_t cycles = _cycles;
+#else
+            uint64_t cycles = 0;
+#endif
+#endif
+            StepResult result = block.native(*this);
+#ifdef TRACE
+            traceSkipped(pc, instructions, cycles);
+#endif
+            if (result != StepResult::Continue) {
+                return result == StepResult::Stop;
+            }
+            if (_instructions == _quantumEnd) {
+                return true;
+            }
+            continue;
+        }
+#endif
+        
+#ifdef JIT
+        if (_jit && runTranslated(block, runState)) {
+            if (_instructions == _quantumEnd) {
+                return true;
+            }
+            continue;
+        }
+#endif
+        
+        for (uint8_t i = 0; i < block.count; ++i) {
+            const DecodedInst& inst = block.insts[i];
+            uint16_t nextPC = _pc + inst.size;
+            
+            StepResult result = step(inst, ea);
+            _instructions += 1;
+            if (result != StepResult::Continue) {
+                return result == StepResult::Stop;
+            }
+            if (_instructions == _quantumEnd) {
+                // Report a watchpoint hit by the last instruction now,
+                // so it's at the right instruction count
+                return _watchHit ? hitWatchpoint() : true;
+            }
+            if (_pc != nextPC || _blockInvalidated) {
+                break;
+            }
+        }
+#else
+        if (atBreakpoint(_pc)) {
+            return hitBreakpoint();
+        }
+        
+        DecodedInst inst;
+        uint16_t pc = _pc;
+        decode(pc, inst);
+        
+        StepResult result = step(inst, ea);
+        _instructions += 1;
+        if (result != StepResult::Continue) {
+            return result == StepResult::Stop;
+        }
+        if (_watchHit) {
+            return hitWatchpoint();
+        }
+        if (_instructions == _quantumEnd || _waitState != WaitState::None) {
+            return true;
+        }
+        
+#ifdef IDLE_LOOPS
+        // Without blocks, any branch back might be to the start of a loop
+        if (_pc <= pc && (inst.adr == Adr::Rel || inst.adr == Adr::RelL) && idlePass(runState)) {
+            return true;
+        }
+#endif
+#endif
+    }
+}
+
+#if defined(JIT) || defined(RECOMPILED) || defined(IDLE_LOOPS)
+bool Emulator::everyInstructionSeen(RunState runState) const
+{
+    if (_haveBreakpoints || _haveWatchpoints ||
+            runState == RunState::StepIn || runState == RunState::StepOver || runState == RunState::StepOut) {
+        return true;
+    }
+#ifdef PROFILER
+    if (_profiler) {
+        return true;
+    }
+#endif
+    return false;
+}
+#endif
+
+#if defined(JIT) || defined(RECOMPILED)
+bool Emulator::mustInterpret(const DecodedBlock& block, RunState runState) const
+{
+    // Self modifying pages are decoded into _scratchBlock
+    if (&block == &_scratchBlock || everyInstructionSeen(runState)) {
+        return true;
+    }
+#ifdef STATS
+    if (_stats) {
+        return true;
+    }
+#endif
+    return false;
+}
+#endif
+
+#ifdef RECOMPILED
+RecompiledFunc Emulator::findRecompiled(const DecodedBlock& block)
+{
+    const RecompiledBlock* recompiled = _recompiled->find(block.pc);
+    
+    // Stores to the block's bytes are caught by the block cache, so it's
+    // enough for the recompiled code to be inside it. That also keeps
+    // it from running past anything that ended the block early.
+    if (!recompiled || recompiled->bytes > block.bytes) {
+        return nullptr;
+    }
+    
+    const uint8_t* code = _recompiled->code(*recompiled);
+    for (uint16_t i = 0; i < recompiled->bytes; ++i) {
+        if (fetch8(block.pc + i) != code[i]) {
+            return nullptr;
+        }
+    }
+    return recompiled->func;
+}
+#endif
+
+#ifdef JIT
+bool Emulator::runTranslated(DecodedBlock& block, RunState runState)
+{
+    if (mustInterpret(block, runState)) {
+        return false;
+    }
+    
+    if (!block.code) {
+        // Only one try at translating, so entries stops one past the threshold
+        if (block.entries > JitThreshold) {
+            return false;
+        }
+        if (++block.entries <= JitThreshold) {
+            return false;
+        }
+        
+        block.code = _jit->translate(*this, block);
+        if (!block.code) {
+            // The blocks are all thrown away when the code buffer is full,
+            // so the hot ones get translated again into the empty buffer
+            if (_jit->full()) {
+                flushBlockCache();
+            }
+            return false;
+        }
+    }
+    
+    uint64_t instructions = _instructions;
+#ifdef TRACE
+    uint16_t pc = _pc;
+#ifdef COMPUTE_CYCLES
+    uint64_t cycles = _cycles;
+#else
+    uint64_t cycles = 0;
+#endif
+#endif
+    block.code(this);
+#ifdef TRACE
+    traceSkipped(pc, instructions, cycles);
+#endif
+    return _instructions != instructions;
+}
+#endif
+
+#ifdef IDLE_LOOPS
+// True if the instruction can write memory
+static bool storesMemory(const DecodedInst& inst)
+{
+    switch (inst.op) {
+        default:
+            return inst.right == Right::St8 || inst.right == Right::St16 ||
+                   ((inst.left == Left::St || inst.left == Left::LdSt) &&
+                    (inst.reg == Reg::M8 || inst.reg == Reg::M16));
+        case Op::PSH:
+        case Op::BSR:
+        case Op::JSR:
+        case Op::SWI:
+        case Op::CWAI:
+#ifdef HD6309
+        case Op::PSHW:
+        case Op::STQ:
+        case Op::STBT:
+        case Op::TFM:
+#endif
+            return true;
+    }
+}
+
+uint8_t Emulator::idleLoop(uint16_t head, bool& polls)
+{
+    polls = false;
+    uint16_t pc = head;
+    for (uint8_t n = 1; n <= MaxIdleLoopInsts; ++n) {
+        DecodedInst inst;
+        decode(pc, inst);
+        pc += inst.size;
+        
+        if (inst.op == Op::JMP || inst.op == Op::JSR) {
+            // System calls go on to the next instruction. The ones
+            // which read input are what a program polls
+            if (inst.adr != Adr::Extended) {
+                return 0;
+            }
+            switch (Func(inst.operand)) {
+                case Func::getc:
+                case Func::peekc:
+                case Func::gets:
+                case Func::peeks:
+                    polls = true;
+                    continue;
+                default:
+                    return 0;
+            }
+        }
+        
+        if ((inst.adr == Adr::Rel || inst.adr == Adr::RelL) && inst.op != Op::BSR) {
+            if (uint16_t(pc + inst.operand) == head) {
+                return n;
+            }
+            
+            // Any other branch leaves the loop or skips part of it, so a
+            // pass which takes it has a different number of instructions
+            if (inst.op == Op::BRA) {
+                return 0;
+            }
+            continue;
+        }
+        
+        if (storesMemory(inst) || endsBlock(inst)) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+void Emulator::idleRegs(uint16_t* regs)
+{
+    regs[0] = _d;
+    regs[1] = _x;
+    regs[2] = _y;
+    regs[3] = _u;
+    regs[4] = _s;
+    regs[5] = _dp;
+    regs[6] = ccByte();
+#ifdef HD6309
+    regs[7] = _w;
+    regs[8] = _v;
+    regs[9] = _md;
+#endif
+}
+
+bool Emulator::idlePass(RunState runState)
+{
+    IdleWatch& watch = _idleWatch;
+    if (watch.valid && watch.head == _pc && watch.insts == 0) {
+        return false;
+    }
+    
+    // Anything but one pass of the loop since the last could have
+    // changed it, so it has to be looked at again
+    bool onePass = watch.valid && watch.head == _pc && _instructions - watch.instructions == watch.insts;
+    if (!onePass) {
+        watch.valid = true;
+        watch.head = _pc;
+        watch.insts = idleLoop(_pc, watch.polls);
+    }
+    
+    uint16_t regs[IdleRegCount];
+    idleRegs(regs);
+    bool same = onePass && memcmp(regs, watch.regs, sizeof(regs)) == 0;
+    bool polled = watch.polls || _deviceReads != watch.deviceReads;
+    
+    uint64_t passCycles = 0;
+#ifdef COMPUTE_CYCLES
+    passCycles = _cycles - watch.cycles;
+    watch.cycles = _cycles;
+#endif
+    watch.instructions = _instructions;
+    watch.deviceReads = _deviceReads;
+    memcpy(watch.regs, regs, sizeof(regs));
+    
+    if (!same || everyInstructionSeen(runState)) {
+        return false;
+    }
+    
+    // Each pass does what this one did until something outside the
+    // loop changes. Input or a device could at any time
+    if (polled) {
+        _idle = Idle::Polling;
+        return true;
+    }
+    
+    // Otherwise only an interrupt can, so skip the passes before the end
+    // of the quantum. The rest of the quantum runs as usual, so it ends
+    // where it would have
+    uint64_t passes = (_quantumEnd - _instructions) / watch.insts;
+    if (passes == 0) {
+        return false;
+    }
+    
+#ifdef TRACE
+    uint64_t instructions = _instructions;
+#ifdef COMPUTE_CYCLES
+    uint64_t cycles = _cycles;
+#else
+    uint64_t cycles = 0;
+#endif
+#endif
+    _instructions += passes * watch.insts;
+    watch.instructions = _instructions;
+#ifdef COMPUTE_CYCLES
+    _cycles += passes * passCycles;
+    watch.cycles = _cycles;
+#endif
+#ifdef TRACE
+    traceSkipped(_pc, instructions, cycles);
+#endif
+    
+#ifdef STATS
+    if (_stats) {
+        _stats->idle(passes * watch.insts, passes * passCycles);
+    }
+#endif
+    
+    _idle = Idle::Waiting;
+    return _instructions == _quantumEnd;
+}
+#endif
+
+void Emulator::assertInterrupt(Interrupt line)
+{
+    _pendingInterrupts.fetch_or(uint8_t(line));
+    _boss9->interruptAsserted();
+}
+
+bool Emulator::waitingForInterrupt() const
+{
+#ifdef IDLE_LOOPS
+    // An idle loop which only reads memory waits like CWAI
+    if (_waitState == WaitState::None && _idle != Idle::Waiting) {
+        return false;
+    }
+#else
+    if (_waitState == WaitState::None) {
+        return false;
+    }
+#endif
+    
+    // I and F are never lazy so _ccByte has them
+    uint8_t pending = _pendingInterrupts.load();
+    if (_waitState == WaitState::Sync && pending) {
+        return false;
+    }
+    return !((pending & uint8_t(Interrupt::NMI)) ||
+             ((pending & uint8_t(Interrupt::FIRQ)) && !(_ccByte & FlagF)) ||
+             ((pending & uint8_t(Interrupt::IRQ)) && !(_ccByte & FlagI)));
+}
+
+bool Emulator::checkInterrupts()
+{
+    uint8_t pending = _pendingInterrupts.load();
+    uint8_t line;
+    
+    if (pending & uint8_t(Interrupt::NMI)) {
+        _pendingInterrupts.fetch_and(~uint8_t(Interrupt::NMI));
+        line = uint8_t(Interrupt::NMI);
+    } else if ((pending & uint8_t(Interrupt::FIRQ)) && !flag(FlagF)) {
+        line = uint8_t(Interrupt::FIRQ);
+    } else if ((pending & uint8_t(Interrupt::IRQ)) && !flag(FlagI)) {
+        line = uint8_t(Interrupt::IRQ);
+    } else if (pending && _waitState == WaitState::Sync) {
+        // Any masked line ends SYNC
+        line = uint8_t(pending & -pending);
+    } else {
+        return _waitState == WaitState::None;
+    }
+    
+#ifdef SNAPSHOTS
+    if (_history) {
+        _history->interrupt(_instructions, Interrupt(line));
+    }
+#endif
+    
+    serviceInterrupt(Interrupt(line));
+    return _waitState == WaitState::None;
+}
+
+void Emulator::serviceInterrupt(Interrupt line)
+{
+    switch (line) {
+        case Interrupt::NMI:
+            takeInterrupt(true, 0xfffc);
+            setFlag(FlagF, true);
+            return;
+        case Interrupt::FIRQ:
+            if (!flag(FlagF)) {
+                takeInterrupt(firqEntireState(), 0xfff6);
+                setFlag(FlagF, true);
+                return;
+            }
+            break;
+        case Interrupt::IRQ:
+            if (!flag(FlagI)) {
+                takeInterrupt(true, 0xfff8);
+                return;
+            }
+            break;
+    }
+    
+    // A masked interrupt ends SYNC, which goes on to the next
+    // instruction. CWAI keeps waiting.
+    if (_waitState == WaitState::Sync) {
+        _waitState = WaitState::None;
+    }
+}
+
+void Emulator::takeInterrupt(bool entireState, uint16_t vector)
+{
+    // CWAI has already stacked the entire state
+    if (_waitState != WaitState::Cwai) {
+        setFlag(FlagE, entireState);
+        if (entireState) {
+            pushEntireState();
+        } else {
+            push16(_s, _pc);
+            push8(_s, ccByte());
+        }
+#ifdef COMPUTE_CYCLES
+        _cycles += entireState ? 19 : 10;
+#endif
+    }
+    
+    _waitState = WaitState::None;
+    setFlag(FlagI, true);
+    _pc = load16(vector);
+    
+#ifdef TRACE
+    if (_trace) {
+#ifdef COMPUTE_CYCLES
+        _trace->interrupt(vector, _cycles);
+#else
+        _trace->interrupt(vector, 0);
+#endif
+    }
+#endif
+    
+#ifdef PROFILER
+    if (_profiler) {
+        _profiler->call(_pc, _s);
+    }
+#endif
+}
+
+void Emulator::pushEntireState()
+{
+    push16(_s, _pc);
+    push16(_s, _u);
+    push16(_s, _y);
+    push16(_s, _x);
+    push8(_s, _dp);
+#ifdef HD6309
+    if (nativeMode()) {
+#ifdef COMPUTE_CYCLES
+        _cycles += 2;
+#endif
+        push8(_s, _f);
+        push8(_s, _e);
+    }
+#endif
+    push8(_s, _b);
+    push8(_s, _a);
+    push8(_s, ccByte());
+}
+
+#ifdef HD6309
+void Emulator::trap(uint8_t mdBit)
+{
+    _md |= mdBit;
+    setFlag(FlagE, true);
+    pushEntireState();
+    setFlag(FlagI, true);
+    setFlag(FlagF, true);
+    _pc = load16(0xfff0);
+#ifdef COMPUTE_CYCLES
+    // The same as stacking for an interrupt
+    _cycles += 19;
+#endif
+}
+
+void Emulator::registerOp(Op op)
+{
+    // The postbyte is in _right. The size of the destination is the size
+    // of the op. A 16 bit source is truncated for an 8 bit destination
+    // and an 8 bit one is zero extended for a 16 bit destination
+    Reg src = Reg(_right >> 4);
+    Reg dst = Reg(_right & 0x0f);
+    bool is16 = regSizeInBytes(dst) == 2;
+    
+    _left = getReg(dst);
+    _right = getReg(src) & (is16 ? 0xffff : 0xff);
+    uint32_t carry = flag(FlagC) ? 1 : 0;
+    
+    switch (op) {
+        default:
+        case Op::ADDR: _result = _left + _right; break;
+        case Op::ADCR: _result = _left + _right + carry; break;
+        case Op::SUBR:
+        case Op::CMPR: _result = _left - _right; break;
+        case Op::SBCR: _result = _left - _right - carry; break;
+        case Op::ANDR: _result = _left & _right; break;
+        case Op::ORR:  _result = _left | _right; break;
+        case Op::EORR: _result = _left ^ _right; break;
+    }
+    
+    if (op == Op::ANDR || op == Op::ORR || op == Op::EORR) {
+        if (is16) {
+            xNZ0x16();
+        } else {
+            xNZ0x8();
+        }
+    } else if (is16) {
+        xNZVC16();
+    } else {
+        xNZVC8();
+    }
+    
+    if (op != Op::CMPR) {
+        setReg(dst, _result);
+    }
+}
+
+bool Emulator::bitOp(Op op, uint8_t postbyte, uint16_t ea)
+{
+    // The postbyte is RRSSSDDD, register (CC, A or B), source bit and
+    // destination bit. The source is memory except for STBT
+    static constexpr Reg bitRegs[4] = { Reg::CC, Reg::A, Reg::B, Reg::None };
+    Reg reg = bitRegs[postbyte >> 6];
+    if (reg == Reg::None) {
+        return false;
+    }
+    
+    uint8_t srcBit = (postbyte >> 3) & 0x07;
+    uint8_t dstBit = postbyte & 0x07;
+    uint8_t m = load8(ea);
+    uint8_t r = uint8_t(getReg(reg));
+    
+    if (op == Op::STBT) {
+        bool src = ((r >> srcBit) & 0x01) != 0;
+        store8(ea, src ? (m | (1 << dstBit)) : (m & ~(1 << dstBit)));
+        return true;
+    }
+    
+    bool src = ((m >> srcBit) & 0x01) != 0;
+    bool dst = ((r >> dstBit) & 0x01) != 0;
+    switch (op) {
+        default:
+        case Op::BAND:  dst = dst && src; break;
+        case Op::BIAND: dst = dst && !src; break;
+        case Op::BOR:   dst = dst || src; break;
+        case Op::BIOR:  dst = dst || !src; break;
+        case Op::BEOR:  dst = dst != src; break;
+        case Op::BIEOR: dst = dst == src; break;
+        case Op::LDBT:  dst = src; break;
+    }
+    setReg(reg, dst ? (r | (1 << dstBit)) : (r & ~(1 << dstBit)));
+    return true;
+}
+
+bool Emulator::transfer(uint8_t postbyte, uint8_t mode)
+{
+    // Only D, X, Y, U and S can be used
+    uint16_t* regs[5] = { &_d, &_x, &_y, &_u, &_s };
+    if ((postbyte >> 4) > 4 || (postbyte & 0x0f) > 4) {
+        return false;
+    }
+    uint16_t& src = *regs[postbyte >> 4];
+    uint16_t& dst = *regs[postbyte & 0x0f];
+    
+#ifdef COMPUTE_CYCLES
+    _cycles += 3 * uint32_t(_w);
+#endif
+    
+    // Each pass moves a run of bytes which doesn't cross a page of the
+    // source or the destination. The real TFM moves a byte at a time, so
+    // a run stops short of any byte it would read after writing it. Runs
+    // from plain memory to plain memory are a memmove or memset. Anything
+    // else moves one byte through load8 and store8, so devices, watchpoints,
+    // write protection and clean pages all work. Once a clean page has
+    // been written it's plain memory.
+    while (_w) {
+        const uint8_t* srcPage = _readPage[src >> 8];
+        uint8_t* dstPage = _writePage[dst >> 8];
+        uint16_t n;
+        
+        switch (mode) {
+            default:
+            case 0: { // r0+,r1+
+                n = std::min({ _w, uint16_t(0x100 - (src & 0xff)), uint16_t(0x100 - (dst & 0xff)) });
+                uint16_t distance = dst - src;
+                if (distance && distance < n) {
+                    n = distance;
+                }
+                if (srcPage && dstPage) {
+                    memmove(dstPage + (dst & 0xff), srcPage + (src & 0xff), n);
+                    codeCheck(dst, n);
+                } else {
+                    n = 1;
+                    store8(dst, load8(src));
+                }
+                src += n;
+                dst += n;
+                break;
+            }
+            case 1: { // r0-,r1-
+                n = std::min({ _w, uint16_t((src & 0xff) + 1), uint16_t((dst & 0xff) + 1) });
+                uint16_t distance = src - dst;
+                if (distance && distance < n) {
+                    n = distance;
+                }
+                if (srcPage && dstPage) {
+                    memmove(dstPage + (dst & 0xff) + 1 - n, srcPage + (src & 0xff) + 1 - n, n);
+                    codeCheck(dst + 1 - n, n);
+                } else {
+                    n = 1;
+                    store8(dst, load8(src));
+                }
+                src -= n;
+                dst -= n;
+                break;
+            }
+            case 2: // r0+,r1
+                // Only the last byte of the run stays, unless the run
+                // reads the destination
+                n = std::min(_w, uint16_t(0x100 - (src & 0xff)));
+                if (srcPage && dstPage && uint16_t(dst - src) >= n) {
+                    dstPage[dst & 0xff] = srcPage[(src & 0xff) + n - 1];
+                    codeCheck(dst);
+                } else {
+                    n = 1;
+                    store8(dst, load8(src));
+                }
+                src += n;
+                break;
+            case 3: // r0,r1+
+                // Writing the source only writes the same value back
+                n = std::min(_w, uint16_t(0x100 - (dst & 0xff)));
+                if (srcPage && dstPage) {
+                    memset(dstPage + (dst & 0xff), srcPage[src & 0xff], n);
+                    codeCheck(dst, n);
+                } else {
+                    n = 1;
+                    store8(dst, load8(src));
+                }
+                dst += n;
+                break;
+        }
+        _w -= n;
+    }
+    return true;
+}
+
+void Emulator::divide(Op op)
+{
+    // DIVD divides D by an 8 bit divisor, leaving the quotient in B and
+    // the remainder in A. DIVQ divides Q by a 16 bit one, leaving them in
+    // W and D. All signed. A quotient which doesn't fit at all leaves the
+    // registers alone. One which only fits unsigned sets V
+    bool isQ = op == Op::DIVQ;
+    int32_t divisor = isQ ? int16_t(_right) : int8_t(_right);
+    if (divisor == 0) {
+        trap(MDDivZero);
+        return;
+    }
+    
+    int64_t dividend = isQ ? int32_t((uint32_t(_d) << 16) | _w) : int16_t(_d);
+    int64_t quotient = dividend / divisor;
+    int64_t remainder = dividend % divisor;
+    int64_t range = isQ ? 0x8000 : 0x80;
+    
+    if (quotient >= 2 * range || quotient < -2 * range) {
+        setFlag(FlagN, false);
+        setFlag(FlagZ, false);
+        setFlag(FlagV, true);
+        setFlag(FlagC, false);
+        return;
+    }
+    
+    uint16_t result;
+    if (isQ) {
+        _w = result = uint16_t(quotient);
+        _d = uint16_t(remainder);
+    } else {
+        _b = result = uint8_t(quotient);
+        _a = uint8_t(remainder);
+    }
+    
+    setFlag(FlagN, (result & (isQ ? 0x8000 : 0x80)) != 0);
+    setFlag(FlagZ, result == 0);
+    setFlag(FlagV, quotient >= range || quotient < -range);
+    setFlag(FlagC, (result & 0x01) != 0);
+}
+#endif
+
+bool Emulator::hitBreakpoint()
+{
+    _stoppedAtBreakpoint = true;
+    _boss9->printF("\n*** hit breakpoint at addr $%04x\n\n", _pc);
+    _boss9->call(Func::mon);
+    return true;
+}
+
+bool Emulator::hitWatchpoint()
+{
+    _watchHit = false;
+    _stoppedAtBreakpoint = true;
+    _boss9->printF("\n*** hit watchpoint, %s of addr $%04x, stopped at addr $%04x\n\n",
+                   (_watchKind == BPKind::Read) ? "read" : "write", _watchAddr, _pc);
+    _boss9->call(Func::mon);
+    return true;
+}
+
+void Emulator::checkWatchpoints(uint16_t ea, BPKind kind)
+{
+    if (_watchHit) {
+        return;
+    }
+    
+    for (const auto& it : _breakpoints) {
+        if (it.status != BPStatus::Enabled || it.kind == BPKind::Exec || ea < it.addr || uint32_t(ea) >= uint32_t(it.addr) + it.size) {
+            continue;
+        }
+        if (it.kind == BPKind::Access || it.kind == kind) {
+            // Finish the instruction and stop before the next one
+            _watchHit = true;
+            _watchAddr = ea;
+            _watchKind = kind;
+#ifdef BLOCK_CACHE
+            _blockInvalidated = true;
+#endif
+            return;
+        }
+    }
+}
+
+bool Emulator::stepDone(RunState runState, uint16_t ea)
+{
+    // Step handling
+    //
+    //  Step In     - Go back to monitor after each instruction executed
+    //  Step Over   - Behave like Step In unless current instruction is
+    //                BSR or JSR in which case we run until that subroutine
+    //                returns.
+    //  Step Out    - Run until we return from current subroutine. If none
+    //                then we never enter monitor until program exits of ESC.
+    //
+    // When doing Step Over or Step Out we need to stop when we hit RTS. but
+    // there might be nested subroutines so we have to keep track of the
+    // depth using _subroutineDepth. When we execute BSR or JSR we increment
+    // and when we hit RTS we decrement. When it hits 0 we stop. For Step Over
+    // we start with _subroutineDepth = 0. Entering the current BSR or JSR
+    // increments to 0 and the matching RTS decrements back to 0 and we
+    // enter the monitor. If there are nested subroutines _subroutineDepth
+    // keeps track of them so we return on the correct RTS. For Step Out
+    // we set _subroutineDepth = 1 so the next RTS we see will stop.
+    //
+    // Continuing only skips a breakpoint at the PC, after that it runs
+    // like Running and mustn't stop at an RTS like Step Out
+    if (runState != RunState::Running) {
+        _lastRunState = (runState == RunState::Continuing) ? RunState::Running : runState;
+    }
+    
+    bool handleStepOverLikeStepIn = false;
+    
+    if (runState == RunState::StepOver) {
+        if ((_prevOp != Op::BSR && _prevOp != Op::JSR) ||
+                (_prevOp == Op::JSR && ea >= SystemAddrStart)) {
+            handleStepOverLikeStepIn = true;
+        } else {
+            _subroutineDepth = 1;
+        }
+    }
+    
+    if (runState == RunState::StepIn || handleStepOverLikeStepIn) {
+        _boss9->printF("\n*** step %s, stopped at addr $%04x\n\n",
+                (_lastRunState == RunState::StepIn) ? "in" : "over", _pc);
+        _boss9->call(Func::mon);
+        return true;
+    }
+    
+    if (runState == RunState::StepOut) {
+        _subroutineDepth = 1;
+    }
+    return false;
+}
+
+void Emulator::readOnlyAddr(uint16_t addr)
+{
+    _boss9->printF("Address $%04x is read-only\n", addr);
+}
+
+uint8_t Emulator::busRead(uint16_t ea)
+{
+    uint8_t page = ea >> 8;
+    if (_devices[page]) {
+#ifdef IDLE_LOOPS
+        _deviceReads += 1;
+#endif
+        return _devices[page]->read(ea);
+    }
+    if (!_pages[page]) {
+        return 0xff;
+    }
+    
+    if (_watchPages[page] & WatchRead) {
+        checkWatchpoints(ea, BPKind::Read);
+    }
+    return _pages[page][ea & 0xff];
+}
+
+void Emulator::busWrite(uint16_t ea, uint8_t v)
+{
+    uint8_t page = ea >> 8;
+    if (_devices[page]) {
+        _devices[page]->write(ea, v);
+        return;
+    }
+    if (!_pages[page]) {
+        return;
+    }
+    
+    if (_watchPages[page] & WatchWrite) {
+        checkWatchpoints(ea, BPKind::Write);
+    }
+    
+    if (writeProtected(ea)) {
+        readOnlyAddr(ea);
+        return;
+    }
+    
+#ifdef SNAPSHOTS
+    // First write to a clean page. Once it's dirty it's written
+    // directly unless it's watched
+    if (pageClean(page)) {
+        setPageClean(page, false);
+    }
+#endif
+    
+    _pages[page][ea & 0xff] = v;
+    codeCheck(ea);
+}
+
+void Emulator::readMemory(uint16_t addr, uint8_t* dst, uint16_t size)
+{
+    while (size) {
+        uint16_t n = std::min(uint16_t(0x100 - (addr & 0xff)), size);
+        const uint8_t* page = _readPage[addr >> 8];
+        if (page) {
+            memcpy(dst, page + (addr & 0xff), n);
+        } else {
+            for (uint16_t i = 0; i < n; ++i) {
+                dst[i] = busRead(addr + i);
+            }
+        }
+        addr += n;
+        dst += n;
+        size -= n;
+    }
+}
+
+void Emulator::writeMemory(uint16_t addr, const uint8_t* src, uint16_t size)
+{
+#ifdef IDLE_LOOPS
+    resetIdleWatch();
+#endif
+    while (size) {
+        uint16_t n = std::min(uint16_t(0x100 - (addr & 0xff)), size);
+        uint8_t* page = _writePage[addr >> 8];
+        if (page) {
+            memcpy(page + (addr & 0xff), src, n);
+            codeCheck(addr, n);
+        } else {
+            for (uint16_t i = 0; i < n; ++i) {
+                busWrite(addr + i, src[i]);
+            }
+        }
+        addr += n;
+        src += n;
+        size -= n;
+    }
+}
+
+const uint8_t* Emulator::memorySpan(uint16_t addr, uint16_t size) const
+{
+    if (size == 0 || uint32_t(addr) + size > 0x10000) {
+        return nullptr;
+    }
+
+    // Every page must be read directly and follow the one before it in host memory
+    const uint8_t* first = _readPage[addr >> 8];
+    uint8_t lastPage = uint8_t((uint32_t(addr) + size - 1) >> 8);
+    for (uint16_t page = addr >> 8; page <= lastPage; ++page) {
+        if (!_readPage[page] || _readPage[page] != first + ((page - (addr >> 8)) << 8)) {
+            return nullptr;
+        }
+    }
+    return first + (addr & 0xff);
+}
+
+void Emulator::updatePage(uint8_t page)
+{
+    bool writable = !writeProtected(uint16_t(page) << 8) && !(_watchPages[page] & WatchWrite);
+#ifdef SNAPSHOTS
+    writable = writable && !pageClean(page);
+#endif
+    _readPage[page] = (_watchPages[page] & WatchRead) ? nullptr : _pages[page];
+    _writePage[page] = writable ? _pages[page] : nullptr;
+}
+
+#ifdef SNAPSHOTS
+void Emulator::setPageClean(uint8_t page, bool clean)
+{
+    if (clean) {
+        _cleanPages[page >> 3] |= uint8_t(1 << (page & 0x07));
+    } else {
+        _cleanPages[page >> 3] &= ~uint8_t(1 << (page & 0x07));
+    }
+    updatePage(page);
+}
+
+void Emulator::setAllPagesClean(bool clean)
+{
+    memset(_cleanPages, clean ? 0xff : 0, sizeof(_cleanPages));
+    for (uint16_t page = 0; page < 256; ++page) {
+        updatePage(page);
+    }
+}
+
+void Emulator::takeSnapshot(Snapshot& snapshot)
+{
+    snapshot.d = _d;
+    snapshot.x = _x;
+    snapshot.y = _y;
+    snapshot.u = _u;
+    snapshot.s = _s;
+    snapshot.pc = _pc;
+    snapshot.dp = _dp;
+    snapshot.cc = ccByte();
+#ifdef HD6309
+    snapshot.w = _w;
+    snapshot.v = _v;
+    snapshot.md = _md;
+#endif
+    snapshot.prevOp = uint8_t(_prevOp);
+    snapshot.waitState = uint8_t(_waitState);
+#ifdef COMPUTE_CYCLES
+    snapshot.cycles = _cycles;
+#endif
+    snapshot.instructions = _instructions;
+
+    snapshot.breakpoints.clear();
+    for (const auto& it : _breakpoints) {
+        snapshot.breakpoints.push_back({ it.addr, it.size, uint8_t(it.kind), uint8_t(it.status) });
+    }
+    
+    // Clean pages still match their base, so share it
+    for (uint16_t page = 0; page < 256; ++page) {
+        if (!_pages[page]) {
+            snapshot.pages[page] = nullptr;
+        } else if (pageClean(page) && _basePages[page]) {
+            snapshot.pages[page] = _basePages[page];
+        } else {
+            auto newPage = std::make_shared<Snapshot::Page>();
+            memcpy(newPage->data(), _pages[page], newPage->size());
+            snapshot.pages[page] = newPage;
+        }
+        _basePages[page] = snapshot.pages[page];
+    }
+    
+    setAllPagesClean(true);
+}
+
+void Emulator::restoreSnapshot(const Snapshot& snapshot)
+{
+#ifdef IDLE_LOOPS
+    resetIdleWatch();
+    _idle = Idle::None;
+#endif
+    
+    _d = snapshot.d;
+    _x = snapshot.x;
+    _y = snapshot.y;
+    _u = snapshot.u;
+    _s = snapshot.s;
+    _pc = snapshot.pc;
+    _dp = snapshot.dp;
+    setCCByte(snapshot.cc);
+#ifdef HD6309
+    _w = snapshot.w;
+    _v = snapshot.v;
+    _md = snapshot.md;
+#endif
+    _prevOp = Op(snapshot.prevOp);
+    _waitState = WaitState(snapshot.waitState);
+#ifdef COMPUTE_CYCLES
+    _cycles = snapshot.cycles;
+#endif
+    _instructions = snapshot.instructions;
+    _watchHit = false;
+
+    // Changing breakpoints flushes the block cache, so leave them if they're the same
+    bool sameBreakpoints = std::equal(_breakpoints.begin(), _breakpoints.end(),
+                                      snapshot.breakpoints.begin(), snapshot.breakpoints.end(),
+                                      [](const BreakpointEntry& a, const Snapshot::Breakpoint& b) {
+        return a.addr == b.addr && a.size == b.size && uint8_t(a.kind) == b.kind && uint8_t(a.status) == b.status;
+    });
+    
+    if (!sameBreakpoints) {
+        _breakpoints.clear();
+        for (const auto& it : snapshot.breakpoints) {
+            BreakpointEntry entry;
+            entry.addr = it.addr;
+            entry.size = it.size;
+            entry.kind = BPKind(it.kind);
+            entry.status = BPStatus(it.status);
+            _breakpoints.push_back(entry);
+        }
+        checkActiveBreakpoints();
+    }
+    
+    // A clean page with the same base already has the right contents
+#ifdef BLOCK_CACHE
+    bool codeChanged = false;
+#endif
+    
+    for (uint16_t page = 0; page < 256; ++page) {
+        const Snapshot::PagePtr& mem = snapshot.pages[page];
+        if (!mem || !_pages[page]) {
+            _basePages[page] = nullptr;
+            continue;
+        }
+        
+        if (!pageClean(page) || _basePages[page] != mem) {
+            memcpy(_pages[page], mem->data(), mem->size());
+#ifdef BLOCK_CACHE
+            codeChanged = codeChanged || _codePages[page];
+#endif
+        }
+        _basePages[page] = mem;
+    }
+    
+    setAllPagesClean(true);
+    
+#ifdef BLOCK_CACHE
+    if (codeChanged) {
+        flushBlockCache();
+    }
+#endif
+}
+#endif
+
+// Returns the range of pages covered by addr and size
+static void pageRange(uint16_t addr, uint32_t size, uint16_t& first, uint16_t& end)
+{
+    first = addr >> 8;
+    uint32_t pages = (size + 0xff) >> 8;
+    end = (first + pages > 256) ? 256 : uint16_t(first + pages);
+}
+
+void Emulator::mapMemory(uint16_t addr, uint32_t size, uint8_t* mem)
+{
+#ifdef IDLE_LOOPS
+    resetIdleWatch();
+#endif
+    
+    uint16_t first, end;
+    pageRange(addr, size, first, end);
+    
+#ifdef BLOCK_CACHE
+    // Only blocks decoded from these pages are stale. Switching banks
+    // remaps pages all the time, mostly ones with no code
+    bool codeChanged = false;
+#endif
+    
+    for (uint16_t page = first; page < end; ++page) {
+#ifdef BLOCK_CACHE
+        codeChanged = codeChanged || _codePages[page];
+#endif
+        _pages[page] = mem + (uint32_t(page - first) << 8);
+        _devices[page] = nullptr;
+#ifdef SNAPSHOTS
+        _cleanPages[page >> 3] &= ~uint8_t(1 << (page & 0x07));
+#endif
+        updatePage(page);
+    }
+    
+#ifdef BLOCK_CACHE
+    if (codeChanged) {
+        flushBlockCache();
+    }
+#endif
+}
+
+void Emulator::mapDevice(uint16_t addr, uint32_t size, Device* device)
+{
+#ifdef IDLE_LOOPS
+    resetIdleWatch();
+#endif
+    
+    uint16_t first, end;
+    pageRange(addr, size, first, end);
+    
+#ifdef BLOCK_CACHE
+    // As in mapMemory
+    bool codeChanged = false;
+#endif
+    
+    for (uint16_t page = first; page < end; ++page) {
+#ifdef BLOCK_CACHE
+        codeChanged = codeChanged || _codePages[page];
+#endif
+        _pages[page] = nullptr;
+        _devices[page] = device;
+#ifdef SNAPSHOTS
+        _cleanPages[page >> 3] &= ~uint8_t(1 << (page & 0x07));
+#endif
+        updatePage(page);
+    }
+    
+#ifdef BLOCK_CACHE
+    if (codeChanged) {
+        flushBlockCache();
+    }
+#endif
+}
+
+void Emulator::unmap(uint16_t addr, uint32_t size)
+{
+    mapDevice(addr, size, nullptr);
+}
+
+void Emulator::setWriteProtect(uint16_t addr, uint32_t size, bool protect)
+{
+    uint16_t first, end;
+    pageRange(addr, size, first, end);
+    
+    for (uint16_t page = first; page < end; ++page) {
+        if (protect) {
+            _writeProtect[page >> 3] |= uint8_t(1 << (page & 0x07));
+        } else {
+            _writeProtect[page >> 3] &= ~uint8_t(1 << (page & 0x07));
+        }
+        updatePage(page);
+    }
+}
+
+// Rebuild the breakpoint bitmap and the watched pages from the list.
+// Blocks end before breakpoints, so decoded blocks are thrown away
+void Emulator::checkActiveBreakpoints()
+{
+    std::fill(_breakpointBits.begin(), _breakpointBits.end(), 0);
+    memset(_watchPages, 0, sizeof(_watchPages));
+    _haveBreakpoints = false;
+    _haveWatchpoints = false;
+    
+    for (const auto& it : _breakpoints) {
+        if (it.status != BPStatus::Enabled) {
+            continue;
+        }
+        
+        if (it.kind == BPKind::Exec) {
+            if (_breakpointBits.empty()) {
+                _breakpointBits.resize(65536 / 8);
+            }
+            _breakpointBits[it.addr >> 3] |= uint8_t(1 << (it.addr & 0x07));
+            _haveBreakpoints = true;
+            continue;
+        }
+        
+        _haveWatchpoints = true;
+        uint8_t flags = (it.kind == BPKind::Read) ? WatchRead : ((it.kind == BPKind::Write) ? WatchWrite : (WatchRead | WatchWrite));
+        uint32_t last = std::min(uint32_t(it.addr) + (it.size ? it.size : 1) - 1, uint32_t(0xffff));
+        for (uint32_t page = it.addr >> 8; page <= (last >> 8); ++page) {
+            _watchPages[page] |= flags;
+        }
+    }
+    
+    for (uint16_t page = 0; page < 256; ++page) {
+        updatePage(page);
+    }
+    
+#ifdef BLOCK_CACHE
+    flushBlockCache();
+#endif
+}
+
+bool Emulator::breakpoint(uint16_t i, BreakpointEntry& entry) const
+{
+    if (i >= _breakpoints.size()) {
+        return false;
+    }
+    entry = _breakpoints[i];
+    return true;
+}
+
+bool Emulator::setBreakpoint(uint16_t addr, uint16_t& i)
+{
+    return setWatchpoint(addr, 1, BPKind::Exec, i);
+}
+
+bool Emulator::setWatchpoint(uint16_t addr, uint16_t size, BPKind kind, uint16_t& i)
+{
+    if (_breakpoints.size() >= 0xffff) {
+        return false;
+    }
+    
+    BreakpointEntry entry;
+    entry.addr = addr;
+    entry.size = size ? size : 1;
+    entry.kind = kind;
+    entry.status = BPStatus::Enabled;
+    
+    i = uint16_t(_breakpoints.size());
+    _breakpoints.push_back(entry);
+    checkActiveBreakpoints();
+    return true;
+}
+
+bool Emulator::clearBreakpoint(uint16_t i)
+{
+    // Clear the passed breakpoint and move all the others past it up one
+    if (i >= _breakpoints.size()) {
+        return false;
+    }
+    
+    _breakpoints.erase(_breakpoints.begin() + i);
+    checkActiveBreakpoints();
+    return true;
+}
+
+bool Emulator::clearAllBreakpoints()
+{
+    _breakpoints.clear();
+    checkActiveBreakpoints();
+    return true;
+}
+
+bool Emulator::disableBreakpoint(uint16_t i)
+{
+    if (i >= _breakpoints.size()) {
         return false;
     }
     
@@ -1288,17 +2854,15 @@ bool Emulator::disableBreakpoint(uint8_t i)
 bool Emulator::disableAllBreakpoints()
 {
     for (auto &it : _breakpoints) {
-        if (it.status == BPStatus::Enabled) {
-            it.status = BPStatus::Disabled;
-        }
+        it.status = BPStatus::Disabled;
     }
     checkActiveBreakpoints();
     return true;
 }
 
-bool Emulator::enableBreakpoint(uint8_t i)
+bool Emulator::enableBreakpoint(uint16_t i)
 {
-    if (i >= NumBreakpoints || _breakpoints[i].status == BPStatus::Empty) {
+    if (i >= _breakpoints.size()) {
         return false;
     }
     
@@ -1310,9 +2874,7 @@ bool Emulator::enableBreakpoint(uint8_t i)
 bool Emulator::enableAllBreakpoints()
 {
     for (auto &it : _breakpoints) {
-        if (it.status == BPStatus::Disabled) {
-            it.status = BPStatus::Enabled;
-        }
+        it.status = BPStatus::Enabled;
     }
     checkActiveBreakpoints();
     return true;
@@ -1320,8 +2882,6 @@ bool Emulator::enableAllBreakpoints()
 
 // TODO:
 //
-// - Handle SYNC and CWAI waiting for interrupt
-// - Handle firing of IRQ, FIRQ, NMI and RESTART
 // - Handle CC. Have a post op deal with most of it, based on value in Opcode
 // - Op handling has zero or more of left, right and ea set in addr handling and reg pre op sections.
 //      Do proper setting of these in all cases. Need more than op.reg to do this. Need leftReg, rightReg, etc.
@@ -15,23 +15,154 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <cstring>
+#include <vector>
 
+#include "Loader.h"
 #include "srec.h"
 
-//#define COMPUTE_CYCLES
+#define COMPUTE_CYCLES
+
+// TRACE records every instruction into the TraceRecorder set with
+// setTrace(). Nothing is recorded until one is set.
 #define TRACE
 
+// LAZY_FLAGS computes N, Z and V when they're read rather than after every
+// op. It's off by default because on the hosts measured so far recording
+// the op costs more than computing the flags. CHECK_LAZY_FLAGS also
+// computes them eagerly and stops with Error::FlagsMismatch if they differ.
+//#define LAZY_FLAGS
+//#define CHECK_LAZY_FLAGS
+
+#if defined(CHECK_LAZY_FLAGS) && !defined(LAZY_FLAGS)
+#define LAZY_FLAGS
+#endif
+
+// PROFILER feeds every instruction, call and return to the Profiler set
+// with setProfiler(). It's off by default so the execution loop has no
+// profiling code in it at all unless it's wanted.
+//#define PROFILER
+
+// STATS counts how often each op, address mode, indexed mode and prefix
+// is executed into the InstructionStats set with setStats(). Like the
+// profiler it's off by default and costs nothing when it is.
+//#define STATS
+
+// IDLE_LOOPS notices short loops which go around without changing
+// anything, like BRA * or a poll of peekc, so the host can sleep rather
+// than spin in them. A loop which only reads memory can only be ended
+// by an interrupt, so the passes it would make are skipped.
+#define IDLE_LOOPS
+
+// HD6309 emulates the Hitachi 6309 instead of the 6809. It adds the E, F,
+// W, V and MD registers, native mode and the 6309 ops, including TFM. It's
+// a compile time choice so the 6809 build has none of it in its tables or
+// its execution loop.
+//#define HD6309
+
+// The block cache needs several hundred KB of host memory, so it's
+// only turned on for host builds. The ESP build decodes every instruction.
+//
+// OPCODE_HANDLERS generates a specialized handler for every opcode on
+// every page and dispatches through a table of them. That's too much code
+// for the ESP build, which runs every instruction through one generic
+// handler instead.
+//
+// SNAPSHOTS saves and restores machine state, which needs up to 64KB of
+// host memory for each snapshot, so it's host only too.
+#ifndef ARDUINO
+#define BLOCK_CACHE
+#define OPCODE_HANDLERS
+#define SNAPSHOTS
+#endif
+
+// JIT translates hot blocks from the block cache into x86-64 code with
+// the Jit set with setJit(). It's opt in since it's only for x86-64 Linux
+// hosts, and it needs eager flags since translated code computes them
+// from the host's.
+//#define JIT
+
+#ifdef JIT
+#if !defined(BLOCK_CACHE) || !defined(__x86_64__) || !defined(__linux__)
+#undef JIT
+#elif defined(LAZY_FLAGS)
+#error JIT is not supported with LAZY_FLAGS
+#endif
+#endif
+
+// RECOMPILED runs blocks of an image from C++ the recompile tool generated
+// for it, compiled into a shared object and loaded into a Recompiled set
+// with setRecompiled(). The block cache decides when that code is still
+// the code in memory, so it's needed too.
+//#define RECOMPILED
+
+#if defined(RECOMPILED) && !defined(BLOCK_CACHE)
+#undef RECOMPILED
+#endif
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+#if defined(OPCODE_HANDLERS) || defined(HD6309)
+#include <array>
+#include <utility>
+#endif
+
+#ifdef SNAPSHOTS
+#include "Snapshot.h"
+#endif
+
+#ifdef PROFILER
+#include "Profiler.h"
+#endif
+
 #ifdef TRACE
-static constexpr uint32_t TraceBufferSize = 10;
+#include "Trace.h"
 #endif
 
 namespace mc6809 {
 
+#ifdef SNAPSHOTS
+class History;
+#endif
+
+#ifdef JIT
+class Jit;
+#endif
+
+#ifdef RECOMPILED
+class Recompiled;
+#endif
+
+#ifdef STATS
+class InstructionStats;
+#endif
+
+class Symbols;
+
 static constexpr uint16_t SystemAddrStart = 0xFC00;
 static constexpr uint32_t InstructionsToExecutePerContinue = 1000;
-static constexpr uint8_t NumBreakpoints = 4;
+
+#ifdef BLOCK_CACHE
+static constexpr uint8_t MaxBlockInsts = 32;
+static constexpr uint16_t BlockCacheSize = 1024;
+static constexpr uint8_t MaxPageInvalidations = 8;
+#endif
+
+#ifdef IDLE_LOOPS
+// Most instructions in a loop that can idle
+static constexpr uint8_t MaxIdleLoopInsts = 8;
+#endif
+
+#ifdef JIT
+// Times a block is entered before it's translated
+static constexpr uint16_t JitThreshold = 64;
+#endif
 
 // Opcode table
 
@@ -50,9 +181,23 @@ enum class Op : uint8_t {
     INC, JMP, JSR, LD8, LD16, LEA, LSR, MUL,
     NEG, NOP, OR, ORCC, PSH, PUL, ROL, ROR,
     RTI, RTS, SBC, SEX, ST8, ST16, SUB8, SUB16,
-    SWI, SYNC, TFR, TST, FIRQ, IRQ, NMI, RESTART
+    SWI, SYNC, TFR, TST, FIRQ, IRQ, NMI, RESTART,
+#ifdef HD6309
+    // 6309 ops. The 16 bit versions of 8 bit ops on D and W
+    // and the 8 bit ones on E and F use the same enums as
+    // the 6809 ones where it has them
+    OIM, AIM, EIM, TIM, SEXW, LDQ, STQ, ADDR,
+    ADCR, SUBR, SBCR, ANDR, ORR, EORR, CMPR, PSHW,
+    PULW, BAND, BIAND, BOR, BIOR, BEOR, BIEOR, LDBT,
+    STBT, TFM, BITMD, LDMD, DIVD, DIVQ, MULD, NEG16,
+    COM16, LSR16, ROR16, ASR16, ASL16, ROL16, DEC16, INC16,
+    TST16, CLR16, ADC16, SBC16, AND16, BIT16, EOR16, OR16,
+#endif
 };
 
+// The mnemonic for op, or ??? for one with no instruction of its own
+const char* opToString(Op);
+
 // Indexed mode
 //
 // See doc/m6809pm/sections.htm#sec2 for info about indexed mode
@@ -73,6 +218,11 @@ enum class IdxMode {
     ConstPC8Off         = 0b00001100,
     ConstPC16Off        = 0b00001101,
     Extended            = 0b00001111,
+#ifdef HD6309
+    AccEOffReg          = 0b00000111,
+    AccFOffReg          = 0b00001010,
+    AccWOffReg          = 0b00001110,
+#endif
 };
 
 // postbyte determines which indexed mode is used. If the MSB is 0
@@ -82,16 +232,38 @@ enum class IdxMode {
 static constexpr uint8_t IdxModeMask = 0b00001111;
 static constexpr uint8_t IndexedIndMask = 0b00010000;
 
-enum class Adr : uint8_t { None, Direct, Inherent, Rel, RelL, RelP, Immed8, Immed16, Indexed, Extended };
+#ifdef HD6309
+// The 6309 modes indexed by W use the postbytes which would be the
+// non-indirect extended mode (1RR01111) and the indirect ,R+ mode
+// (1RR10000) on the 6809, which are both illegal there. RR picks ,W
+// n16,W ,W++ or ,--W
+static constexpr uint8_t IdxWMask = 0b10011111;
+static constexpr uint8_t IdxW = 0b10001111;
+static constexpr uint8_t IdxWInd = 0b10010000;
+
+static constexpr bool wIndexed(uint8_t postbyte)
+{
+    return (postbyte & IdxWMask) == IdxW || (postbyte & IdxWMask) == IdxWInd;
+}
+#endif
+
+// Immed32 is only used by the 6309 LDQ
+enum class Adr : uint8_t { None, Direct, Inherent, Rel, RelL, RelP, Immed8, Immed16, Indexed, Extended,
+#ifdef HD6309
+    Immed32,
+#endif
+};
 
 // Register enums match the register numbers used by EXG and TFR
 // These are used to load and store of regs. The Reg::M enum is
-// used to load or store the mem at ea
+// used to load or store the mem at ea. W, V, E and F are 6309
+// registers and 0xc and 0xd are its zero register, which reads
+// as 0 and ignores writes. MD is only used by the monitor
 enum class Reg : uint8_t {
-    D = 0x0, X = 0x1, Y = 0x2, U = 0x3, S = 0x4, PC = 0X5,
-    A = 0x8, B = 0x9, CC = 0xa, DP = 0xb,
-    M8 = 0xd, M16 = 0xe, None = 0xf,
+    D = 0x0, X = 0x1, Y = 0x2, U = 0x3, S = 0x4, PC = 0X5, W = 0x6, V = 0x7,
+    A = 0x8, B = 0x9, CC = 0xa, DP = 0xb, E = 0xe, F = 0xf,
     DDU = 0x10, XYS = 0x11, XY = 0x12, US = 0x13,
+    M8 = 0x14, M16 = 0x15, None = 0x16, MD = 0x17,
 };
 
 // Determines what type of load and/or store is done with reg
@@ -122,8 +294,180 @@ struct CC
     bool E : 1; // Entire       : All registers stacked from last interrupt
 };
 
+// CC bits as masks of the CC byte
+static constexpr uint8_t FlagC = 0x01;
+static constexpr uint8_t FlagV = 0x02;
+static constexpr uint8_t FlagZ = 0x04;
+static constexpr uint8_t FlagN = 0x08;
+static constexpr uint8_t FlagI = 0x10;
+static constexpr uint8_t FlagH = 0x20;
+static constexpr uint8_t FlagF = 0x40;
+static constexpr uint8_t FlagE = 0x80;
+
+#ifdef LAZY_FLAGS
+static constexpr uint8_t LazyFlagMask = FlagN | FlagZ | FlagV;
+#endif
+
+#ifdef HD6309
+// MD bits. Native mode and FIRQ mode are set by LDMD. The trap bits
+// are set when an op traps and cleared when BITMD tests them
+static constexpr uint8_t MDNative = 0x01;       // Native mode: E and F are stacked too
+static constexpr uint8_t MDFirqEntire = 0x02;   // FIRQ stacks the entire state like IRQ
+static constexpr uint8_t MDIllegal = 0x40;      // Illegal instruction
+static constexpr uint8_t MDDivZero = 0x80;      // Division by zero
+#endif
+
+class Emulator;
+
+enum class StepResult { Continue, Stop, Error };
+
+#ifdef OPCODE_HANDLERS
+struct DecodedInst;
+typedef StepResult (*InstHandler)(Emulator&, const DecodedInst&, uint16_t& ea);
+#endif
+
+// Decoded instruction
+//
+// An instruction with any Page2 or Page3 prefix folded in. The register,
+// op and address mode are resolved against the prefix, so DDU, XYS, XY and
+// US are replaced by the actual register, RelP becomes Rel or RelL and SUB16
+// becomes CMP16 when it's prefixed. operand holds the immediate value, the
+// low byte of a direct address, an extended address or a sign extended
+// branch offset. For indexed mode it holds the constant offset, or the
+// final address for the PC relative and extended indirect modes.
+//
+// The 6309 has ops with more than one operand. extra holds the immediate
+// byte of OIM, AIM, EIM and TIM, the postbyte of the bit ops, the low word
+// of an LDQ immediate value and which registers TFM increments.
+struct DecodedInst
+{
+    Op op;
+    Reg reg;
+    Adr adr;
+    Left left;
+    Right right;
+    Op prefix;          // Op::NOP, Op::Page2 or Op::Page3
+    uint8_t size;       // Instruction size in bytes, including prefix
+    uint8_t postbyte;   // Indexed mode postbyte
+#ifdef COMPUTE_CYCLES
+    uint8_t cycles;     // Cycles, not including any that depend on run time state
+#endif
+#ifdef TRACE
+    uint8_t traceRegs;  // TraceReg bits of the registers it can change, other than CC and PC
+    uint8_t traceFlags; // Flags of its trace records, its size up to 5 and TraceEA
+    uint8_t traceIndex; // Index byte of its trace records
+#endif
+    uint16_t operand;
+#ifdef HD6309
+    uint16_t extra;
+#endif
+#ifdef OPCODE_HANDLERS
+    InstHandler handler;
+#endif
+};
+
+// Decode the instruction at the start of code, which is at pc in the
+// guest, without an Emulator. Bytes past size read as 0, so an inst.size
+// bigger than size means the instruction didn't fit. There's no handler
+void decodeInstruction(const uint8_t* code, size_t size, uint16_t pc, DecodedInst&);
+
+#ifdef BLOCK_CACHE
+#ifdef JIT
+// Translated code for a block. It runs from the start of the block with
+// the registers in the Emulator and leaves them there with _pc, _cycles
+// and _instructions updated for what it did.
+typedef void (*JitCode)(Emulator*);
+#endif
+
+#ifdef RECOMPILED
+// A function from a recompiled image. It runs a prefix of a block the
+// way the interpreter would, stopping wherever the interpreter would
+// stop, and returns the result of the last instruction it ran.
+typedef StepResult (*RecompiledFunc)(Emulator&);
+#endif
+
+// A straight line run of decoded instructions starting at pc. A block ends
+// at any unconditional change of flow, so the bytes following it (which
+// are often data) don't get marked as code.
+struct DecodedBlock
+{
+    uint16_t pc = 0;
+    uint16_t bytes = 0;
+    uint8_t count = 0;
+#ifdef JIT
+    uint16_t entries = 0;       // Times entered, until it reaches JitThreshold
+    JitCode code = nullptr;     // Its translation, once it has one
+#endif
+#ifdef RECOMPILED
+    RecompiledFunc native = nullptr;    // Recompiled code for it, if the image has any
+#endif
+#ifdef IDLE_LOOPS
+    bool idleHead = false;      // It starts a loop which might idle
+#endif
+    DecodedInst insts[MaxBlockInsts];
+};
+#endif
+
+// Returns true if the instruction ends a block, because it never falls
+// through to the next one or goes somewhere else before it does
+static inline bool endsBlock(const DecodedInst& inst)
+{
+    switch (inst.op) {
+        default:
+            return false;
+        case Op::ILL:
+        case Op::Page2:
+        case Op::Page3:
+        case Op::BRA:
+        case Op::BSR:
+        case Op::JMP:
+        case Op::JSR:
+        case Op::RTS:
+        case Op::RTI:
+        case Op::SWI:
+        case Op::SYNC:
+        case Op::CWAI:
+            return true;
+        case Op::PUL:
+            return (inst.operand & 0x80) != 0;
+        case Op::TFR:
+            return (inst.operand & 0x0f) == uint8_t(Reg::PC);
+        case Op::EXG:
+            return (inst.operand & 0x0f) == uint8_t(Reg::PC) || (inst.operand >> 4) == uint8_t(Reg::PC);
+#ifdef HD6309
+        case Op::ADDR:
+        case Op::ADCR:
+        case Op::SUBR:
+        case Op::SBCR:
+        case Op::ANDR:
+        case Op::ORR:
+        case Op::EORR:
+            return (inst.operand & 0x0f) == uint8_t(Reg::PC);
+#endif
+    }
+}
+
+// A memory mapped device. It gets every read and write to the pages
+// it's mapped into, with the full address
+class Device
+{
+  public:
+    virtual ~Device() { }
+    
+    virtual uint8_t read(uint16_t addr) = 0;
+    virtual void write(uint16_t addr, uint8_t v) = 0;
+};
+
+// Interrupt lines, as bits in the pending mask. IRQ and FIRQ are level
+// triggered and stay pending until released. NMI is edge triggered and
+// is released when it's taken.
+enum class Interrupt : uint8_t { NMI = 0x01, FIRQ = 0x02, IRQ = 0x04 };
+
 enum class BPStatus { Empty, Enabled, Disabled };
 
+// Exec is a breakpoint. The others are watchpoints on data accesses
+enum class BPKind : uint8_t { Exec, Read, Write, Access };
+
 enum class RunState {
     Loading,
     Cmd,
@@ -137,6 +481,8 @@ enum class RunState {
 struct BreakpointEntry
 {
     uint16_t addr;
+    uint16_t size = 1; // Watchpoints cover addr to addr + size - 1
+    BPKind kind = BPKind::Exec;
     BPStatus status = BPStatus::Empty;
 };
 
@@ -145,17 +491,21 @@ class BOSS9Base;
 class SRecordInfo : public SRecordParser
 {
   public:
-    SRecordInfo(uint8_t* ram, BOSS9Base* boss9) : _ram(ram), _boss9(boss9) { }
+    SRecordInfo(uint8_t* ram, uint32_t ramSize, BOSS9Base* boss9) : _ram(ram), _ramSize(ramSize), _boss9(boss9) { }
     void init()
     {
         SRecordParser::init();
         _startAddr = 0;
         _startAddrSet = false;
+        _outOfRange = false;
     }
     
     virtual  ~SRecordInfo() { }
     
     bool finished() { return _startAddrSet; }
+    
+    // A data record didn't fit in RAM, so the load failed
+    bool outOfRange() const { return _outOfRange; }
     uint16_t startAddr() const { return _startAddr; }
 
   protected:
@@ -173,7 +523,10 @@ class SRecordInfo : public SRecordParser
     
     virtual bool Data(const SRecordData *sRecData)
     {
-        // FIXME: Need to handle ranges, which means we need to pass in the ram size
+        if (sRecData->m_addr > _ramSize || sRecData->m_dataLen > _ramSize - sRecData->m_addr) {
+            rangeError(sRecData);
+            return false;
+        }
         
         // If the start addr has not been set, set it to the start of the first record.
         // The StartAddress function can change this at the end
@@ -187,9 +540,13 @@ class SRecordInfo : public SRecordParser
     virtual void ParseError(unsigned linenum, const char *fmt, va_list args);
     
   private:
+    void rangeError(const SRecordData *sRecData);
+    
     uint8_t* _ram = nullptr;
+    uint32_t _ramSize = 0;
     uint16_t _startAddr = 0;
     bool _startAddrSet = false;
+    bool _outOfRange = false;
     
     BOSS9Base* _boss9 = nullptr;
 };
@@ -200,19 +557,36 @@ public:
     enum class Error {
         None,
         Illegal,
+        FlagsMismatch,
     };
     
-    Emulator(uint8_t* ram, BOSS9Base* boss9) : sRecInfo(ram, boss9)
+    // ram is mapped from address 0 for ramSize bytes. The system area
+    // from SystemAddrStart is write protected.
+    Emulator(uint8_t* ram, uint32_t ramSize, BOSS9Base* boss9) : sRecInfo(ram, ramSize, boss9)
     {
         _ram = ram;
+        _ramSize = ramSize;
         _boss9 = boss9;
         
-#ifdef TRACE
-        memset(_traceBuffer, 0, sizeof(_traceBuffer));
+#ifdef BLOCK_CACHE
+        _blocks = new DecodedBlock[BlockCacheSize];
+        _blockIndex = new uint16_t[65536]();
 #endif
+        
+        mapMemory(0, ramSize, ram);
+        setWriteProtect(SystemAddrStart, 0x10000 - SystemAddrStart, true);
     }
     
-    ~Emulator() { }
+    Emulator(const Emulator&) = delete;
+    Emulator& operator=(const Emulator&) = delete;
+    
+    ~Emulator()
+    {
+#ifdef BLOCK_CACHE
+        delete [ ] _blocks;
+        delete [ ] _blockIndex;
+#endif
+    }
     
     // Assumes data is in s19 format
     // Returns the start addr of the program
@@ -220,39 +594,205 @@ public:
     bool loadLine(const char* data, bool& finished);
     uint16_t loadEnd();
     
+    // Load a whole s19, DECB or raw image at once, which is much faster
+    // than going a line at a time. A raw image is loaded at rawAddr.
+    // Prints the error and returns false if it's malformed or doesn't
+    // fit in RAM
+    bool loadImage(const uint8_t* data, size_t size, uint16_t& startAddr,
+                   ImageFormat format = ImageFormat::Auto, uint16_t rawAddr = 0);
+    
     void setStack(uint16_t stack) { _s = stack; }
     
     bool execute(RunState);
 
+    // Instructions executed since construction. Ones which stopped
+    // execution (system calls, illegal instructions) are counted too
+    uint64_t instructions() const { return _instructions; }
+    
+    // execute() returns as soon as instructions() reaches limit
+    void setInstructionLimit(uint64_t limit) { _instructionLimit = limit; }
+    
+    // Most instructions one execute() runs. InstructionsToExecutePerContinue
+    // unless it's set
+    void setQuantum(uint32_t quantum) { _quantum = quantum; }
+    uint32_t quantum() const { return _quantum; }
+    
+    // True if the last execute() stopped at a breakpoint or watchpoint
+    bool stoppedAtBreakpoint() const { return _stoppedAtBreakpoint; }
+
+    // The RAM given to the constructor. It's only what the CPU sees
+    // while it's mapped from address 0, as it is unless there's an MMU
     uint8_t* getAddr(uint16_t ea) { return _ram + ea; }
+    uint32_t ramSize() const { return _ramSize; }
+    
+    // Memory bus
+    //
+    // The address space is made of 256 byte pages. Each one is host
+    // memory, a device or unmapped. addr must be on a page boundary and
+    // size is rounded up to whole pages. mem is the host memory for addr.
+    // Reads of unmapped pages return $ff and writes are ignored.
+    void mapMemory(uint16_t addr, uint32_t size, uint8_t* mem);
+    void mapDevice(uint16_t addr, uint32_t size, Device*);
+    void unmap(uint16_t addr, uint32_t size);
+    void setWriteProtect(uint16_t addr, uint32_t size, bool protect);
+    bool writeProtected(uint16_t addr) const { return (_writeProtect[addr >> 11] & (1 << ((addr >> 8) & 0x07))) != 0; }
+
+    // Copy size bytes between host memory and the address space as the
+    // CPU sees it, so devices, write protect and watchpoints all apply.
+    // Each page of plain memory is a single memcpy. Addresses wrap at $ffff
+    void readMemory(uint16_t addr, uint8_t* dst, uint16_t size);
+    void writeMemory(uint16_t addr, const uint8_t* src, uint16_t size);
+
+    // The host memory for size bytes at addr, if the CPU reads all of
+    // them directly from one contiguous run of it. Otherwise nullptr
+    const uint8_t* memorySpan(uint16_t addr, uint16_t size) const;
+
+    // Interrupts
+    //
+    // Lines can be asserted and released from any thread. The CPU samples
+    // them at the start of each block (each execute() without BLOCK_CACHE).
+    // While it's in SYNC or CWAI, or in an idle loop only an interrupt can
+    // end, execute() returns without running anything and
+    // waitingForInterrupt() is true until a line that ends the wait is
+    // asserted, so the host can block on that.
+    void assertInterrupt(Interrupt);
+    void releaseInterrupt(Interrupt line) { _pendingInterrupts.fetch_and(~uint8_t(line)); }
+    uint8_t pendingInterrupts() const { return _pendingInterrupts.load(); }
+    bool waitingForInterrupt() const;
+    
+    // Take line, or end SYNC if it's masked, as though it had been
+    // pending. Used to replay interrupts without asserting the line
+    void serviceInterrupt(Interrupt line);
+    
+#ifdef IDLE_LOOPS
+    // Idle loops
+    //
+    // A loop of at most MaxIdleLoopInsts instructions which can't store
+    // anything, and gets back to its start with the registers as they
+    // were the pass before, goes around the same way until something
+    // outside it changes. If it only reads memory that can only be an
+    // interrupt, so execute() adds the passes it would make before the
+    // end of the quantum to the instruction and cycle counts without
+    // making them, and waitingForInterrupt() is true as it is in SYNC.
+    // If it reads a device or polls for input, execute() returns after
+    // each pass with idle() Polling, so the host can wait for input.
+    // Nothing is skipped while breakpoints, watchpoints, stepping or the
+    // profiler need to see every instruction. The trace records the
+    // skipped passes as one skip record.
+    enum class Idle : uint8_t { None, Waiting, Polling };
+    
+    // Why the last execute() returned, if it was in an idle loop
+    Idle idle() const { return _idle; }
+#endif
+    
+#ifdef SNAPSHOTS
+    // Save and restore the CPU, breakpoints and memory. Restoring only
+    // copies the pages written since the last snapshot was taken or
+    // restored, plus the ones that differ between that snapshot and this
+    // one. Devices and pending interrupts are not part of the snapshot.
+    void takeSnapshot(Snapshot&);
+    void restoreSnapshot(const Snapshot&);
+    
+    // Log every interrupt taken (and every SYNC ended by a masked one)
+    // into history, with the instruction count it happened at
+    void setHistory(History* history) { _history = history; }
+    History* history() const { return _history; }
+#endif
+    
+#ifdef TRACE
+    // Record everything executed until the trace is set to nullptr.
+    // It must be open
+    void setTrace(TraceRecorder* trace) { _trace = trace; }
+    TraceRecorder* trace() const { return _trace; }
+#endif
+    
+#ifdef PROFILER
+    // Profile everything executed until the profiler is set to nullptr
+    void setProfiler(Profiler* profiler) { _profiler = profiler; }
+    Profiler* profiler() const { return _profiler; }
+#endif
+    
+#ifdef STATS
+    // Count everything executed until the stats are set to nullptr
+    void setStats(InstructionStats* stats) { _stats = stats; }
+    InstructionStats* stats() const { return _stats; }
+#endif
+    
+#ifdef JIT
+    // Run hot blocks as translated code until the jit is set to nullptr.
+    // Breakpoints, watchpoints, stepping, tracing and profiling all see
+    // every instruction, so blocks are interpreted while any are active
+    void setJit(Jit* jit)
+    {
+        _jit = jit;
+        flushBlockCache();
+    }
+    Jit* jit() const { return _jit; }
+#endif
+    
+#ifdef RECOMPILED
+    // Run blocks from the recompiled image's code until it's set to
+    // nullptr. A block only runs that way while its bytes are the ones
+    // the image was recompiled from. Like the jit, it's bypassed while
+    // anything needs to see every instruction
+    void setRecompiled(const Recompiled* recompiled)
+    {
+        _recompiled = recompiled;
+        flushBlockCache();
+    }
+    const Recompiled* recompiled() const { return _recompiled; }
+#endif
     
     // Breakpoint support
-    bool breakpoint(uint8_t i, BreakpointEntry& entry) const;
-    bool setBreakpoint(uint16_t addr, uint8_t& i);
-    bool clearBreakpoint(uint8_t i);
+    //
+    // Breakpoints and watchpoints share one list and are numbered by
+    // their place in it. Enabled breakpoints are kept in a bitmap of
+    // every address and enabled watchpoints mark the pages they cover,
+    // so only accesses to those pages are checked.
+    uint16_t numBreakpoints() const { return uint16_t(_breakpoints.size()); }
+    bool breakpoint(uint16_t i, BreakpointEntry& entry) const;
+    bool setBreakpoint(uint16_t addr, uint16_t& i);
+    bool setWatchpoint(uint16_t addr, uint16_t size, BPKind kind, uint16_t& i);
+    bool clearBreakpoint(uint16_t i);
     bool clearAllBreakpoints();
-    bool disableBreakpoint(uint8_t i);
+    bool disableBreakpoint(uint16_t i);
     bool disableAllBreakpoints();
-    bool enableBreakpoint(uint8_t i);
+    bool enableBreakpoint(uint16_t i);
     bool enableAllBreakpoints();
     
-    bool atBreakpoint(uint16_t addr)
+    bool atBreakpoint(uint16_t addr) const
     {
-        if (!_haveBreakpoints) {
-            return false;
-        }
-        for (auto it : _breakpoints) {
-            if (it.status == BPStatus::Enabled && it.addr == addr) {
-                return true;
-            }
-        }
-        return false;
+        return _haveBreakpoints && (_breakpointBits[addr >> 3] & (1 << (addr & 0x07))) != 0;
     }
 
+    // Print n instructions from addr in the monitor, with labels from
+    // any symbols
     void printInstructions(uint16_t addr, uint16_t n);
     
+    // Disassemble the instruction at addr into buf, which must hold
+    // Disassembler::MaxLineSize chars. Returns its size
+    uint8_t disassemble(uint16_t addr, char* buf);
+    
+    // Symbols for disassembly, or nullptr for just addresses
+    void setSymbols(const Symbols* symbols) { _symbols = symbols; }
+    const Symbols* symbols() const { return _symbols; }
+    
+    // Decode the instruction at pc, including any Page2 or Page3 prefix
+    void decode(uint16_t pc, DecodedInst&);
+    
+#ifdef BLOCK_CACHE
+    // Discard all decoded blocks. Must be called whenever RAM is changed
+    // other than by store8 or store16 (e.g., loading s-records)
+    void flushBlockCache();
+#endif
+    
     Error error() const { return _error; }
     
+#ifdef COMPUTE_CYCLES
+    // Total cycles executed since construction
+    uint64_t cycles() const { return _cycles; }
+#endif
+    
     uint16_t getReg(Reg reg)
     {
         switch(reg) {
@@ -264,9 +804,16 @@ public:
             case Reg::Y:    return _y;
             case Reg::U:    return _u;
             case Reg::S:    return _s;
-            case Reg::CC:   return _ccByte;
+            case Reg::CC:   return ccByte();
             case Reg::PC:   return _pc;
             case Reg::DP:   return _dp;
+#ifdef HD6309
+            case Reg::W:    return _w;
+            case Reg::V:    return _v;
+            case Reg::E:    return _e;
+            case Reg::F:    return _f;
+            case Reg::MD:   return _md;
+#endif
             case Reg::DDU:  return (_prevOp == Op::Page2) ? _d : ((_prevOp == Op::Page3) ? _u : _d);
             case Reg::XYS:  return (_prevOp == Op::Page2) ? _y : ((_prevOp == Op::Page3) ? _s : _x);
             case Reg::XY:   return (_prevOp == Op::Page2) ? _y : ((_prevOp == Op::Page3) ?  0 : _x);
@@ -285,9 +832,16 @@ public:
             case Reg::Y:    _y = v; break;
             case Reg::U:    _u = v; break;
             case Reg::S:    _s = v; break;
-            case Reg::CC:   _ccByte = v; break;
+            case Reg::CC:   setCCByte(v); break;
             case Reg::PC:   _pc = v; break;
             case Reg::DP:   _dp = v; break;
+#ifdef HD6309
+            case Reg::W:    _w = v; break;
+            case Reg::V:    _v = v; break;
+            case Reg::E:    _e = v; break;
+            case Reg::F:    _f = v; break;
+            case Reg::MD:   _md = v; break;
+#endif
             case Reg::DDU:  if (_prevOp == Op::Page2) _d = v; else if (_prevOp == Op::Page3) _u = v; else _d = v; break;
             case Reg::XYS:  if (_prevOp == Op::Page2) _y = v; else if (_prevOp == Op::Page3) _s = v; else _x = v; break;
             case Reg::XY:   if (_prevOp == Op::Page2) _y = v; else if (_prevOp != Op::Page3) _x = v; break;
@@ -295,130 +849,503 @@ public:
         }
     }
 
-    const char* regToString(Reg, Op prevOp = Op::NOP);
+    static const char* regToString(Reg, Op prevOp = Op::NOP);
     uint8_t regSizeInBytes(Reg reg)
     {
-        return (reg == Reg::A || reg == Reg::B || reg == Reg::CC || reg == Reg::DP) ? 1 : 2;
+        return (reg == Reg::A || reg == Reg::B || reg == Reg::CC || reg == Reg::DP ||
+                reg == Reg::E || reg == Reg::F || reg == Reg::MD) ? 1 : 2;
     }
 
   private:
-    void push8(uint16_t& s, uint8_t v)
+#ifdef JIT
+    friend class Jit;
+#endif
+#ifdef RECOMPILED
+    friend class Recompiled;
+#endif
+    
+    // Execute one instruction. ea is the effective address it used
+    StepResult step(const DecodedInst& inst, uint16_t& ea)
     {
-        _ram[--s] = v;
+#ifdef TRACE
+        if (_trace) {
+            return traceStep(inst, ea);
+        }
+#endif
+        return untracedStep(inst, ea);
     }
     
-    void push16(uint16_t& s, uint16_t v)
+    StepResult untracedStep(const DecodedInst& inst, uint16_t& ea)
     {
-        _ram[--s] = v;
-        _ram[--s] = v >> 8;
+#ifdef STATS
+        if (_stats) {
+            countInstruction(inst);
+        }
+#endif
+#ifdef PROFILER
+        if (_profiler) {
+            return profileStep(inst, ea);
+        }
+#endif
+        return dispatch(inst, ea);
     }
     
-    uint8_t pop8(uint16_t& s)
+    StepResult dispatch(const DecodedInst& inst, uint16_t& ea)
     {
-        return _ram[s++];
+#ifdef OPCODE_HANDLERS
+        return inst.handler(*this, inst, ea);
+#else
+        return exec(inst.op, inst.reg, inst.adr, inst.left, inst.right, inst, ea);
+#endif
     }
     
-    uint16_t pop16(uint16_t& s)
+    // The body of every instruction. The op, register, address mode and
+    // load and store kinds are passed separately from the decoded
+    // instruction so the specialized handlers can pass them as constants
+    StepResult exec(Op, Reg, Adr, Left, Right, const DecodedInst&, uint16_t& ea);
+    
+#ifdef OPCODE_HANDLERS
+    // One handler for each opcode on each page (none, Page2 and Page3)
+    template<uint8_t Page, uint8_t Opcode>
+    static StepResult handler(Emulator&, const DecodedInst&, uint16_t& ea);
+    
+    template<size_t... I>
+    static constexpr std::array<InstHandler, sizeof...(I)> makeHandlers(std::index_sequence<I...>)
     {
-        uint16_t r = _ram[s++];
-        r <<= 8;
-        r |= _ram[s++];
-        return r;
+        return { { &handler<I / 256, I % 256>... } };
+    }
+    
+    static const std::array<InstHandler, 3 * 256> _handlers;
+#endif
+    
+#ifdef TRACE
+    // Most instructions can change one register at most, so only that
+    // one has to be looked at. That's kept inline, so recording them is
+    // a few loads and two stores. The value is picked without a branch
+    // on which register it is, which would be hard to predict
+    StepResult traceStep(const DecodedInst& inst, uint16_t& ea)
+    {
+        uint16_t pc = _pc;
+        uint64_t bytes = traceBytes(pc, inst);
+#ifdef COMPUTE_CYCLES
+        uint64_t cycles = _cycles;
+#else
+        uint64_t cycles = 0;
+#endif
+        
+        StepResult result = untracedStep(inst, ea);
+        
+#ifdef COMPUTE_CYCLES
+        uint8_t instCycles = uint8_t(_cycles - cycles);
+#else
+        uint8_t instCycles = 0;
+#endif
+        uint8_t written = inst.traceRegs;
+        if ((written & (written - 1)) == 0 && _trace->canRecordOne()) {
+            const uint16_t values[8] = { _d, _x, _y, _u, _s, _dp, 0, 0 };
+            _trace->instruction(pc, bytes, inst.traceFlags, ea, ccByte(), written,
+                                values[__builtin_ctz(written | 0x40)], inst.traceIndex, instCycles);
+        } else {
+            traceAll(pc, bytes, inst, ea, cycles, instCycles);
+        }
+        return result;
+    }
+    
+    // Record an instruction with all the registers
+    void traceAll(uint16_t pc, uint64_t bytes, const DecodedInst& inst, uint16_t ea,
+                  uint64_t cycles, uint8_t instCycles);
+    
+    // The bytes of inst, which is at pc, first in the low byte. Blocks
+    // are thrown away when their bytes are written, so the bytes inst
+    // was decoded from are still in its page. They're read before it
+    // runs, in case it overwrites itself. Only an instruction which runs
+    // into the next page or isn't in plain memory is fetched a byte at
+    // a time
+    uint64_t traceBytes(uint16_t pc, const DecodedInst& inst)
+    {
+        const uint8_t* page = _pages[pc >> 8];
+        if (page && (pc & 0xff) <= 0x100 - sizeof(uint64_t)) {
+            uint64_t bytes;
+            memcpy(&bytes, page + (pc & 0xff), sizeof(bytes));
+            return bytes;
+        }
+        return fetchTraceBytes(pc, inst);
     }
     
-    uint8_t next8()
+    uint64_t fetchTraceBytes(uint16_t pc, const DecodedInst& inst);
+    TraceRegisters traceRegisters();
+    
+    // Record the instructions run from pc without being stepped, since
+    // the instruction and cycle counts were instructions and cycles
+    void traceSkipped(uint16_t pc, uint64_t instructions, uint64_t cycles);
+#endif
+    
+#ifdef PROFILER
+    StepResult profileStep(const DecodedInst& inst, uint16_t& ea);
+#endif
+    
+#ifdef STATS
+    void countInstruction(const DecodedInst& inst);
+#endif
+    
+    // Handle the first instruction of a step. Returns true if we've
+    // entered the monitor
+    bool stepDone(RunState, uint16_t ea);
+    
+    bool hitBreakpoint();
+    bool hitWatchpoint();
+    
+    // Called for accesses to watched pages
+    void checkWatchpoints(uint16_t ea, BPKind kind);
+    
+    // True if there's something for checkInterrupts to do
+    bool interruptCheckNeeded() const
     {
-        uint8_t v = _ram[_pc];
-        _pc += 1;
-        return v;
+        return _waitState != WaitState::None || _pendingInterrupts.load(std::memory_order_relaxed) != 0;
     }
     
-    uint16_t next16()
+    // Service the highest priority pending interrupt. Returns false if
+    // the CPU is still waiting in SYNC or CWAI
+    bool checkInterrupts();
+    void takeInterrupt(bool entireState, uint16_t vector);
+    
+    // Push everything but S, for SWI, CWAI and interrupts. E must be set first
+    void pushEntireState();
+    
+    // True if FIRQ stacks the entire state
+    bool firqEntireState() const
     {
-        uint16_t v = (uint16_t(_ram[_pc]) << 8) | uint16_t(_ram[_pc + 1]);
-        _pc += 2;
-        return v;
+#ifdef HD6309
+        return (_md & MDFirqEntire) != 0;
+#else
+        return false;
+#endif
     }
     
+#ifdef HD6309
+    bool nativeMode() const { return (_md & MDNative) != 0; }
+    
+    // Stack the entire state and jump through the trap vector, setting
+    // the given MD bit
+    void trap(uint8_t mdBit);
+    
+    // The ops which are too big to inline into every handler. bitOp
+    // and transfer return false if their operands are illegal
+    void registerOp(Op);
+    bool bitOp(Op, uint8_t postbyte, uint16_t ea);
+    bool transfer(uint8_t postbyte, uint8_t mode);
+    void divide(Op);
+#endif
+    
+#ifdef SNAPSHOTS
+    bool pageClean(uint8_t page) const { return (_cleanPages[page >> 3] & (1 << (page & 0x07))) != 0; }
+    void setPageClean(uint8_t page, bool clean);
+    void setAllPagesClean(bool clean);
+#endif
+    
+#ifdef BLOCK_CACHE
+    DecodedBlock& findBlock(uint16_t pc)
+    {
+        uint16_t slot = _blockIndex[pc];
+        return slot ? _blocks[slot - 1] : decodeBlock(pc);
+    }
+    
+    DecodedBlock& decodeBlock(uint16_t pc);
+    void invalidateCode(uint16_t ea);
+#endif
+
+#if defined(JIT) || defined(RECOMPILED) || defined(IDLE_LOOPS)
+    // True if breakpoints, watchpoints, stepping or the profiler need
+    // to see every instruction
+    bool everyInstructionSeen(RunState) const;
+#endif
+
+#if defined(JIT) || defined(RECOMPILED)
+    // True if the block has to be interpreted, because it's from a self
+    // modifying page or something needs to see every instruction
+    bool mustInterpret(const DecodedBlock&, RunState) const;
+#endif
+
+#ifdef IDLE_LOOPS
+    // Instructions in one pass of the loop starting at head, if it could
+    // idle, or 0. polls is set if it calls a system function for input
+    uint8_t idleLoop(uint16_t head, bool& polls);
+    
+    // Called at the start of each pass of a loop which might idle.
+    // Returns true if execute() should return, for the host to wait
+    bool idlePass(RunState);
+    
+    void idleRegs(uint16_t* regs);
+    
+    // Memory has changed other than by the CPU, so what the last pass
+    // of the loop did says nothing about the next one
+    void resetIdleWatch() { _idleWatch.valid = false; }
+#endif
+
+#ifdef JIT
+    // Run the block's translation, translating it first if it's hot
+    // enough. Returns false if nothing was run
+    bool runTranslated(DecodedBlock&, RunState);
+#endif
+
+#ifdef RECOMPILED
+    // The recompiled function for the block, if the image has one
+    // starting at its pc which only covers bytes that are unchanged
+    RecompiledFunc findRecompiled(const DecodedBlock&);
+#endif
+
+    // Called for every write to RAM so decoded blocks covering
+    // the written address get thrown away
+    void codeCheck(uint16_t ea)
+    {
+#ifdef BLOCK_CACHE
+        if (_codePages[ea >> 8]) {
+            invalidateCode(ea);
+        }
+#endif
+    }
+    
+    // The same for size bytes written directly to a page, starting at ea
+    void codeCheck(uint16_t ea, uint16_t size)
+    {
+#ifdef BLOCK_CACHE
+        if (_codePages[ea >> 8]) {
+            for (uint16_t i = 0; i < size; ++i) {
+                invalidateCode(ea + i);
+            }
+        }
+#endif
+    }
+    
+    // Instruction fetch. Reads memory directly so fetches don't
+    // trigger read watchpoints
+    uint8_t fetch8(uint16_t ea)
+    {
+        const uint8_t* page = _pages[ea >> 8];
+        return page ? page[ea & 0xff] : busRead(ea);
+    }
+    
+    uint16_t fetch16(uint16_t ea)
+    {
+        return (uint16_t(fetch8(ea)) << 8) | uint16_t(fetch8(ea + 1));
+    }
+    
+    // Memory access. Pages of plain memory are read and written through
+    // the host pointers in _readPage and _writePage. Everything else goes
+    // through busRead and busWrite
     uint8_t load8(uint16_t ea)
     {
-        return _ram[ea];
+        const uint8_t* page = _readPage[ea >> 8];
+        return page ? page[ea & 0xff] : busRead(ea);
     }
     
     uint16_t load16(uint16_t ea)
     {
-        return (uint16_t(_ram[ea]) << 8) | uint16_t(_ram[ea + 1]);
+        const uint8_t* page = _readPage[ea >> 8];
+        if (page && (ea & 0xff) != 0xff) {
+            page += ea & 0xff;
+            return (uint16_t(page[0]) << 8) | uint16_t(page[1]);
+        }
+        return (uint16_t(load8(ea)) << 8) | uint16_t(load8(ea + 1));
     }
     
     void store8(uint16_t ea, uint8_t v)
     {
-        if (ea >= SystemAddrStart) {
-            readOnlyAddr(ea);
+        uint8_t* page = _writePage[ea >> 8];
+        if (page) {
+            page[ea & 0xff] = v;
+            codeCheck(ea);
         } else {
-            _ram[ea] = v;
+            busWrite(ea, v);
         }
     }
     
     void store16(uint16_t ea, uint16_t v)
     {
-        if (ea >= SystemAddrStart) {
-            readOnlyAddr(ea);
-        } else {
-            _ram[ea] = v >> 8;
-            _ram[ea + 1] = v;
+        uint8_t* page = _writePage[ea >> 8];
+        if (page && (ea & 0xff) != 0xff) {
+            page += ea & 0xff;
+            page[0] = v >> 8;
+            page[1] = v;
+            codeCheck(ea);
+            codeCheck(ea + 1);
+            return;
         }
+        store8(ea, v >> 8);
+        store8(ea + 1, v);
+    }
+    
+    void push8(uint16_t& s, uint8_t v)
+    {
+        store8(--s, v);
+    }
+    
+    void push16(uint16_t& s, uint16_t v)
+    {
+        store8(--s, v);
+        store8(--s, v >> 8);
     }
     
+    uint8_t pop8(uint16_t& s)
+    {
+        return load8(s++);
+    }
+    
+    uint16_t pop16(uint16_t& s)
+    {
+        uint16_t r = load8(s++);
+        r <<= 8;
+        r |= load8(s++);
+        return r;
+    }
+    
+    uint8_t busRead(uint16_t ea);
+    void busWrite(uint16_t ea, uint8_t v);
+    void updatePage(uint8_t page);
+    
     // Update the HNZVC condition codes
-    void HNZVC8()  { updateH(); xNZVC8(); }
-    void xNZVC8()  { updateNZ8(); updateV8(); updateC8(); }
-    void xNZVC16() { updateNZ16(); updateV16(); updateC16(); }
-    void xNZ018()  { updateNZ8(); _cc.V = false; _cc.C = true; }
-    void x0ZxC8()  { updateNZ8(); _cc.N = false; updateC8(); }
-    void xNZVx8()  { updateNZ8(); updateV8(); }
-    void xNZ0x8()  { updateNZ8(); _cc.V = false; }
-    void xNZ0x16() { updateNZ16(); _cc.V = false; }
-    void xNZ0C8()  { updateNZ8(); _cc.V = false; updateC8(); }
-    void xNZxC8()  { updateNZ8(); updateC8(); }
-    void xNZxx8()  { updateNZ8(); }
+    //
+    // Flags set to a constant are written before the computed ones so
+    // they don't have to be resolved from the previous op first
+    void HNZVC8()  { setFlags<false>(FlagH | FlagN | FlagZ | FlagV | FlagC); }
+    void xNZVC8()  { setFlags<false>(FlagN | FlagZ | FlagV | FlagC); }
+    void xNZVC16() { setFlags<true>(FlagN | FlagZ | FlagV | FlagC); }
+    void xNZ018()  { setFlag(FlagV, false); setFlag(FlagC, true); setFlags<false>(FlagN | FlagZ); }
+    void xNZVx8()  { setFlags<false>(FlagN | FlagZ | FlagV); }
+    void xNZ0x8()  { setFlag(FlagV, false); setFlags<false>(FlagN | FlagZ); }
+    void xNZ0x16() { setFlag(FlagV, false); setFlags<true>(FlagN | FlagZ); }
+    void xNZ0C8()  { setFlag(FlagV, false); setFlags<false>(FlagN | FlagZ | FlagC); }
+    void xNZxC8()  { setFlags<false>(FlagN | FlagZ | FlagC); }
+    void xNZxx8()  { setFlags<false>(FlagN | FlagZ); }
+#ifdef HD6309
+    void xNZ0116() { setFlag(FlagV, false); setFlag(FlagC, true); setFlags<true>(FlagN | FlagZ); }
+    void xNZxC16() { setFlags<true>(FlagN | FlagZ | FlagC); }
+    void xNZxx16() { setFlags<true>(FlagN | FlagZ); }
+    
+    // For the 32 bit results in Q
+    void xNZ0x32(uint32_t result)
+    {
+        setFlag(FlagN, (result & 0x80000000) != 0);
+        setFlag(FlagZ, result == 0);
+        setFlag(FlagV, false);
+    }
+#endif
+    
+    // Take a conditional branch. Long ones take an extra cycle when taken
+    void takeBranch(Adr adr)
+    {
+        _pc += _right;
+#ifdef COMPUTE_CYCLES
+        if (adr == Adr::RelL) {
+            _cycles += 1;
+        }
+#endif
+    }
     
-    bool NxorV() { return (_cc.N ^ _cc.V) != 0; }
+    bool NxorV()
+    {
+        uint8_t f = flags(FlagN | FlagV);
+        return f == FlagN || f == FlagV;
+    }
     
-    void updateH()
+    // Compute H, N, Z, V and C from the operands and result of an op.
+    // sign is the sign bit for the size of the op (0x80 or 0x8000).
+    static uint8_t computeFlags(uint32_t sign, uint32_t left, uint32_t right, uint32_t result)
     {
-        _cc.H = ((_left ^ _right ^ _result) & 0x10) != 0;
+        return ((((left ^ right ^ result) & 0x10) != 0) ? FlagH : 0) |
+               (((result & sign) != 0) ? FlagN : 0) |
+               (((result & ((sign << 1) - 1)) == 0) ? FlagZ : 0) |
+               ((((left ^ right ^ result ^ (result >> 1)) & sign) != 0) ? FlagV : 0) |
+               (((result & (sign << 1)) != 0) ? FlagC : 0);
     }
     
-    void updateNZ8()
+    static uint8_t mergeFlags(uint8_t cc, uint8_t flags, uint8_t v)
     {
-        _cc.Z = uint8_t(_result) == 0;
-        _cc.N = (_result & 0x80) != 0;
+        return (cc & ~flags) | (v & flags);
     }
     
-    void updateNZ16()
+    // Set the given flags from _left, _right and _result. With LAZY_FLAGS
+    // N, Z and V are just recorded here and computed when they're read.
+    // H and C are cheap and are always computed. Every op which sets flags
+    // sets or clears N and Z and nearly all of them set or clear V, so
+    // there's hardly ever a flag pending from the previous op that has to
+    // be computed before recording this one.
+    template<bool Is16>
+    void setFlags(uint8_t flags)
     {
-        _cc.Z = uint16_t(_result) == 0;
-        _cc.N = (_result & 0x8000) != 0;
+        const uint32_t sign = Is16 ? 0x8000 : 0x80;
+        
+#ifdef LAZY_FLAGS
+        const uint8_t lazyFlags = flags & LazyFlagMask;
+        const uint8_t eagerFlags = flags & ~LazyFlagMask;
+        
+        if (eagerFlags) {
+            _ccByte = mergeFlags(_ccByte, eagerFlags, computeFlags(sign, _left, _right, _result));
+        }
+        if (_lazyFlags & ~lazyFlags) {
+            resolveFlags();
+        }
+        _lazyFlags = lazyFlags;
+        _flagSign = sign;
+        _flagLeft = _left;
+        _flagRight = _right;
+        _flagResult = _result;
+#ifdef CHECK_LAZY_FLAGS
+        _checkCCByte = mergeFlags(_checkCCByte, flags, computeFlags(sign, _left, _right, _result));
+#endif
+#else
+        _ccByte = mergeFlags(_ccByte, flags, computeFlags(sign, _left, _right, _result));
+#endif
     }
     
-    void updateC8()
+#ifdef LAZY_FLAGS
+    // Bring all the pending flags in _cc up to date
+    void resolveFlags()
     {
-        _cc.C = (_result & 0x100) != 0;
+        _ccByte = mergeFlags(_ccByte, _lazyFlags, computeFlags(_flagSign, _flagLeft, _flagRight, _flagResult));
+        _lazyFlags = 0;
     }
+#endif
+
+#ifdef CHECK_LAZY_FLAGS
+    bool checkLazyFlags(uint16_t pc);
+#endif
     
-    void updateC16()
+    // Returns the bits of CC in mask
+    uint8_t flags(uint8_t mask)
     {
-        _cc.C = (_result & 0x10000) != 0;
+#ifdef LAZY_FLAGS
+        if (_lazyFlags & mask) {
+            resolveFlags();
+        }
+#endif
+        return _ccByte & mask;
     }
     
-    void updateV8()
+    bool flag(uint8_t f) { return flags(f) != 0; }
+    
+    void setFlag(uint8_t f, bool v)
     {
-        _cc.V = ((_left ^ _right ^ _result ^ (_result >> 1)) & 0x80) != 0;
+#ifdef LAZY_FLAGS
+        _lazyFlags &= ~f;
+#ifdef CHECK_LAZY_FLAGS
+        _checkCCByte = v ? (_checkCCByte | f) : (_checkCCByte & ~f);
+#endif
+#endif
+        _ccByte = v ? (_ccByte | f) : (_ccByte & ~f);
     }
     
-    void updateV16()
+    uint8_t ccByte() { return flags(0xff); }
+    
+    void setCCByte(uint8_t v)
     {
-        _cc.V = ((_left ^ _right ^ _result ^ (_result >> 1)) & 0x8000) != 0;
+#ifdef LAZY_FLAGS
+        _lazyFlags = 0;
+#ifdef CHECK_LAZY_FLAGS
+        _checkCCByte = v;
+#endif
+#endif
+        _ccByte = v;
     }
     
     void readOnlyAddr(uint16_t addr);
@@ -427,6 +1354,23 @@ public:
 
     
     uint8_t* _ram;
+    uint32_t _ramSize;
+    
+    // Page tables. _pages has the host memory for every memory page and
+    // nullptr for devices and unmapped pages. _readPage is the same except
+    // it's also nullptr for pages with read watchpoints. _writePage is
+    // also nullptr for write protected pages, pages with write watchpoints
+    // and (with SNAPSHOTS) clean pages.
+    uint8_t* _pages[256] = { };
+    uint8_t* _readPage[256] = { };
+    uint8_t* _writePage[256] = { };
+    Device* _devices[256] = { };
+    uint8_t _writeProtect[256 / 8] = { };
+    
+    // Watch flags for each page, to send its accesses to busRead and busWrite
+    static constexpr uint8_t WatchRead = 0x01;
+    static constexpr uint8_t WatchWrite = 0x02;
+    uint8_t _watchPages[256] = { };
     
     union {
         struct { uint8_t _b; uint8_t _a; };
@@ -440,17 +1384,54 @@ public:
     uint16_t _pc = 0;
     uint8_t _dp = 0;
     
+#ifdef HD6309
+    // E and F are W the way A and B are D. D and W are Q
+    union {
+        struct { uint8_t _f; uint8_t _e; };
+        uint16_t _w = 0;
+    };
+    
+    uint16_t _v = 0;
+    uint8_t _md = 0;
+#endif
+    
     union {
         CC _cc;
         uint8_t _ccByte = 0;
     };
     
+#ifdef LAZY_FLAGS
+    // The flags in _cc which are out of date and the values
+    // of the op which set them
+    uint8_t _lazyFlags = 0;
+    uint32_t _flagSign = 0;
+    uint32_t _flagLeft = 0;
+    uint32_t _flagRight = 0;
+    uint32_t _flagResult = 0;
+#endif
+
+#ifdef CHECK_LAZY_FLAGS
+    // The flags computed eagerly, for comparison
+    uint8_t _checkCCByte = 0;
+#endif
+    
     // Used by opcodes. Made members for CC calcs
     uint32_t _left = 0;
     uint32_t _right = 0;
     uint32_t _result = 0;
     Op _prevOp = Op::NOP;
     
+#ifdef COMPUTE_CYCLES
+    uint64_t _cycles = 0;
+#endif
+    
+    // execute() runs until _instructions reaches _quantumEnd, which
+    // is never past _instructionLimit
+    uint64_t _instructions = 0;
+    uint64_t _quantumEnd = 0;
+    uint64_t _instructionLimit = UINT64_MAX;
+    uint32_t _quantum = InstructionsToExecutePerContinue;
+    
     BOSS9Base* _boss9 = nullptr;
     
     SRecordInfo sRecInfo;
@@ -458,16 +1439,105 @@ public:
     
     Error _error = Error::None;
 
-    // Breakpoint support
-    BreakpointEntry _breakpoints[NumBreakpoints];
+    // Breakpoint support. _breakpointBits has a bit for every address
+    // with an enabled breakpoint. It's allocated with the first one.
+    std::vector<BreakpointEntry> _breakpoints;
+    std::vector<uint8_t> _breakpointBits;
     bool _haveBreakpoints = false;
+    bool _haveWatchpoints = false;
+    
+    // The first watchpoint hit since the last one was reported
+    bool _watchHit = false;
+    uint16_t _watchAddr = 0;
+    BPKind _watchKind = BPKind::Read;
+    bool _stoppedAtBreakpoint = false;
     uint32_t _subroutineDepth = 0; // Determines when we've returned from subroutine for Step Over and Step Out
     RunState _lastRunState = RunState::Running;
     
-    #ifdef TRACE
-    uint16_t _traceBuffer[TraceBufferSize];
-    uint32_t _traceBufferIndex = 0;
-    #endif
+    // Interrupt support
+    enum class WaitState : uint8_t { None, Sync, Cwai };
+    
+    std::atomic<uint8_t> _pendingInterrupts { 0 };
+    WaitState _waitState = WaitState::None;
+    
+#ifdef IDLE_LOOPS
+    // The loop being watched and the state at the start of its last
+    // pass. insts is 0 if the loop at head can't idle. Device reads are
+    // counted so a loop polling one isn't taken for one that can't end
+#ifdef HD6309
+    static constexpr uint8_t IdleRegCount = 10;
+#else
+    static constexpr uint8_t IdleRegCount = 7;
+#endif
+    
+    struct IdleWatch
+    {
+        bool valid = false;
+        bool polls = false;
+        uint8_t insts = 0;
+        uint16_t head = 0;
+        uint64_t instructions = 0;
+        uint64_t cycles = 0;
+        uint32_t deviceReads = 0;
+        uint16_t regs[IdleRegCount] = { };
+    };
+    
+    IdleWatch _idleWatch;
+    uint32_t _deviceReads = 0;
+    Idle _idle = Idle::None;
+#endif
+    
+#ifdef PROFILER
+    Profiler* _profiler = nullptr;
+#endif
+    
+    const Symbols* _symbols = nullptr;
+    
+#ifdef STATS
+    InstructionStats* _stats = nullptr;
+#endif
+    
+#ifdef SNAPSHOTS
+    // The pages of the last snapshot taken or restored. A page is clean
+    // if it hasn't been written since then, so it still matches its base
+    // page. The first write to a clean page goes through busWrite, which
+    // makes it dirty.
+    Snapshot::PagePtr _basePages[256];
+    uint8_t _cleanPages[256 / 8] = { };
+    
+    History* _history = nullptr;
+#endif
+    
+#ifdef TRACE
+    TraceRecorder* _trace = nullptr;
+#endif
+    
+#ifdef JIT
+    Jit* _jit = nullptr;
+#endif
+    
+#ifdef RECOMPILED
+    const Recompiled* _recompiled = nullptr;
+#endif
+    
+#ifdef BLOCK_CACHE
+    // Blocks are allocated round robin from _blocks. When it's full the
+    // whole cache is flushed. _blockIndex maps a pc to its block (slot + 1,
+    // 0 means no block). _codePages has a nonzero entry for every 256 byte
+    // page containing decoded code and _codeBytes has a bit set for every
+    // decoded byte, so stores to data sharing a page with code don't cause
+    // an invalidation. A page which has been invalidated MaxPageInvalidations
+    // times is self modifying and is decoded one instruction at a time into
+    // _scratchBlock until the next flush.
+    DecodedBlock* _blocks = nullptr;
+    uint16_t* _blockIndex = nullptr;
+    uint16_t _nextBlock = 0;
+    uint8_t _codePages[256] = { };
+    uint8_t _pageInvalidations[256] = { };
+    uint8_t _codeBytes[65536 / 8] = { };
+    DecodedBlock _scratchBlock;
+    bool _blockInvalidated = false;
+#endif
 };
 
 }
@@ -0,0 +1,102 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  MMU.cpp
+//  Banked memory
+//
+
+#include "MMU.h"
+
+using namespace mc6809;
+
+static constexpr uint8_t RegsPage = MMURegsAddr >> 8;
+static constexpr uint16_t PagesPerBank = MMU::BankSize / 256;
+
+MMU::MMU(Emulator& emu, uint8_t* ram, uint16_t ramBanks, uint8_t* rom, uint16_t romBanks)
+    : _emu(emu)
+    , _ownRAM(emu.getAddr(0))
+    , _ownBanks(uint16_t(emu.ramSize() / BankSize))
+    , _ram(ram)
+    , _romStart(_ownBanks + ramBanks)
+    , _rom(rom)
+    , _romBanks(romBanks)
+{
+    for (uint16_t page = 0; page < 256; ++page) {
+        if (_emu.writeProtected(uint16_t(page << 8))) {
+            _systemPages[page >> 3] |= uint8_t(1 << (page & 0x07));
+        }
+    }
+
+    _emu.mapDevice(RegsPage << 8, 256, this);
+
+    for (uint8_t window = 0; window < Windows; ++window) {
+        setBank(window, window);
+    }
+}
+
+uint8_t* MMU::bankMemory(uint8_t bank) const
+{
+    if (bank < _ownBanks) {
+        return _ownRAM + uint32_t(bank) * BankSize;
+    }
+    if (bank < _romStart) {
+        return _ram + uint32_t(bank - _ownBanks) * BankSize;
+    }
+    if (bank - _romStart < _romBanks) {
+        return _rom + uint32_t(bank - _romStart) * BankSize;
+    }
+    return nullptr;
+}
+
+void MMU::setBank(uint8_t window, uint8_t bank)
+{
+    _banks[window] = bank;
+    uint8_t* mem = bankMemory(bank);
+    _windows[window] = mem;
+
+    uint8_t firstPage = window * PagesPerBank;
+    for (uint16_t i = 0; i < PagesPerBank; ++i) {
+        uint8_t page = uint8_t(firstPage + i);
+        if (page == RegsPage) {
+            continue;
+        }
+
+        uint16_t addr = uint16_t(page << 8);
+        if (mem) {
+            _emu.mapMemory(addr, 256, mem + i * 256);
+        } else {
+            _emu.unmap(addr, 256);
+        }
+        _emu.setWriteProtect(addr, 256, systemPage(page) || romBank(bank));
+    }
+}
+
+uint8_t MMU::read(uint16_t addr)
+{
+    if (addr >= MMURegsAddr && addr < MMURegsAddr + Windows) {
+        return _banks[addr - MMURegsAddr];
+    }
+
+    uint8_t* mem = _windows[addr / BankSize];
+    return mem ? mem[addr % BankSize] : 0xff;
+}
+
+void MMU::write(uint16_t addr, uint8_t v)
+{
+    if (addr >= MMURegsAddr && addr < MMURegsAddr + Windows) {
+        setBank(uint8_t(addr - MMURegsAddr), v);
+        return;
+    }
+
+    uint8_t window = uint8_t(addr / BankSize);
+    uint8_t* mem = _windows[window];
+    if (mem && !systemPage(uint8_t(addr >> 8)) && !romBank(_banks[window])) {
+        mem[addr % BankSize] = v;
+    }
+}
@@ -0,0 +1,89 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  MMU.h
+//  Banked memory
+//
+//  Physical memory is made of 8KB banks and the 64KB address space is
+//  8 windows onto them, like the CoCo 3's GIME or the banking on many
+//  SBCs. Each window has a bank register. Switching banks remaps the
+//  window's pages in the emulator's page tables, so banked memory is
+//  read and written as fast as any other.
+//
+//  The first banks are the emulator's own RAM. After them come the
+//  extra RAM banks and then the ROM banks, which are write protected.
+//  Each window starts out with the bank of the same number, so with
+//  64KB of its own RAM the CPU sees what it would with no MMU. With
+//  less, the windows past it start out on the extra RAM or ROM banks.
+//  Registers for banks that don't exist unmap the window.
+//
+//  The registers are a device at MMURegsAddr, one byte per window,
+//  and read back what was written. The rest of their page goes through
+//  to the memory in window 7, so the vectors still work.
+//
+//  Only the banks mapped in are part of a snapshot, so snapshots can't
+//  be restored across a bank switch.
+//
+
+#pragma once
+
+#include "MC6809.h"
+
+namespace mc6809 {
+
+static constexpr uint16_t MMURegsAddr = 0xffa0;
+
+class MMU : public Device
+{
+  public:
+    static constexpr uint32_t BankSize = 0x2000;
+    static constexpr uint8_t Windows = 8;
+
+    // ram is ramBanks banks and rom is romBanks banks. There can be
+    // 256 banks in all, including the emulator's own RAM
+    MMU(Emulator&, uint8_t* ram, uint16_t ramBanks, uint8_t* rom = nullptr, uint16_t romBanks = 0);
+    virtual ~MMU() { }
+
+    MMU(const MMU&) = delete;
+    MMU& operator=(const MMU&) = delete;
+
+    virtual uint8_t read(uint16_t addr) override;
+    virtual void write(uint16_t addr, uint8_t v) override;
+
+    uint8_t bank(uint8_t window) const { return _banks[window]; }
+    void setBank(uint8_t window, uint8_t bank);
+
+    uint16_t bankCount() const { return _romStart + _romBanks; }
+
+    // The host memory of bank, or nullptr if there's no such bank
+    uint8_t* bankMemory(uint8_t bank) const;
+
+  private:
+    bool romBank(uint8_t bank) const { return bank >= _romStart; }
+    bool systemPage(uint8_t page) const { return (_systemPages[page >> 3] & (1 << (page & 0x07))) != 0; }
+
+    Emulator& _emu;
+    uint8_t* _ownRAM;
+    uint16_t _ownBanks;
+    uint8_t* _ram;
+    uint16_t _romStart;
+    uint8_t* _rom;
+    uint16_t _romBanks;
+
+    uint8_t _banks[Windows];
+
+    // Host memory in each window, for accesses to the registers' page
+    uint8_t* _windows[Windows] = { };
+
+    // Pages which were write protected before the MMU was added, like
+    // the system area. They stay that way whatever is mapped there
+    uint8_t _systemPages[256 / 8] = { };
+};
+
+}
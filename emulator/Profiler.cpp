@@ -0,0 +1,135 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Profiler.cpp
+//  Guest execution profiler
+//
+
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+
+using namespace mc6809;
+
+void Profiler::reset()
+{
+    _counts.assign(65536, 0);
+    _cycles.assign(65536, 0);
+    _nodes.assign(1, Node { 0, 0, 0 });
+    _children.clear();
+    _stack.clear();
+    _current = 0;
+    _started = false;
+}
+
+void Profiler::call(uint16_t addr, uint16_t sp)
+{
+    // Frames at or below sp had their return addresses popped
+    // without a return we saw, or just overwritten by this call
+    while (!_stack.empty() && _stack.back().sp <= sp) {
+        _stack.pop_back();
+    }
+    uint32_t parent = _stack.empty() ? 0 : _stack.back().node;
+
+    uint64_t key = (uint64_t(parent) << 16) | addr;
+    auto it = _children.find(key);
+    uint32_t node = parent;
+    if (it != _children.end()) {
+        node = it->second;
+    } else if (_nodes.size() < MaxProfileNodes) {
+        node = uint32_t(_nodes.size());
+        _nodes.push_back(Node { addr, parent, 0 });
+        _children.emplace(key, node);
+    }
+
+    _stack.push_back(Frame { node, sp });
+    _current = node;
+}
+
+void Profiler::ret(uint16_t sp)
+{
+    while (!_stack.empty() && _stack.back().sp < sp) {
+        _stack.pop_back();
+    }
+    _current = _stack.empty() ? 0 : _stack.back().node;
+}
+
+std::string Profiler::symbolize(uint16_t addr) const
+{
+    if (_symbols) {
+        return _symbols->symbolize(addr);
+    }
+
+    char buf[8];
+    snprintf(buf, sizeof(buf), "$%04x", addr);
+    return buf;
+}
+
+void Profiler::writeChain(FILE* f, uint32_t node) const
+{
+    if (node != 0) {
+        writeChain(f, _nodes[node].parent);
+        fputc(';', f);
+    }
+    fputs(symbolize(_nodes[node].addr).c_str(), f);
+}
+
+void Profiler::writeFolded(FILE* f) const
+{
+    for (uint32_t i = 0; i < _nodes.size(); ++i) {
+        if (_nodes[i].cycles == 0) {
+            continue;
+        }
+        writeChain(f, i);
+        fprintf(f, " %" PRIu64 "\n", _nodes[i].cycles);
+    }
+}
+
+void Profiler::writeHotAddresses(FILE* f, uint32_t n) const
+{
+    std::vector<uint16_t> addrs;
+    for (uint32_t addr = 0; addr < 65536; ++addr) {
+        if (_counts[addr]) {
+            addrs.push_back(uint16_t(addr));
+        }
+    }
+
+    n = std::min(n, uint32_t(addrs.size()));
+    std::partial_sort(addrs.begin(), addrs.begin() + n, addrs.end(),
+                      [this](uint16_t a, uint16_t b) { return _cycles[a] > _cycles[b]; });
+
+    uint64_t total = totalCycles();
+
+    fprintf(f, "  addr  %-24s %12s %14s %7s\n", "symbol", "insts", "cycles", "%");
+    for (uint32_t i = 0; i < n; ++i) {
+        uint16_t addr = addrs[i];
+        fprintf(f, "  %04x  %-24s %12" PRIu32 " %14" PRIu64 " %6.2f%%\n", addr, symbolize(addr).c_str(),
+                _counts[addr], _cycles[addr], total ? 100.0 * double(_cycles[addr]) / double(total) : 0.0);
+    }
+}
+
+uint64_t Profiler::totalInstructions() const
+{
+    uint64_t total = 0;
+    for (uint32_t count : _counts) {
+        total += count;
+    }
+    return total;
+}
+
+uint64_t Profiler::totalCycles() const
+{
+    uint64_t total = 0;
+    for (uint64_t cycles : _cycles) {
+        total += cycles;
+    }
+    return total;
+}
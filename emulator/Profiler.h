@@ -0,0 +1,116 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Profiler.h
+//  Guest execution profiler
+//
+//  A Profiler counts the instructions executed and the cycles used at
+//  every address. It also keeps a shadow of the guest's call stack,
+//  pushed by BSR, JSR, SWI and interrupts and unwound by RTS, RTI and
+//  PULS PC, so time can be charged to the chain of calls that led to
+//  it. Every distinct chain is a node in a call tree, so recording an
+//  instruction is just a few counter updates.
+//
+//  Frames are matched to returns by stack address rather than by
+//  counting, so code which drops return addresses or switches stacks
+//  only confuses the tree until the stack gets back above those frames.
+//
+//  The Emulator only feeds a Profiler when it's built with PROFILER.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Symbols.h"
+
+namespace mc6809 {
+
+// Call tree nodes past this are charged to their caller
+static constexpr uint32_t MaxProfileNodes = 1 << 20;
+
+class Profiler
+{
+  public:
+    Profiler() { reset(); }
+
+    // Clear the counts and call tree. Symbols are kept
+    void reset();
+
+    // Called by the Emulator after each instruction
+    void instruction(uint16_t pc, uint32_t cycles)
+    {
+        if (!_started) {
+            _started = true;
+            _nodes[0].addr = pc;
+        }
+        _counts[pc] += 1;
+        _cycles[pc] += cycles;
+        _nodes[_current].cycles += cycles;
+    }
+
+    // addr is where the call went and sp is the stack pointer after
+    // the return address (or the entire state) was pushed
+    void call(uint16_t addr, uint16_t sp);
+
+    // sp is the stack pointer after the return
+    void ret(uint16_t sp);
+
+    // Symbols to name addresses with, or nullptr for just addresses
+    void setSymbols(const Symbols* symbols) { _symbols = symbols; }
+
+    // The nearest symbol at or below addr as name or name+$offset.
+    // Just the address if there are no symbols below it
+    std::string symbolize(uint16_t addr) const;
+
+    // One line for each call chain with the cycles spent in its last
+    // function, "outer;inner;leaf cycles", as read by flamegraph.pl
+    void writeFolded(FILE*) const;
+
+    // The n addresses which used the most cycles
+    void writeHotAddresses(FILE*, uint32_t n) const;
+
+    uint64_t totalInstructions() const;
+    uint64_t totalCycles() const;
+
+  private:
+    struct Node
+    {
+        uint16_t addr;
+        uint32_t parent;
+        uint64_t cycles;
+    };
+
+    struct Frame
+    {
+        uint32_t node;
+        uint16_t sp;
+    };
+
+    void writeChain(FILE*, uint32_t node) const;
+
+    std::vector<uint32_t> _counts;
+    std::vector<uint64_t> _cycles;
+
+    // _nodes[0] is the root, named for the first instruction executed.
+    // _children maps (parent << 16 | addr) to the child node
+    std::vector<Node> _nodes;
+    std::unordered_map<uint64_t, uint32_t> _children;
+    std::vector<Frame> _stack;
+    uint32_t _current = 0;
+    bool _started = false;
+
+    const Symbols* _symbols = nullptr;
+};
+
+}
@@ -0,0 +1,90 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Recompiled.cpp
+//  Images recompiled to C++ and loaded as shared objects
+//
+
+#include "Recompiled.h"
+
+#ifdef RECOMPILED
+
+#include <dlfcn.h>
+
+using namespace mc6809;
+
+uint32_t Recompiled::hash(const std::string& contents)
+{
+    // 32 bit FNV-1a
+    uint32_t h = 2166136261;
+    for (char c : contents) {
+        h = (h ^ uint8_t(c)) * 16777619;
+    }
+    return h;
+}
+
+bool Recompiled::load(const std::string& filename, uint32_t imageHash, std::string& error)
+{
+    unload();
+
+    // The path needs a slash or dlopen searches the library path for it
+    std::string path = (filename.find('/') == std::string::npos) ? "./" + filename : filename;
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        error = dlerror();
+        return false;
+    }
+
+    auto image = static_cast<const RecompiledImage*>(dlsym(handle, RecompiledImageSymbol));
+    if (!image) {
+        error = filename + " is not a recompiled image";
+    } else if (image->version != RecompiledVersion || image->flags != RecompiledFlags ||
+               image->emulatorSize != sizeof(Emulator)) {
+        error = filename + " was compiled for an emulator with different build flags";
+    } else if (image->hash != imageHash) {
+        error = filename + " was recompiled from a different image";
+    } else {
+        _handle = handle;
+        _image = image;
+        return true;
+    }
+
+    dlclose(handle);
+    return false;
+}
+
+void Recompiled::unload()
+{
+    if (_handle) {
+        dlclose(_handle);
+    }
+    _handle = nullptr;
+    _image = nullptr;
+}
+
+const RecompiledBlock* Recompiled::find(uint16_t pc) const
+{
+    if (!_image) {
+        return nullptr;
+    }
+
+    uint32_t lo = 0;
+    uint32_t hi = _image->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (_image->blocks[mid].pc < pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo < _image->count && _image->blocks[lo].pc == pc) ? &_image->blocks[lo] : nullptr;
+}
+
+#endif
@@ -0,0 +1,177 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Recompiled.h
+//  Images recompiled to C++ and loaded as shared objects
+//
+//  The recompile tool disassembles an s19 image from its entry point and
+//  vectors, splits the code it finds into basic blocks and writes C++ with
+//  one function per block. Each instruction is a call to exec() with the
+//  decoded instruction as a constant, so a function compiles to straight
+//  line code for its block with no decoding or dispatch. The file is
+//  compiled into a shared object which exports a RecompiledImage.
+//
+//  When the emulator decodes a block at an address the image has a
+//  function for, and the bytes the function covers are still the ones it
+//  was recompiled from, the block runs the function instead. Everything
+//  else, like code only reached through an indirect jump, is interpreted.
+//
+
+#pragma once
+
+#include "MC6809.h"
+
+#ifdef RECOMPILED
+
+#include <string>
+
+namespace mc6809 {
+
+// Changes whenever generated code or RecompiledImage changes
+static constexpr uint32_t RecompiledVersion = 1;
+
+// The build flags which change what exec() does or the layout of what
+// it uses. An image has to be compiled with the same ones as the
+// emulator which loads it.
+static constexpr uint32_t RecompiledFlags = 0
+#ifdef COMPUTE_CYCLES
+    | 0x01
+#endif
+#ifdef TRACE
+    | 0x02
+#endif
+#ifdef LAZY_FLAGS
+    | 0x04
+#endif
+#ifdef CHECK_LAZY_FLAGS
+    | 0x08
+#endif
+#ifdef PROFILER
+    | 0x10
+#endif
+#ifdef HD6309
+    | 0x20
+#endif
+#ifdef OPCODE_HANDLERS
+    | 0x40
+#endif
+#ifdef SNAPSHOTS
+    | 0x80
+#endif
+#ifdef JIT
+    | 0x100
+#endif
+    ;
+
+// The name of the RecompiledImage in the shared object
+static constexpr const char* RecompiledImageSymbol = "mc6809RecompiledImage";
+
+struct RecompiledBlock
+{
+    uint16_t pc;
+    uint16_t bytes;         // Length of the code the function runs
+    uint32_t offset;        // Where that code is in RecompiledImage::code
+    RecompiledFunc func;
+};
+
+struct RecompiledImage
+{
+    uint32_t version;
+    uint32_t flags;
+    uint32_t emulatorSize;
+    uint32_t hash;          // Recompiled::hash() of the s19 file
+    uint32_t count;
+    const RecompiledBlock* blocks;  // In pc order
+    const uint8_t* code;
+};
+
+class Recompiled
+{
+  public:
+    Recompiled() { }
+    ~Recompiled() { unload(); }
+
+    Recompiled(const Recompiled&) = delete;
+    Recompiled& operator=(const Recompiled&) = delete;
+
+    // Images are matched to the s19 file they came from by a hash
+    // of its contents
+    static uint32_t hash(const std::string& contents);
+
+    // Load a shared object made from the generated code. Fails with a
+    // message in error if it isn't one, if it was compiled for an emulator
+    // with other build flags or if it was recompiled from a different
+    // image than the one with the given hash.
+    bool load(const std::string& filename, uint32_t imageHash, std::string& error);
+    void unload();
+
+    bool loaded() const { return _image != nullptr; }
+    uint32_t blockCount() const { return _image ? _image->count : 0; }
+
+    // The block starting at pc, or nullptr if there isn't one
+    const RecompiledBlock* find(uint16_t pc) const;
+
+    // The bytes block was recompiled from
+    const uint8_t* code(const RecompiledBlock& block) const { return _image->code + block.offset; }
+
+    // Used by generated code
+    //
+    // A decoded instruction, with the fields this build doesn't have ignored
+    static constexpr DecodedInst inst(Op op, Reg reg, Adr adr, Left left, Right right, Op prefix, uint8_t size,
+                                      uint8_t postbyte, uint8_t cycles, uint16_t operand, uint16_t extra)
+    {
+        DecodedInst inst { };
+        inst.op = op;
+        inst.reg = reg;
+        inst.adr = adr;
+        inst.left = left;
+        inst.right = right;
+        inst.prefix = prefix;
+        inst.size = size;
+        inst.postbyte = postbyte;
+#ifdef COMPUTE_CYCLES
+        inst.cycles = cycles;
+#endif
+        inst.operand = operand;
+#ifdef HD6309
+        inst.extra = extra;
+#endif
+        return inst;
+    }
+
+    // Run one instruction the way the execution loop does. Returns false
+    // if the block has to stop after it, with result set to what the
+    // function returns. nextPC is the address of the next instruction.
+    static ALWAYS_INLINE bool step(Emulator& e, const DecodedInst& inst, uint16_t nextPC, StepResult& result)
+    {
+        uint16_t ea;
+        result = e.exec(inst.op, inst.reg, inst.adr, inst.left, inst.right, inst, ea);
+        e._instructions += 1;
+        return result == StepResult::Continue && e._instructions != e._quantumEnd &&
+               e._pc == nextPC && !e._blockInvalidated;
+    }
+
+    // True if a block whose last instruction returned result can run
+    // again from pc, its start, without going back to the execution loop.
+    // That's where interrupts are taken, so it has to go back if any are
+    // pending.
+    static ALWAYS_INLINE bool loop(Emulator& e, StepResult result, uint16_t pc)
+    {
+        return result == StepResult::Continue && e._instructions != e._quantumEnd &&
+               e._pc == pc && !e._blockInvalidated && !e.interruptCheckNeeded();
+    }
+
+  private:
+    void* _handle = nullptr;
+    const RecompiledImage* _image = nullptr;
+};
+
+}
+
+#endif
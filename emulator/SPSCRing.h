@@ -0,0 +1,126 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  SPSCRing.h
+//  Lock-free single producer, single consumer ring
+//
+//  One thread pushes and one other thread pops, with no locks and no
+//  system calls. Each side only writes its own index, and publishes it
+//  with a release store that the other side reads with an acquire load.
+//  Each side also keeps a copy of the other's index, so it only touches
+//  the other side's cache line when the ring looks full or empty.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+namespace mc6809 {
+
+template<typename T, size_t Size> class SPSCRing
+{
+    static_assert(Size != 0 && (Size & (Size - 1)) == 0, "SPSCRing size must be a power of 2");
+
+  public:
+    // Producer side
+    bool push(const T& value)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _cachedTail == Size) {
+            _cachedTail = _tail.load(std::memory_order_acquire);
+            if (head - _cachedTail == Size) {
+                return false;
+            }
+        }
+        _buffer[head & (Size - 1)] = value;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Push as many of the n values as there's room for, in order.
+    // Returns how many were pushed
+    size_t push(const T* values, size_t n)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (Size - (head - _cachedTail) < n) {
+            _cachedTail = _tail.load(std::memory_order_acquire);
+        }
+        n = std::min(n, Size - (head - _cachedTail));
+        
+        size_t start = head & (Size - 1);
+        size_t firstSize = std::min(n, Size - start);
+        std::copy(values, values + firstSize, _buffer + start);
+        std::copy(values + firstSize, values + n, _buffer);
+        _head.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t space()
+    {
+        _cachedTail = _tail.load(std::memory_order_acquire);
+        return Size - (_head.load(std::memory_order_relaxed) - _cachedTail);
+    }
+
+    // Consumer side
+    bool pop(T& value)
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _cachedHead) {
+            _cachedHead = _head.load(std::memory_order_acquire);
+            if (tail == _cachedHead) {
+                return false;
+            }
+        }
+        value = _buffer[tail & (Size - 1)];
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty()
+    {
+        _cachedHead = _head.load(std::memory_order_acquire);
+        return _tail.load(std::memory_order_relaxed) == _cachedHead;
+    }
+
+    // The values waiting, as up to two contiguous runs since they can
+    // wrap. They stay put until they're consumed. Returns the total
+    size_t peek(const T*& first, size_t& firstSize, const T*& second, size_t& secondSize)
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        _cachedHead = _head.load(std::memory_order_acquire);
+        size_t size = _cachedHead - tail;
+        size_t start = tail & (Size - 1);
+
+        first = _buffer + start;
+        firstSize = (start + size > Size) ? Size - start : size;
+        second = _buffer;
+        secondSize = size - firstSize;
+        return size;
+    }
+
+    void consume(size_t n)
+    {
+        _tail.store(_tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+  private:
+    // The indexes count up forever and are masked to index the buffer.
+    // Each side's index and its copy of the other's share a cache line
+    alignas(64) std::atomic<size_t> _head { 0 };
+    size_t _cachedTail = 0;
+
+    alignas(64) std::atomic<size_t> _tail { 0 };
+    size_t _cachedHead = 0;
+
+    alignas(64) T _buffer[Size];
+};
+
+}
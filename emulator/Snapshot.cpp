@@ -0,0 +1,239 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Snapshot.cpp
+//  Saved machine state
+//
+//  The serialized form is:
+//
+//      "M09S"                  magic
+//      version                 1 byte
+//      d x y u s pc w v        2 bytes each
+//      dp cc md prevOp         1 byte each
+//      waitState               1 byte
+//      cycles                  8 bytes
+//      instructions            8 bytes
+//      runState                1 byte
+//      startAddr               2 bytes
+//      exited                  1 byte
+//      exitCode                4 bytes
+//      input count             2 bytes, then the input
+//      breakpoint count        2 bytes, then 6 bytes (addr, size, kind, status) for each
+//      memory map              32 bytes, a bit for every page that is memory
+//      stored map              32 bytes, a bit for every page stored below
+//      pages                   256 bytes for each stored page, in order
+//
+//  Multibyte values are big endian, like the 6809.
+//
+
+#include "Snapshot.h"
+
+#include <cstring>
+
+using namespace mc6809;
+
+static constexpr char SnapshotMagic[4] = { 'M', '0', '9', 'S' };
+
+namespace {
+
+class Writer
+{
+  public:
+    Writer(std::vector<uint8_t>& data) : _data(data) { }
+
+    void put8(uint8_t v) { _data.push_back(v); }
+    void put16(uint16_t v) { put8(v >> 8); put8(v); }
+    void put32(uint32_t v) { put16(v >> 16); put16(v); }
+    void put64(uint64_t v) { put32(uint32_t(v >> 32)); put32(uint32_t(v)); }
+    void put(const uint8_t* p, size_t size) { _data.insert(_data.end(), p, p + size); }
+
+  private:
+    std::vector<uint8_t>& _data;
+};
+
+class Reader
+{
+  public:
+    Reader(const uint8_t* data, size_t size) : _data(data), _size(size) { }
+
+    // Reading past the end returns 0s and sets the error
+    bool ok() const { return !_error; }
+
+    const uint8_t* get(size_t size)
+    {
+        if (_error || _size - _index < size) {
+            _error = true;
+            return nullptr;
+        }
+        const uint8_t* p = _data + _index;
+        _index += size;
+        return p;
+    }
+
+    uint8_t get8()
+    {
+        const uint8_t* p = get(1);
+        return p ? p[0] : 0;
+    }
+
+    uint16_t get16() { uint16_t v = get8(); return (v << 8) | get8(); }
+    uint32_t get32() { uint32_t v = get16(); return (v << 16) | get16(); }
+    uint64_t get64() { uint64_t v = get32(); return (v << 32) | get32(); }
+
+  private:
+    const uint8_t* _data;
+    size_t _size;
+    size_t _index = 0;
+    bool _error = false;
+};
+
+}
+
+static bool pageBit(const uint8_t* map, uint16_t page)
+{
+    return (map[page >> 3] & (1 << (page & 0x07))) != 0;
+}
+
+void Snapshot::serialize(std::vector<uint8_t>& data, const Snapshot* base) const
+{
+    Writer writer(data);
+
+    writer.put(reinterpret_cast<const uint8_t*>(SnapshotMagic), sizeof(SnapshotMagic));
+    writer.put8(SnapshotVersion);
+
+    writer.put16(d);
+    writer.put16(x);
+    writer.put16(y);
+    writer.put16(u);
+    writer.put16(s);
+    writer.put16(pc);
+    writer.put16(w);
+    writer.put16(v);
+    writer.put8(dp);
+    writer.put8(cc);
+    writer.put8(md);
+    writer.put8(prevOp);
+    writer.put8(waitState);
+    writer.put64(cycles);
+    writer.put64(instructions);
+
+    writer.put8(runState);
+    writer.put16(startAddr);
+    writer.put8(exited ? 1 : 0);
+    writer.put32(uint32_t(exitCode));
+
+    writer.put16(uint16_t(input.size()));
+    writer.put(input.data(), input.size());
+
+    writer.put16(uint16_t(breakpoints.size()));
+    for (const auto& it : breakpoints) {
+        writer.put16(it.addr);
+        writer.put16(it.size);
+        writer.put8(it.kind);
+        writer.put8(it.status);
+    }
+
+    // A page is stored unless base has the same contents
+    uint8_t memoryMap[32] = { };
+    uint8_t storedMap[32] = { };
+
+    for (uint16_t page = 0; page < 256; ++page) {
+        if (!pages[page]) {
+            continue;
+        }
+        memoryMap[page >> 3] |= uint8_t(1 << (page & 0x07));
+
+        const PagePtr* basePage = base ? &base->pages[page] : nullptr;
+        bool same = basePage && *basePage && (*basePage == pages[page] || **basePage == *pages[page]);
+        if (!same) {
+            storedMap[page >> 3] |= uint8_t(1 << (page & 0x07));
+        }
+    }
+
+    writer.put(memoryMap, sizeof(memoryMap));
+    writer.put(storedMap, sizeof(storedMap));
+
+    for (uint16_t page = 0; page < 256; ++page) {
+        if (pageBit(storedMap, page)) {
+            writer.put(pages[page]->data(), pages[page]->size());
+        }
+    }
+}
+
+bool Snapshot::deserialize(const uint8_t* data, size_t size, const Snapshot* base)
+{
+    Reader reader(data, size);
+
+    const uint8_t* magic = reader.get(sizeof(SnapshotMagic));
+    if (!magic || memcmp(magic, SnapshotMagic, sizeof(SnapshotMagic)) != 0 || reader.get8() != SnapshotVersion) {
+        return false;
+    }
+
+    d = reader.get16();
+    x = reader.get16();
+    y = reader.get16();
+    u = reader.get16();
+    s = reader.get16();
+    pc = reader.get16();
+    w = reader.get16();
+    v = reader.get16();
+    dp = reader.get8();
+    cc = reader.get8();
+    md = reader.get8();
+    prevOp = reader.get8();
+    waitState = reader.get8();
+    cycles = reader.get64();
+    instructions = reader.get64();
+
+    runState = reader.get8();
+    startAddr = reader.get16();
+    exited = reader.get8() != 0;
+    exitCode = int32_t(reader.get32());
+
+    uint16_t inputSize = reader.get16();
+    const uint8_t* inputData = reader.get(inputSize);
+    if (!inputData) {
+        return false;
+    }
+    input.assign(inputData, inputData + inputSize);
+
+    breakpoints.resize(reader.get16());
+    for (auto& it : breakpoints) {
+        it.addr = reader.get16();
+        it.size = reader.get16();
+        it.kind = reader.get8();
+        it.status = reader.get8();
+    }
+
+    const uint8_t* memoryMap = reader.get(32);
+    const uint8_t* storedMap = reader.get(32);
+    if (!reader.ok()) {
+        return false;
+    }
+
+    for (uint16_t page = 0; page < 256; ++page) {
+        if (!pageBit(memoryMap, page)) {
+            pages[page] = nullptr;
+        } else if (pageBit(storedMap, page)) {
+            const uint8_t* p = reader.get(sizeof(Page));
+            if (!p) {
+                return false;
+            }
+            auto newPage = std::make_shared<Page>();
+            memcpy(newPage->data(), p, sizeof(Page));
+            pages[page] = newPage;
+        } else if (base && base->pages[page]) {
+            pages[page] = base->pages[page];
+        } else {
+            return false;
+        }
+    }
+
+    return reader.ok();
+}
@@ -0,0 +1,92 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Snapshot.h
+//  Saved machine state
+//
+//  A Snapshot holds the CPU registers, breakpoints, the monitor state
+//  and the contents of every memory page. Pages are immutable and
+//  reference counted, so copying a Snapshot is cheap and the copy
+//  shares every page with the original. That makes a copy a fork:
+//  any number of machines can be restored from it and each one only
+//  gets new pages for the ones it writes.
+//
+//  serialize() writes a compact versioned binary. Given a base snapshot
+//  only the pages which differ from it are written and the same base
+//  must be given to deserialize().
+//
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace mc6809 {
+
+static constexpr uint8_t SnapshotVersion = 5;
+
+class Snapshot
+{
+  public:
+    using Page = std::array<uint8_t, 256>;
+    using PagePtr = std::shared_ptr<const Page>;
+
+    // kind and status are a BPKind and BPStatus
+    struct Breakpoint
+    {
+        uint16_t addr;
+        uint16_t size;
+        uint8_t kind;
+        uint8_t status;
+    };
+
+    // CPU state. prevOp and waitState are the Emulator's enums. w, v
+    // and md are the 6309 registers, which are always 0 for a 6809
+    uint16_t d = 0;
+    uint16_t x = 0;
+    uint16_t y = 0;
+    uint16_t u = 0;
+    uint16_t s = 0;
+    uint16_t pc = 0;
+    uint16_t w = 0;
+    uint16_t v = 0;
+    uint8_t dp = 0;
+    uint8_t cc = 0;
+    uint8_t md = 0;
+    uint8_t prevOp = 0;
+    uint8_t waitState = 0;
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+
+    std::vector<Breakpoint> breakpoints;
+
+    // Monitor state. runState is a RunState
+    uint8_t runState = 0;
+    uint16_t startAddr = 0;
+    bool exited = false;
+    int32_t exitCode = 0;
+    
+    // Console input read ahead of the program
+    std::vector<uint8_t> input;
+
+    // One for each page in the address space. nullptr for
+    // devices and unmapped pages
+    PagePtr pages[256];
+
+    void serialize(std::vector<uint8_t>& data, const Snapshot* base = nullptr) const;
+
+    // Returns false if data is not a snapshot of this version
+    // or it needs pages missing from base
+    bool deserialize(const uint8_t* data, size_t size, const Snapshot* base = nullptr);
+};
+
+}
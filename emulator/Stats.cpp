@@ -0,0 +1,165 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Stats.cpp
+//  Instruction mix statistics
+//
+
+#include "Stats.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace mc6809;
+
+void InstructionStats::reset()
+{
+    _instructions = 0;
+    _idleInstructions = 0;
+    _idleCycles = 0;
+    memset(_ops, 0, sizeof(_ops));
+    memset(_adrs, 0, sizeof(_adrs));
+    memset(_indexed, 0, sizeof(_indexed));
+    memset(_prefixes, 0, sizeof(_prefixes));
+}
+
+const char* InstructionStats::adrName(uint8_t adr)
+{
+    switch (Adr(adr)) {
+        case Adr::None:     return "none";
+        case Adr::Direct:   return "direct";
+        case Adr::Inherent: return "inherent";
+        case Adr::Rel:      return "rel8";
+        case Adr::RelL:     return "rel16";
+        case Adr::RelP:     return "relP";
+        case Adr::Immed8:   return "immed8";
+        case Adr::Immed16:  return "immed16";
+        case Adr::Indexed:  return "indexed";
+        case Adr::Extended: return "extended";
+#ifdef HD6309
+        case Adr::Immed32:  return "immed32";
+#endif
+    }
+    return "???";
+}
+
+void InstructionStats::indexedName(uint8_t slot, char* buf, size_t size)
+{
+    if (slot == Const5Slot) {
+        snprintf(buf, size, "n5,R");
+        return;
+    }
+
+    const char* name = "???";
+    switch (IdxMode(slot & IdxModeMask)) {
+        case IdxMode::ConstRegNoOff: name = ",R"; break;
+        case IdxMode::ConstReg8Off:  name = "n8,R"; break;
+        case IdxMode::ConstReg16Off: name = "n16,R"; break;
+        case IdxMode::AccAOffReg:    name = "A,R"; break;
+        case IdxMode::AccBOffReg:    name = "B,R"; break;
+        case IdxMode::AccDOffReg:    name = "D,R"; break;
+        case IdxMode::Inc1Reg:       name = ",R+"; break;
+        case IdxMode::Inc2Reg:       name = ",R++"; break;
+        case IdxMode::Dec1Reg:       name = ",-R"; break;
+        case IdxMode::Dec2Reg:       name = ",--R"; break;
+        case IdxMode::ConstPC8Off:   name = "n8,PCR"; break;
+        case IdxMode::ConstPC16Off:  name = "n16,PCR"; break;
+        case IdxMode::Extended:      name = "n16"; break;
+#ifdef HD6309
+        case IdxMode::AccEOffReg:    name = "E,R"; break;
+        case IdxMode::AccFOffReg:    name = "F,R"; break;
+        case IdxMode::AccWOffReg:    name = "W,R"; break;
+#endif
+    }
+
+#ifdef HD6309
+    // The postbytes which are illegal on the 6809 are the W modes
+    if (slot == (IdxW & IndexedSlotMask) || slot == (IdxWInd & IndexedSlotMask)) {
+        name = "W modes";
+    }
+#endif
+
+    snprintf(buf, size, (slot & IndexedIndMask) ? "[%s]" : "%s", name);
+}
+
+// opToString leaves the size to the register name, so add it back
+// for the ops which come in both sizes
+static std::string opName(Op op)
+{
+    switch (op) {
+        case Op::ADD8: case Op::CMP8: case Op::LD8: case Op::ST8: case Op::SUB8:
+            return std::string(opToString(op)) + "8";
+        case Op::ADD16: case Op::CMP16: case Op::LD16: case Op::ST16: case Op::SUB16:
+            return std::string(opToString(op)) + "16";
+        default:
+            return opToString(op);
+    }
+}
+
+// One section of the report, with the counts which aren't 0 sorted from most to least
+static void reportSection(InstructionStats::PrintFunc print, void* context, const char* title,
+                          std::vector<std::pair<std::string, uint64_t>>& counts, uint64_t total)
+{
+    std::stable_sort(counts.begin(), counts.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+    char line[80];
+    print(context, title);
+    for (const auto& it : counts) {
+        if (it.second == 0) {
+            break;
+        }
+        snprintf(line, sizeof(line), "    %-10s %14" PRIu64 " %6.2f%%", it.first.c_str(), it.second,
+                 total ? double(it.second) * 100 / double(total) : 0.0);
+        print(context, line);
+    }
+}
+
+void InstructionStats::report(PrintFunc print, void* context) const
+{
+    char line[80];
+    snprintf(line, sizeof(line), "%" PRIu64 " instructions", _instructions);
+    print(context, line);
+    if (_idleInstructions) {
+        snprintf(line, sizeof(line), "%" PRIu64 " instructions and %" PRIu64 " cycles skipped in idle loops",
+                 _idleInstructions, _idleCycles);
+        print(context, line);
+    }
+
+    std::vector<std::pair<std::string, uint64_t>> counts;
+    for (uint16_t i = 0; i < 256; ++i) {
+        counts.emplace_back(opName(Op(i)), _ops[i]);
+    }
+    reportSection(print, context, "Ops", counts, _instructions);
+
+    counts.clear();
+    for (uint8_t i = 0; i < 16; ++i) {
+        counts.emplace_back(adrName(i), _adrs[i]);
+    }
+    reportSection(print, context, "Address modes", counts, _instructions);
+
+    counts.clear();
+    uint64_t indexed = 0;
+    for (uint8_t i = 0; i <= Const5Slot; ++i) {
+        char name[16];
+        indexedName(i, name, sizeof(name));
+        counts.emplace_back(name, _indexed[i]);
+        indexed += _indexed[i];
+    }
+    reportSection(print, context, "Indexed modes", counts, indexed);
+
+    counts.clear();
+    counts.emplace_back("none", _prefixes[0]);
+    counts.emplace_back("Page2", _prefixes[1]);
+    counts.emplace_back("Page3", _prefixes[2]);
+    reportSection(print, context, "Prefixes", counts, _instructions);
+}
@@ -0,0 +1,84 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Stats.h
+//  Instruction mix statistics
+//
+//  InstructionStats counts how often each op, address mode, indexed mode
+//  and page prefix is executed, to show which handlers are worth a fast
+//  path and where guest code spends its instructions. Ops are counted
+//  after the prefix is folded in, so CMPY is a CMP16 with a Page2
+//  prefix. Everything is a fixed array indexed by the enum, so counting
+//  an instruction is a handful of increments.
+//
+//  The Emulator only feeds an InstructionStats when it's built with STATS.
+//
+
+#pragma once
+
+#include "MC6809.h"
+
+namespace mc6809 {
+
+class InstructionStats
+{
+  public:
+    InstructionStats() { reset(); }
+
+    void reset();
+
+    // Called by the Emulator before each instruction
+    void instruction(const DecodedInst& inst)
+    {
+        _instructions += 1;
+        _ops[uint8_t(inst.op)] += 1;
+        _adrs[uint8_t(inst.adr)] += 1;
+        _prefixes[(inst.prefix == Op::Page2) ? 1 : ((inst.prefix == Op::Page3) ? 2 : 0)] += 1;
+        if (inst.adr == Adr::Indexed) {
+            _indexed[(inst.postbyte & 0x80) ? (inst.postbyte & IndexedSlotMask) : Const5Slot] += 1;
+        }
+    }
+
+    // Called by the Emulator for the passes of an idle loop it skips
+    void idle(uint64_t instructions, uint64_t cycles)
+    {
+        _idleInstructions += instructions;
+        _idleCycles += cycles;
+    }
+
+    uint64_t instructions() const { return _instructions; }
+    uint64_t idleInstructions() const { return _idleInstructions; }
+    uint64_t idleCycles() const { return _idleCycles; }
+
+    // The report is a section each for ops, address modes, indexed modes
+    // and prefixes, with the counts that aren't 0 from most to least.
+    // Skipped instructions aren't in them, just in a line of their own.
+    // print is called with each line, which has no newline
+    using PrintFunc = void (*)(void* context, const char* line);
+    void report(PrintFunc print, void* context) const;
+
+  private:
+    // Indexed modes are counted by the mode and indirect bits of the
+    // postbyte, with one more for the 5 bit constant offset mode
+    static constexpr uint8_t IndexedSlotMask = IndexedIndMask | IdxModeMask;
+    static constexpr uint8_t Const5Slot = IndexedSlotMask + 1;
+
+    static const char* adrName(uint8_t adr);
+    static void indexedName(uint8_t slot, char* buf, size_t size);
+
+    uint64_t _instructions;
+    uint64_t _idleInstructions;
+    uint64_t _idleCycles;
+    uint64_t _ops[256];
+    uint64_t _adrs[16];
+    uint64_t _indexed[Const5Slot + 1];
+    uint64_t _prefixes[3];
+};
+
+}
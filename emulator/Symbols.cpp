@@ -0,0 +1,76 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Symbols.cpp
+//  Guest symbol table
+//
+
+#include "Symbols.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace mc6809;
+
+bool Symbols::load(const char* filename)
+{
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+        return false;
+    }
+
+    char line[256];
+    char name[128];
+    char file[128];
+    unsigned addr;
+
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "Symbol: %127s (%127[^)]) = %x", name, file, &addr) == 3 ||
+            sscanf(line, "%127s EQU $%x", name, &addr) == 2 ||
+            sscanf(line, "%127s SET $%x", name, &addr) == 2) {
+            _symbols.push_back(Symbol { uint16_t(addr), name });
+        }
+    }
+    fclose(f);
+
+    // Keep the first symbol loaded for any address
+    std::stable_sort(_symbols.begin(), _symbols.end(), [](const Symbol& a, const Symbol& b) { return a.addr < b.addr; });
+    return true;
+}
+
+const char* Symbols::name(uint16_t addr) const
+{
+    auto it = std::lower_bound(_symbols.begin(), _symbols.end(), addr,
+                               [](const Symbol& sym, uint16_t addr) { return sym.addr < addr; });
+    return (it != _symbols.end() && it->addr == addr) ? it->name.c_str() : nullptr;
+}
+
+std::string Symbols::symbolize(uint16_t addr) const
+{
+    char buf[16];
+
+    auto it = std::upper_bound(_symbols.begin(), _symbols.end(), addr,
+                               [](uint16_t addr, const Symbol& sym) { return addr < sym.addr; });
+    if (it == _symbols.begin()) {
+        snprintf(buf, sizeof(buf), "$%04x", addr);
+        return buf;
+    }
+
+    // Back up to the first symbol at this address
+    uint16_t symAddr = (--it)->addr;
+    while (it != _symbols.begin() && (it - 1)->addr == symAddr) {
+        --it;
+    }
+
+    if (symAddr == addr) {
+        return it->name;
+    }
+    snprintf(buf, sizeof(buf), "+$%x", addr - symAddr);
+    return it->name + buf;
+}
@@ -0,0 +1,58 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Symbols.h
+//  Guest symbol table
+//
+//  Symbols holds the labels of a guest program by address, so the
+//  profiler can name call chains and the disassembler can name the
+//  addresses in operands. They come from the files lwasm and lwlink
+//  already write, so programs don't need anything special.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mc6809 {
+
+class Symbols
+{
+  public:
+    // Load symbols from an lwasm --symbol-dump file ("name EQU $1234")
+    // or an lwasm or lwlink --map file ("Symbol: name (file) = 1234").
+    // They're added to any already loaded. Returns false if the file
+    // can't be opened
+    bool load(const char* filename);
+
+    void clear() { _symbols.clear(); }
+    bool empty() const { return _symbols.empty(); }
+
+    // The symbol at addr, or nullptr if there isn't one. If more than
+    // one has the address it's the first one loaded
+    const char* name(uint16_t addr) const;
+
+    // The nearest symbol at or below addr as name or name+$offset.
+    // Just the address if there are no symbols below it
+    std::string symbolize(uint16_t addr) const;
+
+  private:
+    struct Symbol
+    {
+        uint16_t addr;
+        std::string name;
+    };
+
+    // Sorted by address
+    std::vector<Symbol> _symbols;
+};
+
+}
@@ -0,0 +1,407 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Trace.cpp
+//  Binary execution trace
+//
+
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#ifndef ARDUINO
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace mc6809;
+
+static constexpr char TraceMagic[4] = { 'M', '0', '9', 'T' };
+
+static void put32(uint8_t* p, uint32_t v)
+{
+    p[0] = uint8_t(v >> 24);
+    p[1] = uint8_t(v >> 16);
+    p[2] = uint8_t(v >> 8);
+    p[3] = uint8_t(v);
+}
+
+static void put64(uint8_t* p, uint64_t v)
+{
+    put32(p, uint32_t(v >> 32));
+    put32(p + 4, uint32_t(v));
+}
+
+bool TraceRecorder::open(size_t size, uint32_t chunkSize)
+{
+    close();
+
+    // Records mustn't straddle chunks
+    chunkSize -= chunkSize % TraceRecordSize;
+
+    size_t chunks = std::max(size / chunkSize, size_t(2));
+    size = TraceHeaderSize + chunks * chunkSize;
+    uint8_t* data = static_cast<uint8_t*>(malloc(size));
+    if (!data) {
+        return false;
+    }
+    return init(data, size, chunkSize);
+}
+
+#ifndef ARDUINO
+bool TraceRecorder::openFile(const char* filename, size_t size, uint32_t chunkSize)
+{
+    close();
+
+    chunkSize -= chunkSize % TraceRecordSize;
+
+    size_t chunks = std::max(size / chunkSize, size_t(2));
+    size = TraceHeaderSize + chunks * chunkSize;
+
+    int fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    // The file is sparse until chunks are written
+    if (ftruncate(fd, off_t(size)) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    _mapped = true;
+    return init(static_cast<uint8_t*>(data), size, chunkSize);
+}
+
+bool TraceRecorder::save(const char* filename) const
+{
+    FILE* f = fopen(filename, "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(_data, 1, _size, f) == _size;
+    return fclose(f) == 0 && ok;
+}
+#endif
+
+void TraceRecorder::close()
+{
+    if (!_data) {
+        return;
+    }
+
+#ifndef ARDUINO
+    if (_mapped) {
+        munmap(_data, _size);
+    } else
+#endif
+    {
+        free(_data);
+    }
+
+    _data = nullptr;
+    _size = 0;
+    _mapped = false;
+    _ptr = nullptr;
+    _end = nullptr;
+}
+
+bool TraceRecorder::init(uint8_t* data, size_t size, uint32_t chunkSize)
+{
+    _data = data;
+    _size = size;
+    _chunkSize = chunkSize;
+    _chunkCount = uint32_t((size - TraceHeaderSize) / chunkSize);
+    _chunk = _chunkCount - 1;
+    _sequence = 0;
+    _count = 0;
+
+    // Chunks are cleared as they're used, so only their sequence
+    // numbers need to say they haven't been written
+    memset(_data, 0, TraceHeaderSize);
+    memcpy(_data, TraceMagic, sizeof(TraceMagic));
+    _data[4] = TraceVersion;
+    put32(_data + 8, _chunkSize);
+    put32(_data + 12, _chunkCount);
+
+    for (uint32_t i = 0; i < _chunkCount; ++i) {
+        put64(_data + TraceHeaderSize + size_t(i) * _chunkSize, 0);
+    }
+    memset(_last, 0, sizeof(_last));
+
+    // Leave no room so the first record starts a chunk
+    _ptr = _data;
+    _end = _data;
+    return true;
+}
+
+void TraceRecorder::nextChunk(uint64_t cycles)
+{
+    _chunk = (_chunk + 1 == _chunkCount) ? 0 : _chunk + 1;
+    uint8_t* chunk = _data + TraceHeaderSize + size_t(_chunk) * _chunkSize;
+
+    // Clear the records first so there's never a written sequence
+    // number in front of old records
+    memset(chunk, 0, _chunkSize);
+    put64(chunk + 8, _count);
+    put64(chunk + 16, cycles);
+    put64(chunk, ++_sequence);
+
+    _ptr = chunk + TraceChunkHeaderSize;
+    _end = chunk + _chunkSize;
+    _forceMask = TraceForceState;
+}
+
+void TraceRecorder::skip(uint16_t pc, uint32_t count, const TraceRegisters& regs, uint64_t cycles)
+{
+    if (size_t(_end - _ptr) < 2 * TraceRecordSize) {
+        nextChunk(cycles);
+    }
+    _ptr[0] = TraceSkip;
+    put16(_ptr + 1, pc);
+    put32(_ptr + 3, count);
+    _ptr += TraceRecordSize;
+
+    state(regs);
+    _last[0] = regs.d;
+    _last[1] = regs.x;
+    _last[2] = regs.y;
+    _last[3] = regs.u;
+    _last[4] = regs.s;
+    _last[5] = regs.dp;
+    _count += count;
+}
+
+void TraceRecorder::state(const TraceRegisters& regs)
+{
+    uint8_t* p = _ptr;
+    p[0] = TraceState;
+    put16(p + 1, regs.d);
+    p[3] = regs.dp;
+    p[4] = regs.cc;
+    put16(p + 5, regs.x);
+    put16(p + 7, regs.y);
+    put16(p + 9, regs.u);
+    put16(p + 11, regs.s);
+    _ptr += TraceRecordSize;
+    _forceMask = 0;
+}
+
+#ifndef ARDUINO
+static uint16_t get16(const uint8_t* p)
+{
+    return uint16_t((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return (uint32_t(get16(p)) << 16) | get16(p + 2);
+}
+
+static uint64_t get64(const uint8_t* p)
+{
+    return (uint64_t(get32(p)) << 32) | get32(p + 4);
+}
+
+static void setReg(TraceRegisters& regs, uint8_t reg, uint16_t value)
+{
+    switch (reg) {
+        default: break;
+        case TraceRegD: regs.d = value; break;
+        case TraceRegX: regs.x = value; break;
+        case TraceRegY: regs.y = value; break;
+        case TraceRegU: regs.u = value; break;
+        case TraceRegS: regs.s = value; break;
+        case TraceRegDP: regs.dp = uint8_t(value); break;
+    }
+}
+
+bool TraceReader::open(const char* filename)
+{
+    close();
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < TraceHeaderSize) {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    _data = static_cast<const uint8_t*>(data);
+    _size = size_t(st.st_size);
+
+    _chunkSize = get32(_data + 8);
+    uint32_t chunkCount = get32(_data + 12);
+    if (memcmp(_data, TraceMagic, sizeof(TraceMagic)) != 0 || _data[4] != TraceVersion ||
+            _chunkSize < TraceChunkHeaderSize + 3 * TraceRecordSize || (_chunkSize % TraceRecordSize) != 0 ||
+            TraceHeaderSize + size_t(chunkCount) * _chunkSize > _size) {
+        close();
+        return false;
+    }
+
+    for (uint32_t i = 0; i < chunkCount; ++i) {
+        const uint8_t* chunk = _data + TraceHeaderSize + size_t(i) * _chunkSize;
+        if (get64(chunk) != 0) {
+            _chunks.push_back(chunk);
+        }
+    }
+
+    std::sort(_chunks.begin(), _chunks.end(), [](const uint8_t* a, const uint8_t* b) { return get64(a) < get64(b); });
+
+    if (!_chunks.empty()) {
+        _firstIndex = get64(_chunks.front() + 8);
+
+        // Count the records in the newest chunk
+        _endIndex = get64(_chunks.back() + 8);
+        readChunk(_chunks.back(), 0, [this](const TraceEntry& entry) {
+            if (entry.size || entry.skipped) {
+                _endIndex = entry.index + (entry.skipped ? entry.skipped : 1);
+            }
+            return true;
+        });
+    }
+    return true;
+}
+
+void TraceReader::close()
+{
+    if (_data) {
+        munmap(const_cast<uint8_t*>(_data), _size);
+    }
+    _data = nullptr;
+    _size = 0;
+    _chunks.clear();
+    _firstIndex = 0;
+    _endIndex = 0;
+}
+
+void TraceReader::read(uint64_t first, const std::function<bool(const TraceEntry&)>& f) const
+{
+    for (size_t i = 0; i < _chunks.size(); ++i) {
+        // Skip chunks which end before first
+        if (i + 1 < _chunks.size() && get64(_chunks[i + 1] + 8) <= first) {
+            continue;
+        }
+        if (!readChunk(_chunks[i], first, f)) {
+            return;
+        }
+    }
+}
+
+bool TraceReader::readChunk(const uint8_t* chunk, uint64_t first, const std::function<bool(const TraceEntry&)>& f) const
+{
+    const uint8_t* p = chunk + TraceChunkHeaderSize;
+    const uint8_t* end = chunk + _chunkSize;
+
+    // An instruction is reported once any state record following it has
+    // been seen. Changes are from the registers as of the last one
+    TraceEntry entry;
+    entry.index = get64(chunk + 8);
+    TraceRegisters prev;
+    bool pending = false;
+    bool start = true;
+
+    auto report = [&]() {
+        const TraceRegisters& regs = entry.regs;
+        entry.changed = start ? 0xff : 0;
+        entry.changed |= ((regs.d >> 8) != (prev.d >> 8)) ? TraceChangedA : 0;
+        entry.changed |= (uint8_t(regs.d) != uint8_t(prev.d)) ? TraceChangedB : 0;
+        entry.changed |= (regs.dp != prev.dp) ? TraceChangedDP : 0;
+        entry.changed |= (regs.cc != prev.cc) ? TraceChangedCC : 0;
+        entry.changed |= (regs.x != prev.x) ? TraceChangedX : 0;
+        entry.changed |= (regs.y != prev.y) ? TraceChangedY : 0;
+        entry.changed |= (regs.u != prev.u) ? TraceChangedU : 0;
+        entry.changed |= (regs.s != prev.s) ? TraceChangedS : 0;
+        prev = regs;
+        start = false;
+        pending = false;
+
+        // A skip is reported if any of its instructions are at or after first
+        uint64_t next = entry.index + (entry.skipped ? entry.skipped : 1);
+        bool more = next <= first || f(entry);
+        entry.index = next;
+        return more;
+    };
+
+    for ( ; end - p >= ptrdiff_t(TraceRecordSize) && p[0] != 0; p += TraceRecordSize) {
+        uint8_t flags = p[0];
+
+        if (flags == TraceState) {
+            entry.regs.d = get16(p + 1);
+            entry.regs.dp = p[3];
+            entry.regs.cc = p[4];
+            entry.regs.x = get16(p + 5);
+            entry.regs.y = get16(p + 7);
+            entry.regs.u = get16(p + 9);
+            entry.regs.s = get16(p + 11);
+            continue;
+        }
+
+        if (pending && !report()) {
+            return false;
+        }
+
+        if (flags == TraceInterrupt) {
+            TraceEntry interrupt;
+            interrupt.index = entry.index;
+            interrupt.vector = get16(p + 1);
+            interrupt.regs = entry.regs;
+            if (interrupt.index >= first && !f(interrupt)) {
+                return false;
+            }
+            continue;
+        }
+
+        if (flags == TraceSkip) {
+            entry.size = 0;
+            entry.skipped = get32(p + 3);
+            entry.pc = get16(p + 1);
+            entry.hasEA = false;
+            entry.cycles = 0;
+            pending = true;
+            continue;
+        }
+
+        entry.skipped = 0;
+        entry.size = flags & TraceSizeMask;
+        entry.hasEA = (flags & TraceEA) != 0;
+        entry.pc = get16(p + 1);
+        memcpy(entry.bytes, p + 3, sizeof(entry.bytes));
+        entry.ea = get16(p + 8);
+        entry.regs.cc = p[10];
+        entry.cycles = p[14];
+
+        setReg(entry.regs, p[11] & ~TraceForceState, get16(p + 12));
+        setReg(entry.regs, p[15] & ((1 << TraceIndexShift) - 1), uint16_t(entry.ea + (p[15] >> TraceIndexShift)));
+        pending = true;
+    }
+
+    return !pending || report();
+}
+#endif
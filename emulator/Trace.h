@@ -0,0 +1,363 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  Trace.h
+//  Binary execution trace
+//
+//  A TraceRecorder keeps a record of every instruction executed in a
+//  ring of fixed size chunks. An instruction record has the PC, the
+//  instruction bytes, the effective address, CC and the one other
+//  register the instruction changed. An index register incremented or
+//  decremented by the addressing mode is worked out from the effective
+//  address, so it doesn't count. An instruction which changes more than
+//  one is followed by a record of all the registers.
+//
+//  Records are a fixed 16 bytes, so writing one is two stores. The
+//  Emulator knows from decoding which register an instruction can
+//  change and only that one is compared with its last value. That
+//  costs some space over a variable length encoding, but it keeps
+//  recording cheap enough to leave on.
+//
+//  Translated and recompiled code and skipped passes of an idle loop
+//  don't run instructions one at a time. They're recorded as a skip of
+//  that many instructions followed by a state record.
+//
+//  The first instruction in a chunk is followed by a state record, so
+//  decoding can start at any chunk. When the ring is full the oldest
+//  chunk is reused.
+//
+//  The ring can be in memory or in a memory mapped file. A file is
+//  written by the OS as it goes, so it survives the emulator crashing
+//  and can be as large as the disk allows.
+//
+//  The layout, in memory or on disk, is:
+//
+//      "M09T"                  magic
+//      version                 1 byte
+//      pad                     3 bytes
+//      chunk size              4 bytes
+//      chunk count             4 bytes
+//      pad                     to TraceHeaderSize
+//      chunks                  chunk size bytes each
+//
+//  A chunk is:
+//
+//      sequence                8 bytes, 0 for a chunk never written
+//      index                   8 bytes, number of the first instruction
+//      cycles                  8 bytes, cycle count at the first instruction
+//      pad                     8 bytes
+//      records                 to the end of the chunk or a 0 byte
+//
+//  An instruction record is:
+//
+//      flags                   1 byte, the instruction size (1-5) and TraceEA
+//      pc                      2 bytes
+//      instruction bytes       5 bytes
+//      ea                      2 bytes
+//      cc                      1 byte
+//      register                1 byte, a TraceReg bit or 0 if none changed.
+//                              It can be set for one which didn't
+//      value                   2 bytes, of that register
+//      cycles                  1 byte, used by the instruction
+//      index                   1 byte, a TraceReg bit for an index register
+//                              incremented or decremented, which now holds
+//                              ea plus the top 2 bits. 0 if none
+//
+//  A state record has TraceState as its flags, then A, B, DP and CC
+//  (1 byte each) and X, Y, U and S (2 bytes each). An interrupt record
+//  has TraceInterrupt and the vector (2 bytes). A skip record has
+//  TraceSkip, the PC it started at (2 bytes) and the number of
+//  instructions (4 bytes). Multibyte values are big endian, like the
+//  6809.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifndef ARDUINO
+#include <functional>
+#include <vector>
+#endif
+
+namespace mc6809 {
+
+static constexpr uint8_t TraceVersion = 2;
+static constexpr uint32_t TraceHeaderSize = 64;
+static constexpr uint32_t TraceChunkHeaderSize = 32;
+static constexpr uint32_t TraceRecordSize = 16;
+static constexpr uint32_t DefaultTraceChunkSize = 64 * 1024;
+
+// Record flags. Instructions have their size in the low 3 bits
+static constexpr uint8_t TraceSizeMask = 0x07;
+static constexpr uint8_t TraceEA = 0x08;
+static constexpr uint8_t TraceState = 0x06;
+static constexpr uint8_t TraceInterrupt = 0x07;
+static constexpr uint8_t TraceSkip = 0x10;
+
+// Registers in an instruction record
+static constexpr uint8_t TraceRegD = 0x01;
+static constexpr uint8_t TraceRegX = 0x02;
+static constexpr uint8_t TraceRegY = 0x04;
+static constexpr uint8_t TraceRegU = 0x08;
+static constexpr uint8_t TraceRegS = 0x10;
+static constexpr uint8_t TraceRegDP = 0x20;
+static constexpr uint8_t TraceRegAll = 0x3f;
+
+// The index byte of an instruction record has how far past ea the
+// index register is in its top 2 bits
+static constexpr uint8_t TraceIndexShift = 6;
+
+// Set in the mask to force a state record
+static constexpr uint8_t TraceForceState = 0xc0;
+
+// Register values after an instruction
+struct TraceRegisters
+{
+    uint16_t d = 0;
+    uint16_t x = 0;
+    uint16_t y = 0;
+    uint16_t u = 0;
+    uint16_t s = 0;
+    uint8_t dp = 0;
+    uint8_t cc = 0;
+};
+
+class TraceRecorder
+{
+  public:
+    TraceRecorder() { }
+    ~TraceRecorder() { close(); }
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // Record into a ring of size bytes in memory. size is rounded down
+    // to whole chunks and there are always at least 2
+    bool open(size_t size, uint32_t chunkSize = DefaultTraceChunkSize);
+
+#ifndef ARDUINO
+    // Record into a ring of size bytes in a memory mapped file, which
+    // is created or truncated
+    bool openFile(const char* filename, size_t size, uint32_t chunkSize = DefaultTraceChunkSize);
+
+    // Write an in memory ring to a file TraceReader can read
+    bool save(const char* filename) const;
+#endif
+
+    void close();
+
+    bool isOpen() const { return _data != nullptr; }
+
+    // Instructions recorded since open
+    uint64_t count() const { return _count; }
+
+    // True if the next instruction can be recorded with the one register
+    // it could have changed. It can't when it has to be followed by a
+    // state record, at the start of a chunk or after an interrupt
+    bool canRecordOne() const { return !_forceMask && size_t(_end - _ptr) >= 2 * TraceRecordSize; }
+
+    // Called by the Emulator after an instruction which can only change
+    // CC, reg and index, which are TraceReg bits or 0 for none. value is
+    // what reg holds now and index is laid out like the record's index
+    // byte. Only called when canRecordOne(), so there's no need to look
+    // at the other registers. reg is recorded whether or not it changed,
+    // which saves comparing it. flags are the instruction's size and
+    // TraceEA. bytes has its first byte in its low byte, and anything
+    // past its size is ignored.
+    void instruction(uint16_t pc, uint64_t bytes, uint8_t flags, uint16_t ea,
+                     uint8_t cc, uint8_t reg, uint16_t value, uint8_t index, uint8_t instCycles)
+    {
+        // With no register the index is 6, which is never recorded
+        _last[__builtin_ctz(reg | 0x40)] = value;
+        _last[__builtin_ctz(index | 0x40)] = uint16_t(ea + (index >> TraceIndexShift));
+        record(flags, pc, bytes, ea, cc, reg, value, index, instCycles);
+        _count += 1;
+    }
+
+    // Called by the Emulator after any other instruction, with all the
+    // registers. cycles is the count before the instruction.
+    void instruction(uint16_t pc, uint64_t bytes, uint8_t flags, uint16_t ea,
+                     const TraceRegisters& regs, uint64_t cycles, uint8_t instCycles)
+    {
+        // Leave room for a state record
+        if (size_t(_end - _ptr) < 2 * TraceRecordSize) {
+            nextChunk(cycles);
+        }
+
+        uint8_t mask = _forceMask;
+        mask |= (regs.d != _last[0]) ? TraceRegD : 0;
+        mask |= (regs.x != _last[1]) ? TraceRegX : 0;
+        mask |= (regs.y != _last[2]) ? TraceRegY : 0;
+        mask |= (regs.u != _last[3]) ? TraceRegU : 0;
+        mask |= (regs.s != _last[4]) ? TraceRegS : 0;
+        mask |= (regs.dp != _last[5]) ? TraceRegDP : 0;
+
+        // With no bits set ctz is 8, which picks d. That's never used
+        const uint16_t values[8] = { regs.d, regs.x, regs.y, regs.u, regs.s, regs.dp, 0, 0 };
+        uint16_t value = values[__builtin_ctz(mask | 0x100) & 0x07];
+
+        record(flags, pc, bytes, ea, regs.cc, mask, value, 0, instCycles);
+
+        if (mask & (mask - 1)) {
+            state(regs);
+        }
+
+        _last[0] = regs.d;
+        _last[1] = regs.x;
+        _last[2] = regs.y;
+        _last[3] = regs.u;
+        _last[4] = regs.s;
+        _last[5] = regs.dp;
+        _count += 1;
+    }
+
+    // Something other than an instruction may have changed the
+    // registers, so record all of them after the next instruction
+    void resync() { _forceMask = TraceForceState; }
+
+    // Called by the Emulator after count instructions ran from pc without
+    // being recorded, with the registers after them. cycles is the count
+    // before them
+    void skip(uint16_t pc, uint32_t count, const TraceRegisters& regs, uint64_t cycles);
+
+    // Called by the Emulator when it takes an interrupt
+    void interrupt(uint16_t vector, uint64_t cycles)
+    {
+        if (size_t(_end - _ptr) < 3 * TraceRecordSize) {
+            nextChunk(cycles);
+        }
+        _ptr[0] = TraceInterrupt;
+        put16(_ptr + 1, vector);
+        _ptr += TraceRecordSize;
+
+        // Interrupts push and change CC
+        _forceMask = TraceForceState;
+    }
+
+  private:
+    static void put16(uint8_t* p, uint16_t v)
+    {
+        p[0] = uint8_t(v >> 8);
+        p[1] = uint8_t(v);
+    }
+
+    // Write an instruction record as two 8 byte stores. The fields are
+    // put together in the order they're laid out on a little endian host
+    void record(uint8_t flags, uint16_t pc, uint64_t bytes, uint16_t ea, uint8_t cc,
+                uint8_t mask, uint16_t value, uint8_t index, uint8_t instCycles)
+    {
+        uint64_t head = (bytes & 0xffffffffff) << 24 | uint64_t(__builtin_bswap16(pc)) << 8 | flags;
+        uint64_t tail = uint64_t(__builtin_bswap16(ea)) | uint64_t(cc) << 16 | uint64_t(mask) << 24 |
+                        uint64_t(__builtin_bswap16(value)) << 32 | uint64_t(instCycles) << 48 |
+                        uint64_t(index) << 56;
+        uint8_t* p = _ptr;
+        memcpy(p, &head, 8);
+        memcpy(p + 8, &tail, 8);
+        _ptr = p + TraceRecordSize;
+    }
+
+    void state(const TraceRegisters&);
+
+    bool init(uint8_t* data, size_t size, uint32_t chunkSize);
+    void nextChunk(uint64_t cycles);
+
+    uint8_t* _data = nullptr;
+    size_t _size = 0;
+    bool _mapped = false;
+
+    uint32_t _chunkSize = 0;
+    uint32_t _chunkCount = 0;
+    uint32_t _chunk = 0;
+    uint64_t _sequence = 0;
+
+    // Where the next record goes and the end of its chunk
+    uint8_t* _ptr = nullptr;
+    uint8_t* _end = nullptr;
+
+    // D, X, Y, U, S and DP as of the last record, in TraceReg bit order.
+    // _forceMask is set at the start of a chunk, after an interrupt and
+    // by resync() to record all of them
+    uint16_t _last[8] = { };
+    uint8_t _forceMask = TraceForceState;
+
+    uint64_t _count = 0;
+};
+
+#ifndef ARDUINO
+// Bits of TraceEntry::changed
+static constexpr uint8_t TraceChangedA = 0x01;
+static constexpr uint8_t TraceChangedB = 0x02;
+static constexpr uint8_t TraceChangedDP = 0x04;
+static constexpr uint8_t TraceChangedCC = 0x08;
+static constexpr uint8_t TraceChangedX = 0x10;
+static constexpr uint8_t TraceChangedY = 0x20;
+static constexpr uint8_t TraceChangedU = 0x40;
+static constexpr uint8_t TraceChangedS = 0x80;
+
+// One decoded record. size is 0 for an interrupt or a skip, which has
+// the number of instructions in skipped. regs are all current and
+// changed has a bit for each register that changed since the last
+// instruction, which includes the effects of any interrupt taken
+struct TraceEntry
+{
+    uint64_t index = 0;
+    uint16_t pc = 0;
+    uint8_t size = 0;
+    uint32_t skipped = 0;
+    uint8_t bytes[5] = { };
+    bool hasEA = false;
+    uint16_t ea = 0;
+    uint8_t cycles = 0;
+    uint8_t changed = 0;
+    uint16_t vector = 0;
+    TraceRegisters regs;
+};
+
+class TraceReader
+{
+  public:
+    TraceReader() { }
+    ~TraceReader() { close(); }
+
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    // Returns false if the file can't be mapped or isn't a trace
+    bool open(const char* filename);
+    void close();
+
+    // The index of the oldest instruction in the trace and one past the newest
+    uint64_t firstIndex() const { return _firstIndex; }
+    uint64_t endIndex() const { return _endIndex; }
+
+    // Call f with every record from the instruction at index first on,
+    // until it returns false. Interrupts have the index of the next instruction
+    void read(uint64_t first, const std::function<bool(const TraceEntry&)>& f) const;
+
+  private:
+    // Decode a chunk. Returns false if f did
+    bool readChunk(const uint8_t* chunk, uint64_t first, const std::function<bool(const TraceEntry&)>& f) const;
+
+    const uint8_t* _data = nullptr;
+    size_t _size = 0;
+
+    uint32_t _chunkSize = 0;
+
+    // Written chunks, oldest first
+    std::vector<const uint8_t*> _chunks;
+
+    uint64_t _firstIndex = 0;
+    uint64_t _endIndex = 0;
+};
+#endif
+
+}
@@ -47,6 +47,9 @@ char simpleTest[ ] =
 static constexpr bool StartInMonitor = true;
 static constexpr uint32_t MemorySize = 32768;
 
+// Label of the data partition in the partition table used as the disk
+static constexpr const char* DiskPartition = "disk";
+
 char* findNextLine(char* s)
 {
     while (*s != '\n' && *s != '\0') {
@@ -95,6 +98,14 @@ class ESPBOSS9 : public mc6809::BOSS9<MemorySize>
     
         startAddr = emulator().loadEnd();
 
+#ifdef ESP32
+        if (_disk.open(DiskPartition)) {
+            setBlockDevice(&_disk);
+        } else {
+            Serial.println("No disk partition\n");
+        }
+#endif
+
         startExecution(startAddr, StartInMonitor);
     }
 
@@ -108,6 +119,11 @@ class ESPBOSS9 : public mc6809::BOSS9<MemorySize>
     {
         Serial.write(c);
     }
+    
+    virtual void write(const char* s, size_t n) const override
+    {
+        Serial.write(reinterpret_cast<const uint8_t*>(s), n);
+    }
 
     virtual int getc() override
     {
@@ -123,7 +139,46 @@ class ESPBOSS9 : public mc6809::BOSS9<MemorySize>
         return true;
     }
     
+    virtual uint32_t microseconds() const override
+    {
+        return micros();
+    }
+    
+    virtual void sleepMicroseconds(uint32_t us) override
+    {
+        // delay() lets the system run, delayMicroseconds() spins
+        delay(us / 1000);
+        delayMicroseconds(us % 1000);
+    }
+    
+    virtual void interruptAsserted() override
+    {
+        // Lines are asserted from ISRs or loop() and waitForInterrupt
+        // polls for them
+    }
+    
+    virtual void waitForInterrupt(uint32_t us) override
+    {
+        uint32_t start = micros();
+        while (emulator().waitingForInterrupt() && micros() - start < us) {
+            delay(1);
+        }
+    }
+    
+#ifdef IDLE_LOOPS
+    virtual void waitForInput(uint32_t us) override
+    {
+        uint32_t start = micros();
+        while (!Serial.available() && !emulator().pendingInterrupts() && micros() - start < us) {
+            delay(1);
+        }
+    }
+#endif
+    
   private:
+#ifdef ESP32
+    mc6809::FlashBlockDevice _disk;
+#endif
 };
 
 ESPBOSS9 boss9;
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <cassert>
+#include <cctype>
 #include <cstdlib>
 #include <cstdint>
 #include <cstring>
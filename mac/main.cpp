@@ -9,10 +9,20 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <vector>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <unistd.h>
-#include <sys/ioctl.h>
 
 #include "BOSS9.h"
+#include "Console.h"
+#include "MMU.h"
+#include "Symbols.h"
+
+#ifdef STATS
+#include "Stats.h"
+#endif
 
 // Test data
 char simpleTest[ ] =
@@ -25,6 +35,16 @@ char simpleTest[ ] =
 ;
 
 static constexpr uint32_t MemorySize = 65536;
+static constexpr size_t DefaultTraceMB = 64;
+
+// Time each continueExecution() aims to take. It's how long ESC can take
+// to be noticed
+static constexpr uint32_t QuantumTargetUS = 2000;
+
+#ifdef PROFILER
+// Number of addresses in the hot address report
+static constexpr uint32_t HotAddresses = 20;
+#endif
 
 class MacBOSS9 : public mc6809::BOSS9<MemorySize>
 {
@@ -35,25 +55,27 @@ class MacBOSS9 : public mc6809::BOSS9<MemorySize>
     }
     
     virtual ~MacBOSS9() { }
+    
+    // Console I/O is done on its own thread while running
+    void startConsole() { _console.start(); }
+    void stopConsole() { _console.stop(); }
 
   protected:
+    // Output is paced by the clock rate (-c), if there is one, like
+    // everything else the program does
     virtual void putc(char c) const override
     {
-        // Throttle character output so console doesn't get swamped
-        usleep(1000);
-        fputc(c, stdout);
+        _console.putc(c);
+    }
+    
+    virtual void write(const char* s, size_t n) const override
+    {
+        _console.write(s, n);
     }
     
     virtual int getc() override
     {
-        int bytes = 0;
-        if (ioctl(0, FIONREAD, &bytes) == -1) {
-            return -1;
-        }
-        if (bytes == 0) {
-            return 0;
-        }
-        return getchar();
+        return _console.getc();
     }
 
     virtual bool handleRunLoop() override
@@ -61,26 +83,71 @@ class MacBOSS9 : public mc6809::BOSS9<MemorySize>
         return true;
     }
     
+    virtual uint32_t microseconds() const override
+    {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+    }
+    
+    virtual void sleepMicroseconds(uint32_t us) override
+    {
+        usleep(us);
+    }
+    
+    virtual void interruptAsserted() override
+    {
+        // Taking the lock makes sure we don't notify between the
+        // waiter checking and going to sleep
+        std::lock_guard<std::mutex> lock(_interruptMutex);
+        _interruptCondition.notify_one();
+        
+#ifdef IDLE_LOOPS
+        _console.wake();
+#endif
+    }
+    
+    virtual void waitForInterrupt(uint32_t us) override
+    {
+        std::unique_lock<std::mutex> lock(_interruptMutex);
+        _interruptCondition.wait_for(lock, std::chrono::microseconds(us), [this] { return !emulator().waitingForInterrupt(); });
+    }
+    
+#ifdef IDLE_LOOPS
+    virtual void waitForInput(uint32_t us) override
+    {
+        _console.waitForInput(us);
+    }
+#endif
+    
   private:
     uint32_t _cursor = 0;
+    
+    // putc and write are const in BOSS9Base
+    mutable mc6809::Console _console;
+    
+    std::mutex _interruptMutex;
+    std::condition_variable _interruptCondition;
 };
 
-char* findNextLine(char* s)
-{
-    while (*s != '\n' && *s != '\0') {
-        ++s;
-    }
-    if (*s != '\0') {
-        s++;
-    }
-    return s;
-}
-
 //
-// Usage: emulator -m [filename]
+// Usage: emulator -m [-c hz] [-p file] [-s file] [-t file] [-T mb] [-k n] [-d file] [-M kb] [filename]
 //
 //          -m:         stop in monitor on entry
-//          filename:   s19 file to load. If none given a simple test progam is loaded
+//          -c:         run at a clock rate of hz (e.g., 1000000)
+//          -p:         profile the run, write folded call stacks to file and
+//                      print the hottest addresses at exit (PROFILER builds)
+//          -s:         lwasm symbol dump or map file, for labels in the
+//                      monitor's disassembly and the profile
+//          -t:         trace every instruction into a ring in file, for tracedump
+//          -T:         size of the trace ring in MB (default 64)
+//          -k:         checkpoint every n instructions for stepping back in
+//                      the monitor, 0 is off (default 100000)
+//          -d:         disk image for the dk functions. It must exist and is
+//                      used in place (e.g., truncate -s 3M disk.img)
+//          -M:         add kb KB of RAM in 8KB banks, behind an MMU with its
+//                      bank registers at $FFA0. Checkpoints are off, since
+//                      they only hold the banks which are mapped in
+//          filename:   s19, DECB or raw image to load. If none given a simple test progam is loaded
 int main(int argc, char * const argv[])
 {
     // For now we're going to assume 64KB of RAM and that there will
@@ -98,66 +165,156 @@ int main(int argc, char * const argv[])
     
     uint16_t startAddr = 0;
     bool startInMonitor = false;
+    const char* profileFile = nullptr;
+    const char* symbolFile = nullptr;
+    const char* traceFile = nullptr;
+    size_t traceSize = DefaultTraceMB;
+    uint64_t checkpointInterval = mc6809::DefaultCheckpointInterval;
+    const char* diskFile = nullptr;
+    uint32_t bankedSize = 0;
     int c;
         
-    while ((c = getopt(argc, argv, "m")) != -1) {
+    while ((c = getopt(argc, argv, "mc:p:s:t:T:k:d:M:")) != -1) {
         switch (c) {
             case 'm':
                 startInMonitor = true;
                 break;
+            case 'c':
+                boss9.setClockRate(uint32_t(strtoul(optarg, nullptr, 10)));
+                break;
+            case 'p':
+                profileFile = optarg;
+                break;
+            case 's':
+                symbolFile = optarg;
+                break;
+            case 't':
+                traceFile = optarg;
+                break;
+            case 'T':
+                traceSize = size_t(strtoull(optarg, nullptr, 10));
+                break;
+            case 'k':
+                checkpointInterval = strtoull(optarg, nullptr, 10);
+                break;
+            case 'd':
+                diskFile = optarg;
+                break;
+            case 'M':
+                bankedSize = uint32_t(strtoul(optarg, nullptr, 10)) * 1024;
+                break;
             default: /* '?' */
-                fprintf(stderr, "Usage: %s [-m] [filename]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-m] [-c hz] [-p file] [-s file] [-t file] [-T mb] [-k n] [-d file] [-M kb] [filename]\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
     
-    char* fileString = nullptr;
-    bool isFileStringAllocated = false;
-    uint32_t size = 0;
+    // The first banks are the RAM BOSS9 has
+    std::vector<uint8_t> bankedRAM;
+    std::unique_ptr<mc6809::MMU> mmu;
+    if (bankedSize) {
+        uint16_t banks = uint16_t(std::min(bankedSize / mc6809::MMU::BankSize, uint32_t(256 - MemorySize / mc6809::MMU::BankSize)));
+        bankedRAM.resize(size_t(banks) * mc6809::MMU::BankSize);
+        mmu.reset(new mc6809::MMU(boss9.emulator(), bankedRAM.data(), banks));
+        checkpointInterval = 0;
+    }
     
+    bool loaded;
     if (optind >= argc) {
         // use sample
-        fileString = simpleTest;
-        size = sizeof(simpleTest);
+        loaded = boss9.emulator().loadImage(reinterpret_cast<const uint8_t*>(simpleTest), sizeof(simpleTest), startAddr);
     } else {
-        const char* filename = argv[optind];
-        size = uint32_t(std::filesystem::file_size(filename));
-        std::ifstream f(filename);
-        if (f.is_open()) {
-            fileString = new char[size + 1];
-            f.read(fileString, size);
-            fileString[size] = '\0';
-            f.close();
-        } else {
+        // s19, DECB or raw, which is loaded at 0
+        mc6809::MappedFile file;
+        if (!file.open(argv[optind])) {
             std::cout << "Unable to open file\n";
             return -1;
         }
+        loaded = boss9.emulator().loadImage(file.data(), file.size(), startAddr);
     }
     
-    boss9.emulator().loadStart();
-    while (true) {
-        bool finished;
-        if (!boss9.emulator().loadLine(fileString, finished)) {
-            std::cout << "Unable to load file\n";
+    if (!loaded) {
+        std::cout << "Unable to load file\n";
+        return -1;
+    }
+
+    mc6809::Symbols symbols;
+    if (symbolFile) {
+        if (!symbols.load(symbolFile)) {
+            std::cout << "Unable to open symbol file\n";
             return -1;
         }
+        boss9.emulator().setSymbols(&symbols);
+    }
 
-        fileString = findNextLine(fileString);
-        if (*fileString == '\0') {
-            break;
+#ifdef PROFILER
+    mc6809::Profiler profiler;
+    if (profileFile) {
+        profiler.setSymbols(&symbols);
+        boss9.emulator().setProfiler(&profiler);
+    }
+#else
+    if (profileFile) {
+        std::cout << "Profiling needs a PROFILER build\n";
+        return -1;
+    }
+#endif
+
+#ifdef STATS
+    // Building with STATS is the opt in. The monitor's stats command
+    // shows the counts so far and they're printed at exit
+    mc6809::InstructionStats stats;
+    boss9.emulator().setStats(&stats);
+#endif
+
+    // The ring is in a mapped file so it's there even if we crash
+    mc6809::TraceRecorder trace;
+    if (traceFile) {
+        if (!trace.openFile(traceFile, traceSize * 1024 * 1024)) {
+            std::cout << "Unable to create trace file\n";
+            return -1;
         }
+        boss9.emulator().setTrace(&trace);
     }
-    
-    startAddr = boss9.emulator().loadEnd();
-    
-    if (isFileStringAllocated) {
-        delete [ ] fileString;
+
+    mc6809::MappedBlockDevice disk;
+    if (diskFile) {
+        if (!disk.open(diskFile)) {
+            std::cout << "Unable to open disk image\n";
+            return -1;
+        }
+        boss9.setBlockDevice(&disk);
     }
 
+    boss9.setCheckpointInterval(checkpointInterval);
+    boss9.setQuantumTarget(QuantumTargetUS);
+    
+    fflush(stdout);
+    boss9.startConsole();
     boss9.startExecution(startAddr, startInMonitor);
     
     while (boss9.continueExecution()) { }
     
+    boss9.stopConsole();
+    boss9.setBlockDevice(nullptr);
+    
+#ifdef PROFILER
+    if (profileFile) {
+        FILE* f = fopen(profileFile, "w");
+        if (f) {
+            profiler.writeFolded(f);
+            fclose(f);
+        } else {
+            printf("*** unable to write profile to '%s'\n", profileFile);
+        }
+        profiler.writeHotAddresses(stdout, HotAddresses);
+    }
+#endif
+
+#ifdef STATS
+    stats.report([](void*, const char* line) { printf("%s\n", line); }, nullptr);
+#endif
+    
     if (boss9.emulator().error() != mc6809::Emulator::Error::None) {
         printf("*** finished with error: %d\n", int32_t(boss9.emulator().error()));
     } else {
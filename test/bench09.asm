@@ -0,0 +1,47 @@
+        ; 6809 Benchmark program, from sbc09/bench09.asm.
+        ;
+        ; Adds up a 20 byte table 65536 times. Prints 'a' at the start
+        ; and 'b' at the end, or 'e' if a sum is wrong. The sbc09 timer
+        ; isn't there, so it exits with 0 (1 on an error) instead of
+        ; leaving the time in D.
+
+        include BOSS9.inc
+
+        org $400
+
+        lds #$8000
+
+        lda #'a'
+        jsr putc
+
+        ldy #0
+loop    ldx #data
+        lda #(enddata-data)
+        clrb
+loop2   addb ,x+
+        deca
+        bne loop2
+        cmpb #210
+        lbne error
+        leay -1,y
+        bne loop
+
+        lda #'b'
+        jsr putc
+        lda #newline
+        jsr putc
+        clra
+        jmp exit
+
+error   lda #'e'
+        jsr putc
+        lda #newline
+        jsr putc
+        lda #1
+        jmp exit
+
+data    fcb 1,2,3,4,5,6,7,8,9,10
+        fcb 11,12,13,14,15,16,17,18,19,20
+enddata
+
+        end $400
@@ -0,0 +1,155 @@
+        ; MMU test program. Needs at least 64KB of banked RAM, e.g. emufarm -M 64
+
+        include BOSS9.inc
+
+testnr  equ 128
+
+        org $400
+        jmp entry
+
+; Output an error message: 'ERROR xx' where xx is test number in hex
+;
+error   ldx #errmsg
+        jsr puts
+        lda testnr
+        bsr outhex
+        lda #newline
+        jsr putc
+        lda #1
+        jmp exit
+
+errmsg  fcn "ERROR  "
+
+; Output value in the lower 4 bits of a as a hex digit
+;
+outdig  adda #48
+        cmpa #57
+        bls  od2
+        adda #7
+od2     jsr putc
+        rts
+
+; Output a as 2 hex digits
+;
+outhex  pshs a
+        lsra
+        lsra
+        lsra
+        lsra
+        bsr outdig
+        puls a
+        anda #$0f
+        bra outdig
+
+; Output an passed message: 'PASSED xx' where xx is test number in hex
+;
+good    pshs a,x,cc
+        ldx #passmsg
+        jsr puts
+        lda testnr
+        jsr outhex
+        lda #newline
+        jsr putc
+        inc testnr
+        puls a,x,cc
+        rts
+
+passmsg  fcn "PASSED "
+
+; Copy the routine at x, b bytes long, to $6000
+;
+copy    ldy #$6000
+cp1     lda ,x+
+        sta ,y+
+        decb
+        bne cp1
+        rts
+
+entry   clr testnr
+        jsr good          ;test #0, does it print msg?
+
+        ; test #1, each window starts out with the bank of the same number
+        ldx #mmu
+        clra
+t1      cmpa ,x+
+        lbne error
+        inca
+        cmpa #8
+        bne t1
+        jsr good
+
+        ; test #2, a bank switched into a window hides the one that was there
+        lda #$11
+        sta $4000
+        lda #8
+        sta mmu+2
+        lda #$a5
+        sta $4000
+        sta $5fff
+        lda #2
+        sta mmu+2
+        lda $4000
+        cmpa #$11
+        lbne error
+        lda #8
+        sta mmu+2
+        lda $4000
+        cmpa #$a5
+        lbne error
+        lda $5fff
+        cmpa #$a5
+        lbne error
+        lda #2
+        sta mmu+2
+        jsr good
+
+        ; test #3, code runs from whichever bank is in its window
+        lda #9
+        sta mmu+3
+        ldx #rout1
+        ldb #routlen
+        jsr copy
+        jsr $6000
+        cmpa #$42
+        lbne error
+        lda #10
+        sta mmu+3
+        ldx #rout2
+        ldb #routlen
+        jsr copy
+        jsr $6000
+        cmpa #$43
+        lbne error
+        lda #9
+        sta mmu+3
+        jsr $6000
+        cmpa #$42
+        lbne error
+        lda #3
+        sta mmu+3
+        jsr good
+
+        ; test #4, a bank that doesn't exist reads as $ff
+        lda #$ff
+        sta mmu+2
+        clr $4000
+        lda $4000
+        cmpa #$ff
+        lbne error
+        lda #2
+        sta mmu+2
+        lda $4000
+        cmpa #$11
+        lbne error
+        jsr good
+
+        clra
+        jmp exit
+
+rout1   lda #$42
+        rts
+routlen equ *-rout1
+rout2   lda #$43
+        rts
+
+        end $400
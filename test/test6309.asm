@@ -0,0 +1,224 @@
+        ; HD6309 test program. Needs an emulator built with HD6309.
+
+        pragma 6309
+        include BOSS9.inc
+
+testnr  equ 128
+bits    equ 129     ; bit ops only reach the direct page
+
+        org $400
+        jmp entry
+
+; Output an error message: 'ERROR xx' where xx is test number in hex
+;
+error   ldx #errmsg
+        jsr puts
+        lda testnr
+        bsr outhex
+        lda #newline
+        jsr putc
+        lda #1
+        jmp exit
+
+errmsg  fcn "ERROR  "
+
+; Output value in the lower 4 bits of a as a hex digit
+;
+outdig  adda #48
+        cmpa #57
+        bls  od2
+        adda #7
+od2     jsr putc
+        rts
+
+; Output a as 2 hex digits
+;
+outhex  pshs a
+        lsra
+        lsra
+        lsra
+        lsra
+        bsr outdig
+        puls a
+        anda #$0f
+        bra outdig
+
+; Output an passed message: 'PASSED xx' where xx is test number in hex
+;
+good    pshs a,x,cc
+        ldx #passmsg
+        jsr puts
+        lda testnr
+        jsr outhex
+        lda #newline
+        jsr putc
+        inc testnr
+        puls a,x,cc
+        rts
+
+passmsg  fcn "PASSED "
+
+; Division by zero lands here. Skip the DIVD and say where we've been
+;
+trapped lda #1
+        sta wastrap
+        rti
+
+entry   clr testnr
+        jsr good          ;test #0, does it print msg?
+
+        ; test #1, LDQ and the E, F and W registers
+        ldq #$12345678
+        cmpd #$1234
+        lbne error
+        cmpw #$5678
+        lbne error
+        cmpe #$56
+        lbne error
+        cmpf #$78
+        lbne error
+        stq qbuf
+        ldd qbuf+2
+        cmpd #$5678
+        lbne error
+        jsr good
+
+        ; test #2, TFM copy
+        ldx #src
+        ldy #dst
+        ldw #srclen
+        tfm x+,y+
+        tstw
+        lbne error
+        cmpx #src+srclen
+        lbne error
+        lda dst+srclen-1
+        cmpa #'9
+        lbne error
+        jsr good
+
+        ; test #3, TFM fill and copy down through overlapping memory
+        ldx #fillch
+        ldy #dst
+        ldw #srclen
+        tfm x,y+
+        lda dst
+        cmpa #'*
+        lbne error
+        lda dst+srclen-1
+        cmpa #'*
+        lbne error
+        ldx #src+srclen-1
+        ldy #dst+srclen-1
+        ldw #srclen
+        tfm x-,y-
+        lda dst
+        cmpa #'0
+        lbne error
+        jsr good
+
+        ; test #4, MULD, DIVD and DIVQ
+        ldd #200
+        muld #300
+        cmpd #0
+        lbne error
+        cmpw #60000
+        lbne error
+        ldd #100
+        divd #7
+        cmpb #14
+        lbne error
+        cmpa #2
+        lbne error
+        ldd #1
+        ldw #0
+        divq #256
+        cmpw #256
+        lbne error
+        jsr good
+
+        ; test #5, OIM, AIM, EIM and TIM
+        lda #$30
+        sta scratch
+        oim #$0f,scratch
+        aim #$f3,scratch
+        eim #$ff,scratch
+        lda scratch
+        cmpa #$cc
+        lbne error
+        tim #$c0,scratch
+        lbeq error
+        tim #$33,scratch
+        lbne error
+        jsr good
+
+        ; test #6, register to register ops
+        lde #5
+        ldf #3
+        addr e,f
+        cmpf #8
+        lbne error
+        ldx #$1000
+        ldy #$0234
+        addr y,x
+        cmpx #$1234
+        lbne error
+        subr y,x
+        cmpr x,y
+        lbeq error
+        jsr good
+
+        ; test #7, W indexed
+        ldw #src
+        lda ,w++
+        cmpa #'0
+        lbne error
+        lda ,w
+        cmpa #'2
+        lbne error
+        ldx #src
+        lde #3
+        lda e,x
+        cmpa #'3
+        lbne error
+        jsr good
+
+        ; test #8, bit ops
+        lda #$01
+        sta bits
+        clrb
+        bor b,0,7,bits
+        cmpb #$80
+        lbne error
+        stbt b,7,3,bits
+        lda bits
+        cmpa #$09
+        lbne error
+        jsr good
+
+        ; test #9, division by zero traps
+        clr wastrap
+        ldd #100
+        divd #0
+        lda wastrap
+        lbeq error
+        bitmd #$80
+        lbeq error
+        jsr good
+
+        clra
+        jmp exit
+
+src     fcc "0123456789"
+srclen  equ *-src
+fillch  fcb '*
+dst     rmb srclen
+qbuf    rmb 4
+scratch rmb 1
+wastrap rmb 1
+
+        ; The trap vector is in system memory, so it comes with the program
+        org $fff0
+        fdb trapped
+
+        end entry
@@ -0,0 +1,150 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  HeadlessBOSS9.h
+//  BOSS9 with no terminal, for batch tools
+//
+//  Console output is captured in a buffer and console input comes
+//  from a string given up front. There's no raw terminal setup, so
+//  any number of these can run in one process.
+//
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "BOSS9.h"
+
+#ifdef RECOMPILED
+#include "Recompiled.h"
+#endif
+
+namespace mc6809 {
+
+static constexpr uint32_t HeadlessMemorySize = 65536;
+static constexpr uint16_t HeadlessStackAddr = 0xe000;
+
+class HeadlessBOSS9 : public BOSS9<HeadlessMemorySize>
+{
+  public:
+    HeadlessBOSS9()
+    {
+        _echoBS = false;
+        emulator().setStack(HeadlessStackAddr);
+    }
+
+    virtual ~HeadlessBOSS9() { }
+
+    // Load an s19, DECB or raw image file. Returns false and sets error
+    // if it can't be opened or parsed. Raw images are loaded at 0
+    bool loadFile(const std::string& filename, std::string& error)
+    {
+        MappedFile file;
+        if (!file.open(filename.c_str())) {
+            error = "unable to open " + filename;
+            return false;
+        }
+        
+#ifdef RECOMPILED
+        _imageHash = Recompiled::hash(std::string(reinterpret_cast<const char*>(file.data()), file.size()));
+#endif
+
+        if (!emulator().loadImage(file.data(), file.size(), _loadAddr)) {
+            error = "unable to load " + filename;
+            return false;
+        }
+        return true;
+    }
+
+    uint16_t loadAddr() const { return _loadAddr; }
+    
+#ifdef RECOMPILED
+    // The hash a recompiled image of the loaded file has to have
+    uint32_t imageHash() const { return _imageHash; }
+#endif
+
+    void setInput(const std::string& input)
+    {
+        _input = input;
+        _inputIndex = 0;
+    }
+
+    const std::string& output() const { return _output; }
+    void clearOutput() { _output.clear(); }
+
+  protected:
+    virtual void putc(char c) const override
+    {
+        _output += c;
+    }
+    
+    virtual void write(const char* s, size_t n) const override
+    {
+        _output.append(s, n);
+    }
+
+    virtual int getc() override
+    {
+        if (_inputIndex >= _input.size()) {
+            return 0;
+        }
+        return uint8_t(_input[_inputIndex++]);
+    }
+
+    virtual bool handleRunLoop() override
+    {
+        return true;
+    }
+
+    virtual uint32_t microseconds() const override
+    {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+    }
+
+    virtual void sleepMicroseconds(uint32_t us) override
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+
+    virtual void interruptAsserted() override
+    {
+        std::lock_guard<std::mutex> lock(_interruptMutex);
+        _interruptCondition.notify_one();
+    }
+    
+    virtual void waitForInterrupt(uint32_t us) override
+    {
+        std::unique_lock<std::mutex> lock(_interruptMutex);
+        _interruptCondition.wait_for(lock, std::chrono::microseconds(us), [this] { return !emulator().waitingForInterrupt(); });
+    }
+
+  private:
+    // putc and write are const in BOSS9Base
+    mutable std::string _output;
+
+    std::string _input;
+    size_t _inputIndex = 0;
+    uint16_t _loadAddr = 0;
+    
+#ifdef RECOMPILED
+    uint32_t _imageHash = 0;
+#endif
+    
+    std::mutex _interruptMutex;
+    std::condition_variable _interruptCondition;
+};
+
+}
@@ -0,0 +1,795 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  cosim.cpp
+//  Run the emulator and the sbc09 engine in lockstep
+//
+//  Usage: cosim [-n programs] [-l insts] [-s seed] [-I insts] [image.s19 ...]
+//
+//          -n:     random programs to run (default 100000)
+//          -l:     most instructions each random program runs (default 256)
+//          -s:     seed of the first random program (default 1)
+//          -I:     instructions to run each image for (default 10000000)
+//
+//  sbc09/engine.c is an independent 6809 interpreter. Both it and the
+//  emulator run from the same registers and memory, and after every
+//  instruction all the registers and memory are compared. Memory from
+//  $8000 up is read only in sbc09, so it is in the emulator too and both
+//  read it from the same place.
+//
+//  With images, each one is run from its start address with the stack
+//  just below $8000. System calls are made by the emulator and their
+//  results copied to sbc09. If <image>.in exists it's the console input.
+//
+//  With no images random programs are run. Each is a run of random
+//  instructions, in memory and with registers which are also random.
+//  Branches skip the instruction after them and jumps are rare, but it
+//  stops when it does leave its code or gets to an instruction the two
+//  don't model the same way (see comparable()). To go faster, only a
+//  slice of memory is compared after each instruction and all of it at
+//  the end, and a program which diverges is run again comparing all of
+//  it every time. Then it's cut down to the fewest instructions which
+//  still diverge and printed along with where it diverged. -s with its
+//  seed and -n 1 runs it again.
+//
+//  sbc09 is GPL licensed (see sbc09/COPYING), and so is this tool since
+//  it's linked with it.
+//
+
+#include <chrono>
+#include <cinttypes>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "Disassembler.h"
+#include "HeadlessBOSS9.h"
+
+extern "C" {
+#define engine extern
+#include "v09.h"
+#undef engine
+}
+
+using namespace mc6809;
+
+static constexpr uint32_t DefaultPrograms = 100000;
+static constexpr uint32_t DefaultProgramLength = 256;
+static constexpr uint64_t DefaultBudget = 10000000;
+
+// Where sbc09's ROM starts. Writes to it are ignored
+static constexpr uint32_t RomStart = 0x8000;
+
+// Where random programs go, and where their stacks are
+static constexpr uint16_t CodeStart = 0x4000;
+static constexpr uint16_t StackLow = 0x0100;
+static constexpr uint16_t StackHigh = 0x7f00;
+
+// How much memory a quick run compares after each instruction. It
+// goes round all of it a slice at a time
+static constexpr uint32_t SliceSize = 0x800;
+
+// Divergent programs which are minimized and printed. The rest are
+// just counted
+static constexpr uint32_t MaxReports = 10;
+
+static bool readFile(const std::string& filename, std::string& contents)
+{
+    std::ifstream f(filename, std::ios::binary);
+    if (!f.is_open()) {
+        return false;
+    }
+    std::stringstream stream;
+    stream << f.rdbuf();
+    contents = stream.str();
+    return true;
+}
+
+// True if the 6809 has this indexed postbyte
+static bool legalPostbyte(uint8_t postbyte)
+{
+    if (!(postbyte & 0x80)) {
+        return true;
+    }
+    uint8_t mode = postbyte & IdxModeMask;
+    bool indirect = (postbyte & IndexedIndMask) != 0;
+    switch (IdxMode(mode)) {
+        case IdxMode::Inc1Reg:
+        case IdxMode::Dec1Reg:
+            return !indirect;
+        case IdxMode::Extended:
+            return postbyte == 0x9f;
+        case IdxMode::Inc2Reg:
+        case IdxMode::Dec2Reg:
+        case IdxMode::ConstRegNoOff:
+        case IdxMode::ConstReg8Off:
+        case IdxMode::ConstReg16Off:
+        case IdxMode::AccAOffReg:
+        case IdxMode::AccBOffReg:
+        case IdxMode::AccDOffReg:
+        case IdxMode::ConstPC8Off:
+        case IdxMode::ConstPC16Off:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// True if TFR or EXG with this postbyte does the same thing on every
+// 6809. Undefined registers and mixing sizes don't
+static bool legalTransfer(uint8_t postbyte)
+{
+    uint8_t from = postbyte >> 4;
+    uint8_t to = postbyte & 0x0f;
+    auto valid = [](uint8_t r) { return r <= 5 || (r >= 8 && r <= 11); };
+    return valid(from) && valid(to) && (from & 0x08) == (to & 0x08);
+}
+
+// True if the opcode after a $10 or $11 prefix is one the 6809 has
+static bool legalPrefixed(uint8_t prefix, uint8_t opcode)
+{
+    uint8_t low = opcode & 0x0f;
+    if (opcode == 0x3f) {
+        return true;
+    }
+    if (prefix == 0x10) {
+        switch (opcode >> 4) {
+            case 0x2: return low != 0;
+            case 0x8: return low == 0x3 || low == 0xc || low == 0xe;
+            case 0x9:
+            case 0xa:
+            case 0xb: return low == 0x3 || low == 0xc || low == 0xe || low == 0xf;
+            case 0xc: return low == 0xe;
+            case 0xd:
+            case 0xe:
+            case 0xf: return low == 0xe || low == 0xf;
+            default: return false;
+        }
+    }
+    return (opcode >> 4) >= 0x8 && (opcode >> 4) <= 0xb && (low == 0x3 || low == 0xc);
+}
+
+// True if the instruction is something the two are expected to agree
+// on. Illegal instructions are NOPs in sbc09 and SYNC and CWAI wait
+// there for an interrupt which never comes. sbc09's SWI stacks CC
+// before it sets E and its RTI looks at E before it pulls CC, which the
+// 6809 does the other way round, and its DAA can add a correction twice
+// when A isn't BCD. code is its bytes
+static bool comparable(const DecodedInst& inst, const uint8_t* code)
+{
+    if ((code[0] == 0x10 || code[0] == 0x11) && !legalPrefixed(code[0], code[1])) {
+        return false;
+    }
+    switch (inst.op) {
+        case Op::ILL:
+        case Op::SYNC:
+        case Op::CWAI:
+        case Op::SWI:
+        case Op::RTI:
+        case Op::DAA:
+            return false;
+        case Op::TFR:
+        case Op::EXG:
+            return legalTransfer(uint8_t(inst.operand));
+        default:
+            break;
+    }
+    return inst.adr != Adr::Indexed || legalPostbyte(inst.postbyte);
+}
+
+struct Regs
+{
+    uint16_t pc = 0;
+    uint16_t x = 0;
+    uint16_t y = 0;
+    uint16_t u = 0;
+    uint16_t s = 0;
+    uint8_t a = 0;
+    uint8_t b = 0;
+    uint8_t dp = 0;
+    uint8_t cc = 0;
+};
+
+// Memory from RomStart up. Both cores read it from sbc09's memory.
+// sbc09 doesn't wrap a 16 bit access at $ffff round to $0000, so it
+// notes when $ffff is used
+class Rom : public Device
+{
+  public:
+    virtual uint8_t read(uint16_t addr) override { top |= addr == 0xffff; return ::mem[addr]; }
+    virtual void write(uint16_t addr, uint8_t v) override { top |= addr == 0xffff; }
+
+    bool top = false;
+};
+
+class Cosim;
+static Cosim* active = nullptr;
+
+class Cosim
+{
+  public:
+    enum class Outcome { Limit, LeftCode, NotComparable, Stopped, Diverged };
+
+    Cosim()
+    {
+        emulator().mapDevice(RomStart, 0x10000 - RomStart, &_rom);
+        emulator().setQuantum(1);
+    }
+
+    HeadlessBOSS9& boss9() { return _boss9; }
+    Emulator& emulator() { return _boss9.emulator(); }
+
+    // The emulator's memory, which is copied to sbc09 by run(). That
+    // includes the part from RomStart up, which is where an image loads
+    // ROM code
+    uint8_t* memory() { return emulator().getAddr(0); }
+
+    // Run both from regs for at most limit instructions, stopping if
+    // pc leaves [lo, hi). All of memory is compared after every
+    // instruction unless quick is set. Then it's a slice of it each time
+    // and all of it at the end, which might say it diverged later than
+    // it did or miss a difference which is written over before it's
+    // seen. Quick runs also run each instruction on its own rather than
+    // from a block. One instruction at a time, a block is decoded from
+    // every pc and code which only runs once never reuses them
+    Outcome run(const Regs& regs, uint64_t limit, uint32_t lo = 0, uint32_t hi = 0x10000, bool quick = false)
+    {
+        Emulator& e = emulator();
+        e.flushBlockCache();
+        _boss9.clearOutput();
+        _boss9.startExecution(regs.pc);
+        e.setReg(Reg::A, regs.a);
+        e.setReg(Reg::B, regs.b);
+        e.setReg(Reg::X, regs.x);
+        e.setReg(Reg::Y, regs.y);
+        e.setReg(Reg::U, regs.u);
+        e.setReg(Reg::S, regs.s);
+        e.setReg(Reg::DP, regs.dp);
+        e.setReg(Reg::CC, regs.cc);
+
+        memcpy(::mem, memory(), sizeof(::mem));
+        syncRegs();
+
+        _limit = e.instructions() + limit;
+        _lo = lo;
+        _hi = hi;
+        _quick = quick;
+        _slice = 0;
+        _stepped = false;
+        _diff.clear();
+
+        // sbc09 calls do_escape before every instruction while escape
+        // is set, and do_escape longjmps back here when the run is over
+        ::tracing = 0;
+        ::attention = 1;
+        ::escape = 1;
+        ::irq = 0;
+        active = this;
+        if (setjmp(_done) == 0) {
+            ::interpr();
+        }
+        active = nullptr;
+
+        if (quick && _outcome != Outcome::Diverged && !compareMemory(0, RomStart)) {
+            _outcome = Outcome::Diverged;
+            _diff = "at the end:" + _diff;
+        }
+        return _outcome;
+    }
+
+    // What differed, for Outcome::Diverged
+    const std::string& difference() const { return _diff; }
+
+    // Called before sbc09 runs each instruction, with its registers in
+    // the globals. Checks the instruction it just ran and runs the next
+    // one in the emulator. Returns false when the run is over
+    bool step()
+    {
+        Emulator& e = emulator();
+        if (_stepped) {
+            if (_jumped && ::pcreg >= SystemAddrStart) {
+                // The emulator made a system call, which sbc09 has no
+                // idea about, so it gets the result
+                memcpy(::mem, memory(), RomStart);
+                syncRegs();
+            } else if (!compare()) {
+                _outcome = Outcome::Diverged;
+                return false;
+            }
+        }
+
+        uint16_t pc = e.getReg(Reg::PC);
+        if (e.instructions() >= _limit) {
+            _outcome = Outcome::Limit;
+            return false;
+        }
+        if (pc < _lo || pc >= _hi) {
+            _outcome = Outcome::LeftCode;
+            return false;
+        }
+
+        DecodedInst inst;
+        uint8_t code[2];
+        e.decode(pc, inst);
+        e.readMemory(pc, code, 2);
+        if (!comparable(inst, code)) {
+            _outcome = Outcome::NotComparable;
+            return false;
+        }
+
+        _jumped = inst.op == Op::JMP || inst.op == Op::JSR;
+        _pc = pc;
+        _op = inst.op;
+        _rom.top = false;
+        // Continuing runs the instruction at pc without finding its block
+        if (!e.execute(_quick ? RunState::Continuing : RunState::Running) || _boss9.runState() == RunState::Cmd || e.waitingForInterrupt()) {
+            _outcome = Outcome::Stopped;
+            return false;
+        }
+        if (_rom.top) {
+            _outcome = Outcome::NotComparable;
+            return false;
+        }
+        _stepped = true;
+        return true;
+    }
+
+    // End the run. Only called from sbc09's callbacks
+    [[noreturn]] void finish() { std::longjmp(_done, 1); }
+
+    // The disassembly of the instruction at addr, as the monitor shows it
+    std::string disassembly(uint16_t addr)
+    {
+        char buf[Disassembler::MaxLineSize];
+        emulator().disassemble(addr, buf);
+        return buf;
+    }
+
+  private:
+    void syncRegs()
+    {
+        Emulator& e = emulator();
+        ::pcreg = e.getReg(Reg::PC);
+        ::xreg = e.getReg(Reg::X);
+        ::yreg = e.getReg(Reg::Y);
+        ::ureg = e.getReg(Reg::U);
+        ::sreg = e.getReg(Reg::S);
+        *::areg = uint8_t(e.getReg(Reg::A));
+        *::breg = uint8_t(e.getReg(Reg::B));
+        ::dpreg = uint8_t(e.getReg(Reg::DP));
+        ::ccreg = uint8_t(e.getReg(Reg::CC));
+    }
+
+    bool compare()
+    {
+        Emulator& e = emulator();
+        char buf[100];
+
+        // sbc09 sets H after these, where the 6809 leaves it undefined,
+        // so it's taken from the emulator. And its TST leaves V alone
+        switch (_op) {
+            case Op::NEG: case Op::ASL: case Op::ASR: case Op::LSR:
+            case Op::SUB8: case Op::SBC: case Op::CMP8:
+                ::ccreg = (::ccreg & ~FlagH) | (e.getReg(Reg::CC) & FlagH);
+                break;
+            case Op::TST:
+                ::ccreg &= ~FlagV;
+                break;
+            default:
+                break;
+        }
+
+#define CHECK(reg, value, format) \
+        if (e.getReg(Reg::reg) != (value)) { \
+            snprintf(buf, sizeof(buf), " " #reg " " format " (sbc09 " format ")", e.getReg(Reg::reg), (value)); \
+            _diff += buf; \
+        }
+
+        CHECK(PC, ::pcreg, "$%04x");
+        CHECK(A, *::areg, "$%02x");
+        CHECK(B, *::breg, "$%02x");
+        CHECK(X, ::xreg, "$%04x");
+        CHECK(Y, ::yreg, "$%04x");
+        CHECK(U, ::ureg, "$%04x");
+        CHECK(S, ::sreg, "$%04x");
+        CHECK(DP, ::dpreg, "$%02x");
+        CHECK(CC, ::ccreg, "$%02x");
+
+#undef CHECK
+
+        if (_quick) {
+            compareMemory(_slice, _slice + SliceSize);
+            _slice = (_slice + SliceSize) % RomStart;
+        } else {
+            compareMemory(0, RomStart);
+        }
+
+        if (_diff.empty()) {
+            return true;
+        }
+        _diff = "at $" + hex(_pc) + " " + disassembly(_pc) + ":" + _diff;
+        return false;
+    }
+
+    // Adds the first difference in [start, end) to _diff
+    bool compareMemory(uint32_t start, uint32_t end)
+    {
+        const uint8_t* m = memory();
+        if (memcmp(m + start, ::mem + start, end - start) == 0) {
+            return true;
+        }
+        for (uint32_t addr = start; addr < end; ++addr) {
+            if (m[addr] != ::mem[addr]) {
+                char buf[100];
+                snprintf(buf, sizeof(buf), " memory at $%04x $%02x (sbc09 $%02x)", addr, m[addr], ::mem[addr]);
+                _diff += buf;
+                break;
+            }
+        }
+        return false;
+    }
+
+    static std::string hex(uint16_t v)
+    {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "%04x", v);
+        return buf;
+    }
+
+    HeadlessBOSS9 _boss9;
+    Rom _rom;
+
+    std::jmp_buf _done;
+    Outcome _outcome = Outcome::Limit;
+    std::string _diff;
+
+    uint64_t _limit = 0;
+    uint32_t _lo = 0;
+    uint32_t _hi = 0x10000;
+    bool _quick = false;
+    uint32_t _slice = 0;        // Where the next slice compared starts
+    uint16_t _pc = 0;           // Of the instruction being compared
+    Op _op = Op::NOP;
+    bool _stepped = false;      // The emulator has run an instruction sbc09 is about to
+    bool _jumped = false;       // It was a JMP or JSR, so it might have been a system call
+};
+
+// sbc09 calls these, and engine.c has the only copy of its registers
+// and memory, so there's one Cosim running at a time
+
+extern "C" void do_escape(void)
+{
+    if (!active->step()) {
+        active->finish();
+    }
+}
+
+extern "C" void do_trace(void)
+{
+}
+
+// The I/O page is just more ROM here
+extern "C" int do_input(int addr)
+{
+    return ::mem[IOPAGE | addr];
+}
+
+extern "C" void do_output(int addr, int v)
+{
+}
+
+// Random programs. Every one starts from the same random memory, with
+// random registers and instructions from its seed
+class Fuzzer
+{
+  public:
+    struct Inst
+    {
+        std::vector<uint8_t> bytes;
+        uint8_t offsetSize = 0;     // Of the branch offset at the end, if it's a branch
+    };
+
+    struct Program
+    {
+        uint32_t seed = 0;
+        Regs regs;
+        std::vector<Inst> insts;
+    };
+
+    Fuzzer(Cosim& cosim, uint32_t length) : _cosim(cosim), _length(length)
+    {
+        // Anything, as long as it's always the same
+        Random random(0x6809);
+        for (uint8_t& byte : _memory) {
+            byte = uint8_t(random.next());
+        }
+    }
+
+    void generate(uint32_t seed, Program& program)
+    {
+        Random random(seed);
+        program.seed = seed;
+        program.regs.pc = CodeStart;
+        program.regs.x = uint16_t(random.next());
+        program.regs.y = uint16_t(random.next());
+        program.regs.u = StackLow + uint16_t(random.next() % (StackHigh - StackLow));
+        program.regs.s = StackLow + uint16_t(random.next() % (StackHigh - StackLow));
+        program.regs.a = uint8_t(random.next());
+        program.regs.b = uint8_t(random.next());
+        program.regs.dp = uint8_t(random.next());
+        program.regs.cc = uint8_t(random.next());
+
+        // Each instruction is random bytes which decode as something
+        // comparable, with a prefix one time in 8
+        Emulator& e = _cosim.emulator();
+        uint8_t* code = _cosim.memory() + CodeStart;
+        program.insts.clear();
+        while (program.insts.size() < _length) {
+            uint64_t bytes = random.next();
+            for (int i = 0; i < 8; ++i) {
+                code[i] = uint8_t(bytes >> (i * 8));
+            }
+            if ((code[0] & 0x07) == 0) {
+                code[0] = (code[0] & 0x08) ? 0x10 : 0x11;
+            }
+
+            DecodedInst inst;
+            e.decode(CodeStart, inst);
+            if (!comparable(inst, code) || (jumps(inst) && (random.next() & 0x0f) != 0)) {
+                continue;
+            }
+
+            Inst& added = program.insts.emplace_back();
+            added.bytes.assign(code, code + inst.size);
+            if (inst.adr == Adr::Rel || inst.adr == Adr::RelL || inst.adr == Adr::RelP) {
+                added.offsetSize = (inst.size == 2) ? 1 : 2;
+            }
+        }
+    }
+
+    Cosim::Outcome run(const Program& program)
+    {
+        uint16_t end = place(program);
+        Cosim::Outcome outcome = _cosim.run(program.regs, _length, CodeStart, end, true);
+        if (outcome == Cosim::Outcome::Diverged) {
+            // Again, comparing everything every time, to find where
+            place(program);
+            outcome = _cosim.run(program.regs, _length, CodeStart, end);
+        }
+        return outcome;
+    }
+
+    // Take out instructions while it still diverges, in halves, then
+    // quarters and so on down to one at a time
+    void minimize(Program& program)
+    {
+        for (size_t chunk = program.insts.size() / 2; chunk > 0; chunk /= 2) {
+            size_t i = 0;
+            while (i < program.insts.size()) {
+                Program smaller = program;
+                auto first = smaller.insts.begin() + i;
+                smaller.insts.erase(first, first + std::min(chunk, smaller.insts.size() - i));
+                if (!smaller.insts.empty() && run(smaller) == Cosim::Outcome::Diverged) {
+                    program = smaller;
+                } else {
+                    i += chunk;
+                }
+            }
+        }
+    }
+
+    void print(const Program& program)
+    {
+        run(program);
+        std::string diff = _cosim.difference();
+        place(program);
+
+        const Regs& r = program.regs;
+        printf("seed %u diverged with %zu instructions:\n", program.seed, program.insts.size());
+        printf("    pc $%04x a $%02x b $%02x x $%04x y $%04x u $%04x s $%04x dp $%02x cc $%02x\n",
+               r.pc, r.a, r.b, r.x, r.y, r.u, r.s, r.dp, r.cc);
+        uint16_t addr = CodeStart;
+        for (const Inst& inst : program.insts) {
+            printf("    $%04x: %s\n", addr, _cosim.disassembly(addr).c_str());
+            addr += inst.bytes.size();
+        }
+        printf("    %s\n", diff.c_str());
+    }
+
+  private:
+    // True if the instruction goes somewhere other than a branch would.
+    // That almost always leaves the program, so they're kept rarer
+    static bool jumps(const DecodedInst& inst)
+    {
+        switch (inst.op) {
+            case Op::JMP:
+            case Op::JSR:
+            case Op::RTS:
+                return true;
+            case Op::PUL:
+                return (inst.operand & 0x80) != 0;
+            case Op::TFR:
+            case Op::EXG:
+                return (inst.operand & 0x0f) == 5 || (inst.operand >> 4) == 5;
+            default:
+                return false;
+        }
+    }
+
+    // splitmix64, which is plenty for this and fast enough to not
+    // matter next to running the programs
+    class Random
+    {
+      public:
+        Random(uint64_t seed) : _state(seed) { }
+
+        uint64_t next()
+        {
+            uint64_t z = (_state += 0x9e3779b97f4a7c15);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            return z ^ (z >> 31);
+        }
+
+      private:
+        uint64_t _state;
+    };
+
+    // Put the memory and program in the emulator. Returns the end of
+    // the program's code
+    uint16_t place(const Program& program)
+    {
+        uint8_t* m = _cosim.memory();
+        memcpy(m, _memory, sizeof(_memory));
+
+        // Branches skip over the next instruction, so the program goes
+        // on whether they're taken or not
+        uint16_t addr = CodeStart;
+        for (size_t i = 0; i < program.insts.size(); ++i) {
+            const Inst& inst = program.insts[i];
+            memcpy(m + addr, inst.bytes.data(), inst.bytes.size());
+            addr += inst.bytes.size();
+            if (inst.offsetSize) {
+                uint16_t offset = (i + 1 < program.insts.size()) ? program.insts[i + 1].bytes.size() : 0;
+                if (inst.offsetSize == 2) {
+                    m[addr - 2] = 0;
+                }
+                m[addr - 1] = uint8_t(offset);
+            }
+        }
+        return addr;
+    }
+
+    Cosim& _cosim;
+    uint32_t _length;
+    uint8_t _memory[0x10000];
+};
+
+static const char* describe(Cosim::Outcome outcome)
+{
+    switch (outcome) {
+        case Cosim::Outcome::Limit: return "reached the limit";
+        case Cosim::Outcome::LeftCode: return "left its code";
+        case Cosim::Outcome::NotComparable: return "got to an instruction which isn't compared";
+        case Cosim::Outcome::Stopped: return "stopped";
+        case Cosim::Outcome::Diverged: return "diverged";
+    }
+    return "";
+}
+
+static bool checkImage(Cosim& cosim, const std::string& image, uint64_t budget)
+{
+    HeadlessBOSS9& boss9 = cosim.boss9();
+    std::string error;
+    if (!boss9.loadFile(image, error)) {
+        printf("%s: %s\n", image.c_str(), error.c_str());
+        return false;
+    }
+
+    std::string input;
+    readFile(image.substr(0, image.find_last_of('.')) + ".in", input);
+    boss9.setInput(input);
+
+    Emulator& e = cosim.emulator();
+    Regs regs;
+    regs.pc = boss9.loadAddr();
+    regs.s = RomStart;
+    regs.cc = uint8_t(e.getReg(Reg::CC));
+
+    uint64_t start = e.instructions();
+    Cosim::Outcome outcome = cosim.run(regs, budget);
+    uint64_t executed = e.instructions() - start;
+    if (outcome == Cosim::Outcome::Diverged) {
+        printf("%s: differs after %" PRIu64 " instructions, %s\n", image.c_str(), executed, cosim.difference().c_str());
+        return false;
+    }
+    printf("%s: %" PRIu64 " instructions match, then it %s\n", image.c_str(), executed, describe(outcome));
+    return true;
+}
+
+static bool fuzz(Cosim& cosim, uint32_t programs, uint32_t length, uint32_t seed)
+{
+    Fuzzer fuzzer(cosim, length);
+    Fuzzer::Program program;
+    uint32_t outcomes[5] = { };
+    uint32_t diverged = 0;
+    uint64_t instructions = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < programs; ++i) {
+        fuzzer.generate(seed + i, program);
+        uint64_t before = cosim.emulator().instructions();
+        Cosim::Outcome outcome = fuzzer.run(program);
+        instructions += cosim.emulator().instructions() - before;
+        outcomes[int(outcome)] += 1;
+
+        if (outcome == Cosim::Outcome::Diverged && diverged++ < MaxReports) {
+            fuzzer.minimize(program);
+            fuzzer.print(program);
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%u programs, %" PRIu64 " instructions in %.2fs, %.1f million a second\n", programs, instructions,
+           seconds, seconds > 0 ? instructions / seconds / 1e6 : 0);
+    for (int i = 0; i < 5; ++i) {
+        if (outcomes[i]) {
+            printf("    %u %s\n", outcomes[i], describe(Cosim::Outcome(i)));
+        }
+    }
+    return diverged == 0;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [-n programs] [-l insts] [-s seed] [-I insts] [image.s19 ...]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char * const argv[])
+{
+    uint32_t programs = DefaultPrograms;
+    uint32_t length = DefaultProgramLength;
+    uint32_t seed = 1;
+    uint64_t budget = DefaultBudget;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:l:s:I:")) != -1) {
+        switch (c) {
+            case 'n': programs = uint32_t(strtoul(optarg, nullptr, 10)); break;
+            case 'l': length = uint32_t(strtoul(optarg, nullptr, 10)); break;
+            case 's': seed = uint32_t(strtoul(optarg, nullptr, 10)); break;
+            case 'I': budget = strtoull(optarg, nullptr, 10); break;
+            default: usage(argv[0]);
+        }
+    }
+
+    // Programs have to fit between CodeStart and RomStart
+    if (length == 0 || length > (RomStart - CodeStart) / 5 || budget == 0) {
+        usage(argv[0]);
+    }
+
+    // There's only one sbc09
+    static Cosim cosim;
+
+    bool ok = true;
+    if (optind < argc) {
+        for (int i = optind; i < argc; ++i) {
+            ok = checkImage(cosim, argv[i], budget) && ok;
+        }
+    } else {
+        ok = fuzz(cosim, programs, length, seed);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,429 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  emubench.cpp
+//  Emulator benchmark
+//
+//  Runs each image for a fixed number of instructions, a number of
+//  times, and reports emulated MIPS, host ns per instruction and how
+//  much they varied between repetitions.
+//
+//  Usage: emubench [-I insts] [-r reps] [-w reps] [-o file] [-j] [-R dir] [image.s19 ...]
+//
+//          -I:     instructions per repetition (default 20000000)
+//          -r:     timed repetitions of each image (default 5)
+//          -w:     untimed warmup repetitions before them (default 1)
+//          -o:     write the results as JSON to file
+//          -j:     run hot blocks as translated code (JIT builds only)
+//          -R:     run each image with dir/<image>.so, made from it by
+//                  recompile (RECOMPILED builds only)
+//
+//  With no images it runs perf, basic, forth9, test09 and bench09 from
+//  the current directory, which is meant to be test/.
+//
+//  Each repetition starts from a snapshot taken after loading. An image
+//  which exits, enters the monitor, fails, waits for an interrupt or
+//  polls for more input than there is before the budget is used up is
+//  restarted from the snapshot, so every repetition executes exactly
+//  the same instructions. If
+//  <image>.in exists it is fed to the console input on every start.
+//
+//  Compare JSON from before and after a change to MC6809.cpp. A change
+//  in mean MIPS smaller than the stddev is noise.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "HeadlessBOSS9.h"
+
+#ifdef JIT
+#include "Jit.h"
+#endif
+
+#ifdef RECOMPILED
+#include "Recompiled.h"
+#endif
+
+using namespace mc6809;
+
+static constexpr uint64_t DefaultBudget = 20000000;
+static constexpr uint32_t DefaultRepetitions = 5;
+static constexpr uint32_t DefaultWarmups = 1;
+
+static const char* DefaultImages[] = { "perf.s19", "basic.s19", "forth9.s19", "test09.s19", "bench09.s19" };
+
+struct Stats
+{
+    double mean = 0;
+    double min = 0;
+    double max = 0;
+    double stddev = 0;
+};
+
+struct Bench
+{
+    std::string image;
+    std::string name;
+    std::string error;
+
+    // For each timed repetition
+    std::vector<double> seconds;
+    uint32_t restarts = 0;
+};
+
+static Stats computeStats(const std::vector<double>& values)
+{
+    Stats stats;
+    if (values.empty()) {
+        return stats;
+    }
+
+    stats.min = *std::min_element(values.begin(), values.end());
+    stats.max = *std::max_element(values.begin(), values.end());
+    for (double v : values) {
+        stats.mean += v;
+    }
+    stats.mean /= values.size();
+
+    // Sample variance, since the repetitions are a sample of all the runs we could do
+    if (values.size() > 1) {
+        double sum = 0;
+        for (double v : values) {
+            sum += (v - stats.mean) * (v - stats.mean);
+        }
+        stats.stddev = std::sqrt(sum / (values.size() - 1));
+    }
+    return stats;
+}
+
+static std::string baseName(const std::string& path)
+{
+    size_t slash = path.find_last_of('/');
+    std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return (dot == std::string::npos) ? name : name.substr(0, dot);
+}
+
+static bool readFile(const std::string& filename, std::string& contents)
+{
+    std::ifstream f(filename, std::ios::binary);
+    if (!f.is_open()) {
+        return false;
+    }
+    std::stringstream stream;
+    stream << f.rdbuf();
+    contents = stream.str();
+    return true;
+}
+
+// True if the image is polling for input which has all been read, so
+// it would only go around its loop from here on
+static bool polling(const Emulator& emulator)
+{
+#ifdef IDLE_LOOPS
+    return emulator.idle() == Emulator::Idle::Polling;
+#else
+    (void) emulator;
+    return false;
+#endif
+}
+
+// Execute budget instructions from the loaded snapshot. Returns the
+// number of restarts, or -1 if the image stops without executing anything
+static int32_t runBudget(HeadlessBOSS9& boss9, const Snapshot& loaded, const std::string& input, uint64_t budget)
+{
+    Emulator& emulator = boss9.emulator();
+    int32_t restarts = -1;
+
+    while (budget) {
+        boss9.restoreSnapshot(loaded);
+        boss9.setInput(input);
+        restarts += 1;
+
+        uint64_t start = emulator.instructions();
+        emulator.setInstructionLimit(start + budget);
+
+        while (emulator.instructions() - start < budget) {
+            if (!emulator.execute(RunState::Running) || boss9.runState() == RunState::Cmd ||
+                    emulator.waitingForInterrupt() || polling(emulator)) {
+                break;
+            }
+        }
+
+        uint64_t executed = emulator.instructions() - start;
+        if (executed == 0) {
+            restarts = -1;
+            break;
+        }
+        budget -= executed;
+    }
+
+    emulator.setInstructionLimit(UINT64_MAX);
+    return restarts;
+}
+
+static void runBench(Bench& bench, uint64_t budget, uint32_t repetitions, uint32_t warmups, bool useJit,
+                     const std::string& recompiledDir)
+{
+#ifdef JIT
+    Jit jit;
+#endif
+#ifdef RECOMPILED
+    Recompiled recompiled;
+#endif
+    HeadlessBOSS9 boss9;
+    if (!boss9.loadFile(bench.image, bench.error)) {
+        return;
+    }
+    
+#ifdef JIT
+    if (useJit) {
+        boss9.emulator().setJit(&jit);
+    }
+#else
+    (void) useJit;
+#endif
+
+#ifdef RECOMPILED
+    if (!recompiledDir.empty()) {
+        if (!recompiled.load(recompiledDir + "/" + bench.name + ".so", boss9.imageHash(), bench.error)) {
+            return;
+        }
+        boss9.emulator().setRecompiled(&recompiled);
+    }
+#else
+    (void) recompiledDir;
+#endif
+
+    std::string input;
+    readFile(bench.image.substr(0, bench.image.find_last_of('.')) + ".in", input);
+
+    Snapshot loaded;
+    boss9.startExecution(boss9.loadAddr());
+    boss9.takeSnapshot(loaded);
+
+    for (uint32_t i = 0; i < warmups + repetitions; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        int32_t restarts = runBudget(boss9, loaded, input, budget);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (restarts < 0) {
+            bench.error = "stops without executing";
+            return;
+        }
+        if (i >= warmups) {
+            bench.seconds.push_back(seconds);
+            bench.restarts = uint32_t(restarts);
+        }
+    }
+}
+
+static std::string jsonString(const std::string& s)
+{
+    std::string result = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+        }
+        result += c;
+    }
+    return result + "\"";
+}
+
+static void writeStats(FILE* f, const char* name, const Stats& stats)
+{
+    fprintf(f, "      \"%s\": { \"mean\": %.3f, \"min\": %.3f, \"max\": %.3f, \"stddev\": %.3f, \"variance\": %.4f }",
+            name, stats.mean, stats.min, stats.max, stats.stddev, stats.stddev * stats.stddev);
+}
+
+static std::vector<double> mipsOf(const Bench& bench, uint64_t budget)
+{
+    std::vector<double> mips;
+    for (double s : bench.seconds) {
+        mips.push_back(double(budget) / s / 1e6);
+    }
+    return mips;
+}
+
+static std::vector<double> nsOf(const Bench& bench, uint64_t budget)
+{
+    std::vector<double> ns;
+    for (double s : bench.seconds) {
+        ns.push_back(s * 1e9 / double(budget));
+    }
+    return ns;
+}
+
+static bool writeJSON(const char* filename, const std::vector<Bench>& benches, uint64_t budget, uint32_t repetitions,
+                      uint32_t warmups, bool useJit, bool useRecompiled)
+{
+    FILE* f = fopen(filename, "w");
+    if (!f) {
+        return false;
+    }
+
+    // Results are only comparable between builds with the same flags
+    std::vector<const char*> flags;
+#ifdef COMPUTE_CYCLES
+    flags.push_back("COMPUTE_CYCLES");
+#endif
+#ifdef BLOCK_CACHE
+    flags.push_back("BLOCK_CACHE");
+#endif
+#ifdef OPCODE_HANDLERS
+    flags.push_back("OPCODE_HANDLERS");
+#endif
+#ifdef LAZY_FLAGS
+    flags.push_back("LAZY_FLAGS");
+#endif
+#ifdef CHECK_LAZY_FLAGS
+    flags.push_back("CHECK_LAZY_FLAGS");
+#endif
+#ifdef PROFILER
+    flags.push_back("PROFILER");
+#endif
+#ifdef SNAPSHOTS
+    flags.push_back("SNAPSHOTS");
+#endif
+#ifdef TRACE
+    flags.push_back("TRACE");
+#endif
+#ifdef HD6309
+    flags.push_back("HD6309");
+#endif
+    if (useJit) {
+        flags.push_back("JIT");
+    }
+    if (useRecompiled) {
+        flags.push_back("RECOMPILED");
+    }
+
+    fprintf(f, "{\n");
+#ifdef __VERSION__
+    fprintf(f, "  \"compiler\": %s,\n", jsonString(__VERSION__).c_str());
+#endif
+    fprintf(f, "  \"flags\": [");
+    for (size_t i = 0; i < flags.size(); ++i) {
+        fprintf(f, "%s\"%s\"", i ? ", " : "", flags[i]);
+    }
+    fprintf(f, "],\n");
+    fprintf(f, "  \"instructions\": %" PRIu64 ",\n", budget);
+    fprintf(f, "  \"repetitions\": %u,\n", repetitions);
+    fprintf(f, "  \"warmups\": %u,\n", warmups);
+    fprintf(f, "  \"images\": [\n");
+
+    for (size_t i = 0; i < benches.size(); ++i) {
+        const Bench& bench = benches[i];
+        fprintf(f, "    {\n");
+        fprintf(f, "      \"name\": %s,\n", jsonString(bench.name).c_str());
+        fprintf(f, "      \"image\": %s,\n", jsonString(bench.image).c_str());
+        if (!bench.error.empty()) {
+            fprintf(f, "      \"error\": %s\n", jsonString(bench.error).c_str());
+        } else {
+            fprintf(f, "      \"restarts\": %u,\n", bench.restarts);
+            fprintf(f, "      \"seconds\": [");
+            for (size_t j = 0; j < bench.seconds.size(); ++j) {
+                fprintf(f, "%s%.6f", j ? ", " : "", bench.seconds[j]);
+            }
+            fprintf(f, "],\n");
+            writeStats(f, "mips", computeStats(mipsOf(bench, budget)));
+            fprintf(f, ",\n");
+            writeStats(f, "nsPerInstruction", computeStats(nsOf(bench, budget)));
+            fprintf(f, "\n");
+        }
+        fprintf(f, "    }%s\n", (i + 1 < benches.size()) ? "," : "");
+    }
+
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [-I insts] [-r reps] [-w reps] [-o file] [-j] [-R dir] [image.s19 ...]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char * const argv[])
+{
+    uint64_t budget = DefaultBudget;
+    uint32_t repetitions = DefaultRepetitions;
+    uint32_t warmups = DefaultWarmups;
+    const char* jsonFile = nullptr;
+    bool useJit = false;
+    std::string recompiledDir;
+    int c;
+
+    while ((c = getopt(argc, argv, "I:r:w:o:jR:")) != -1) {
+        switch (c) {
+            case 'I': budget = strtoull(optarg, nullptr, 10); break;
+            case 'r': repetitions = uint32_t(strtoul(optarg, nullptr, 10)); break;
+            case 'w': warmups = uint32_t(strtoul(optarg, nullptr, 10)); break;
+            case 'o': jsonFile = optarg; break;
+#ifdef JIT
+            case 'j': useJit = true; break;
+#endif
+#ifdef RECOMPILED
+            case 'R': recompiledDir = optarg; break;
+#endif
+            default: usage(argv[0]);
+        }
+    }
+
+    if (budget == 0 || repetitions == 0) {
+        usage(argv[0]);
+    }
+
+    std::vector<Bench> benches;
+    if (optind < argc) {
+        for (int i = optind; i < argc; ++i) {
+            benches.emplace_back();
+            benches.back().image = argv[i];
+        }
+    } else {
+        for (const char* image : DefaultImages) {
+            benches.emplace_back();
+            benches.back().image = image;
+        }
+    }
+
+    bool ok = true;
+
+    printf("%-16s %8s %10s %10s %10s %8s %10s\n", "image", "restarts", "MIPS", "min", "max", "stddev", "ns/inst");
+    for (Bench& bench : benches) {
+        bench.name = baseName(bench.image);
+        runBench(bench, budget, repetitions, warmups, useJit, recompiledDir);
+
+        if (!bench.error.empty()) {
+            printf("%-16s %s\n", bench.name.c_str(), bench.error.c_str());
+            ok = false;
+            continue;
+        }
+
+        Stats mips = computeStats(mipsOf(bench, budget));
+        Stats ns = computeStats(nsOf(bench, budget));
+        printf("%-16s %8u %10.1f %10.1f %10.1f %8.2f %10.2f\n", bench.name.c_str(), bench.restarts,
+               mips.mean, mips.min, mips.max, mips.stddev, ns.mean);
+    }
+
+    if (jsonFile && !writeJSON(jsonFile, benches, budget, repetitions, warmups, useJit, !recompiledDir.empty())) {
+        fprintf(stderr, "Unable to write %s\n", jsonFile);
+        ok = false;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,451 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  emufarm.cpp
+//  Headless batch runner for s19 images
+//
+//  Every image (times the -n count) gets its own HeadlessBOSS9 and
+//  Emulator. Runs are scheduled a slice of execute() quanta at a time
+//  across a pool of worker threads. Each worker keeps a deque of runs.
+//  It takes work from the back of its own deque and when that's empty
+//  steals from the front of another worker's. A run only ever belongs
+//  to one deque, so no emulator state is shared between threads.
+//
+//  Usage: emufarm [-j threads] [-n copies] [-I insts] [-C cycles] [-o dir] [-t kb] [-M kb] [-R dir] [-S] [-v] image.s19 ...
+//
+//          -j:     worker threads (default is the number of host cores)
+//          -n:     independent runs of each image (default 1)
+//          -I:     instruction budget per run, checked every quantum
+//          -C:     cycle budget per run, checked every quantum
+//          -o:     write each run's console output to dir/<image>[.<copy>].out
+//          -t:     trace each run into a ring of kb KB. A run which doesn't exit
+//                  writes it to <image>[.<copy>].trace, in dir if given
+//          -M:     give each run kb KB more RAM in 8KB banks, behind an MMU
+//                  with its bank registers at $FFA0
+//          -R:     run each image with dir/<image>.so, made from it by recompile
+//                  (RECOMPILED builds only)
+//          -S:     count each run's ops, address modes, indexed modes and
+//                  prefixes and print them after the summary (STATS builds only)
+//          -v:     print each run's console output after the summary
+//
+//  Each image is parsed once and the other copies of it are restored
+//  from a snapshot taken after loading.
+//
+//  If <image>.in exists it is fed to the run's console input. The exit
+//  status is 0 if every run called exit with a code of 0.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "HeadlessBOSS9.h"
+#include "MMU.h"
+
+#ifdef RECOMPILED
+#include "Recompiled.h"
+#endif
+
+#ifdef STATS
+#include "Stats.h"
+#endif
+
+using namespace mc6809;
+
+// Number of execute() quanta a run gets before going back on its deque
+static constexpr uint32_t SliceQuanta = 16;
+
+enum class Status { Running, Exited, Monitor, Error, Waiting, InputWait, InstructionBudget, CycleBudget, LoadFailed };
+
+static const char* statusToString(Status status)
+{
+    switch (status) {
+        case Status::Running:           return "running";
+        case Status::Exited:            return "exited";
+        case Status::Monitor:           return "monitor";
+        case Status::Error:             return "error";
+        case Status::Waiting:           return "sync-wait";
+        case Status::InputWait:         return "input-wait";
+        case Status::InstructionBudget: return "inst-limit";
+        case Status::CycleBudget:       return "cycle-limit";
+        case Status::LoadFailed:        return "load-failed";
+    }
+    return "unknown";
+}
+
+struct Run
+{
+    std::string image;
+    uint32_t copy = 0;
+    std::unique_ptr<HeadlessBOSS9> boss9;
+    std::vector<uint8_t> bankedRAM;
+    std::unique_ptr<MMU> mmu;
+    std::unique_ptr<TraceRecorder> trace;
+#ifdef STATS
+    std::unique_ptr<InstructionStats> stats;
+#endif
+    Status status = Status::Running;
+    std::string error;
+    uint64_t instructions = 0;
+    double seconds = 0;
+};
+
+struct Budget
+{
+    uint64_t instructions = 0;  // 0 is unlimited
+    uint64_t cycles = 0;        // 0 is unlimited
+};
+
+class WorkStealingPool
+{
+  public:
+    WorkStealingPool(std::vector<Run>& runs, uint32_t numWorkers, const Budget& budget)
+        : _runs(runs)
+        , _queues(numWorkers)
+        , _budget(budget)
+    {
+        // Deal the runs out round robin
+        for (size_t i = 0; i < runs.size(); ++i) {
+            if (runs[i].status == Status::Running) {
+                _queues[i % numWorkers].runs.push_back(i);
+                _remaining += 1;
+            }
+        }
+    }
+
+    void run()
+    {
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < _queues.size(); ++i) {
+            threads.emplace_back([this, i] { worker(i); });
+        }
+        for (auto& it : threads) {
+            it.join();
+        }
+    }
+
+  private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> runs;
+    };
+
+    bool pop(uint32_t self, size_t& index)
+    {
+        Queue& queue = _queues[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.runs.empty()) {
+            return false;
+        }
+        index = queue.runs.back();
+        queue.runs.pop_back();
+        return true;
+    }
+
+    bool steal(uint32_t self, size_t& index)
+    {
+        for (uint32_t i = 1; i < _queues.size(); ++i) {
+            Queue& queue = _queues[(self + i) % _queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.runs.empty()) {
+                index = queue.runs.front();
+                queue.runs.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void push(uint32_t self, size_t index)
+    {
+        Queue& queue = _queues[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.runs.push_back(index);
+    }
+
+    void worker(uint32_t self)
+    {
+        while (_remaining.load(std::memory_order_acquire) != 0) {
+            size_t index;
+            if (!pop(self, index) && !steal(self, index)) {
+                // Every run left is being executed by another worker
+                std::this_thread::yield();
+                continue;
+            }
+
+            if (runSlice(_runs[index])) {
+                push(self, index);
+            } else {
+                _remaining.fetch_sub(1, std::memory_order_release);
+            }
+        }
+    }
+
+    // Returns true if the run needs more time
+    bool runSlice(Run& run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        Emulator& emulator = run.boss9->emulator();
+
+        for (uint32_t i = 0; i < SliceQuanta && run.status == Status::Running; ++i) {
+            uint64_t instructions = emulator.instructions();
+            bool ok = emulator.execute(RunState::Running);
+            run.instructions += emulator.instructions() - instructions;
+
+            if (!ok) {
+                run.status = Status::Error;
+            } else if (run.boss9->runState() == RunState::Cmd) {
+                // exit, a breakpoint or a call to mon all end up in the monitor
+                run.status = run.boss9->exited() ? Status::Exited : Status::Monitor;
+            } else if (emulator.waitingForInterrupt()) {
+                // Nothing here asserts interrupts, so it would wait forever
+                run.status = Status::Waiting;
+#ifdef IDLE_LOOPS
+            } else if (emulator.idle() == Emulator::Idle::Polling) {
+                // The input is all read, so it would poll forever
+                run.status = Status::InputWait;
+#endif
+            } else if (_budget.instructions && run.instructions >= _budget.instructions) {
+                run.status = Status::InstructionBudget;
+            } else if (_budget.cycles && emulator.cycles() >= _budget.cycles) {
+                run.status = Status::CycleBudget;
+            }
+        }
+
+        run.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return run.status == Status::Running;
+    }
+
+    std::vector<Run>& _runs;
+    std::vector<Queue> _queues;
+    Budget _budget;
+    std::atomic<size_t> _remaining { 0 };
+};
+
+static std::string baseName(const std::string& path)
+{
+    size_t slash = path.find_last_of('/');
+    std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return (dot == std::string::npos) ? name : name.substr(0, dot);
+}
+
+static bool readFile(const std::string& filename, std::string& contents)
+{
+    std::ifstream f(filename, std::ios::binary);
+    if (!f.is_open()) {
+        return false;
+    }
+    std::stringstream stream;
+    stream << f.rdbuf();
+    contents = stream.str();
+    return true;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [-j threads] [-n copies] [-I insts] [-C cycles] [-o dir] [-t kb] [-M kb] [-R dir] [-S] [-v] image.s19 ...\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char * const argv[])
+{
+    uint32_t numWorkers = std::thread::hardware_concurrency();
+    uint32_t copies = 1;
+    Budget budget;
+    std::string outputDir;
+    size_t traceSize = 0;
+    uint32_t bankedSize = 0;
+    std::string recompiledDir;
+    bool verbose = false;
+#ifdef STATS
+    bool countStats = false;
+#endif
+    int c;
+
+    while ((c = getopt(argc, argv, "j:n:I:C:o:t:M:R:Sv")) != -1) {
+        switch (c) {
+            case 'j': numWorkers = uint32_t(strtoul(optarg, nullptr, 10)); break;
+            case 'n': copies = uint32_t(strtoul(optarg, nullptr, 10)); break;
+            case 'I': budget.instructions = strtoull(optarg, nullptr, 10); break;
+            case 'C': budget.cycles = strtoull(optarg, nullptr, 10); break;
+            case 'o': outputDir = optarg; break;
+            case 't': traceSize = size_t(strtoull(optarg, nullptr, 10)) * 1024; break;
+            case 'M': bankedSize = uint32_t(strtoul(optarg, nullptr, 10)) * 1024; break;
+#ifdef RECOMPILED
+            case 'R': recompiledDir = optarg; break;
+#endif
+#ifdef STATS
+            case 'S': countStats = true; break;
+#endif
+            case 'v': verbose = true; break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc || copies == 0) {
+        usage(argv[0]);
+    }
+    if (numWorkers == 0) {
+        numWorkers = 1;
+    }
+
+#ifdef RECOMPILED
+    // Every copy of an image shares its recompiled code
+    std::vector<std::unique_ptr<Recompiled>> recompiledImages;
+#endif
+
+    std::vector<Run> runs;
+    for (int i = optind; i < argc; ++i) {
+        std::string image = argv[i];
+        std::string input;
+        bool haveInput = readFile(image.substr(0, image.find_last_of('.')) + ".in", input);
+
+        // Parse the image once. The other copies start from a snapshot of the first
+        Snapshot loaded;
+        bool loadFailed = false;
+#ifdef RECOMPILED
+        Recompiled* recompiled = nullptr;
+#endif
+
+        for (uint32_t copy = 0; copy < copies; ++copy) {
+            runs.emplace_back();
+            Run& run = runs.back();
+            run.image = image;
+            run.copy = copy;
+            run.boss9.reset(new HeadlessBOSS9());
+            if (bankedSize) {
+                uint16_t banks = uint16_t(std::min(bankedSize / MMU::BankSize, uint32_t(256 - HeadlessMemorySize / MMU::BankSize)));
+                run.bankedRAM.resize(size_t(banks) * MMU::BankSize);
+                run.mmu.reset(new MMU(run.boss9->emulator(), run.bankedRAM.data(), banks));
+            }
+
+            if (copy == 0) {
+                loadFailed = !run.boss9->loadFile(run.image, run.error);
+#ifdef RECOMPILED
+                if (!loadFailed && !recompiledDir.empty()) {
+                    recompiledImages.emplace_back(new Recompiled());
+                    recompiled = recompiledImages.back().get();
+                    loadFailed = !recompiled->load(recompiledDir + "/" + baseName(image) + ".so",
+                                                   run.boss9->imageHash(), run.error);
+                }
+#endif
+                if (!loadFailed) {
+                    run.boss9->startExecution(run.boss9->loadAddr());
+                    run.boss9->takeSnapshot(loaded);
+                }
+            } else if (!loadFailed) {
+                run.boss9->restoreSnapshot(loaded);
+            }
+
+            if (loadFailed) {
+                run.status = Status::LoadFailed;
+                continue;
+            }
+#ifdef RECOMPILED
+            if (recompiled) {
+                run.boss9->emulator().setRecompiled(recompiled);
+            }
+#endif
+            if (haveInput) {
+                run.boss9->setInput(input);
+            }
+            if (traceSize) {
+                run.trace.reset(new TraceRecorder());
+                if (run.trace->open(traceSize)) {
+                    run.boss9->emulator().setTrace(run.trace.get());
+                }
+            }
+#ifdef STATS
+            if (countStats) {
+                run.stats.reset(new InstructionStats());
+                run.boss9->emulator().setStats(run.stats.get());
+            }
+#endif
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    WorkStealingPool pool(runs, numWorkers, budget);
+    pool.run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool allPassed = true;
+    uint64_t totalInstructions = 0;
+
+    printf("%-32s %-12s %5s %14s %14s %10s\n", "image", "status", "code", "instructions", "cycles", "ms");
+    for (const Run& run : runs) {
+        std::string name = baseName(run.image);
+        if (copies > 1) {
+            name += "." + std::to_string(run.copy);
+        }
+
+        bool passed = run.status == Status::Exited && run.boss9->exitCode() == 0;
+        allPassed = allPassed && passed;
+        totalInstructions += run.instructions;
+
+        if (run.status == Status::Exited) {
+            printf("%-32s %-12s %5d ", name.c_str(), statusToString(run.status), int(run.boss9->exitCode()));
+        } else {
+            printf("%-32s %-12s %5s ", name.c_str(), statusToString(run.status), "-");
+        }
+        printf("%14" PRIu64 " %14" PRIu64 " %10.1f", run.instructions,
+               run.boss9->emulator().cycles(), run.seconds * 1000);
+        if (!run.error.empty()) {
+            printf("  %s", run.error.c_str());
+        }
+        printf("\n");
+
+        if (!outputDir.empty()) {
+            std::ofstream out(outputDir + "/" + name + ".out", std::ios::binary);
+            out << run.boss9->output();
+        }
+        
+        // The trace shows how a run got to an error or the monitor
+        if (run.trace && run.trace->isOpen() && run.status != Status::Exited) {
+            std::string filename = (outputDir.empty() ? "" : outputDir + "/") + name + ".trace";
+            if (!run.trace->save(filename.c_str())) {
+                printf("*** unable to write trace to '%s'\n", filename.c_str());
+            }
+        }
+    }
+
+    printf("\n%zu runs on %u threads in %.3fs, %.1f emulated MIPS\n", runs.size(), numWorkers,
+           seconds, (seconds > 0) ? double(totalInstructions) / seconds / 1e6 : 0.0);
+
+    if (verbose) {
+        for (const Run& run : runs) {
+            // Output can have NULs in it, which printf would stop at
+            const std::string& out = run.boss9->output();
+            printf("\n==== %s (%u)\n", run.image.c_str(), run.copy);
+            fwrite(out.data(), 1, out.size(), stdout);
+        }
+    }
+
+#ifdef STATS
+    for (const Run& run : runs) {
+        if (run.stats) {
+            printf("\n==== %s (%u) stats\n", run.image.c_str(), run.copy);
+            run.stats->report([](void*, const char* line) { printf("%s\n", line); }, nullptr);
+        }
+    }
+#endif
+
+    return allPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,156 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  inputcheck.cpp
+//  Check console input typed while a program runs
+//
+//  Usage: inputcheck [basic.s19]
+//
+//  Runs BASIC through continueExecution, the way the interactive
+//  emulator does, and types a line only once it's waiting at its
+//  prompt, so the input arrives between quanta. The line has to reach
+//  BASIC intact and be answered. Then an ESC typed with more input
+//  behind it has to stop the program without losing that input, and
+//  one typed to a program which has stopped reading input, after the
+//  input queue is full, has to stop it too.
+//
+//  The default image is basic.s19 in the current directory, which is
+//  meant to be test/. The exit status is 0 if everything checked out.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "HeadlessBOSS9.h"
+
+using namespace mc6809;
+
+// Plenty for BASIC to start up or to answer a line
+static constexpr uint32_t MaxQuanta = 10000;
+
+class InputCheckBOSS9 : public HeadlessBOSS9
+{
+  protected:
+    // Input only shows up when it's typed, so there's nothing to wait for
+#ifdef IDLE_LOOPS
+    virtual void waitForInput(uint32_t) override { }
+#endif
+};
+
+// Run until the output ends with text, like BASIC's ":" prompt. Returns false if the program
+// stops or it takes more than MaxQuanta
+static bool runUntil(InputCheckBOSS9& boss9, const std::string& text)
+{
+    for (uint32_t i = 0; i < MaxQuanta; ++i) {
+        const std::string& output = boss9.output();
+        if (output.size() >= text.size() && output.compare(output.size() - text.size(), text.size(), text) == 0) {
+            return true;
+        }
+        if (boss9.runState() == RunState::Cmd || !boss9.continueExecution()) {
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool fail(const char* what, const InputCheckBOSS9& boss9)
+{
+    printf("FAILED: %s. Output was:\n", what);
+    const std::string& output = boss9.output();
+    fwrite(output.data(), 1, output.size(), stdout);
+    printf("\n");
+    return false;
+}
+
+static bool check(const char* image)
+{
+    InputCheckBOSS9 boss9;
+    std::string error;
+    if (!boss9.loadFile(image, error)) {
+        printf("%s\n", error.c_str());
+        return false;
+    }
+    boss9.startExecution(boss9.loadAddr());
+
+    if (!runUntil(boss9, ":")) {
+        return fail("no prompt", boss9);
+    }
+
+    // BASIC is polling for input by now. Its break test reads two keys
+    // before it runs a line, which the spaces after the CR are for
+    boss9.clearOutput();
+    boss9.setInput("PRINT 12+3\r  ");
+    if (!runUntil(boss9, ":")) {
+        return fail("no answer to PRINT 12+3", boss9);
+    }
+    if (boss9.output().find("15") == std::string::npos) {
+        return fail("PRINT 12+3 didn't print 15", boss9);
+    }
+
+    // The ESC stops it and the line after it is still there when
+    // it's continued from the monitor
+    boss9.clearOutput();
+    boss9.setInput("\x1bPRINT 4*5\r  ");
+    for (uint32_t i = 0; i < MaxQuanta && boss9.runState() != RunState::Cmd; ++i) {
+        boss9.continueExecution();
+    }
+    if (boss9.runState() != RunState::Cmd) {
+        return fail("ESC didn't stop it", boss9);
+    }
+
+    boss9.clearOutput();
+    boss9.setInput("c\r");
+    for (uint32_t i = 0; i < MaxQuanta && boss9.runState() == RunState::Cmd; ++i) {
+        boss9.continueExecution();
+    }
+    if (!runUntil(boss9, ":")) {
+        return fail("no answer to PRINT 4*5 after the ESC", boss9);
+    }
+    if (boss9.output().find("20") == std::string::npos) {
+        return fail("PRINT 4*5 didn't print 20", boss9);
+    }
+
+    printf("%s: input between quanta ok\n", image);
+    return true;
+}
+
+// A program which never reads the console, so the input queue fills up
+// and an ESC typed after that has to be found on the console
+static bool checkFullQueue()
+{
+    static const uint8_t loop[] = { 0x20, 0xfe }; // BRA *
+    static constexpr uint16_t LoopAddr = 0x1000;
+
+    InputCheckBOSS9 boss9;
+    uint16_t startAddr;
+    if (!boss9.emulator().loadImage(loop, sizeof(loop), startAddr, ImageFormat::Raw, LoopAddr)) {
+        printf("FAILED: unable to load the loop\n");
+        return false;
+    }
+    boss9.startExecution(startAddr);
+
+    boss9.setInput(std::string(InputQueueSize * 2, 'x') + "\x1b");
+    for (uint32_t i = 0; i < MaxQuanta && boss9.runState() != RunState::Cmd; ++i) {
+        boss9.continueExecution();
+    }
+    if (boss9.runState() != RunState::Cmd) {
+        return fail("ESC after a full input queue didn't stop it", boss9);
+    }
+
+    printf("ESC with the input queue full ok\n");
+    return true;
+}
+
+int main(int argc, char * const argv[])
+{
+    bool passed = check((argc > 1) ? argv[1] : "basic.s19");
+    passed = checkFullQueue() && passed;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
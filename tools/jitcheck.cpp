@@ -0,0 +1,213 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  jitcheck.cpp
+//  Run images with and without the JIT in lockstep
+//
+//  Usage: jitcheck [-I insts] [-q insts] [image.s19 ...]
+//
+//          -I:     instructions to run each image for (default 20000000)
+//          -q:     instructions between comparisons (default 1000)
+//
+//  Each image is loaded into two emulators, one of which runs hot
+//  blocks as translated code. After every -q instructions their
+//  registers, cycle counts, memory and console output are compared
+//  and the first difference is reported. An image which exits or
+//  enters the monitor is checked up to that point. If <image>.in
+//  exists it is fed to both console inputs.
+//
+//  With no images it checks the same ones emubench runs, from the
+//  current directory, which is meant to be test/.
+//
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+#include "HeadlessBOSS9.h"
+#include "Jit.h"
+
+using namespace mc6809;
+
+static constexpr uint64_t DefaultBudget = 20000000;
+static constexpr uint64_t DefaultQuantum = 1000;
+
+static const char* DefaultImages[] = { "perf.s19", "basic.s19", "forth9.s19", "test09.s19", "bench09.s19" };
+
+static bool readFile(const std::string& filename, std::string& contents)
+{
+    std::ifstream f(filename, std::ios::binary);
+    if (!f.is_open()) {
+        return false;
+    }
+    std::stringstream stream;
+    stream << f.rdbuf();
+    contents = stream.str();
+    return true;
+}
+
+// Run until limit. Returns false if the image stopped before then
+static bool runTo(HeadlessBOSS9& boss9, uint64_t limit)
+{
+    Emulator& emulator = boss9.emulator();
+    emulator.setInstructionLimit(limit);
+
+    while (emulator.instructions() < limit) {
+        if (!emulator.execute(RunState::Running) || boss9.runState() == RunState::Cmd ||
+                emulator.waitingForInterrupt()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Describe the first difference between the two states, or return
+// an empty string if there isn't one
+static std::string difference(const Snapshot& a, const Snapshot& b)
+{
+    char buf[100];
+
+#define CHECK(field, format) \
+    if (a.field != b.field) { \
+        snprintf(buf, sizeof(buf), #field " " format " != " format, a.field, b.field); \
+        return buf; \
+    }
+
+    CHECK(instructions, "%" PRIu64);
+    CHECK(pc, "$%04x");
+    CHECK(d, "$%04x");
+    CHECK(x, "$%04x");
+    CHECK(y, "$%04x");
+    CHECK(u, "$%04x");
+    CHECK(s, "$%04x");
+    CHECK(w, "$%04x");
+    CHECK(v, "$%04x");
+    CHECK(dp, "$%02x");
+    CHECK(cc, "$%02x");
+    CHECK(md, "$%02x");
+    CHECK(prevOp, "%u");
+    CHECK(waitState, "%u");
+    CHECK(cycles, "%" PRIu64);
+
+#undef CHECK
+
+    for (uint32_t page = 0; page < 256; ++page) {
+        if (!a.pages[page] || !b.pages[page] || a.pages[page] == b.pages[page]) {
+            continue;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint8_t va = (*a.pages[page])[i];
+            uint8_t vb = (*b.pages[page])[i];
+            if (va != vb) {
+                snprintf(buf, sizeof(buf), "memory at $%04x $%02x != $%02x", (page << 8) | i, va, vb);
+                return buf;
+            }
+        }
+    }
+    return "";
+}
+
+static bool check(const std::string& image, uint64_t budget, uint64_t quantum)
+{
+    Jit jit;
+    HeadlessBOSS9 interpreted;
+    HeadlessBOSS9 translated;
+    std::string error;
+
+    if (!jit.valid()) {
+        printf("%s: unable to allocate the code buffer\n", image.c_str());
+        return false;
+    }
+    if (!interpreted.loadFile(image, error) || !translated.loadFile(image, error)) {
+        printf("%s: %s\n", image.c_str(), error.c_str());
+        return false;
+    }
+    translated.emulator().setJit(&jit);
+
+    std::string input;
+    readFile(image.substr(0, image.find_last_of('.')) + ".in", input);
+    interpreted.setInput(input);
+    translated.setInput(input);
+
+    interpreted.startExecution(interpreted.loadAddr());
+    translated.startExecution(translated.loadAddr());
+
+    uint64_t start = interpreted.emulator().instructions();
+    uint64_t executed = 0;
+    bool running = true;
+    Snapshot a;
+    Snapshot b;
+
+    while (running && executed < budget) {
+        uint64_t limit = start + std::min(executed + quantum, budget);
+        bool ranInterpreted = runTo(interpreted, limit);
+        bool ranTranslated = runTo(translated, limit);
+        running = ranInterpreted && ranTranslated;
+
+        interpreted.takeSnapshot(a);
+        translated.takeSnapshot(b);
+        std::string diff = difference(a, b);
+        if (diff.empty() && interpreted.output() != translated.output()) {
+            diff = "console output";
+        }
+        if (diff.empty() && ranInterpreted != ranTranslated) {
+            diff = ranInterpreted ? "only the translated run stopped" : "only the interpreted run stopped";
+        }
+        if (!diff.empty()) {
+            printf("%s: differs after %" PRIu64 " instructions, %s\n", image.c_str(),
+                   interpreted.emulator().instructions() - start, diff.c_str());
+            return false;
+        }
+        executed = a.instructions - start;
+    }
+
+    printf("%s: %" PRIu64 " instructions match, %u blocks translated with %u instructions\n", image.c_str(),
+           executed, jit.blocksTranslated(), jit.instructionsTranslated());
+    return true;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [-I insts] [-q insts] [image.s19 ...]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char * const argv[])
+{
+    uint64_t budget = DefaultBudget;
+    uint64_t quantum = DefaultQuantum;
+    int c;
+
+    while ((c = getopt(argc, argv, "I:q:")) != -1) {
+        switch (c) {
+            case 'I': budget = strtoull(optarg, nullptr, 10); break;
+            case 'q': quantum = strtoull(optarg, nullptr, 10); break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if (budget == 0 || quantum == 0) {
+        usage(argv[0]);
+    }
+
+    bool ok = true;
+    if (optind < argc) {
+        for (int i = optind; i < argc; ++i) {
+            ok = check(argv[i], budget, quantum) && ok;
+        }
+    } else {
+        for (const char* image : DefaultImages) {
+            ok = check(image, budget, quantum) && ok;
+        }
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,500 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  recompile.cpp
+//  Recompile an s19 image to C++
+//
+//  Usage: recompile [-o file] [-e addr] [-I insts] image.s19
+//
+//          -o:     write the C++ to file (default is <image>.cpp)
+//          -e:     another entry point, in hex. Can be given more than once
+//          -I:     also run the image for insts instructions, feeding it
+//                  <image>.in, and use everywhere it jumped to as an entry point
+//
+//  The image is disassembled from its start address, the interrupt and
+//  SWI vectors and any other entry points, following branches, calls and
+//  jumps to known addresses. The code is split into basic blocks, which
+//  end at every branch, at every address branched to and wherever the
+//  emulator would end a decoded block. Each becomes a function. Indirect
+//  jumps and returns are left to the emulator, which interprets their
+//  targets unless they're also the start of a block. A training run with
+//  -I finds the targets of the indirect jumps a run takes, like the
+//  entries in a table of command handlers.
+//
+//  The output is compiled into a shared object with the same build flags
+//  as the emulator which is going to load it, for instance
+//
+//      c++ -O2 -shared -fPIC -iquote emulator image.cpp -o image.so
+//
+//  CMake does that for some of the images in test/ when the emulator
+//  is built with RECOMPILED.
+//
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "Disassembler.h"
+#include "HeadlessBOSS9.h"
+#include "Recompiled.h"
+
+using namespace mc6809;
+
+// The SWI3, SWI2, FIRQ, IRQ, SWI, NMI and RESTART vectors
+static constexpr uint16_t FirstVector = 0xfff2;
+
+static bool readFile(const std::string& filename, std::string& contents)
+{
+    std::ifstream f(filename, std::ios::binary);
+    if (!f.is_open()) {
+        return false;
+    }
+    std::stringstream stream;
+    stream << f.rdbuf();
+    contents = stream.str();
+    return true;
+}
+
+// Mark the bytes the S1 records in an s19 file load
+static void loadedBytes(const std::string& contents, std::vector<bool>& loaded)
+{
+    std::istringstream stream(contents);
+    std::string line;
+    while (std::getline(stream, line)) {
+        if (line.size() < 8 || line[0] != 'S' || line[1] != '1') {
+            continue;
+        }
+        uint32_t count = uint32_t(strtoul(line.substr(2, 2).c_str(), nullptr, 16));
+        uint32_t addr = uint32_t(strtoul(line.substr(4, 4).c_str(), nullptr, 16));
+
+        // The count includes the address and checksum
+        for (uint32_t i = 0; i + 3 < count; ++i) {
+            loaded[(addr + i) & 0xffff] = true;
+        }
+    }
+}
+
+static bool isBranch(const DecodedInst& inst)
+{
+    return inst.adr == Adr::Rel || inst.adr == Adr::RelL;
+}
+
+// The address a branch, or a jump or call which doesn't depend on any
+// registers, goes to. Returns false if it isn't known
+static bool target(uint16_t pc, const DecodedInst& inst, uint16_t& addr)
+{
+    if (isBranch(inst)) {
+        addr = pc + inst.size + inst.operand;
+        return true;
+    }
+    if (inst.op != Op::JMP && inst.op != Op::JSR) {
+        return false;
+    }
+    if (inst.adr == Adr::Extended) {
+        addr = inst.operand;
+        return true;
+    }
+
+    // PC relative without indirection. decode has already made the
+    // operand the final address
+    uint8_t mode = inst.postbyte & IdxModeMask;
+    if (inst.adr == Adr::Indexed && (inst.postbyte & 0x80) && !(inst.postbyte & IndexedIndMask) &&
+            (IdxMode(mode) == IdxMode::ConstPC8Off || IdxMode(mode) == IdxMode::ConstPC16Off)) {
+#ifdef HD6309
+        if (wIndexed(inst.postbyte)) {
+            return false;
+        }
+#endif
+        addr = inst.operand;
+        return true;
+    }
+    return false;
+}
+
+// True if the instruction after this one is reached from it, directly
+// or by returning
+static bool fallsThrough(const DecodedInst& inst)
+{
+    if (!endsBlock(inst)) {
+        return true;
+    }
+    switch (inst.op) {
+        default:
+            return false;
+        case Op::BSR:
+        case Op::JSR:
+        case Op::SYNC:
+        case Op::CWAI:
+            return true;
+    }
+}
+
+class Recompiler
+{
+  public:
+    Recompiler(HeadlessBOSS9& boss9, const std::vector<bool>& loaded)
+        : _boss9(boss9)
+        , _emulator(boss9.emulator())
+        , _loaded(loaded)
+    { }
+
+    void addEntry(uint16_t addr)
+    {
+        if (addr < SystemAddrStart && _loaded[addr]) {
+            _heads.insert(addr);
+            _pending.push_back(addr);
+        }
+    }
+
+    // Disassemble from every entry point and split the code into blocks
+    void analyze()
+    {
+        disassemble();
+
+        // A block is cut off at MaxBlockInsts to match the emulator,
+        // which makes a new head where it stopped. That can cut short a
+        // block made before it, so start over until there are no new ones
+        while (true) {
+            _blocks.clear();
+            bool added = false;
+            for (uint16_t head : std::set<uint16_t>(_heads)) {
+                added = makeBlock(head) || added;
+            }
+            if (!added) {
+                break;
+            }
+        }
+    }
+
+    uint32_t instructionCount() const { return _instructionCount; }
+    size_t blockCount() const { return _blocks.size(); }
+
+    bool write(FILE* f, const std::string& image, uint32_t hash);
+
+  private:
+    struct Block
+    {
+        uint16_t pc;
+        uint16_t bytes;
+        std::vector<uint16_t> insts;
+        bool loops;
+    };
+
+    void disassemble()
+    {
+        while (!_pending.empty()) {
+            uint16_t addr = _pending.back();
+            _pending.pop_back();
+
+            // Follow the code until it stops falling through, joins
+            // code which has already been disassembled or runs into
+            // memory the image didn't load
+            while (addr < SystemAddrStart) {
+                Inst& inst = _insts[addr];
+                if (inst.decoded) {
+                    // Where it joins is also the start of a block
+                    _heads.insert(addr);
+                    break;
+                }
+                _emulator.decode(addr, inst.inst);
+                if (!loaded(addr, inst.inst.size)) {
+                    break;
+                }
+                inst.decoded = true;
+                _instructionCount += 1;
+
+                uint16_t to;
+                if (target(addr, inst.inst, to)) {
+                    addEntry(to);
+                }
+
+                uint16_t next = addr + inst.inst.size;
+                if (endsBlock(inst.inst) || isBranch(inst.inst)) {
+                    if (fallsThrough(inst.inst)) {
+                        addEntry(next);
+                    }
+                    break;
+                }
+                addr = next;
+            }
+        }
+    }
+
+    // Returns true if it made a new head
+    bool makeBlock(uint16_t head)
+    {
+        Block block;
+        block.pc = head;
+        block.loops = false;
+
+        uint16_t addr = head;
+        while (true) {
+            const DecodedInst& inst = _insts[addr].inst;
+            block.insts.push_back(addr);
+
+            uint16_t next = addr + inst.size;
+            if (endsBlock(inst) || isBranch(inst)) {
+                uint16_t to;
+                block.loops = target(addr, inst, to) && to == head && inst.op != Op::JSR && inst.op != Op::BSR;
+                addr = next;
+                break;
+            }
+            addr = next;
+            if (addr >= SystemAddrStart || !_insts[addr].decoded || _heads.count(addr)) {
+                break;
+            }
+            if (block.insts.size() == MaxBlockInsts) {
+                block.bytes = addr - head;
+                _blocks.push_back(block);
+                _heads.insert(addr);
+                return true;
+            }
+        }
+
+        block.bytes = addr - head;
+        _blocks.push_back(block);
+        return false;
+    }
+
+    bool loaded(uint16_t addr, uint8_t size) const
+    {
+        for (uint8_t i = 0; i < size; ++i) {
+            if (!_loaded[uint16_t(addr + i)]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The disassembly of the instruction at addr, as the monitor shows it
+    std::string disassembly(uint16_t addr)
+    {
+        char buf[Disassembler::MaxLineSize];
+        _emulator.disassemble(addr, buf);
+        return buf;
+    }
+
+    struct Inst
+    {
+        bool decoded = false;
+        DecodedInst inst;
+    };
+
+    HeadlessBOSS9& _boss9;
+    Emulator& _emulator;
+    const std::vector<bool>& _loaded;
+    std::vector<Inst> _insts = std::vector<Inst>(65536);
+    std::set<uint16_t> _heads;
+    std::vector<uint16_t> _pending;
+    std::vector<Block> _blocks;
+    uint32_t _instructionCount = 0;
+};
+
+bool Recompiler::write(FILE* f, const std::string& image, uint32_t hash)
+{
+    std::sort(_blocks.begin(), _blocks.end(), [](const Block& a, const Block& b) { return a.pc < b.pc; });
+
+    fprintf(f, "// Recompiled from %s by recompile, with %zu blocks of %u instructions.\n", image.c_str(),
+            _blocks.size(), _instructionCount);
+    fprintf(f, "// Compile it with the same build flags as the emulator which loads it.\n\n");
+    fprintf(f, "#include \"Exec.h\"\n#include \"Recompiled.h\"\n\n");
+    fprintf(f, "using namespace mc6809;\n\nnamespace {\n");
+
+    for (const Block& block : _blocks) {
+        fprintf(f, "\n");
+        for (uint16_t addr : block.insts) {
+            const DecodedInst& inst = _insts[addr].inst;
+#ifdef COMPUTE_CYCLES
+            uint8_t cycles = inst.cycles;
+#else
+            uint8_t cycles = 0;
+#endif
+#ifdef HD6309
+            uint16_t extra = inst.extra;
+#else
+            uint16_t extra = 0;
+#endif
+            fprintf(f, "constexpr DecodedInst i%04x = Recompiled::inst(Op(%u), Reg(%u), Adr(%u), Left(%u), Right(%u), "
+                       "Op(%u), %u, 0x%02x, %u, 0x%04x, 0x%04x);\n", addr,
+                       unsigned(inst.op), unsigned(inst.reg), unsigned(inst.adr), unsigned(inst.left),
+                       unsigned(inst.right), unsigned(inst.prefix), inst.size, inst.postbyte, cycles,
+                       inst.operand, extra);
+        }
+
+        fprintf(f, "\nStepResult b%04x(Emulator& e)\n{\n    StepResult result;\n", block.pc);
+        if (block.loops) {
+            fprintf(f, "\n  top:\n");
+        }
+
+        for (size_t i = 0; i < block.insts.size(); ++i) {
+            uint16_t addr = block.insts[i];
+            uint16_t next = addr + _insts[addr].inst.size;
+            fprintf(f, "    // $%04x: %s\n", addr, disassembly(addr).c_str());
+            if (i + 1 < block.insts.size()) {
+                fprintf(f, "    if (!Recompiled::step(e, i%04x, 0x%04x, result)) {\n        return result;\n    }\n", addr, next);
+            } else {
+                fprintf(f, "    Recompiled::step(e, i%04x, 0x%04x, result);\n", addr, next);
+            }
+        }
+
+        if (block.loops) {
+            fprintf(f, "    if (Recompiled::loop(e, result, 0x%04x)) {\n        goto top;\n    }\n", block.pc);
+        }
+        fprintf(f, "    return result;\n}\n");
+    }
+
+    fprintf(f, "\nconst RecompiledBlock blocks[] = {\n");
+    uint32_t offset = 0;
+    for (const Block& block : _blocks) {
+        fprintf(f, "    { 0x%04x, %u, %u, b%04x },\n", block.pc, block.bytes, offset, block.pc);
+        offset += block.bytes;
+    }
+    fprintf(f, "};\n");
+
+    // The bytes each block was recompiled from, so the emulator can tell
+    // if they've changed
+    fprintf(f, "\nconst uint8_t code[] = {");
+    uint32_t n = 0;
+    for (const Block& block : _blocks) {
+        for (uint16_t i = 0; i < block.bytes; ++i) {
+            uint8_t byte;
+            _emulator.readMemory(block.pc + i, &byte, 1);
+            fprintf(f, "%s0x%02x,", (n++ % 16) ? " " : "\n    ", byte);
+        }
+    }
+    fprintf(f, "\n};\n\n}\n\n");
+
+    fprintf(f, "extern \"C\" __attribute__((visibility(\"default\"))) const RecompiledImage %s = {\n", RecompiledImageSymbol);
+    fprintf(f, "    RecompiledVersion, RecompiledFlags, sizeof(Emulator), 0x%08x, %zu, blocks, code\n};\n",
+            hash, _blocks.size());
+    return !ferror(f);
+}
+
+// Run the image from its start and add every address it gets to other
+// than by falling through from the instruction before
+static void train(const std::string& image, uint64_t budget, Recompiler& recompiler)
+{
+    HeadlessBOSS9 boss9;
+    std::string error;
+    if (!boss9.loadFile(image, error)) {
+        return;
+    }
+
+    std::string input;
+    if (readFile(image.substr(0, image.find_last_of('.')) + ".in", input)) {
+        boss9.setInput(input);
+    }
+
+    Emulator& emulator = boss9.emulator();
+    boss9.startExecution(boss9.loadAddr());
+    emulator.setQuantum(1);
+
+    std::set<uint16_t> seen;
+    while (emulator.instructions() < budget) {
+        uint16_t pc = emulator.getReg(Reg::PC);
+        DecodedInst inst;
+        emulator.decode(pc, inst);
+
+        if (!emulator.execute(RunState::Running) || boss9.runState() == RunState::Cmd ||
+                emulator.waitingForInterrupt()) {
+            break;
+        }
+
+        uint16_t next = emulator.getReg(Reg::PC);
+        if (next != uint16_t(pc + inst.size) && seen.insert(next).second) {
+            recompiler.addEntry(next);
+        }
+    }
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [-o file] [-e addr] [-I insts] image.s19\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char * const argv[])
+{
+    std::string output;
+    std::vector<uint16_t> entries;
+    uint64_t trainingBudget = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "o:e:I:")) != -1) {
+        switch (c) {
+            case 'o': output = optarg; break;
+            case 'e': entries.push_back(uint16_t(strtoul(optarg, nullptr, 16))); break;
+            case 'I': trainingBudget = strtoull(optarg, nullptr, 10); break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+
+    std::string image = argv[optind];
+    std::string error;
+    HeadlessBOSS9 boss9;
+    if (!boss9.loadFile(image, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (output.empty()) {
+        size_t slash = image.find_last_of('/');
+        std::string name = (slash == std::string::npos) ? image : image.substr(slash + 1);
+        output = name.substr(0, name.find_last_of('.')) + ".cpp";
+    }
+
+    std::string contents;
+    std::vector<bool> loaded(65536);
+    if (readFile(image, contents)) {
+        loadedBytes(contents, loaded);
+    }
+
+    Recompiler recompiler(boss9, loaded);
+    recompiler.addEntry(boss9.loadAddr());
+    for (uint16_t addr = FirstVector; addr != 0; addr += 2) {
+        uint8_t vector[2];
+        boss9.emulator().readMemory(addr, vector, 2);
+        uint16_t entry = (uint16_t(vector[0]) << 8) | vector[1];
+        if (entry) {
+            recompiler.addEntry(entry);
+        }
+    }
+    for (uint16_t addr : entries) {
+        recompiler.addEntry(addr);
+    }
+    if (trainingBudget) {
+        train(image, trainingBudget, recompiler);
+    }
+
+    recompiler.analyze();
+
+    FILE* f = fopen(output.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "unable to open %s\n", output.c_str());
+        return EXIT_FAILURE;
+    }
+    bool ok = recompiler.write(f, image, boss9.imageHash());
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "unable to write %s\n", output.c_str());
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: %zu blocks of %u instructions\n", output.c_str(), recompiler.blockCount(), recompiler.instructionCount());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,135 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of the MC6809 Simulator
+    For the latest info, see http:www.marrin.org/
+    Copyright (c) 2018-2024, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+//
+//  tracedump.cpp
+//  Print a binary execution trace
+//
+//  Each instruction is disassembled from the bytes in the trace, so it
+//  reads the same as the monitor. The cycles used, the effective address
+//  and the registers the instruction changed follow. Instructions run by
+//  translated or recompiled code or in skipped passes of an idle loop
+//  are shown as one line with the registers after them.
+//
+//  Usage: tracedump [-n count] [-f first] [-s symbols] trace
+//
+//          -n:     print only the last count instructions
+//          -f:     start at instruction number first
+//          -s:     lwasm symbol dump or map file, for labels in operands
+//
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "Disassembler.h"
+#include "Trace.h"
+
+using namespace mc6809;
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [-n count] [-f first] [-s symbols] trace\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static void printRegs(const TraceEntry& entry)
+{
+    const TraceRegisters& regs = entry.regs;
+    if (entry.changed & TraceChangedA) { printf(" A=%02x", regs.d >> 8); }
+    if (entry.changed & TraceChangedB) { printf(" B=%02x", regs.d & 0xff); }
+    if (entry.changed & TraceChangedDP) { printf(" DP=%02x", regs.dp); }
+    if (entry.changed & TraceChangedCC) { printf(" CC=%02x", regs.cc); }
+    if (entry.changed & TraceChangedX) { printf(" X=%04x", regs.x); }
+    if (entry.changed & TraceChangedY) { printf(" Y=%04x", regs.y); }
+    if (entry.changed & TraceChangedU) { printf(" U=%04x", regs.u); }
+    if (entry.changed & TraceChangedS) { printf(" S=%04x", regs.s); }
+}
+
+int main(int argc, char * const argv[])
+{
+    uint64_t count = 0;
+    uint64_t first = 0;
+    bool haveFirst = false;
+    Symbols symbols;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:f:s:")) != -1) {
+        switch (c) {
+            case 'n': count = strtoull(optarg, nullptr, 10); break;
+            case 'f': first = strtoull(optarg, nullptr, 10); haveFirst = true; break;
+            case 's':
+                if (!symbols.load(optarg)) {
+                    fprintf(stderr, "%s: unable to read symbols '%s'\n", argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+
+    TraceReader reader;
+    if (!reader.open(argv[optind])) {
+        fprintf(stderr, "%s: unable to read trace '%s'\n", argv[0], argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    // Older instructions have been overwritten
+    if (!haveFirst) {
+        first = reader.firstIndex();
+        if (count && reader.endIndex() - first > count) {
+            first = reader.endIndex() - count;
+        }
+    } else if (first < reader.firstIndex()) {
+        first = reader.firstIndex();
+    }
+    uint64_t end = (count && first + count < reader.endIndex()) ? first + count : reader.endIndex();
+
+    printf("instructions %" PRIu64 " to %" PRIu64 " of %" PRIu64 "\n\n", first, end, reader.endIndex());
+
+    Disassembler disassembler(&symbols);
+
+    reader.read(first, [&](const TraceEntry& entry) {
+        if (entry.index >= end) {
+            return false;
+        }
+
+        if (entry.skipped) {
+            printf("%12" PRIu64 "  [$%04x]    *** %u instructions not traced", entry.index, entry.pc, entry.skipped);
+            printRegs(entry);
+            printf("\n");
+            return true;
+        }
+
+        if (entry.size == 0) {
+            printf("%12" PRIu64 "  *** interrupt, vector $%04x\n", entry.index, entry.vector);
+            return true;
+        }
+
+        // The trace only has the first bytes of a longer instruction
+        char inst[Disassembler::MaxLineSize];
+        if (!disassembler.instruction(entry.bytes, std::min(size_t(entry.size), sizeof(entry.bytes)), entry.pc, inst)) {
+            snprintf(inst, sizeof(inst), "???");
+        }
+        printf("%12" PRIu64 "  [$%04x]    %-29s %2u", entry.index, entry.pc, inst, entry.cycles);
+        if (entry.hasEA) {
+            printf(" ea=$%04x", entry.ea);
+        }
+        printRegs(entry);
+        printf("\n");
+        return true;
+    });
+
+    return EXIT_SUCCESS;
+}